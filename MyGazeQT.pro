@@ -4,25 +4,104 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+#qmake CONFIG+=trace compiles in the TRACE_SCOPE timing spans (see tracing.h)
+CONFIG(trace): DEFINES += MYGAZE_TRACE
+
 TARGET = MyGazeQT
 TEMPLATE = app
+CONFIG += c++17
 
 
 SOURCES += main.cpp\
-        mygazeqtwidget.cpp
+        mygazeqtwidget.cpp \
+    gazeresampler.cpp \
+    clocksync.cpp \
+    sessionrecorder.cpp \
+    sessionreader.cpp \
+    threadpool.cpp \
+    sessionanalysis.cpp \
+    batchanalyzer.cpp \
+    sessionexporter.cpp \
+    calibrationcache.cpp \
+    headlesscapture.cpp \
+    gazesource.cpp \
+    callbackregistry.cpp \
+    trackersession.cpp \
+    heatmapaggregator.cpp \
+    scanpathsimilarity.cpp \
+    fixationclustering.cpp \
+    samplepyramid.cpp \
+    timelinewidget.cpp \
+    sampleclassifier.cpp \
+    qualitymonitor.cpp \
+    pupillometry.cpp \
+    screengeometry.cpp \
+    vergence.cpp \
+    headcompensation.cpp \
+    microsaccades.cpp \
+    pursuit.cpp \
+    savitzkygolay.cpp \
+    sessionquery.cpp \
+    memorybudget.cpp \
+    metrics.cpp \
+    metricsserver.cpp \
+    diagnosticspanel.cpp \
+    tracing.cpp \
+    validationtargets.cpp \
+    csvutil.cpp \
+    statsutil.cpp
 
 HEADERS  += mygazeqtwidget.h \
-    myGazeAPI.h
+    myGazeAPI.h \
+    gazeresampler.h \
+    clocksync.h \
+    sessionformat.h \
+    sessionrecorder.h \
+    sessionreader.h \
+    threadpool.h \
+    sessionanalysis.h \
+    batchanalyzer.h \
+    sessionexporter.h \
+    calibrationcache.h \
+    headlesscapture.h \
+    gazesource.h \
+    callbackregistry.h \
+    trackersession.h \
+    heatmapaggregator.h \
+    scanpathsimilarity.h \
+    fixationclustering.h \
+    samplepyramid.h \
+    timelinewidget.h \
+    sampleclassifier.h \
+    qualitymonitor.h \
+    pupillometry.h \
+    screengeometry.h \
+    vergence.h \
+    headcompensation.h \
+    microsaccades.h \
+    pursuit.h \
+    savitzkygolay.h \
+    sessionquery.h \
+    memorybudget.h \
+    metrics.h \
+    metricsserver.h \
+    diagnosticspanel.h \
+    tracing.h \
+    validationtargets.h \
+    csvutil.h \
+    statsutil.h
 
 FORMS    += mygazeqtwidget.ui
 
 QMAKE_CFLAGS += /Gz
 QMAKE_CXXFLAGS += /Gz
 
+win32: LIBS += -lpsapi
+
 win32:CONFIG(release, debug|release): LIBS += -L$$PWD/ -lmyGazeAPI
 else:win32:CONFIG(debug, debug|release): LIBS += -L$$PWD/ -lmyGazeAPI
 
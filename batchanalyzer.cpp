@@ -0,0 +1,157 @@
+//batchanalyzer.cpp
+//Implements the parallel batch analysis of recorded session archives
+
+#include "batchanalyzer.h"
+#include "sessionreader.h"
+#include "csvutil.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+static const int sessionsInFlightPerThread = 4; //bounds mapped sessions and buffered rows
+
+//Batch Analyzer Constructor, threads 0 uses every core
+BatchAnalyzer::BatchAnalyzer(int threads) : pool(threads) {
+}
+
+void BatchAnalyzer::addAnalysis(SessionAnalysis *analysis) {
+    analyses.push_back(std::unique_ptr<SessionAnalysis>(analysis));
+}
+
+int BatchAnalyzer::threadCount() const {
+    return pool.threadCount();
+}
+
+QStringList BatchAnalyzer::findSessions(const QString &directory) {
+    QStringList sessions;
+    QDirIterator it(directory, QStringList() << "*.mgs", QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext()) {
+        sessions << it.next();
+    }
+    sessions.sort();
+    return sessions;
+}
+
+//Maps one session, runs every analysis on it and unmaps it again before returning the row
+QString BatchAnalyzer::analyzeSession(const QString &path) const {
+    QStringList row;
+    row << csvField(path);
+    SessionReader session;
+    if(!session.open(path)) {
+        row << QString() << "unreadable";
+        for(size_t i = 0; i < analyses.size(); i++) {
+            for(int c = 0; c < analyses[i]->columns().size(); c++) {
+                row << QString();
+            }
+        }
+        return row.join(',');
+    }
+    row << csvField(session.participant()) << (session.isTruncated() ? "truncated" : "ok");
+    for(size_t i = 0; i < analyses.size(); i++) {
+        QStringList values = analyses[i]->analyze(session);
+        for(int v = 0; v < values.size(); v++) {
+            row << csvField(values[v]);
+        }
+    }
+    return row.join(',');
+}
+
+void BatchAnalyzer::run(const QStringList &sessions, QTextStream &out) {
+    QStringList header;
+    header << "session" << "participant" << "status";
+    for(size_t i = 0; i < analyses.size(); i++) {
+        header << analyses[i]->columns();
+    }
+    out << header.join(',') << '\n';
+
+    std::mutex resultMutex;
+    std::condition_variable resultReady;
+    std::map<int, QString> finished; //rows done but not yet written because an earlier one is outstanding
+    int total = sessions.size();
+    int submitted = 0;
+    int written = 0;
+    int window = pool.threadCount() * sessionsInFlightPerThread;
+
+    while(written < total) {
+        //keep a bounded number of sessions between submission and output
+        while(submitted < total && submitted - written < window) {
+            int index = submitted++;
+            QString path = sessions[index];
+            pool.submit([this, index, path, &resultMutex, &resultReady, &finished]() {
+                QString row = analyzeSession(path);
+                std::lock_guard<std::mutex> lock(resultMutex);
+                finished[index] = row;
+                resultReady.notify_one();
+            });
+        }
+
+        QStringList rows;
+        {
+            std::unique_lock<std::mutex> lock(resultMutex);
+            resultReady.wait(lock, [&finished, written] { return finished.count(written) > 0; });
+            std::map<int, QString>::iterator it = finished.begin();
+            while(it != finished.end() && it->first == written + rows.size()) {
+                rows << it->second;
+                it = finished.erase(it);
+            }
+        }
+        for(int i = 0; i < rows.size(); i++) {
+            out << rows[i] << '\n';
+        }
+        written += rows.size();
+    }
+    out.flush();
+}
+
+//--batch <directory> [--output file] [--threads n] [--analyses list] [--aoi file]
+int BatchAnalyzer::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Batch analysis of recorded MyGaze sessions");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("batch", "Directory scanned recursively for .mgs sessions.", "directory"));
+    parser.addOption(QCommandLineOption("output", "Result table, standard output if omitted.", "file"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.addOption(QCommandLineOption("analyses", "Comma separated analyses: fixations, dataloss, aoi.", "list", "fixations,dataloss"));
+    parser.addOption(QCommandLineOption("aoi", "Areas of interest file used by the aoi analysis.", "file"));
+    parser.process(arguments);
+
+    std::vector<AreaOfInterest> areas;
+    if(parser.isSet("aoi")) {
+        areas = loadAreasOfInterest(parser.value("aoi"));
+    }
+    BatchAnalyzer analyzer(parser.value("threads").toInt());
+    QStringList names = splitList(parser.value("analyses"));
+    for(int i = 0; i < names.size(); i++) {
+        SessionAnalysis *analysis = createSessionAnalysis(names[i].trimmed(), areas);
+        if(!analysis) {
+            qWarning() << "Unknown analysis:" << names[i];
+            return 1;
+        }
+        analyzer.addAnalysis(analysis);
+    }
+
+    QStringList sessions = findSessions(parser.value("batch"));
+    QFile file;
+    if(parser.isSet("output")) {
+        file.setFileName(parser.value("output"));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            qWarning() << "Could not open output file:" << file.fileName();
+            return 1;
+        }
+    }
+    else {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    QTextStream out(&file);
+
+    QElapsedTimer timer;
+    timer.start();
+    analyzer.run(sessions, out);
+    qDebug() << "Analysed" << sessions.size() << "sessions on" << analyzer.threadCount() << "threads in" << timer.elapsed() << "ms";
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef BATCHANALYZER_H
+#define BATCHANALYZER_H
+
+//batchanalyzer.h
+//Runs the per session analyses over a directory of recorded sessions in parallel and merges the
+//results into one table, one row per session in sorted path order
+
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <memory>
+#include <vector>
+#include "sessionanalysis.h"
+#include "threadpool.h"
+
+class BatchAnalyzer {
+
+public:
+    explicit BatchAnalyzer(int threads = 0);
+
+    void addAnalysis(SessionAnalysis *analysis); //takes ownership
+    int threadCount() const;
+
+    //recursively collects .mgs files below directory, sorted so output order is reproducible
+    static QStringList findSessions(const QString &directory);
+
+    //analyses every session and streams rows to out as soon as they are in order, at most a few
+    //sessions per thread are mapped or waiting for output so memory does not grow with the archive
+    void run(const QStringList &sessions, QTextStream &out);
+
+    //entry point of the --batch command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    QString analyzeSession(const QString &path) const;
+
+    std::vector<std::unique_ptr<SessionAnalysis> > analyses;
+    ThreadPool pool; //declared last so workers are joined before the analyses go away
+};
+
+#endif // BATCHANALYZER_H
@@ -0,0 +1,173 @@
+//calibrationcache.cpp
+//Implements the calibration profile cache on top of iV_SaveCalibration / iV_LoadCalibration
+
+#include "calibrationcache.h"
+#include <QCryptographicHash>
+#include <QSettings>
+#include <QStringList>
+#include <algorithm>
+#include <string.h>
+
+static const int entriesPerGroup = 10; //older index entries are pruned, the server keeps its copies
+
+//copies name into the fixed size buffer the myGaze API expects
+static void toCalibrationName(const QString &name, char buffer[256]) {
+    QByteArray bytes = name.toLatin1().left(255);
+    memset(buffer, 0, 256);
+    memcpy(buffer, bytes.constData(), bytes.size());
+}
+
+//keeps identifiers usable as settings groups and server calibration names; an identifier that had to be changed or cut
+//gets a short hash of the original appended, so "a.b" and "a_b" stay apart
+static QString sanitized(const QString &text) {
+    QString result;
+    for(int i = 0; i < text.size() && result.size() < 64; i++) {
+        QChar c = text[i];
+        result += (c.isLetterOrNumber() || c == '-') ? c : QChar('_');
+    }
+    if(result.isEmpty()) {
+        return QString("default");
+    }
+    if(result != text) {
+        QByteArray hash = QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Sha1).toHex().left(8);
+        result += "_" + QString::fromLatin1(hash);
+    }
+    return result;
+}
+
+//Calibration Cache Constructor, defaults accept calibrations under one degree from the last 24 hours
+CalibrationCache::CalibrationCache(const QString &indexPath) : indexPath(indexPath), deviationLimit(1.0), ageLimit(24 * 3600) {
+}
+
+void CalibrationCache::setMaxDeviation(double degrees) {
+    deviationLimit = degrees;
+}
+
+void CalibrationCache::setMaxAge(qint64 seconds) {
+    ageLimit = seconds;
+}
+
+double CalibrationCache::maxDeviation() const {
+    return deviationLimit;
+}
+
+qint64 CalibrationCache::maxAge() const {
+    return ageLimit;
+}
+
+QString CalibrationCache::groupName(const QString &participant, const QString &profile) {
+    return sanitized(participant) + "@" + sanitized(profile);
+}
+
+int CalibrationCache::store(const QString &participant, const QString &profile, const AccuracyStruct &accuracy) {
+    if(participant.trimmed().isEmpty()) {
+        return ERR_PARAMETER_INVALID;
+    }
+    QDateTime now = QDateTime::currentDateTime();
+    QString name = "mgq_" + sanitized(participant) + "_" + now.toString("yyyyMMdd_HHmmss");
+    char buffer[256];
+    toCalibrationName(name, buffer);
+    int status = iV_SaveCalibration(buffer);
+    if(status != RET_SUCCESS) {
+        return status;
+    }
+
+    QSettings settings(indexPath, QSettings::IniFormat);
+    settings.beginGroup(groupName(participant, profile));
+    settings.beginGroup(name);
+    settings.setValue("participant", participant);
+    settings.setValue("profile", profile);
+    settings.setValue("created", now.toString(Qt::ISODate));
+    settings.setValue("deviationLX", accuracy.deviationLX);
+    settings.setValue("deviationLY", accuracy.deviationLY);
+    settings.setValue("deviationRX", accuracy.deviationRX);
+    settings.setValue("deviationRY", accuracy.deviationRY);
+    settings.endGroup();
+
+    //names sort by creation time, so the oldest entries come first
+    QStringList names = settings.childGroups();
+    names.sort();
+    for(int i = 0; i < names.size() - entriesPerGroup; i++) {
+        settings.remove(names[i]);
+    }
+    settings.endGroup();
+    return RET_SUCCESS;
+}
+
+std::vector<CachedCalibration> CalibrationCache::entries(const QString &participant, const QString &profile) const {
+    std::vector<CachedCalibration> result;
+    QSettings settings(indexPath, QSettings::IniFormat);
+    settings.beginGroup(groupName(participant, profile));
+    QStringList names = settings.childGroups();
+    for(int i = 0; i < names.size(); i++) {
+        settings.beginGroup(names[i]);
+        CachedCalibration entry;
+        entry.name = names[i];
+        entry.participant = settings.value("participant").toString();
+        entry.profile = settings.value("profile").toString();
+        entry.created = QDateTime::fromString(settings.value("created").toString(), Qt::ISODate);
+        entry.accuracy.deviationLX = settings.value("deviationLX").toDouble();
+        entry.accuracy.deviationLY = settings.value("deviationLY").toDouble();
+        entry.accuracy.deviationRX = settings.value("deviationRX").toDouble();
+        entry.accuracy.deviationRY = settings.value("deviationRY").toDouble();
+        settings.endGroup();
+        result.push_back(entry);
+    }
+    settings.endGroup();
+    std::sort(result.begin(), result.end(), [](const CachedCalibration &a, const CachedCalibration &b) {
+        return a.created > b.created;
+    });
+    return result;
+}
+
+bool CalibrationCache::isAcceptable(const CachedCalibration &entry) const {
+    if(!entry.created.isValid() || entry.created.secsTo(QDateTime::currentDateTime()) > ageLimit) {
+        return false;
+    }
+    const AccuracyStruct &a = entry.accuracy;
+    return a.deviationLX <= deviationLimit && a.deviationLY <= deviationLimit
+        && a.deviationRX <= deviationLimit && a.deviationRY <= deviationLimit;
+}
+
+bool CalibrationCache::findLatest(const QString &participant, const QString &profile, CachedCalibration &entry) const {
+    std::vector<CachedCalibration> all = entries(participant, profile);
+    for(size_t i = 0; i < all.size(); i++) {
+        if(isAcceptable(all[i])) {
+            entry = all[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+int CalibrationCache::restore(const QString &participant, const QString &profile, CachedCalibration *restored) const {
+    if(participant.trimmed().isEmpty()) {
+        return ERR_CALIBRATION_NOT_AVAILABLE;
+    }
+    //fall back to older acceptable entries if the server no longer has the newest one
+    std::vector<CachedCalibration> all = entries(participant, profile);
+    for(size_t i = 0; i < all.size(); i++) {
+        if(!isAcceptable(all[i])) {
+            continue;
+        }
+        char buffer[256];
+        toCalibrationName(all[i].name, buffer);
+        if(iV_LoadCalibration(buffer) == RET_SUCCESS) {
+            if(restored) {
+                *restored = all[i];
+            }
+            return RET_SUCCESS;
+        }
+    }
+    return ERR_CALIBRATION_NOT_AVAILABLE;
+}
+
+QString CalibrationCache::currentGeometryProfile() {
+    MonitorAttachedGeometryStruct geometry;
+    memset(&geometry, 0, sizeof(geometry));
+    if(iV_GetCurrentMonitorAttachedGeometry(&geometry) != RET_SUCCESS) {
+        return QString();
+    }
+    geometry.setupName[sizeof(geometry.setupName) - 1] = 0;
+    return QString::fromLatin1(geometry.setupName);
+}
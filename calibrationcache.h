@@ -0,0 +1,56 @@
+#ifndef CALIBRATIONCACHE_H
+#define CALIBRATIONCACHE_H
+
+//calibrationcache.h
+//Keeps calibrations saved on the eyetracking-server per participant and geometry profile so a
+//returning participant can skip the calibration and validation sequence
+
+#include <QDateTime>
+#include <QString>
+#include <vector>
+#include <myGazeAPI.h>
+
+struct CachedCalibration {
+    QString name;          //identifier passed to iV_SaveCalibration / iV_LoadCalibration
+    QString participant;
+    QString profile;       //monitor attached geometry profile the calibration was made with
+    QDateTime created;
+    AccuracyStruct accuracy; //validation result at save time [degree]
+};
+
+class CalibrationCache {
+
+public:
+    explicit CalibrationCache(const QString &indexPath = "calibrations.ini");
+
+    //a cached calibration is reused only if its validation deviation and age are within these limits
+    void setMaxDeviation(double degrees);
+    void setMaxAge(qint64 seconds);
+    double maxDeviation() const;
+    qint64 maxAge() const;
+
+    //saves the current server calibration and records it in the index, returns the iV_SaveCalibration status;
+    //an empty participant is refused with ERR_PARAMETER_INVALID and never restored
+    int store(const QString &participant, const QString &profile, const AccuracyStruct &accuracy);
+
+    //newest calibration of participant and profile, newest first, optionally only acceptable ones
+    std::vector<CachedCalibration> entries(const QString &participant, const QString &profile) const;
+    bool findLatest(const QString &participant, const QString &profile, CachedCalibration &entry) const;
+    bool isAcceptable(const CachedCalibration &entry) const;
+
+    //loads the newest acceptable calibration with iV_LoadCalibration, returns RET_SUCCESS when a
+    //fresh calibration can be skipped, ERR_CALIBRATION_NOT_AVAILABLE when nothing usable is cached
+    int restore(const QString &participant, const QString &profile, CachedCalibration *restored = 0) const;
+
+    //name of the active geometry profile on the server, empty if it cannot be read
+    static QString currentGeometryProfile();
+
+private:
+    static QString groupName(const QString &participant, const QString &profile);
+
+    QString indexPath;
+    double deviationLimit;
+    qint64 ageLimit;
+};
+
+#endif // CALIBRATIONCACHE_H
@@ -0,0 +1,105 @@
+//callbackregistry.cpp
+//Implements the trampoline registry, one pair of functions is instantiated per slot at compile time
+
+#include "callbackregistry.h"
+#include "trackersession.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+
+static std::atomic<TrackerSession *> boundSessions[CallbackRegistry::MaxSlots];
+static std::atomic<int> runningCallbacks[CallbackRegistry::MaxSlots]; //entered trampolines of each slot
+
+//counts a trampoline as running from before it reads the binding until it has left the session, the sequentially
+//consistent increment and load pair with the store and load in release(): either the trampoline sees the slot unbound
+//or release() sees it running and waits
+class RunningCallback {
+public:
+    explicit RunningCallback(int slot) : count(runningCallbacks[slot]) {
+        count.fetch_add(1);
+    }
+    ~RunningCallback() {
+        count.fetch_sub(1, std::memory_order_release);
+    }
+private:
+    std::atomic<int> &count;
+};
+
+//the myGaze api thread is blocked for as long as a callback runs
+static const std::vector<long long> callbackBuckets = { 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000, 1000000, 10000000 };
+static MetricCounter &sampleCallbacks = *MetricsRegistry::global().counter("mygaze_sample_callbacks_total", "Sample callbacks delivered to a session.");
+static MetricCounter &eventCallbacks = *MetricsRegistry::global().counter("mygaze_event_callbacks_total", "Event callbacks delivered to a session.");
+static MetricHistogram &sampleCallbackTime = *MetricsRegistry::global().histogram("mygaze_sample_callback_duration_nanoseconds",
+    "Time a sample callback spent in the session pipeline.", callbackBuckets);
+static MetricHistogram &eventCallbackTime = *MetricsRegistry::global().histogram("mygaze_event_callback_duration_nanoseconds",
+    "Time an event callback spent in the session pipeline.", callbackBuckets);
+
+template<int Slot> static int CALLBACK sampleTrampoline(SampleStruct sampleData) {
+    RunningCallback running(Slot);
+    TrackerSession *session = boundSessions[Slot].load();
+    if(session) {
+        TRACE_SCOPE("sample callback");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        session->handleSample(sampleData);
+        sampleCallbackTime.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        sampleCallbacks.add();
+    }
+    return 1; //returns successful operation status
+}
+
+template<int Slot> static int CALLBACK eventTrampoline(EventStruct eventData) {
+    RunningCallback running(Slot);
+    TrackerSession *session = boundSessions[Slot].load();
+    if(session) {
+        TRACE_SCOPE("event callback");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        session->handleEvent(eventData);
+        eventCallbackTime.observe(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        eventCallbacks.add();
+    }
+    return 1; //returns successful operation status
+}
+
+template<int... Slots> static const pDLLSetSample *sampleTable(std::integer_sequence<int, Slots...>) {
+    static const pDLLSetSample table[] = { &sampleTrampoline<Slots>... };
+    return table;
+}
+
+template<int... Slots> static const pDLLSetEvent *eventTable(std::integer_sequence<int, Slots...>) {
+    static const pDLLSetEvent table[] = { &eventTrampoline<Slots>... };
+    return table;
+}
+
+int CallbackRegistry::acquire(TrackerSession *session) {
+    for(int i = 0; i < MaxSlots; i++) {
+        TrackerSession *expected = 0;
+        if(boundSessions[i].compare_exchange_strong(expected, session, std::memory_order_acq_rel)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void CallbackRegistry::release(int slot) {
+    if(slot >= 0 && slot < MaxSlots) {
+        boundSessions[slot].store(0);
+        while(runningCallbacks[slot].load() != 0) { //seq_cst like the store, an acquire load could be ordered before it
+            std::this_thread::yield(); //a callback that loaded the session before the store finishes with it
+        }
+    }
+}
+
+pDLLSetSample CallbackRegistry::sampleCallback(int slot) {
+    return slot >= 0 && slot < MaxSlots ? sampleTable(std::make_integer_sequence<int, MaxSlots>())[slot] : 0;
+}
+
+pDLLSetEvent CallbackRegistry::eventCallback(int slot) {
+    return slot >= 0 && slot < MaxSlots ? eventTable(std::make_integer_sequence<int, MaxSlots>())[slot] : 0;
+}
+
+TrackerSession *CallbackRegistry::session(int slot) {
+    return slot >= 0 && slot < MaxSlots ? boundSessions[slot].load(std::memory_order_acquire) : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef CALLBACKREGISTRY_H
+#define CALLBACKREGISTRY_H
+
+//callbackregistry.h
+//Routes the context free CALLBACK function pointers of the myGaze interface to session instances.
+//Each slot owns a pair of generated trampoline functions that forward to the session bound to it.
+
+#include <myGazeAPI.h>
+
+class TrackerSession;
+
+class CallbackRegistry {
+
+public:
+    enum { MaxSlots = 64 };
+
+    //binds session to a free slot, returns the slot index or -1 if all slots are taken
+    static int acquire(TrackerSession *session);
+    //unbinds the slot and waits until the callbacks already running for it have returned, so the session may be torn
+    //down afterwards; never call it from a callback
+    static void release(int slot);
+
+    static pDLLSetSample sampleCallback(int slot);
+    static pDLLSetEvent eventCallback(int slot);
+    static TrackerSession *session(int slot);
+};
+
+#endif // CALLBACKREGISTRY_H
@@ -0,0 +1,336 @@
+//clocksync.cpp
+//Implements the tracker to host clock synchronization service
+
+#include "clocksync.h"
+#include "csvutil.h"
+#include "myGazeAPI.h"
+#include "statsutil.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+static const size_t measurementCapacity = 300;    //30 seconds of history at the default interval
+static const long long minimumPairSpacing = 20000; //pairs closer than this carry more jitter than drift [microseconds]
+
+//reads the eyetracking-server clock through the myGaze API
+static bool readServerTimestamp(long long &timestamp) {
+    return iV_GetCurrentTimestamp(&timestamp) == RET_SUCCESS;
+}
+
+//Clock Sync Constructor using the myGaze server clock and the host steady clock
+ClockSync::ClockSync() : ClockSync(&readServerTimestamp, &ClockSync::hostNow) {
+}
+
+//Clock Sync Constructor with injected clocks, used to run against a simulated drifting clock
+ClockSync::ClockSync(TrackerClock trackerClock, HostClock hostClock)
+    : trackerClock(trackerClock), hostClock(hostClock), nextMeasurement(0), sequence(0),
+      anchorHost(0), anchorTracker(0), drift(0), residual(0), fittedCount(0),
+      stopRequested(false), running(false) {
+    measurements.reserve(measurementCapacity);
+}
+
+//Clock Sync Destructor
+ClockSync::~ClockSync() {
+    stop();
+}
+
+//Starts periodic measurements on a background thread
+void ClockSync::start(int intervalMs) {
+    if(running.load()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = false;
+    }
+    running.store(true);
+    worker = std::thread(&ClockSync::run, this, intervalMs);
+}
+
+//Stops the background thread, the last fitted model stays published
+void ClockSync::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = true;
+    }
+    stopCondition.notify_all();
+    if(worker.joinable()) {
+        worker.join();
+    }
+    running.store(false);
+}
+
+bool ClockSync::isRunning() const {
+    return running.load();
+}
+
+void ClockSync::run(int intervalMs) {
+    std::unique_lock<std::mutex> lock(stopMutex);
+    while(!stopRequested) {
+        lock.unlock();
+        measure();
+        lock.lock();
+        stopCondition.wait_for(lock, std::chrono::milliseconds(intervalMs), [this] { return stopRequested; });
+    }
+}
+
+//Reads the tracker clock bracketed by two host reads and takes the host midpoint as the match
+bool ClockSync::measure() {
+    long long before = hostClock();
+    long long tracker = 0;
+    bool ok = trackerClock(tracker);
+    long long after = hostClock();
+    if(!ok) {
+        return false;
+    }
+    addMeasurement(before + (after - before) / 2, tracker, after - before);
+    return true;
+}
+
+void ClockSync::addMeasurement(long long hostTime, long long trackerTime, long long roundTrip) {
+    {
+        std::lock_guard<std::mutex> lock(measurementMutex);
+        Measurement m = { hostTime, trackerTime, roundTrip };
+        if(measurements.size() < measurementCapacity) {
+            measurements.push_back(m);
+        }
+        else {
+            measurements[nextMeasurement] = m;
+        }
+        nextMeasurement = (nextMeasurement + 1) % measurementCapacity;
+    }
+    refit();
+}
+
+//Drops all measurements and unpublishes the model
+void ClockSync::clear() {
+    std::lock_guard<std::mutex> writer(writerMutex);
+    {
+        std::lock_guard<std::mutex> lock(measurementMutex);
+        measurements.clear();
+        nextMeasurement = 0;
+    }
+    ClockModel empty = { 0, 0, 0, 0, 0 };
+    publish(empty);
+}
+
+//Fits offset and drift with a Theil-Sen estimator over the measurements with the shortest round trips,
+//slow reads (scheduling hiccups, busy server) are discarded and remaining outliers cannot pull the median
+void ClockSync::refit() {
+    std::lock_guard<std::mutex> writer(writerMutex);
+    std::vector<Measurement> points;
+    {
+        std::lock_guard<std::mutex> lock(measurementMutex);
+        points = measurements;
+    }
+    if(points.empty()) {
+        return;
+    }
+
+    std::vector<double> roundTrips;
+    for(size_t i = 0; i < points.size(); i++) {
+        roundTrips.push_back(double(points[i].roundTrip));
+    }
+    double roundTripLimit = median(roundTrips);
+    std::vector<Measurement> fast;
+    long long newest = points[0].host;
+    for(size_t i = 0; i < points.size(); i++) {
+        if(points[i].roundTrip <= roundTripLimit) {
+            fast.push_back(points[i]);
+        }
+        newest = std::max(newest, points[i].host);
+    }
+
+    //median of pairwise drift estimates
+    double fittedDrift = 0;
+    std::vector<double> slopes;
+    for(size_t i = 0; i < fast.size(); i++) {
+        for(size_t j = i + 1; j < fast.size(); j++) {
+            long long dh = fast[j].host - fast[i].host;
+            if(dh < minimumPairSpacing && dh > -minimumPairSpacing) {
+                continue;
+            }
+            long long dt = fast[j].tracker - fast[i].tracker;
+            slopes.push_back(double(dt - dh) / double(dh));
+        }
+    }
+    if(!slopes.empty()) {
+        fittedDrift = median(slopes);
+    }
+
+    //anchor at the newest measurement so conversions near now do not extrapolate far
+    std::vector<double> offsets;
+    for(size_t i = 0; i < fast.size(); i++) {
+        offsets.push_back(double(fast[i].tracker - fast[i].host) - double(fast[i].host - newest) * fittedDrift);
+    }
+    double offset = median(offsets);
+    std::vector<double> deviations;
+    for(size_t i = 0; i < offsets.size(); i++) {
+        deviations.push_back(std::fabs(offsets[i] - offset));
+    }
+
+    ClockModel fitted;
+    fitted.anchorHost = newest;
+    fitted.anchorTracker = newest + (long long)std::llround(offset);
+    fitted.drift = fittedDrift;
+    fitted.residual = 1.4826 * median(deviations);
+    fitted.measurements = (int)fast.size();
+    publish(fitted);
+}
+
+//Writer side of the sequence lock, called with writerMutex held
+void ClockSync::publish(const ClockModel &fitted) {
+    unsigned s = sequence.load(std::memory_order_relaxed);
+    sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    anchorHost.store(fitted.anchorHost, std::memory_order_relaxed);
+    anchorTracker.store(fitted.anchorTracker, std::memory_order_relaxed);
+    drift.store(fitted.drift, std::memory_order_relaxed);
+    residual.store(fitted.residual, std::memory_order_relaxed);
+    fittedCount.store(fitted.measurements, std::memory_order_relaxed);
+    sequence.store(s + 2, std::memory_order_release);
+}
+
+//Reads a consistent copy of the published model, retrying only while a refit is being written
+ClockModel ClockSync::model() const {
+    ClockModel current;
+    unsigned before, after;
+    do {
+        before = sequence.load(std::memory_order_acquire);
+        current.anchorHost = anchorHost.load(std::memory_order_relaxed);
+        current.anchorTracker = anchorTracker.load(std::memory_order_relaxed);
+        current.drift = drift.load(std::memory_order_relaxed);
+        current.residual = residual.load(std::memory_order_relaxed);
+        current.measurements = fittedCount.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+    } while((before & 1) || before != after);
+    return current;
+}
+
+bool ClockSync::isSynchronized() const {
+    return model().measurements >= 2;
+}
+
+long long ClockSync::trackerToHost(long long trackerTime) const {
+    ClockModel m = model();
+    return m.anchorHost + (long long)std::llround(double(trackerTime - m.anchorTracker) / (1.0 + m.drift));
+}
+
+long long ClockSync::hostToTracker(long long hostTime) const {
+    ClockModel m = model();
+    return m.anchorTracker + (long long)std::llround(double(hostTime - m.anchorHost) * (1.0 + m.drift));
+}
+
+long long ClockSync::hostNow() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//tracker clock of the benchmark on a virtual host timeline: the first host read of every measurement advances it by the
+//interval, a tracker read takes 100-200 us (5% of the reads 5 ms) and is taken at its midpoint with up to 20 us of noise;
+//everything but the atomics is only touched by the worker thread
+struct SimulatedServer {
+    explicit SimulatedServer(double driftPpm) : host(0), offset(123456789), drift(driftPpm * 1e-6), random(12345), hostReads(0), reads(0) {}
+    long long truth(long long hostTime) const {
+        return offset.load() + (long long)std::llround(hostTime * (1.0 + drift));
+    }
+    std::atomic<long long> host;
+    std::atomic<long long> offset;
+    double drift;
+    std::mt19937 random;
+    long long hostReads;
+    std::atomic<int> reads;
+};
+
+static void waitForReads(const SimulatedServer &server, int reads) {
+    while(server.reads.load() < reads) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+QStringList ClockSync::benchmark(const std::vector<double> &driftsPpm, int measurements) {
+    const long long interval = 100000;
+    QStringList rows;
+    rows << "drift_ppm,fitted_drift_ppm,error_us,error_10s_us,residual_us,measurements,reconnect_error_us";
+    for(size_t d = 0; d < driftsPpm.size(); d++) {
+        SimulatedServer server(driftsPpm[d]);
+        HostClock hostClock = [&server, interval]() {
+            if(server.hostReads++ % 2 == 0) {
+                server.host.fetch_add(interval);
+            }
+            return server.host.load();
+        };
+        TrackerClock trackerClock = [&server](long long &timestamp) {
+            std::uniform_int_distribution<int> delay(100, 200), noise(-20, 20), outlier(0, 19);
+            long long roundTrip = outlier(server.random) == 0 ? 5000 : delay(server.random);
+            server.host.fetch_add(roundTrip / 2);
+            timestamp = server.truth(server.host.load()) + noise(server.random);
+            server.host.fetch_add(roundTrip - roundTrip / 2);
+            server.reads.fetch_add(1);
+            return true;
+        };
+
+        ClockSync sync(trackerClock, hostClock);
+        sync.start(1);
+        waitForReads(server, measurements);
+        sync.stop();
+        ClockModel fitted = sync.model();
+        long long now = server.host.load();
+        long long error = sync.hostToTracker(now) - server.truth(now);
+        long long extrapolated = sync.hostToTracker(now + 10000000) - server.truth(now + 10000000);
+
+        //the server restarts with its clock 5 s ahead while the worker runs, then TrackerSession::connect stops, clears and restarts
+        sync.start(1);
+        waitForReads(server, measurements + 10);
+        server.offset.fetch_add(5000000);
+        sync.stop();
+        sync.clear();
+        sync.start(1);
+        waitForReads(server, measurements + 40);
+        sync.stop();
+        now = server.host.load();
+        long long reconnect = sync.hostToTracker(now) - server.truth(now);
+
+        QStringList row;
+        row << QString::number(driftsPpm[d]) << QString::number(fitted.drift * 1e6, 'f', 2) << QString::number(error)
+            << QString::number(extrapolated) << QString::number(fitted.residual, 'f', 1) << QString::number(fitted.measurements)
+            << QString::number(reconnect);
+        rows << row.join(",");
+    }
+    return rows;
+}
+
+//--clock-benchmark [--output file] [--drifts ppm,...] [--measurements n]
+int ClockSync::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Clock synchronization against simulated drifting tracker clocks");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("clock-benchmark", "Benchmark the clock synchronization."));
+    parser.addOption(QCommandLineOption("output", "Result table.", "file", "clock_benchmark.csv"));
+    parser.addOption(QCommandLineOption("drifts", "Comma separated tracker clock drifts.", "ppm", "0,20,100,-250,1000"));
+    parser.addOption(QCommandLineOption("measurements", "Measurements before the fit is judged, 100 ms of simulated time each.", "n", "300"));
+    parser.process(arguments);
+
+    std::vector<double> drifts;
+    QStringList values = splitList(parser.value("drifts"));
+    for(int i = 0; i < values.size(); i++) {
+        drifts.push_back(values[i].toDouble());
+    }
+    QFile file(parser.value("output"));
+    if(drifts.empty() || !file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    QStringList rows = benchmark(drifts, std::max(10, parser.value("measurements").toInt()));
+    for(int r = 0; r < rows.size(); r++) {
+        out << rows[r] << '\n';
+        qDebug().noquote() << rows[r];
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+//clocksync.h
+//Maps the eyetracking-server microsecond clock (SampleStruct::timestamp) onto the host monotonic clock
+
+#include <QStringList>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//linear clock model: tracker = anchorTracker + (host - anchorHost) * (1 + drift)
+struct ClockModel {
+    long long anchorHost;    //host time of the anchor [microseconds]
+    long long anchorTracker; //tracker time at the anchor [microseconds]
+    double drift;            //relative rate difference of the tracker clock [seconds/second]
+    double residual;         //robust spread of the fit (scaled median absolute deviation) [microseconds]
+    int measurements;        //number of measurements the fit was made from
+};
+
+class ClockSync {
+
+public:
+    //tracker clock reads the server time into its argument and returns false on failure,
+    //host clock returns monotonic host time [microseconds]
+    typedef std::function<bool(long long &)> TrackerClock;
+    typedef std::function<long long()> HostClock;
+
+    ClockSync();
+    ClockSync(TrackerClock trackerClock, HostClock hostClock);
+    ~ClockSync();
+
+    //background sampling of both clocks, intervalMs between measurements
+    void start(int intervalMs = 100);
+    void stop();
+    bool isRunning() const;
+
+    //takes a single measurement and refits, used by the background thread and for manual stepping
+    bool measure();
+    //feeds an externally taken measurement, roundTrip is the host time spent reading the tracker clock
+    void addMeasurement(long long hostTime, long long trackerTime, long long roundTrip);
+    //drops all measurements and unpublishes the model; stop() first when the clock itself changed (reconnect),
+    //otherwise a measurement the worker is taking still lands after the clear
+    void clear();
+
+    //lock free conversions, safe from any thread including sample callbacks
+    bool isSynchronized() const;
+    long long trackerToHost(long long trackerTime) const;
+    long long hostToTracker(long long hostTime) const;
+    ClockModel model() const;
+
+    //monotonic host clock used by default [microseconds]
+    static long long hostNow();
+
+    //runs the background thread against simulated tracker clocks of each drift [ppm] with jittered reads and slow outliers,
+    //then restarts the server clock at another offset the way TrackerSession reconnects, one result row per drift
+    static QStringList benchmark(const std::vector<double> &driftsPpm, int measurements);
+    //entry point of the --clock-benchmark command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    struct Measurement {
+        long long host;
+        long long tracker;
+        long long roundTrip;
+    };
+
+    void run(int intervalMs);
+    void refit();
+    void publish(const ClockModel &fitted);
+
+    TrackerClock trackerClock;
+    HostClock hostClock;
+
+    std::mutex writerMutex; //serializes refit() and clear(), the sequence lock has a single writer at a time
+    std::mutex measurementMutex;
+    std::vector<Measurement> measurements; //ring of the most recent measurements
+    size_t nextMeasurement;
+
+    //published model guarded by a sequence lock so readers never block
+    std::atomic<unsigned> sequence;
+    std::atomic<long long> anchorHost;
+    std::atomic<long long> anchorTracker;
+    std::atomic<double> drift;
+    std::atomic<double> residual;
+    std::atomic<int> fittedCount;
+
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopRequested;
+    std::atomic<bool> running;
+};
+
+#endif // CLOCKSYNC_H
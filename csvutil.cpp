@@ -0,0 +1,21 @@
+//csvutil.cpp
+//Implements the csv helpers of the list options and result tables
+
+#include "csvutil.h"
+
+QString csvField(const QString &value) {
+    if(!value.contains(',') && !value.contains('"') && !value.contains('\n')) {
+        return value;
+    }
+    QString quoted = value;
+    quoted.replace("\"", "\"\"");
+    return "\"" + quoted + "\"";
+}
+
+QStringList splitList(const QString &text, QChar separator) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    return text.split(separator, Qt::SkipEmptyParts);
+#else
+    return text.split(separator, QString::SkipEmptyParts);
+#endif
+}
@@ -0,0 +1,16 @@
+#ifndef CSVUTIL_H
+#define CSVUTIL_H
+
+//csvutil.h
+//Helpers shared by the command line modes for their list options and result tables
+
+#include <QString>
+#include <QStringList>
+
+//quotes a value when it would break the csv row, doubling embedded quotes
+QString csvField(const QString &value);
+
+//splits a command line list such as "a,b,,c" at separator and drops the empty parts
+QStringList splitList(const QString &text, QChar separator = ',');
+
+#endif // CSVUTIL_H
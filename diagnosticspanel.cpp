@@ -0,0 +1,101 @@
+//diagnosticspanel.cpp
+//Implements the diagnostics window
+
+#include "diagnosticspanel.h"
+#include "metrics.h"
+#include "metricsserver.h"
+#include "memorybudget.h"
+#include "tracing.h"
+#include <QHeaderView>
+#include <QLabel>
+#include <QTableWidget>
+#include <QTimer>
+#include <QVBoxLayout>
+
+static const int refreshIntervalMs = 1000;
+
+//upper bound of the bucket holding the given share of the observations, empty if it is above every bound
+static QString histogramPercentile(const MetricSample &sample, double share) {
+    long long target = (long long)(share * sample.value + 0.5);
+    long long cumulative = 0;
+    for(size_t b = 0; b < sample.bounds.size(); b++) {
+        cumulative += sample.counts[b];
+        if(cumulative >= target) {
+            return QString("<= %1").arg(sample.bounds[b]);
+        }
+    }
+    return QString("> %1").arg(sample.bounds.empty() ? 0 : sample.bounds.back());
+}
+
+//Diagnostics Panel Constructor
+DiagnosticsPanel::DiagnosticsPanel(const MetricsServer *server, QWidget *parent) : QWidget(parent, Qt::Window), server(server) {
+    setWindowTitle("MyGaze Diagnostics");
+    endpointLabel = new QLabel(this);
+    endpointLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    table = new QTableWidget(0, 4, this);
+    table->setHorizontalHeaderLabels(QStringList() << "Metric" << "Value" << "Per second" << "Distribution");
+    table->horizontalHeader()->setStretchLastSection(true);
+    table->verticalHeader()->setVisible(false);
+    table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    memoryLabel = new QLabel(this);
+    memoryLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(endpointLabel);
+    layout->addWidget(table);
+    layout->addWidget(memoryLabel);
+    resize(760, 560);
+
+    clock.start();
+    refreshTimer = new QTimer(this);
+    connect(refreshTimer, &QTimer::timeout, this, &DiagnosticsPanel::refresh);
+    refreshTimer->start(refreshIntervalMs);
+}
+
+void DiagnosticsPanel::showEvent(QShowEvent *event) {
+    QWidget::showEvent(event);
+    refresh();
+}
+
+void DiagnosticsPanel::refresh() {
+    TRACE_SCOPE("diagnostics refresh");
+    if(!isVisible()) {
+        return;
+    }
+    endpointLabel->setText(server && server->isRunning() ? "Prometheus endpoint: " + server->url() : QString("Prometheus endpoint not running"));
+
+    std::vector<MetricSample> samples = MetricsRegistry::global().snapshot();
+    qint64 now = clock.elapsed();
+    table->setRowCount((int)samples.size());
+    for(size_t i = 0; i < samples.size(); i++) {
+        const MetricSample &sample = samples[i];
+        QString key = sample.labels.isEmpty() ? sample.name : sample.name + "{" + sample.labels + "}";
+
+        //counters and histogram counts get a rate over the last refresh, gauges are shown as they are
+        QString rate;
+        std::map<QString, std::pair<double, qint64> >::iterator last = previous.find(key);
+        if(sample.type != GaugeMetric && last != previous.end() && now > last->second.second) {
+            rate = QString::number((sample.value - last->second.first) * 1000.0 / (now - last->second.second), 'f', 1);
+        }
+        previous[key] = std::make_pair(sample.value, now);
+
+        QString distribution;
+        if(sample.type == HistogramMetric && sample.value > 0) {
+            distribution = QString("mean %1, p50 %2, p99 %3").arg(sample.sum / sample.value, 0, 'f', 1)
+                               .arg(histogramPercentile(sample, 0.5)).arg(histogramPercentile(sample, 0.99));
+        }
+
+        QStringList cells;
+        cells << key << QString::number(sample.value, 'g', 10) << rate << distribution;
+        for(int c = 0; c < cells.size(); c++) {
+            QTableWidgetItem *item = table->item((int)i, c);
+            if(!item) {
+                item = new QTableWidgetItem();
+                table->setItem((int)i, c, item);
+            }
+            item->setText(cells[c]);
+            item->setToolTip(c == 0 ? sample.help : QString());
+        }
+    }
+    memoryLabel->setText(MemoryBudget::global().report().join("\n"));
+}
@@ -0,0 +1,38 @@
+#ifndef DIAGNOSTICSPANEL_H
+#define DIAGNOSTICSPANEL_H
+
+//diagnosticspanel.h
+//Window behind the Settings button listing every registered metric with its rate, histogram percentiles and the
+//memory budget, refreshed once a second while it is shown.
+
+#include <QElapsedTimer>
+#include <QWidget>
+#include <map>
+
+class MetricsServer;
+class QLabel;
+class QTableWidget;
+class QTimer;
+
+class DiagnosticsPanel : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit DiagnosticsPanel(const MetricsServer *server, QWidget *parent = 0);
+
+protected:
+    void showEvent(QShowEvent *event);
+
+private:
+    void refresh();
+
+    const MetricsServer *server;
+    QLabel *endpointLabel;
+    QTableWidget *table;
+    QLabel *memoryLabel;
+    QTimer *refreshTimer;
+    QElapsedTimer clock;
+    std::map<QString, std::pair<double, qint64> > previous; //value and clock time of the last refresh per metric
+};
+
+#endif // DIAGNOSTICSPANEL_H
@@ -0,0 +1,444 @@
+//fixationclustering.cpp
+//Implements the grid indexed parallel DBSCAN over weighted fixations
+
+#include "fixationclustering.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <random>
+
+static const int neighbourReach = 2; //cells of epsilon / sqrt(2) are searched two cells in every direction
+
+//Fixation Clustering Constructor, threads 0 uses every core
+FixationClustering::FixationClustering(double epsilon, double minWeight, int threads)
+    : epsilon(epsilon), minWeight(minWeight), pool(threads) {
+}
+
+void FixationClustering::clear() {
+    points.clear();
+    pointLabels.clear();
+    found.clear();
+}
+
+void FixationClustering::addFixation(double x, double y, double durationMs) {
+    Point point;
+    point.x = (float)x;
+    point.y = (float)y;
+    point.weight = (float)durationMs;
+    points.push_back(point);
+}
+
+void FixationClustering::addSession(const SessionReader &session) {
+    session.forEachEvent([this](const EventStruct &event) {
+        if(event.eventType == 'F') {
+            addFixation(event.positionX, event.positionY, event.duration / 1000.0);
+        }
+    });
+}
+
+int FixationClustering::loadSessions(const QStringList &sessions) {
+    //each session fills its own list so the insertion order does not depend on scheduling
+    std::vector<std::vector<Point> > loaded(sessions.size());
+    pool.parallelFor(sessions.size(), 1, [&](long long begin, long long end) {
+        for(long long i = begin; i < end; i++) {
+            SessionReader session;
+            if(!session.open(sessions[(int)i])) {
+                qWarning() << "Session could not be read:" << sessions[(int)i];
+                continue;
+            }
+            session.forEachEvent([&loaded, i](const EventStruct &event) {
+                if(event.eventType == 'F') {
+                    Point point;
+                    point.x = (float)event.positionX;
+                    point.y = (float)event.positionY;
+                    point.weight = (float)(event.duration / 1000.0);
+                    loaded[i].push_back(point);
+                }
+            });
+        }
+    });
+    int added = 0;
+    for(size_t i = 0; i < loaded.size(); i++) {
+        points.insert(points.end(), loaded[i].begin(), loaded[i].end());
+        added += (int)loaded[i].size();
+    }
+    return added;
+}
+
+int FixationClustering::fixationCount() const {
+    return (int)points.size();
+}
+
+const std::vector<int> &FixationClustering::labels() const {
+    return pointLabels;
+}
+
+const std::vector<FixationCluster> &FixationClustering::clusters() const {
+    return found;
+}
+
+//keys sort row major with negative coordinates kept in order
+long long FixationClustering::cellKey(int column, int row) {
+    return (long long)(((unsigned long long)((long long)column + 0x80000000LL) << 32) | (unsigned long long)((long long)row + 0x80000000LL));
+}
+
+int FixationClustering::findCell(long long key) const {
+    int low = 0, high = (int)cells.size();
+    while(low < high) {
+        int middle = (low + high) / 2;
+        if(cells[middle].key < key) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low < (int)cells.size() && cells[low].key == key ? low : -1;
+}
+
+//true if a core point of a lies within epsilon of a core point of b
+bool FixationClustering::coresConnected(const Cell &a, const Cell &b) const {
+    float limit = (float)(epsilon * epsilon);
+    for(int i = a.begin; i < a.end; i++) {
+        if(!core[i]) {
+            continue;
+        }
+        for(int j = b.begin; j < b.end; j++) {
+            if(!core[j]) {
+                continue;
+            }
+            float dx = sorted[i].x - sorted[j].x;
+            float dy = sorted[i].y - sorted[j].y;
+            if(dx * dx + dy * dy <= limit) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//union find root with path halving
+static int findRoot(std::vector<int> &parent, int i) {
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+int FixationClustering::run() {
+    int n = (int)points.size();
+    found.clear();
+    pointLabels.assign(n, -1);
+    if(n == 0 || epsilon <= 0) {
+        return 0;
+    }
+    const double side = epsilon / std::sqrt(2.0);
+    const float limit = (float)(epsilon * epsilon);
+
+    //grid index: sort the points by cell and cut the order into cell ranges
+    std::vector<std::pair<long long, int> > keyed(n);
+    pool.parallelFor(n, 65536, [&](long long begin, long long end) {
+        for(long long i = begin; i < end; i++) {
+            int column = (int)std::floor(points[i].x / side);
+            int row = (int)std::floor(points[i].y / side);
+            keyed[i] = std::make_pair(cellKey(column, row), (int)i);
+        }
+    });
+    std::sort(keyed.begin(), keyed.end());
+    order.resize(n);
+    sorted.resize(n);
+    cells.clear();
+    for(int i = 0; i < n; i++) {
+        order[i] = keyed[i].second;
+        sorted[i] = points[keyed[i].second];
+        if(cells.empty() || cells.back().key != keyed[i].first) {
+            Cell cell;
+            cell.key = keyed[i].first;
+            cell.column = (int)std::floor(sorted[i].x / side);
+            cell.row = (int)std::floor(sorted[i].y / side);
+            cell.begin = i;
+            cell.end = i;
+            cell.weight = 0;
+            cells.push_back(cell);
+        }
+        cells.back().end = i + 1;
+        cells.back().weight += sorted[i].weight;
+    }
+    std::vector<std::pair<long long, int> >().swap(keyed);
+    int cellCount = (int)cells.size();
+
+    //neighbour cells of cell c, -1 where the grid is empty
+    auto neighbours = [this](int c, int result[25]) {
+        int k = 0;
+        for(int dx = -neighbourReach; dx <= neighbourReach; dx++) {
+            for(int dy = -neighbourReach; dy <= neighbourReach; dy++) {
+                result[k++] = (dx == 0 && dy == 0) ? c : findCell(cellKey(cells[c].column + dx, cells[c].row + dy));
+            }
+        }
+    };
+
+    //core points, a cell heavy enough on its own makes all its points core since its diameter is epsilon
+    core.assign(n, 0);
+    pool.parallelFor(cellCount, 256, [&](long long begin, long long end) {
+        int near[25];
+        for(long long c = begin; c < end; c++) {
+            const Cell &cell = cells[c];
+            if(cell.weight >= minWeight) {
+                std::fill(core.begin() + cell.begin, core.begin() + cell.end, 1);
+                continue;
+            }
+            neighbours((int)c, near);
+            for(int i = cell.begin; i < cell.end; i++) {
+                //cells entirely inside the disk count whole, cells out of reach are skipped and only the
+                //ones cut by the circle are scanned, stopping as soon as the outcome is certain
+                double inside = 0, cut = 0;
+                int partial[25];
+                int partialCount = 0;
+                for(int k = 0; k < 25; k++) {
+                    if(near[k] < 0) {
+                        continue;
+                    }
+                    const Cell &other = cells[near[k]];
+                    double left = other.column * side - sorted[i].x, right = left + side;
+                    double top = other.row * side - sorted[i].y, bottom = top + side;
+                    double nearX = left > 0 ? left : (right < 0 ? right : 0);
+                    double nearY = top > 0 ? top : (bottom < 0 ? bottom : 0);
+                    if(nearX * nearX + nearY * nearY > limit) {
+                        continue;
+                    }
+                    double farX = std::max(std::fabs(left), std::fabs(right));
+                    double farY = std::max(std::fabs(top), std::fabs(bottom));
+                    if(farX * farX + farY * farY <= limit) {
+                        inside += other.weight;
+                    }
+                    else {
+                        cut += other.weight;
+                        partial[partialCount++] = near[k];
+                    }
+                }
+                if(inside >= minWeight || inside + cut < minWeight) {
+                    core[i] = inside >= minWeight ? 1 : 0;
+                    continue;
+                }
+                double sum = inside;
+                for(int k = 0; k < partialCount && sum < minWeight && sum + cut >= minWeight; k++) {
+                    const Cell &other = cells[partial[k]];
+                    cut -= other.weight;
+                    for(int j = other.begin; j < other.end; j++) {
+                        float dx = sorted[i].x - sorted[j].x;
+                        float dy = sorted[i].y - sorted[j].y;
+                        if(dx * dx + dy * dy <= limit) {
+                            sum += sorted[j].weight;
+                        }
+                    }
+                }
+                core[i] = sum >= minWeight ? 1 : 0;
+            }
+        }
+    });
+
+    std::vector<unsigned char> coreCell(cellCount, 0);
+    for(int c = 0; c < cellCount; c++) {
+        coreCell[c] = std::find(core.begin() + cells[c].begin, core.begin() + cells[c].end, (unsigned char)1) != core.begin() + cells[c].end;
+    }
+
+    //connect core cells in parallel, each pair is tested once from its lower index
+    std::vector<std::pair<int, int> > edges;
+    std::mutex edgeMutex;
+    pool.parallelFor(cellCount, 256, [&](long long begin, long long end) {
+        std::vector<std::pair<int, int> > local;
+        int near[25];
+        for(long long c = begin; c < end; c++) {
+            if(!coreCell[c]) {
+                continue;
+            }
+            neighbours((int)c, near);
+            for(int k = 0; k < 25; k++) {
+                if(near[k] > c && coreCell[near[k]] && coresConnected(cells[c], cells[near[k]])) {
+                    local.push_back(std::make_pair((int)c, near[k]));
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(edgeMutex);
+        edges.insert(edges.end(), local.begin(), local.end());
+    });
+    std::vector<int> parent(cellCount);
+    for(int c = 0; c < cellCount; c++) {
+        parent[c] = c;
+    }
+    for(size_t e = 0; e < edges.size(); e++) {
+        int a = findRoot(parent, edges[e].first);
+        int b = findRoot(parent, edges[e].second);
+        if(a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    //provisional cluster ids in cell order
+    std::vector<int> cellCluster(cellCount, -1);
+    int clusterCount = 0;
+    for(int c = 0; c < cellCount; c++) {
+        if(!coreCell[c]) {
+            continue;
+        }
+        int root = findRoot(parent, c);
+        if(cellCluster[root] < 0) {
+            cellCluster[root] = clusterCount++;
+        }
+        cellCluster[c] = cellCluster[root];
+    }
+
+    //core points take their cell's cluster, border points the cluster of the nearest core point within epsilon
+    std::vector<int> sortedLabels(n, -1);
+    pool.parallelFor(cellCount, 256, [&](long long begin, long long end) {
+        int near[25];
+        for(long long c = begin; c < end; c++) {
+            const Cell &cell = cells[c];
+            bool searched = false;
+            for(int i = cell.begin; i < cell.end; i++) {
+                if(core[i]) {
+                    sortedLabels[i] = cellCluster[c];
+                    continue;
+                }
+                if(!searched) {
+                    neighbours((int)c, near);
+                    searched = true;
+                }
+                float best = limit;
+                for(int k = 0; k < 25; k++) {
+                    if(near[k] < 0 || !coreCell[near[k]]) {
+                        continue;
+                    }
+                    const Cell &other = cells[near[k]];
+                    for(int j = other.begin; j < other.end; j++) {
+                        float dx = sorted[i].x - sorted[j].x;
+                        float dy = sorted[i].y - sorted[j].y;
+                        float distance = dx * dx + dy * dy;
+                        if(core[j] && distance <= best) {
+                            best = distance;
+                            sortedLabels[i] = cellCluster[near[k]];
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    //cluster statistics, then renumber by descending weight
+    std::vector<FixationCluster> stats(clusterCount);
+    std::vector<double> minX(clusterCount, 1e300), minY(clusterCount, 1e300), maxX(clusterCount, -1e300), maxY(clusterCount, -1e300);
+    for(int c = 0; c < clusterCount; c++) {
+        stats[c].id = c;
+        stats[c].x = 0;
+        stats[c].y = 0;
+        stats[c].weight = 0;
+        stats[c].count = 0;
+    }
+    for(int i = 0; i < n; i++) {
+        int label = sortedLabels[i];
+        if(label < 0) {
+            continue;
+        }
+        FixationCluster &cluster = stats[label];
+        cluster.x += sorted[i].x * (double)sorted[i].weight;
+        cluster.y += sorted[i].y * (double)sorted[i].weight;
+        cluster.weight += sorted[i].weight;
+        cluster.count++;
+        if(core[i]) {
+            minX[label] = std::min(minX[label], (double)sorted[i].x);
+            minY[label] = std::min(minY[label], (double)sorted[i].y);
+            maxX[label] = std::max(maxX[label], (double)sorted[i].x);
+            maxY[label] = std::max(maxY[label], (double)sorted[i].y);
+        }
+    }
+    for(int c = 0; c < clusterCount; c++) {
+        if(stats[c].weight > 0) {
+            stats[c].x /= stats[c].weight;
+            stats[c].y /= stats[c].weight;
+        }
+        stats[c].bounds = QRectF(minX[c], minY[c], maxX[c] - minX[c], maxY[c] - minY[c]);
+    }
+    std::stable_sort(stats.begin(), stats.end(), [](const FixationCluster &a, const FixationCluster &b) {
+        return a.weight > b.weight;
+    });
+    std::vector<int> renumbered(clusterCount);
+    for(int c = 0; c < clusterCount; c++) {
+        renumbered[stats[c].id] = c;
+        stats[c].id = c;
+    }
+    for(int i = 0; i < n; i++) {
+        pointLabels[order[i]] = sortedLabels[i] < 0 ? -1 : renumbered[sortedLabels[i]];
+    }
+    found.swap(stats);
+    return clusterCount;
+}
+
+std::vector<AreaOfInterest> FixationClustering::areasOfInterest(double padding) const {
+    std::vector<AreaOfInterest> areas;
+    for(size_t c = 0; c < found.size(); c++) {
+        AreaOfInterest area;
+        area.name = QString("cluster_%1").arg((int)c + 1);
+        area.rect = found[c].bounds.adjusted(-padding, -padding, padding, padding);
+        areas.push_back(area);
+    }
+    return areas;
+}
+
+//--cluster <directory> [--output aoi.txt] [--epsilon px] [--min-weight ms] [--padding px] [--synthetic n] [--threads n]
+int FixationClustering::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Density based clustering of fixations into data driven areas of interest");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("cluster", "Directory scanned recursively for .mgs sessions.", "directory"));
+    parser.addOption(QCommandLineOption("output", "Areas of interest file written from the clusters.", "file", "clusters.txt"));
+    parser.addOption(QCommandLineOption("epsilon", "Neighbourhood radius in pixels.", "px", "40"));
+    parser.addOption(QCommandLineOption("min-weight", "Summed fixation duration within epsilon that makes a core point.", "ms", "1000"));
+    parser.addOption(QCommandLineOption("padding", "Margin added around each cluster area.", "px", "0"));
+    parser.addOption(QCommandLineOption("synthetic", "Cluster n generated fixations instead of sessions.", "n", "0"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    FixationClustering clustering(parser.value("epsilon").toDouble(), parser.value("min-weight").toDouble(), parser.value("threads").toInt());
+    int synthetic = parser.value("synthetic").toInt();
+    if(synthetic > 0) {
+        //twenty hotspots on a 1920 x 1080 screen holding 80 % of the fixations, the rest spread uniformly
+        std::mt19937 random(1);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::normal_distribution<double> spread(0.0, 30.0);
+        std::vector<double> hotX, hotY;
+        for(int h = 0; h < 20; h++) {
+            hotX.push_back(100 + uniform(random) * 1720);
+            hotY.push_back(100 + uniform(random) * 880);
+        }
+        for(int i = 0; i < synthetic; i++) {
+            double duration = 100 + uniform(random) * 500;
+            if(uniform(random) < 0.8) {
+                int h = (int)(uniform(random) * 20) % 20;
+                clustering.addFixation(hotX[h] + spread(random), hotY[h] + spread(random), duration);
+            }
+            else {
+                clustering.addFixation(uniform(random) * 1920, uniform(random) * 1080, duration);
+            }
+        }
+    }
+    else {
+        clustering.loadSessions(BatchAnalyzer::findSessions(parser.value("cluster")));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int count = clustering.run();
+    qDebug() << "Clustered" << clustering.fixationCount() << "fixations into" << count << "clusters in" << timer.elapsed() << "ms";
+
+    if(!saveAreasOfInterest(parser.value("output"), clustering.areasOfInterest(parser.value("padding").toDouble()))) {
+        qWarning() << "Could not write areas of interest:" << parser.value("output");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef FIXATIONCLUSTERING_H
+#define FIXATIONCLUSTERING_H
+
+//fixationclustering.h
+//Duration weighted DBSCAN over fixation positions to find the screen regions that attract attention
+//without predefined areas. A uniform grid with cells of epsilon / sqrt(2) serves as neighbour index:
+//points sharing a cell are always neighbours, and only the 5 x 5 surrounding cells need to be searched.
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "sessionanalysis.h"
+#include "threadpool.h"
+
+class SessionReader;
+
+struct FixationCluster {
+    int id;
+    double x;      //duration weighted centroid [pixel]
+    double y;
+    QRectF bounds; //bounding box of the core fixations [pixel]
+    double weight; //summed fixation duration [milliseconds]
+    int count;     //fixations assigned to the cluster, border fixations included
+};
+
+class FixationClustering {
+
+public:
+    //epsilon is the neighbourhood radius [pixel], a fixation is a core point once the summed duration within
+    //epsilon (its own included) reaches minWeight [milliseconds]
+    explicit FixationClustering(double epsilon = 40.0, double minWeight = 1000.0, int threads = 0);
+
+    void clear();
+    void addFixation(double x, double y, double durationMs);
+    void addSession(const SessionReader &session); //adds the fixation events of a session
+    int loadSessions(const QStringList &sessions);  //reads sessions in parallel, returns the fixations added
+    int fixationCount() const;
+
+    //clusters every fixation added so far, returns the number of clusters
+    int run();
+    const std::vector<int> &labels() const; //cluster id per fixation in insertion order, -1 for noise
+    const std::vector<FixationCluster> &clusters() const;
+
+    //clusters as areas of interest named cluster_1, cluster_2, ... by descending weight, for saveAreasOfInterest
+    std::vector<AreaOfInterest> areasOfInterest(double padding = 0.0) const;
+
+    //entry point of the --cluster command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    struct Point {
+        float x;
+        float y;
+        float weight;
+    };
+
+    struct Cell {
+        long long key;
+        int column;
+        int row;
+        int begin;    //range into the cell sorted point order
+        int end;
+        double weight;
+    };
+
+    static long long cellKey(int column, int row);
+    int findCell(long long key) const;
+    bool coresConnected(const Cell &a, const Cell &b) const;
+
+    double epsilon;
+    double minWeight;
+    std::vector<Point> points;
+    std::vector<int> pointLabels;
+    std::vector<FixationCluster> found;
+
+    //neighbour index of the last run
+    std::vector<int> order;         //point indices sorted by cell
+    std::vector<Point> sorted;      //points in that order so cell scans stay contiguous
+    std::vector<unsigned char> core; //per point, in sorted order
+    std::vector<Cell> cells;        //sorted by key
+    ThreadPool pool;
+};
+
+#endif // FIXATIONCLUSTERING_H
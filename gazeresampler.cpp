@@ -0,0 +1,344 @@
+//gazeresampler.cpp
+//Implements the fixed rate gaze resampler used to feed fixed rate control loops
+
+#include "gazeresampler.h"
+#include "sampleclassifier.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string.h>
+
+//eye of v[i] in the left x, left y, right x, right y order
+static int eyeOf(int i) {
+    return i < 2 ? LeftEyeTracked : RightEyeTracked;
+}
+
+//Resampler Constructor, ring size is rounded up to a power of two so tick lookup is a mask
+GazeResampler::GazeResampler(int outputRate, Interpolation method, long long maxGap, int history)
+    : rate(outputRate), period(1000000.0 / outputRate), method(method), maxGap(maxGap),
+      published(-1), lastLatencyValue(0), maxLatencyValue(0) {
+    long long capacity = 16;
+    while(capacity < history) {
+        capacity <<= 1;
+    }
+    ring.resize(capacity);
+    mask = capacity - 1;
+    reset();
+}
+
+//Drops all buffered input and output ticks
+void GazeResampler::reset() {
+    std::lock_guard<std::mutex> lock(producerMutex);
+    count = 0;
+    nextTick = -1;
+    for(int i = 0; i < 4; i++) {
+        held[i] = 0;
+    }
+    for(size_t i = 0; i < ring.size(); i++) {
+        ring[i].tick = -1;
+    }
+    published.store(-1, std::memory_order_release);
+    lastLatencyValue.store(0, std::memory_order_relaxed);
+    maxLatencyValue.store(0, std::memory_order_relaxed);
+}
+
+//Adds a tracker sample and produces every tick that can now be interpolated
+void GazeResampler::addSample(const SampleStruct &sample, int eyes) {
+    std::lock_guard<std::mutex> lock(producerMutex);
+    if(count > 0 && sample.timestamp <= window[count - 1].t) {
+        return; //drop duplicated or out of order samples
+    }
+
+    InputPoint point;
+    point.t = sample.timestamp;
+    point.v[0] = sample.leftEye.gazeX;
+    point.v[1] = sample.leftEye.gazeY;
+    point.v[2] = sample.rightEye.gazeX;
+    point.v[3] = sample.rightEye.gazeY;
+    point.eyes = eyes;
+
+    if(count == 4) {
+        for(int i = 0; i < 3; i++) {
+            window[i] = window[i + 1];
+        }
+        count = 3;
+    }
+    window[count++] = point;
+
+    if(nextTick < 0) {
+        nextTick = (long long)std::ceil(point.t / period); //first tick at or after the first sample
+        return;
+    }
+    emitSegment(point.t);
+}
+
+//Closes ticks as gaps when the input has stalled so output latency stays bounded by maxGap
+void GazeResampler::advanceTo(long long trackerTime) {
+    std::lock_guard<std::mutex> lock(producerMutex);
+    if(nextTick < 0 || count == 0) {
+        return;
+    }
+    long long limit = trackerTime - maxGap;
+    const InputPoint &newest = window[count - 1];
+    if(limit <= newest.t) {
+        return;
+    }
+
+    //the next sample is now known to be more than maxGap away, so the pending cubic segment
+    //can be finished with a one sided end tangent exactly as if that sample had arrived
+    if(method == Cubic && count >= 2) {
+        emitHermite(count >= 3 ? &window[count - 3] : 0, window[count - 2], newest, 0, trackerTime);
+    }
+    emitGapUntil(limit, trackerTime);
+}
+
+//Produces the ticks of the newest complete segment
+void GazeResampler::emitSegment(long long arrival) {
+    if(method == Linear) {
+        const InputPoint &a = window[count - 2];
+        const InputPoint &b = window[count - 1];
+        int eyes = usableEyes(a, b);
+        if(eyes == 0) {
+            emitGapUntil(b.t, arrival);
+            return;
+        }
+        double h = double(b.t - a.t);
+        while(tickTime(nextTick) < b.t) {
+            double s = (tickTime(nextTick) - a.t) / h;
+            double v[4];
+            for(int i = 0; i < 4; i++) {
+                v[i] = (eyes & eyeOf(i)) ? a.v[i] + s * (b.v[i] - a.v[i]) : held[i];
+            }
+            publish(nextTick++, v, eyes, arrival);
+        }
+        return;
+    }
+
+    //cubic segments need one sample of lookahead for the end tangent
+    if(count >= 3) {
+        emitHermite(count == 4 ? &window[0] : 0, window[count - 3], window[count - 2], &window[count - 1], arrival);
+    }
+}
+
+//Produces the ticks of segment (a, b) by cubic hermite interpolation of each eye tracked in both, tangents are taken
+//from the neighbouring samples when that eye is usable there and fall back to the segment secant otherwise
+void GazeResampler::emitHermite(const InputPoint *previous, const InputPoint &a, const InputPoint &b, const InputPoint *next, long long arrival) {
+    int eyes = usableEyes(a, b);
+    if(eyes == 0) {
+        emitGapUntil(b.t, arrival);
+        return;
+    }
+    int previousEyes = previous ? usableEyes(*previous, a) : 0;
+    int nextEyes = next ? usableEyes(b, *next) : 0;
+    double h = double(b.t - a.t);
+    double m1[4], m2[4];
+    for(int i = 0; i < 4; i++) {
+        double secant = (b.v[i] - a.v[i]) / h;
+        m1[i] = (previousEyes & eyeOf(i)) ? (b.v[i] - previous->v[i]) / double(b.t - previous->t) : secant;
+        m2[i] = (nextEyes & eyeOf(i)) ? (next->v[i] - a.v[i]) / double(next->t - a.t) : secant;
+    }
+    while(tickTime(nextTick) < b.t) {
+        double s = (tickTime(nextTick) - a.t) / h;
+        double s2 = s * s, s3 = s2 * s;
+        double h00 = 2 * s3 - 3 * s2 + 1;
+        double h10 = s3 - 2 * s2 + s;
+        double h01 = -2 * s3 + 3 * s2;
+        double h11 = s3 - s2;
+        double v[4];
+        for(int i = 0; i < 4; i++) {
+            v[i] = (eyes & eyeOf(i)) ? h00 * a.v[i] + h10 * h * m1[i] + h01 * b.v[i] + h11 * h * m2[i] : held[i];
+        }
+        publish(nextTick++, v, eyes, arrival);
+    }
+}
+
+//Produces invalid ticks holding the last valid gaze up to endTime
+void GazeResampler::emitGapUntil(long long endTime, long long arrival) {
+    while(tickTime(nextTick) < endTime) {
+        publish(nextTick++, held, 0, arrival);
+    }
+}
+
+//Writes a tick into the ring and makes it visible to readers
+void GazeResampler::publish(long long tick, const double *v, int eyes, long long arrival) {
+    ResampledGaze &slot = ring[tick & mask];
+    slot.tick = tick;
+    slot.timestamp = tickTime(tick);
+    slot.leftX = v[0];
+    slot.leftY = v[1];
+    slot.rightX = v[2];
+    slot.rightY = v[3];
+    slot.eyes = eyes;
+    slot.valid = eyes != 0;
+    for(int i = 0; i < 4; i++) {
+        if(eyes & eyeOf(i)) {
+            held[i] = v[i];
+        }
+    }
+    published.store(tick, std::memory_order_release);
+
+    long long latency = arrival - slot.timestamp;
+    lastLatencyValue.store(latency, std::memory_order_relaxed);
+    if(latency > maxLatencyValue.load(std::memory_order_relaxed)) {
+        maxLatencyValue.store(latency, std::memory_order_relaxed);
+    }
+}
+
+//An eye can be interpolated between two samples when it is tracked in both and they are close enough in time
+int GazeResampler::usableEyes(const InputPoint &a, const InputPoint &b) const {
+    return (b.t - a.t) <= maxGap ? a.eyes & b.eyes : 0;
+}
+
+//Copies tick into value, returns false if the tick is not produced yet or already overwritten
+bool GazeResampler::valueAt(long long tick, ResampledGaze &value) const {
+    long long capacity = mask + 1;
+    long long newest = published.load(std::memory_order_acquire);
+    if(tick < 0 || tick > newest || newest - tick >= capacity - 1) {
+        return false;
+    }
+    value = ring[tick & mask];
+    //the producer may have lapped the slot while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    newest = published.load(std::memory_order_relaxed);
+    return value.tick == tick && newest - tick < capacity - 1;
+}
+
+long long GazeResampler::latestTick() const {
+    return published.load(std::memory_order_acquire);
+}
+
+long long GazeResampler::tickAt(long long trackerTime) const {
+    return (long long)std::floor(trackerTime / period);
+}
+
+long long GazeResampler::tickTime(long long tick) const {
+    return (long long)std::llround(tick * period);
+}
+
+long long GazeResampler::lastLatency() const {
+    return lastLatencyValue.load(std::memory_order_relaxed);
+}
+
+long long GazeResampler::maxLatency() const {
+    return maxLatencyValue.load(std::memory_order_relaxed);
+}
+
+//charges every tick published since seen the time of the call that produced it
+static void collectTicks(const GazeResampler &resampler, long long now, long long &seen, std::vector<long long> &latency, long long &invalid) {
+    for(long long newest = resampler.latestTick(); seen < newest; seen++) {
+        ResampledGaze value;
+        if(resampler.valueAt(seen + 1, value) && !value.valid) {
+            invalid++;
+        }
+        latency.push_back(now - resampler.tickTime(seen + 1));
+    }
+}
+
+//feeds input as it would arrive, each sample at its own timestamp, with a consumer tick every millisecond in between
+//when tick is set; latency (optional) receives the latency of every published tick
+static void feedResampler(GazeResampler &resampler, const std::vector<SampleStruct> &input, const std::vector<int> &eyes, bool tick,
+                          std::vector<long long> *latency, long long *invalid) {
+    long long seen = -1;
+    long long consumer = input.empty() ? 0 : input[0].timestamp;
+    for(size_t i = 0; i < input.size(); i++) {
+        long long arrival = input[i].timestamp;
+        for(; tick && consumer < arrival; consumer += 1000) {
+            resampler.advanceTo(consumer);
+            if(latency) {
+                collectTicks(resampler, consumer, seen, *latency, *invalid);
+            }
+        }
+        resampler.addSample(input[i], eyes[i]);
+        if(latency) {
+            collectTicks(resampler, arrival, seen, *latency, *invalid);
+        }
+    }
+}
+
+QStringList GazeResampler::benchmark(long long samples, int stallMs) {
+    typedef std::chrono::steady_clock Clock;
+    //500 Hz, every 1000th sample starts a 60 ms loss of the left eye, every 3000th a 100 ms blink and every 5000th a stall
+    std::vector<SampleStruct> input(samples);
+    std::vector<int> eyes(samples);
+    long long t = 0;
+    for(long long i = 0; i < samples; i++) {
+        SampleStruct &sample = input[i];
+        memset(&sample, 0, sizeof(sample));
+        sample.timestamp = t;
+        bool leftLost = i % 1000 < 30, blink = i % 3000 >= 1500 && i % 3000 < 1550;
+        if(!leftLost && !blink) {
+            sample.leftEye.gazeX = 960 + 300 * std::sin(i * 0.01);
+            sample.leftEye.gazeY = 540 + 200 * std::cos(i * 0.013);
+            sample.leftEye.diam = 3.5;
+        }
+        if(!blink) {
+            sample.rightEye.gazeX = 970 + 300 * std::sin(i * 0.01);
+            sample.rightEye.gazeY = 545 + 200 * std::cos(i * 0.013);
+            sample.rightEye.diam = 3.5;
+        }
+        eyes[i] = trackedEyes(sample);
+        t += i % 5000 == 4999 ? stallMs * 1000LL : 2000;
+    }
+
+    QStringList rows;
+    rows << "interpolation,consumer_tick,ns_per_sample,mean_latency_us,p99_latency_us,max_latency_us,ticks,invalid_ticks";
+    for(int m = 0; m < 2; m++) {
+        for(int tick = 0; tick < 2; tick++) {
+            Interpolation method = m == 0 ? Linear : Cubic;
+            GazeResampler timed(1000, method);
+            Clock::time_point start = Clock::now();
+            feedResampler(timed, input, eyes, tick != 0, 0, 0);
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / std::max(1LL, samples);
+
+            GazeResampler measured(1000, method);
+            std::vector<long long> latency;
+            latency.reserve(t / 1000 + 1);
+            long long invalid = 0;
+            feedResampler(measured, input, eyes, tick != 0, &latency, &invalid);
+            double mean = 0;
+            for(size_t k = 0; k < latency.size(); k++) {
+                mean += latency[k];
+            }
+            mean /= std::max<size_t>(1, latency.size());
+            std::sort(latency.begin(), latency.end());
+            long long p99 = latency.empty() ? 0 : latency[latency.size() * 99 / 100];
+            long long worst = latency.empty() ? 0 : latency.back();
+
+            QStringList row;
+            row << (method == Linear ? "linear" : "cubic") << (tick ? "1" : "0") << QString::number(ns, 'f', 1)
+                << QString::number(mean, 'f', 0) << QString::number(p99) << QString::number(worst)
+                << QString::number((long long)latency.size()) << QString::number(invalid);
+            rows << row.join(",");
+        }
+    }
+    return rows;
+}
+
+//--resample-benchmark [--output file] [--samples n] [--stall ms]
+int GazeResampler::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Gaze resampler cost and tick latency with and without the consumer tick");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("resample-benchmark", "Benchmark the gaze resampler."));
+    parser.addOption(QCommandLineOption("output", "Result table.", "file", "resample_benchmark.csv"));
+    parser.addOption(QCommandLineOption("samples", "Synthetic 500 Hz samples per run.", "n", "1000000"));
+    parser.addOption(QCommandLineOption("stall", "Input stall every 5000 samples.", "ms", "200"));
+    parser.process(arguments);
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    QStringList rows = benchmark(std::max(1000LL, parser.value("samples").toLongLong()), std::max(0, parser.value("stall").toInt()));
+    for(int r = 0; r < rows.size(); r++) {
+        out << rows[r] << '\n';
+        qDebug().noquote() << rows[r];
+    }
+    return 0;
+}
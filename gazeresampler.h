@@ -0,0 +1,90 @@
+#ifndef GAZERESAMPLER_H
+#define GAZERESAMPLER_H
+
+//gazeresampler.h
+//Resamples the irregular myGaze sample stream onto a fixed rate tick grid
+//so that fixed rate consumers (ie. the 1 kHz haptics loop) can pull gaze by tick index
+
+#include <QStringList>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <myGazeAPI.h>
+
+//gaze value of a single output tick
+struct ResampledGaze {
+    long long tick;      //tick index, tick k lies at k * period [microseconds] on the tracker clock
+    long long timestamp; //tracker time of the tick [microseconds]
+    double leftX;        //left eye gaze [pixel]
+    double leftY;
+    double rightX;       //right eye gaze [pixel]
+    double rightY;
+    int eyes;            //TrackedEye bits of the interpolated eyes, an eye that is not holds its last value
+    bool valid;          //false when no eye could be interpolated (lost tracking or missing samples)
+};
+
+class GazeResampler {
+
+public:
+    enum Interpolation { Linear, Cubic };
+
+    //outputRate [Hz], maxGap [microseconds] is the longest sample spacing that is still interpolated,
+    //history is the number of output ticks kept for pulling (rounded up to a power of two)
+    explicit GazeResampler(int outputRate = 1000, Interpolation method = Linear, long long maxGap = 20000, int history = 4096);
+
+    //producer side, serialized on a mutex so the consumer tick may advance while the sample callback adds
+    void reset();
+    void addSample(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+    void advanceTo(long long trackerTime); //closes ticks older than trackerTime - maxGap as gaps while input is stalled
+
+    //consumer side, lock free and constant time, safe to call from any thread
+    bool valueAt(long long tick, ResampledGaze &value) const;
+    long long latestTick() const;  //newest tick available for pulling, -1 if none yet
+    long long tickAt(long long trackerTime) const; //index of the last tick at or before trackerTime
+    long long tickTime(long long tick) const;
+
+    //latency statistics in tracker time between a tick and the moment it became available [microseconds]
+    long long lastLatency() const;
+    long long maxLatency() const;
+
+    int outputRate() const { return rate; }
+    Interpolation interpolation() const { return method; }
+
+    //producer cost and tick latency of a synthetic 500 Hz stream with blinks and stalled input, per interpolation with and
+    //without a 1 kHz consumer tick calling advanceTo, one result row each
+    static QStringList benchmark(long long samples, int stallMs);
+    //entry point of the --resample-benchmark command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    struct InputPoint {
+        long long t;
+        double v[4]; //left x, left y, right x, right y
+        int eyes;    //TrackedEye bits
+    };
+
+    void emitSegment(long long arrival);
+    void emitHermite(const InputPoint *previous, const InputPoint &a, const InputPoint &b, const InputPoint *next, long long arrival);
+    void emitGapUntil(long long endTime, long long arrival);
+    void publish(long long tick, const double *v, int eyes, long long arrival);
+    int usableEyes(const InputPoint &a, const InputPoint &b) const;
+
+    int rate;
+    double period;          //output period [microseconds]
+    Interpolation method;
+    long long maxGap;
+
+    std::mutex producerMutex; //the sample callback and the consumer tick both produce ticks
+    InputPoint window[4];   //newest input point is window[count - 1]
+    int count;
+    long long nextTick;     //next tick to be produced
+    double held[4];         //last produced gaze, held through gaps
+
+    std::vector<ResampledGaze> ring;
+    long long mask;
+    std::atomic<long long> published; //newest tick written to the ring
+    std::atomic<long long> lastLatencyValue;
+    std::atomic<long long> maxLatencyValue;
+};
+
+#endif // GAZERESAMPLER_H
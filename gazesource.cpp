@@ -0,0 +1,259 @@
+//gazesource.cpp
+//Implements the device, synthetic and replay gaze sources
+
+#include "gazesource.h"
+#include "sessionreader.h"
+#include "tracing.h"
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string.h>
+
+//monotonic time used to stamp generated samples [microseconds]
+static long long monotonicMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QString MyGazeSource::name() const {
+    return "myGaze";
+}
+
+bool MyGazeSource::isDevice() const {
+    return true;
+}
+
+int MyGazeSource::sampleRate() const {
+    SystemInfoStruct systemInfoData;
+    return iV_GetSystemInfo(&systemInfoData) == RET_SUCCESS ? systemInfoData.samplerate : 0;
+}
+
+//the server calls back on its own thread, which acts as the ingestion thread of this source
+bool MyGazeSource::start(pDLLSetSample sampleCallback, pDLLSetEvent eventCallback) {
+    return iV_SetSampleCallback(sampleCallback) == RET_SUCCESS && iV_SetEventCallback(eventCallback) == RET_SUCCESS;
+}
+
+void MyGazeSource::stop() {
+    iV_SetSampleCallback(NULL);
+    iV_SetEventCallback(NULL);
+}
+
+//Threaded Source Constructor
+ThreadedSource::ThreadedSource() : sampleCallback(0), eventCallback(0), stopRequested(false), finished(false) {
+}
+
+//Threaded Source Destructor, derived classes call stop() themselves since run() is theirs
+ThreadedSource::~ThreadedSource() {
+    stop();
+}
+
+bool ThreadedSource::start(pDLLSetSample sampleCallback, pDLLSetEvent eventCallback) {
+    if(worker.joinable()) {
+        return false;
+    }
+    this->sampleCallback = sampleCallback;
+    this->eventCallback = eventCallback;
+    stopRequested.store(false);
+    finished.store(false);
+    worker = std::thread(&ThreadedSource::work, this);
+    return true;
+}
+
+void ThreadedSource::work() {
+    TRACE_THREAD("gaze source");
+    run();
+    finished.store(true);
+}
+
+void ThreadedSource::stop() {
+    stopRequested.store(true);
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool ThreadedSource::isFinished() const {
+    return finished.load();
+}
+
+bool ThreadedSource::stopping() const {
+    return stopRequested.load(std::memory_order_relaxed);
+}
+
+//Synthetic Source Constructor
+SyntheticSource::SyntheticSource(int rate, unsigned int seed, int screenWidth, int screenHeight)
+    : rate(rate), seed(seed), screenWidth(screenWidth), screenHeight(screenHeight) {
+}
+
+SyntheticSource::~SyntheticSource() {
+    stop();
+}
+
+QString SyntheticSource::name() const {
+    return QString("synthetic#%1").arg(seed);
+}
+
+int SyntheticSource::sampleRate() const {
+    return rate;
+}
+
+//fixations of 150-600 ms with tremor noise, 30 ms saccades between them and occasional 120 ms blinks
+void SyntheticSource::run() {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 3.0);
+    std::normal_distribution<double> pupilNoise(0.0, 0.02);
+
+    const double period = 1e6 / (rate > 0 ? rate : 500); //timestamps follow the nominal rate even when unpaced
+    const int saccadeSamples = std::max(1, (int)(30000 / period));
+    const int blinkSamples = std::max(1, (int)(120000 / period));
+    long long firstTimestamp = monotonicMicroseconds();
+    long long produced = 0;
+
+    double fromX = screenWidth / 2.0, fromY = screenHeight / 2.0;
+    double centerX = fromX, centerY = fromY;
+    int fixationLeft = (int)((150000 + uniform(random) * 450000) / period);
+    int saccadeLeft = 0;
+    int blinkLeft = 0;
+    long long fixationStart = firstTimestamp;
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    while(!stopping()) {
+        //paced sources emit everything due and then sleep, unpaced ones emit in batches
+        long long due = produced + 1024;
+        if(rate > 0) {
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            due = (long long)(elapsed * rate);
+            if(due <= produced) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+        }
+
+        for(; produced < due; produced++) {
+            long long timestamp = firstTimestamp + (long long)(produced * period);
+            double x = centerX, y = centerY;
+            if(saccadeLeft > 0) {
+                double progress = 1.0 - (double)saccadeLeft / saccadeSamples;
+                x = fromX + (centerX - fromX) * progress;
+                y = fromY + (centerY - fromY) * progress;
+                if(--saccadeLeft == 0) {
+                    fixationStart = timestamp;
+                }
+            }
+            else if(--fixationLeft <= 0) {
+                EventStruct event;
+                memset(&event, 0, sizeof(event));
+                event.eventType = 'F';
+                event.eye = 'l';
+                event.startTime = fixationStart;
+                event.endTime = timestamp;
+                event.duration = timestamp - fixationStart;
+                event.positionX = centerX;
+                event.positionY = centerY;
+                eventCallback(event);
+
+                fromX = centerX;
+                fromY = centerY;
+                centerX = uniform(random) * screenWidth;
+                centerY = uniform(random) * screenHeight;
+                fixationLeft = (int)((150000 + uniform(random) * 450000) / period);
+                saccadeLeft = saccadeSamples;
+                if(uniform(random) < 0.05) {
+                    blinkLeft = blinkSamples;
+                }
+            }
+
+            SampleStruct sample;
+            memset(&sample, 0, sizeof(sample));
+            sample.timestamp = timestamp;
+            if(blinkLeft > 0) {
+                blinkLeft--; //lost samples report all gaze values as zero
+            }
+            else {
+                sample.leftEye.gazeX = x + noise(random);
+                sample.leftEye.gazeY = y + noise(random);
+                sample.rightEye.gazeX = x + noise(random);
+                sample.rightEye.gazeY = y + noise(random);
+                sample.leftEye.diam = 3.5 + pupilNoise(random);
+                sample.rightEye.diam = 3.5 + pupilNoise(random);
+                sample.leftEye.eyePositionX = -32.0;
+                sample.rightEye.eyePositionX = 32.0;
+                sample.leftEye.eyePositionZ = 600.0;
+                sample.rightEye.eyePositionZ = 600.0;
+            }
+            sampleCallback(sample);
+        }
+    }
+}
+
+//Replay Source Constructor
+ReplaySource::ReplaySource(const QString &path, double speed) : path(path), speed(speed), recordedRate(0) {
+    SessionReader reader;
+    if(reader.open(path)) {
+        recordedRate = (int)reader.header().sampleRate;
+    }
+}
+
+ReplaySource::~ReplaySource() {
+    stop();
+}
+
+QString ReplaySource::name() const {
+    return "replay:" + path;
+}
+
+int ReplaySource::sampleRate() const {
+    return recordedRate;
+}
+
+//events are delivered once the sample stream has passed their end time, as the server does
+void ReplaySource::run() {
+    SessionReader reader;
+    if(!reader.open(path)) {
+        qWarning() << "Replay session could not be opened:" << path;
+        return;
+    }
+    const std::vector<SampleBlock> &samples = reader.sampleBlocks();
+    const std::vector<EventBlock> &events = reader.eventBlocks();
+    size_t eventBlock = 0;
+    int eventIndex = 0;
+
+    bool first = true;
+    long long firstTimestamp = 0;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    for(size_t b = 0; b < samples.size() && !stopping(); b++) {
+        for(int i = 0; i < samples[b].count && !stopping(); i++) {
+            const SampleStruct &sample = samples[b].records[i];
+            if(first) {
+                firstTimestamp = sample.timestamp;
+                first = false;
+            }
+            if(speed > 0) {
+                std::chrono::steady_clock::time_point due = started
+                    + std::chrono::microseconds((long long)((sample.timestamp - firstTimestamp) / speed));
+                if(due > std::chrono::steady_clock::now()) {
+                    std::this_thread::sleep_until(due);
+                }
+            }
+            for(; eventBlock < events.size(); eventIndex = 0, eventBlock++) {
+                for(; eventIndex < events[eventBlock].count; eventIndex++) {
+                    const EventStruct &event = events[eventBlock].records[eventIndex];
+                    //blinks and pursuits were derived by the recorder and are detected again live, so they are dropped
+                    //before the time gate and a long one cannot hold back the fixations and markers after it
+                    if(event.eventType != 'F' && event.eventType != 'M') {
+                        continue;
+                    }
+                    if(event.endTime > sample.timestamp) {
+                        break;
+                    }
+                    eventCallback(event);
+                }
+                if(eventIndex < events[eventBlock].count) {
+                    break;
+                }
+            }
+            sampleCallback(sample);
+        }
+    }
+}
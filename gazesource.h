@@ -0,0 +1,103 @@
+#ifndef GAZESOURCE_H
+#define GAZESOURCE_H
+
+//gazesource.h
+//Producers of sample and event streams. Every source delivers through the same plain function pointer
+//interface the myGaze API uses (pDLLSetSample / pDLLSetEvent), so sessions do not care where data comes from.
+
+#include <QString>
+#include <atomic>
+#include <thread>
+#include <myGazeAPI.h>
+
+class GazeSource {
+
+public:
+    virtual ~GazeSource() {}
+    virtual QString name() const = 0;
+    virtual bool isDevice() const { return false; } //true only for the physical tracker
+    virtual int sampleRate() const = 0;             //nominal rate [Hz], 0 if unknown or unpaced
+    virtual bool isFinished() const { return false; } //true once a finite source delivered all its data
+
+    //callbacks are invoked on the source's own ingestion thread until stop() returns
+    virtual bool start(pDLLSetSample sampleCallback, pDLLSetEvent eventCallback) = 0;
+    virtual void stop() = 0;
+};
+
+//the myGaze eyetracking-server, the API supports a single connection per process
+class MyGazeSource : public GazeSource {
+
+public:
+    QString name() const;
+    bool isDevice() const;
+    int sampleRate() const;
+    bool start(pDLLSetSample sampleCallback, pDLLSetEvent eventCallback);
+    void stop();
+};
+
+//base for sources that generate data on a thread of their own
+class ThreadedSource : public GazeSource {
+
+public:
+    ThreadedSource();
+    ~ThreadedSource();
+    bool isFinished() const;
+    bool start(pDLLSetSample sampleCallback, pDLLSetEvent eventCallback);
+    void stop();
+
+protected:
+    virtual void run() = 0; //returns when the data ends or stopping() becomes true
+    bool stopping() const;
+
+    pDLLSetSample sampleCallback;
+    pDLLSetEvent eventCallback;
+
+private:
+    void work();
+
+    std::thread worker;
+    std::atomic<bool> stopRequested;
+    std::atomic<bool> finished;
+};
+
+//simulated tracker producing fixations, saccades and noise at a fixed rate
+class SyntheticSource : public ThreadedSource {
+
+public:
+    //rate [Hz], 0 produces samples as fast as the consumer takes them
+    explicit SyntheticSource(int rate = 500, unsigned int seed = 1, int screenWidth = 1920, int screenHeight = 1080);
+    ~SyntheticSource();
+    QString name() const;
+    int sampleRate() const;
+
+protected:
+    void run();
+
+private:
+    int rate;
+    unsigned int seed;
+    int screenWidth;
+    int screenHeight;
+};
+
+//replays a recorded session file with its original timing scaled by speed; only the fixation events the server
+//reported are replayed, the events the recorder derived itself are derived again
+class ReplaySource : public ThreadedSource {
+
+public:
+    //speed 1 replays in real time, 0 replays as fast as possible
+    explicit ReplaySource(const QString &path, double speed = 1.0);
+    ~ReplaySource();
+    QString name() const;
+    int sampleRate() const;
+
+protected:
+    void run();
+
+private:
+    QString path;
+    double speed;
+    int recordedRate;
+};
+
+#endif // GAZESOURCE_H
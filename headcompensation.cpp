@@ -0,0 +1,442 @@
+//headcompensation.cpp
+//Implements the head movement compensation, its recursive least squares fit and the offline evaluation with
+//injected head motion
+
+#include "headcompensation.h"
+#include "sampleclassifier.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "threadpool.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string.h>
+
+static const double positionScale = 0.01; //eye shifts enter the model in 100 mm, gaze in 1000 pixel, so all features are
+static const double gazeScale = 0.001;    //of similar size and the initial covariance suits every weight
+static const double pi = 3.14159265358979323846;
+
+//Head Compensation Constructor
+HeadCompensation::HeadCompensation(const HeadCompensationSettings &settings) : settings(settings), referenceSet(false),
+    referenceX(0), referenceY(0), referenceZ(0), captureLeft(0), captured(0), seenGeneration(0), targetShown(false),
+    requestGeneration(0), requestReference(false), requestCapture(false), requestReset(true), requestTarget(false),
+    requestedTargetX(0), requestedTargetY(0), publishedReference(false), publishedUpdates(0), publishedX(0), publishedY(0),
+    publishedShift(0) {
+    requestGeneration.store(1); //the first sample applies the reset, which initialises the model
+}
+
+void HeadCompensation::setReference(double x, double y, double z) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestReference = true;
+    requestCapture = false;
+    requestedX = x;
+    requestedY = y;
+    requestedZ = z;
+    publishedReference.store(true);
+    requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void HeadCompensation::captureReference() {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestCapture = true;
+    requestReference = false;
+    requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void HeadCompensation::resetModel() {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestReset = true;
+    requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void HeadCompensation::setTarget(double x, double y) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestTarget = true;
+    requestedTargetX = x;
+    requestedTargetY = y;
+    requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void HeadCompensation::clearTarget() {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestTarget = false;
+    requestGeneration.fetch_add(1, std::memory_order_release);
+}
+
+//a target that is set again, even at the same place, ends the previous one
+void HeadCompensation::applyRequests(long long timestamp) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    seenGeneration = requestGeneration.load(std::memory_order_relaxed);
+    if(targetShown || requestTarget) {
+        finishTarget();
+        targetShown = requestTarget;
+        shownX = requestedTargetX;
+        shownY = requestedTargetY;
+        targetStart = timestamp;
+        targetSamples = 0;
+        memset(targetFeatures, 0, sizeof(targetFeatures));
+        targetErrorX = targetErrorY = 0;
+    }
+    if(requestReset) {
+        requestReset = false;
+        memset(weightsX, 0, sizeof(weightsX));
+        memset(weightsY, 0, sizeof(weightsY));
+        memset(covariance, 0, sizeof(covariance));
+        for(int i = 0; i < Features; i++) {
+            covariance[i][i] = settings.prior;
+        }
+        publishedUpdates.store(0, std::memory_order_relaxed);
+    }
+    if(requestReference) {
+        requestReference = false;
+        referenceSet = true;
+        referenceX = requestedX;
+        referenceY = requestedY;
+        referenceZ = requestedZ;
+        captureLeft = 0;
+    }
+    if(requestCapture) {
+        requestCapture = false;
+        captureLeft = settings.referenceSamples > 0 ? settings.referenceSamples : 1;
+        captureX = captureY = captureZ = 0;
+        captured = 0;
+    }
+}
+
+bool HeadCompensation::eyePosition(const SampleStruct &sample, double &x, double &y, double &z) {
+    bool left = sample.leftEye.eyePositionZ > 0;
+    bool right = sample.rightEye.eyePositionZ > 0;
+    if(left && right) {
+        x = (sample.leftEye.eyePositionX + sample.rightEye.eyePositionX) * 0.5;
+        y = (sample.leftEye.eyePositionY + sample.rightEye.eyePositionY) * 0.5;
+        z = (sample.leftEye.eyePositionZ + sample.rightEye.eyePositionZ) * 0.5;
+        return true;
+    }
+    const EyeDataStruct &eye = left ? sample.leftEye : sample.rightEye;
+    x = eye.eyePositionX;
+    y = eye.eyePositionY;
+    z = eye.eyePositionZ;
+    return left || right;
+}
+
+//the correction is the same for both eyes, samples without a tracked eye or an eye position pass unchanged
+void HeadCompensation::correct(SampleStruct &sample, int eyes) {
+    if(requestGeneration.load(std::memory_order_acquire) != seenGeneration) {
+        applyRequests(sample.timestamp);
+    }
+    double gazeX, gazeY, eyeX, eyeY, eyeZ;
+    if(!trackedGaze(sample, eyes, gazeX, gazeY) || !eyePosition(sample, eyeX, eyeY, eyeZ)) {
+        return;
+    }
+    if(captureLeft > 0) {
+        captureX += eyeX;
+        captureY += eyeY;
+        captureZ += eyeZ;
+        captured++;
+        if(--captureLeft == 0) {
+            referenceSet = true;
+            referenceX = captureX / captured;
+            referenceY = captureY / captured;
+            referenceZ = captureZ / captured;
+            publishedReference.store(true, std::memory_order_relaxed);
+        }
+    }
+    if(!referenceSet) {
+        return;
+    }
+
+    double shiftX = eyeX - referenceX, shiftY = eyeY - referenceY, shiftZ = eyeZ - referenceZ;
+    double depth = shiftZ * positionScale;
+    double features[Features] = { 1.0, shiftX * positionScale, shiftY * positionScale, depth, depth * gazeX * gazeScale, depth * gazeY * gazeScale };
+    double errorX = 0, errorY = 0;
+    for(int i = 0; i < Features; i++) {
+        errorX += weightsX[i] * features[i];
+        errorY += weightsY[i] * features[i];
+    }
+
+    //the fit works on the uncorrected gaze, as that is what the model predicts
+    if(targetShown && sample.timestamp - targetStart >= settings.settle) {
+        targetSamples++;
+        double weight = 1.0 / targetSamples;
+        for(int i = 0; i < Features; i++) {
+            targetFeatures[i] += (features[i] - targetFeatures[i]) * weight;
+        }
+        targetErrorX += (gazeX - shownX - targetErrorX) * weight;
+        targetErrorY += (gazeY - shownY - targetErrorY) * weight;
+    }
+
+    if(eyes & LeftEyeTracked) {
+        sample.leftEye.gazeX -= errorX;
+        sample.leftEye.gazeY -= errorY;
+    }
+    if(eyes & RightEyeTracked) {
+        sample.rightEye.gazeX -= errorX;
+        sample.rightEye.gazeY -= errorY;
+    }
+    publishedX.store(errorX, std::memory_order_relaxed);
+    publishedY.store(errorY, std::memory_order_relaxed);
+    publishedShift.store(std::sqrt(shiftX * shiftX + shiftY * shiftY + shiftZ * shiftZ), std::memory_order_relaxed);
+}
+
+void HeadCompensation::finishTarget() {
+    if(targetShown && targetSamples > 0) {
+        update(targetFeatures, targetErrorX, targetErrorY);
+    }
+    targetSamples = 0;
+}
+
+//recursive least squares step, both axes share the features and so the covariance; the covariance is only inflated
+//by the forgetting factor while it is small, which keeps directions the points do not excite from winding up
+void HeadCompensation::update(const double *features, double errorX, double errorY) {
+    double spread[Features];
+    double denominator = settings.forgetting;
+    for(int i = 0; i < Features; i++) {
+        spread[i] = 0;
+        for(int j = 0; j < Features; j++) {
+            spread[i] += covariance[i][j] * features[j];
+        }
+        denominator += features[i] * spread[i];
+    }
+    double predictedX = 0, predictedY = 0;
+    for(int i = 0; i < Features; i++) {
+        predictedX += weightsX[i] * features[i];
+        predictedY += weightsY[i] * features[i];
+    }
+    double trace = 0;
+    for(int i = 0; i < Features; i++) {
+        double gain = spread[i] / denominator;
+        weightsX[i] += gain * (errorX - predictedX);
+        weightsY[i] += gain * (errorY - predictedY);
+        for(int j = 0; j < Features; j++) {
+            covariance[i][j] -= gain * spread[j];
+        }
+        trace += covariance[i][i];
+    }
+    if(trace < settings.prior * Features) {
+        for(int i = 0; i < Features; i++) {
+            for(int j = 0; j < Features; j++) {
+                covariance[i][j] /= settings.forgetting;
+            }
+        }
+    }
+    publishedUpdates.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool HeadCompensation::hasReference() const {
+    return publishedReference.load(std::memory_order_relaxed);
+}
+
+long long HeadCompensation::updates() const {
+    return publishedUpdates.load(std::memory_order_relaxed);
+}
+
+double HeadCompensation::correctionX() const {
+    return publishedX.load(std::memory_order_relaxed);
+}
+
+double HeadCompensation::correctionY() const {
+    return publishedY.load(std::memory_order_relaxed);
+}
+
+double HeadCompensation::headShift() const {
+    return publishedShift.load(std::memory_order_relaxed);
+}
+
+static bool byStart(const EventStruct &a, const EventStruct &b) {
+    return a.startTime < b.startTime;
+}
+
+//the recorded gaze is the ground truth; the reference is taken from the first samples, where the injected motion is 0
+HeadMotionResult HeadCompensation::evaluate(const SessionReader &session, const HeadMotionInjection &injection,
+                                            const HeadCompensationSettings &settings) {
+    HeadMotionResult result = { 0, 0, 0, 0, 0 };
+    std::vector<EventStruct> fixations;
+    session.forEachEvent([&](const EventStruct &event) {
+        if(event.eventType == 'F' && event.duration >= settings.settle + 100000) {
+            fixations.push_back(event);
+        }
+    });
+    std::sort(fixations.begin(), fixations.end(), byStart);
+
+    HeadCompensation compensation(settings);
+    compensation.captureReference();
+    std::vector<SampleStruct> disturbed;
+    std::vector<unsigned char> eyes;
+    size_t fixation = 0;
+    bool targetShown = false;
+    long long nextValidation = 0;
+    long long first = 0;
+    double squaredInjected = 0, squaredCompensated = 0;
+    double nanoseconds = 0;
+    long long corrected = 0;
+
+    const std::vector<SampleBlock> &blocks = session.sampleBlocks();
+    for(size_t b = 0; b < blocks.size(); b++) {
+        const SampleStruct *samples = blocks[b].records;
+        int count = blocks[b].count;
+        if(b == 0 && count > 0) {
+            first = samples[0].timestamp;
+            nextValidation = first + injection.validateEvery;
+        }
+        disturbed.assign(samples, samples + count);
+        eyes.resize(count);
+        trackedEyes(samples, count, eyes.data());
+        for(int i = 0; i < count; i++) {
+            SampleStruct &sample = disturbed[i];
+            double phase = 2 * pi * (sample.timestamp - first) / injection.period;
+            double shiftX = injection.amplitude * std::sin(phase);
+            double shiftY = 0.5 * injection.amplitude * std::sin(phase / 1.3);
+            double shiftZ = 1.5 * injection.amplitude * std::sin(phase / 1.7);
+            EyeDataStruct *eye[2] = { &sample.leftEye, &sample.rightEye };
+            for(int e = 0; e < 2; e++) {
+                if(eye[e]->eyePositionZ > 0) {
+                    eye[e]->eyePositionX += shiftX;
+                    eye[e]->eyePositionY += shiftY;
+                    eye[e]->eyePositionZ += shiftZ;
+                }
+                if(eyes[i] & (1 << e)) {
+                    eye[e]->gazeX += injection.lateral * shiftX + (eye[e]->gazeX - injection.screenWidth / 2.0) * injection.depth * shiftZ;
+                    eye[e]->gazeY += injection.lateral * shiftY + (eye[e]->gazeY - injection.screenHeight / 2.0) * injection.depth * shiftZ;
+                }
+            }
+        }
+
+        std::vector<SampleStruct> before(disturbed);
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        for(int i = 0; i < count; i++) {
+            long long timestamp = disturbed[i].timestamp;
+            if(targetShown && timestamp >= fixations[fixation].endTime) {
+                compensation.clearTarget();
+                targetShown = false;
+                nextValidation = fixations[fixation].endTime + injection.validateEvery;
+                fixation++;
+            }
+            while(!targetShown && fixation < fixations.size() && fixations[fixation].startTime < nextValidation) {
+                fixation++;
+            }
+            if(!targetShown && fixation < fixations.size() && timestamp >= fixations[fixation].startTime) {
+                compensation.setTarget(fixations[fixation].positionX, fixations[fixation].positionY);
+                targetShown = true;
+            }
+            compensation.correct(disturbed[i], eyes[i]);
+        }
+        nanoseconds += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+        corrected += count;
+
+        for(int i = 0; i < count; i++) {
+            double truthX, truthY, injectedX, injectedY, compensatedX, compensatedY;
+            if(!compensation.referenceSet || !trackedGaze(samples[i], eyes[i], truthX, truthY)) {
+                continue;
+            }
+            trackedGaze(before[i], eyes[i], injectedX, injectedY);
+            trackedGaze(disturbed[i], eyes[i], compensatedX, compensatedY);
+            squaredInjected += (injectedX - truthX) * (injectedX - truthX) + (injectedY - truthY) * (injectedY - truthY);
+            squaredCompensated += (compensatedX - truthX) * (compensatedX - truthX) + (compensatedY - truthY) * (compensatedY - truthY);
+            result.samples++;
+        }
+    }
+    if(targetShown) {
+        compensation.clearTarget();
+        compensation.applyRequests(0);
+    }
+    result.validationPoints = (int)compensation.updates();
+    result.rmsInjected = result.samples ? std::sqrt(squaredInjected / result.samples) : 0;
+    result.rmsCompensated = result.samples ? std::sqrt(squaredCompensated / result.samples) : 0;
+    result.nsPerSample = corrected ? nanoseconds / corrected : 0;
+    return result;
+}
+
+QStringList HeadCompensation::columns() {
+    return QStringList() << "session" << "participant" << "samples" << "validation_points" << "rms_injected" << "rms_compensated" << "ns_per_sample";
+}
+
+//--headmotion <directory|session> [--output file] [--amplitude mm] [--period s] [--lateral px/mm] [--depth 1/mm]
+//             [--screen WxH] [--validate-every s] [--forgetting f] [--threads n]
+int HeadCompensation::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Head movement compensation replayed with injected head motion");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("headmotion", "Session file or directory scanned recursively for .mgs sessions.", "path"));
+    parser.addOption(QCommandLineOption("output", "Result table, one row per session.", "file", "headmotion.csv"));
+    parser.addOption(QCommandLineOption("amplitude", "Sideways head motion amplitude.", "mm", "20"));
+    parser.addOption(QCommandLineOption("period", "Period of the sideways head motion.", "s", "30"));
+    parser.addOption(QCommandLineOption("lateral", "Injected gaze error per mm of sideways and vertical shift.", "px/mm", "2"));
+    parser.addOption(QCommandLineOption("depth", "Injected gaze scaling per mm of depth shift.", "1/mm", "0.002"));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("validate-every", "Time between validation targets, taken from the recorded fixations.", "s", "10"));
+    parser.addOption(QCommandLineOption("forgetting", "RLS forgetting factor per validation point.", "factor", "0.95"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    HeadMotionInjection injection;
+    QStringList screen = parser.value("screen").split('x');
+    if(screen.size() != 2 || screen[0].toInt() <= 0 || screen[1].toInt() <= 0 || parser.value("period").toDouble() <= 0) {
+        qWarning() << "Screen size must be given as WIDTHxHEIGHT and the period must be positive";
+        return 1;
+    }
+    injection.screenWidth = screen[0].toInt();
+    injection.screenHeight = screen[1].toInt();
+    injection.amplitude = parser.value("amplitude").toDouble();
+    injection.period = (long long)(parser.value("period").toDouble() * 1e6);
+    injection.lateral = parser.value("lateral").toDouble();
+    injection.depth = parser.value("depth").toDouble();
+    injection.validateEvery = (long long)(parser.value("validate-every").toDouble() * 1e6);
+    HeadCompensationSettings settings;
+    settings.forgetting = parser.value("forgetting").toDouble();
+    if(settings.forgetting <= 0 || settings.forgetting > 1) {
+        qWarning() << "--forgetting must be in (0, 1]";
+        return 1;
+    }
+
+    QString input = parser.value("headmotion");
+    QStringList sessions = QFileInfo(input).isDir() ? BatchAnalyzer::findSessions(input) : QStringList(input);
+
+    QElapsedTimer timer;
+    timer.start();
+    ThreadPool pool(parser.value("threads").toInt());
+    std::vector<QString> rows(sessions.size());
+    std::vector<HeadMotionResult> results(sessions.size());
+    for(int s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            SessionReader session;
+            if(!session.open(sessions[s])) {
+                qWarning() << "Session could not be opened:" << sessions[s];
+                return;
+            }
+            results[s] = evaluate(session, injection, settings);
+            QStringList row;
+            row << sessions[s] << session.participant() << QString::number(results[s].samples) << QString::number(results[s].validationPoints)
+                << QString::number(results[s].rmsInjected) << QString::number(results[s].rmsCompensated) << QString::number(results[s].nsPerSample);
+            rows[s] = row.join(',');
+        });
+    }
+    pool.waitForIdle();
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    out << columns().join(',') << '\n';
+    long long samples = 0;
+    double squaredInjected = 0, squaredCompensated = 0;
+    for(size_t s = 0; s < rows.size(); s++) {
+        if(rows[s].isEmpty()) {
+            continue;
+        }
+        out << rows[s] << '\n';
+        samples += results[s].samples;
+        squaredInjected += results[s].rmsInjected * results[s].rmsInjected * results[s].samples;
+        squaredCompensated += results[s].rmsCompensated * results[s].rmsCompensated * results[s].samples;
+    }
+    qDebug() << "Replayed" << samples << "samples of" << sessions.size() << "sessions in" << timer.elapsed() / 1000.0 << "s, RMS error"
+             << (samples ? std::sqrt(squaredInjected / samples) : 0) << "px injected," << (samples ? std::sqrt(squaredCompensated / samples) : 0) << "px compensated";
+    return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef HEADCOMPENSATION_H
+#define HEADCOMPENSATION_H
+
+//headcompensation.h
+//Head movement compensation: the gaze error that builds up when the head moves away from where it was during
+//calibration is modelled as a linear function of the eye position shift and subtracted from every sample. The
+//model is fitted by recursive least squares, one update per validation target, so it follows the participant
+//between calibrations. HeadMotionInjection replays recordings with simulated head motion to measure it offline.
+
+#include <QStringList>
+#include <atomic>
+#include <mutex>
+#include <myGazeAPI.h>
+
+class SessionReader;
+
+struct HeadCompensationSettings {
+    HeadCompensationSettings() : forgetting(0.95), prior(100.0), referenceSamples(50), settle(300000) {}
+    double forgetting;    //weight older validation points keep per new point (RLS forgetting factor, 1 keeps all)
+    double prior;         //initial covariance of the model weights, larger trusts the first points more
+    int referenceSamples; //tracked samples averaged into the reference eye position
+    long long settle;     //time after a target appears that is not used for the fit [microseconds]
+};
+
+//simulated head motion added to a recording: the eye positions drift sinusoidally on all axes and the gaze picks up
+//an error of lateral px per mm of sideways / vertical shift plus a scaling about the screen centre with the depth shift
+struct HeadMotionInjection {
+    HeadMotionInjection() : amplitude(20), period(30000000), lateral(2.0), depth(0.002), screenWidth(1920), screenHeight(1080),
+        validateEvery(10000000) {}
+    double amplitude;        //sideways amplitude, vertical is half and depth 1.5 times that [mm]
+    long long period;        //of the sideways motion, the other axes are slower [microseconds]
+    double lateral;          //gaze error per mm of sideways and vertical shift [pixel]
+    double depth;            //relative gaze scaling per mm of depth shift
+    int screenWidth;         //[pixel]
+    int screenHeight;
+    long long validateEvery; //the first recorded fixation after this time is used as a validation target [microseconds]
+};
+
+struct HeadMotionResult {
+    long long samples;       //tracked samples compared
+    int validationPoints;
+    double rmsInjected;      //distance of the disturbed gaze from the recorded gaze [pixel]
+    double rmsCompensated;   //distance of the compensated gaze from the recorded gaze [pixel]
+    double nsPerSample;      //time spent in HeadCompensation::correct
+};
+
+class HeadCompensation {
+
+public:
+    enum { Features = 6 }; //bias, eye shift x, y, z, depth shift times gaze x and y
+
+    explicit HeadCompensation(const HeadCompensationSettings &settings = HeadCompensationSettings());
+
+    //calibration and validation, safe to call from any thread, taken over by the next sample
+    void setReference(double x, double y, double z); //cyclopean eye position at calibration time [mm]
+    void captureReference(); //averages the next tracked samples into the reference
+    void resetModel();       //forgets the fitted correction, after a new calibration
+    void setTarget(double x, double y); //validation target shown at [pixel]
+    void clearTarget();                 //the settled samples of the target update the model
+
+    //producer side, must be called from a single thread (the sample callback)
+    void correct(SampleStruct &sample, int eyes); //in place, eyes as returned by trackedEyes(sample)
+
+    //lock free and safe to read from any thread
+    bool hasReference() const;
+    long long updates() const;  //validation points fitted since the last reset
+    double correctionX() const; //correction subtracted from the last tracked sample [pixel]
+    double correctionY() const;
+    double headShift() const;   //distance of the eyes from the reference [mm]
+
+    //cyclopean eye position of the eyes with a position, false if there is none
+    static bool eyePosition(const SampleStruct &sample, double &x, double &y, double &z);
+    //replays a recording with injected head motion, compensated with fixations as validation targets
+    static HeadMotionResult evaluate(const SessionReader &session, const HeadMotionInjection &injection,
+                                     const HeadCompensationSettings &settings = HeadCompensationSettings());
+    static QStringList columns();
+
+    //entry point of the --headmotion command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    void applyRequests(long long timestamp);
+    void finishTarget();
+    void update(const double *features, double errorX, double errorY);
+
+    HeadCompensationSettings settings;
+
+    //model, owned by the producer: predicted gaze error = weights . features
+    double weightsX[Features];
+    double weightsY[Features];
+    double covariance[Features][Features];
+    bool referenceSet;
+    double referenceX, referenceY, referenceZ;
+    int captureLeft; //samples still to average into the reference
+    double captureX, captureY, captureZ;
+    int captured;
+
+    //current validation target, cumulative feature and error means over its settled samples
+    unsigned int seenGeneration;
+    bool targetShown;
+    double shownX, shownY;
+    long long targetStart;
+    long long targetSamples;
+    double targetFeatures[Features];
+    double targetErrorX, targetErrorY;
+
+    //requests of other threads, applied by the producer
+    std::atomic<unsigned int> requestGeneration;
+    std::mutex requestMutex;
+    bool requestReference;
+    double requestedX, requestedY, requestedZ;
+    bool requestCapture;
+    bool requestReset;
+    bool requestTarget;
+    double requestedTargetX, requestedTargetY;
+
+    std::atomic<bool> publishedReference;
+    std::atomic<long long> publishedUpdates;
+    std::atomic<double> publishedX;
+    std::atomic<double> publishedY;
+    std::atomic<double> publishedShift;
+};
+
+#endif // HEADCOMPENSATION_H
@@ -0,0 +1,378 @@
+//headlesscapture.cpp
+//Implements the headless capture mode driven only by command line options and process signals
+
+#include "headlesscapture.h"
+#include "calibrationcache.h"
+#include "trackersession.h"
+#include "gazesource.h"
+#include "callbackregistry.h"
+#include "metricsserver.h"
+#include "tracing.h"
+#include "screengeometry.h"
+#include "csvutil.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <signal.h>
+#include <string.h>
+#include <thread>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+std::atomic<bool> HeadlessCapture::stopRequested(false);
+static const int memoryReportSeconds = 60; //unattended captures log their buffers and resident set this often
+
+static std::mutex commandMutex;
+static std::deque<QString> pendingCommands;
+
+//reads commands until standard input closes; detached, a blocking read cannot be interrupted
+static void readCommands() {
+    char line[256];
+    while(fgets(line, sizeof(line), stdin)) {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        pendingCommands.push_back(QString::fromUtf8(line).trimmed());
+    }
+}
+
+static void logMemory() {
+    QStringList lines = MemoryBudget::global().report();
+    for(int i = 0; i < lines.size(); i++) {
+        qDebug().noquote() << lines[i];
+    }
+}
+
+//Headless Capture Constructor
+HeadlessCapture::HeadlessCapture(const Options &options) : options(options), pipe(0) {
+}
+
+//Headless Capture Destructor
+HeadlessCapture::~HeadlessCapture() {
+}
+
+void HeadlessCapture::requestStop() {
+    stopRequested.store(true);
+}
+
+void HeadlessCapture::handleSignal(int) {
+    requestStop();
+}
+
+//Loads the cached calibration or calibrates when asked to, returns the calibration status
+int HeadlessCapture::prepareCalibration(TrackerSession &session) {
+    if(!options.useCalibration) {
+        qDebug() << "No calibration loaded, streaming with the current server calibration";
+        return RET_SUCCESS;
+    }
+    CalibrationCache cache;
+    int status = session.calibrateWithCache(cache, options.participant, options.calibrate);
+    if(status == ERR_CALIBRATION_NOT_AVAILABLE && !options.calibrate) {
+        qDebug() << "No cached calibration, streaming with the current server calibration";
+        return RET_SUCCESS;
+    }
+    if(status != RET_SUCCESS) {
+        qWarning() << "Calibration could not be finished:" << status;
+    }
+    return status;
+}
+
+//output file of device index out of count, numbered as name_01.mgs, name_02.mgs, ... for several devices
+QString HeadlessCapture::outputPath(int index, int count) const {
+    if(options.output.isEmpty() || count == 1) {
+        return options.output;
+    }
+    QFileInfo info(options.output);
+    QString numbered = QString("%1_%2").arg(info.completeBaseName()).arg(index + 1, 2, 10, QChar('0'));
+    if(!info.suffix().isEmpty()) {
+        numbered += "." + info.suffix();
+    }
+    return info.dir().filePath(numbered);
+}
+
+double HeadlessCapture::capture(std::vector<std::unique_ptr<TrackerSession> > &sessions) {
+    int count = (int)sessions.size();
+    for(int i = 0; i < count; i++) {
+        sessions[i]->setRecordingSyncInterval(options.syncInterval);
+        sessions[i]->setRecordingBuffer(options.recordingBuffer, options.overflow);
+        if(!sessions[i]->startStreaming(outputPath(i, count), options.participant)) {
+            qWarning() << "Streaming could not be started for" << sessions[i]->name();
+        }
+    }
+
+    static bool readingCommands = false;
+    if(options.commands && !readingCommands) {
+        readingCommands = true;
+        std::thread(readCommands).detach();
+    }
+
+    //no event loop, the main thread only applies commands and waits for a stop condition
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point reported = start;
+    while(!stopRequested.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        applyCommands(sessions);
+        for(int i = 0; i < count; i++) {
+            sessions[i]->advanceResampledGaze(); //closes ticks of stalled input for consumers of the resampled stream
+        }
+        if(std::chrono::steady_clock::now() - reported >= std::chrono::seconds(memoryReportSeconds)) {
+            reported = std::chrono::steady_clock::now();
+            logMemory();
+        }
+        if(options.duration > 0 && std::chrono::steady_clock::now() - start >= std::chrono::seconds(options.duration)) {
+            break;
+        }
+        bool finished = true;
+        for(int i = 0; i < count && finished; i++) {
+            finished = sessions[i]->source()->isFinished();
+        }
+        if(finished) {
+            break;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for(int i = 0; i < count; i++) {
+        sessions[i]->stopStreaming();
+    }
+    if(pipe) {
+        fflush(pipe);
+    }
+    return elapsed;
+}
+
+//target x y: validation target shown at screen pixel (x, y) to every session, clear-target: the target disappeared,
+//marker code: experiment event marker at the current time
+void HeadlessCapture::applyCommands(std::vector<std::unique_ptr<TrackerSession> > &sessions) {
+    std::deque<QString> commands;
+    {
+        std::lock_guard<std::mutex> lock(commandMutex);
+        commands.swap(pendingCommands);
+    }
+    for(size_t c = 0; c < commands.size(); c++) {
+        QStringList words = splitList(commands[c], ' ');
+        if(words.isEmpty()) {
+            continue;
+        }
+        if(words[0] == "target" && words.size() == 3) {
+            for(size_t i = 0; i < sessions.size(); i++) {
+                sessions[i]->setValidationTarget(words[1].toDouble(), words[2].toDouble());
+            }
+        }
+        else if(words[0] == "marker" && words.size() == 2) {
+            for(size_t i = 0; i < sessions.size(); i++) {
+                sessions[i]->addMarkerNow(words[1].toInt());
+            }
+        }
+        else if(words[0] == "clear-target") {
+            for(size_t i = 0; i < sessions.size(); i++) {
+                sessions[i]->clearValidationTarget();
+            }
+        }
+        else {
+            qWarning() << "Unknown command:" << commands[c];
+        }
+    }
+}
+
+int HeadlessCapture::runDevice() {
+    std::vector<std::unique_ptr<TrackerSession> > sessions;
+    sessions.emplace_back(new TrackerSession(new MyGazeSource()));
+    TrackerSession &session = *sessions[0];
+    session.setScreenSize(options.screenWidth, options.screenHeight);
+    if(session.connect() != RET_SUCCESS) {
+        qWarning() << "Eyetracker Could Not Be Connected:" << session.connectStatus();
+        return 2;
+    }
+    if(prepareCalibration(session) != RET_SUCCESS) {
+        session.disconnect();
+        return 3;
+    }
+    if(pipe) {
+        FILE *out = pipe;
+        session.setSampleListener([out](const SampleStruct &sampleData) {
+            if(fwrite(&sampleData, sizeof(sampleData), 1, out) != 1) {
+                requestStop(); //reader side of the pipe went away
+            }
+        });
+    }
+    qDebug() << "Capturing at" << session.source()->sampleRate() << "Hz, startup took" << QDateTime::currentMSecsSinceEpoch() - options.processStartMs << "ms";
+    capture(sessions);
+    session.disconnect();
+    const SampleClassifier &quality = session.sampleClassification();
+    qDebug() << "Captured" << session.sampleCount() << "samples," << quality.lossPercent() << "% lost," << quality.blinkCount() << "blinks";
+    return 0;
+}
+
+int HeadlessCapture::runReplay() {
+    std::vector<std::unique_ptr<TrackerSession> > sessions;
+    sessions.emplace_back(new TrackerSession(new ReplaySource(options.replay, options.speed)));
+    if(pipe) {
+        FILE *out = pipe;
+        sessions[0]->setSampleListener([out](const SampleStruct &sampleData) {
+            if(fwrite(&sampleData, sizeof(sampleData), 1, out) != 1) {
+                requestStop();
+            }
+        });
+    }
+    double elapsed = capture(sessions);
+    const SampleClassifier &quality = sessions[0]->sampleClassification();
+    qDebug() << "Replayed" << sessions[0]->sampleCount() << "samples in" << elapsed << "s," << quality.lossPercent() << "% lost," << quality.blinkCount() << "blinks";
+    return 0;
+}
+
+//one run per requested device count, each device on its own ingestion thread
+int HeadlessCapture::runSimulation() {
+    for(size_t r = 0; r < options.simulate.size() && !stopRequested.load(); r++) {
+        int devices = options.simulate[r];
+        std::vector<std::unique_ptr<TrackerSession> > sessions;
+        for(int i = 0; i < devices; i++) {
+            sessions.emplace_back(new TrackerSession(new SyntheticSource(options.rate, i + 1)));
+            sessions.back()->connect();
+        }
+        double elapsed = capture(sessions);
+
+        long long total = 0;
+        long long slowest = -1;
+        for(int i = 0; i < devices; i++) {
+            long long count = sessions[i]->sampleCount();
+            total += count;
+            slowest = slowest < 0 ? count : std::min(slowest, count);
+        }
+        qDebug().nospace() << devices << " devices: " << total << " samples in " << elapsed << " s, "
+                           << total / elapsed << " samples/s aggregate, " << slowest / elapsed << " samples/s slowest device";
+    }
+    return 0;
+}
+
+int HeadlessCapture::run() {
+    if(options.pipe) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        pipe = stdout;
+    }
+    stopRequested.store(false);
+    signal(SIGINT, &HeadlessCapture::handleSignal);
+    signal(SIGTERM, &HeadlessCapture::handleSignal);
+
+    //sessions an earlier capture left open are repaired before new ones are added next to them
+    if(!options.output.isEmpty()) {
+        SessionRecorder::recoverDirectory(QFileInfo(options.output).absolutePath());
+    }
+
+    if(!options.simulate.empty()) {
+        return runSimulation();
+    }
+    if(!options.replay.isEmpty()) {
+        return runReplay();
+    }
+    return runDevice();
+}
+
+//--headless [--participant id] [--output file] [--pipe] [--load-calibration] [--calibrate] [--duration s]
+//           [--simulate n[,n...]] [--rate hz] [--replay file] [--speed factor] [--sync-interval ms]
+//           [--memory-budget MB] [--recording-buffer MB] [--overflow policy] [--metrics-port n]
+//           [--trace file] [--commands] [--screen WxH]
+int HeadlessCapture::runFromCommandLine(const QStringList &arguments, qint64 processStartMs) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless MyGaze capture");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("headless", "Capture without the widget."));
+    parser.addOption(QCommandLineOption("participant", "Participant identifier.", "id"));
+    parser.addOption(QCommandLineOption("output", "Session file to record to.", "file"));
+    parser.addOption(QCommandLineOption("pipe", "Stream raw SampleStruct records to standard output."));
+    parser.addOption(QCommandLineOption("load-calibration", "Load the cached calibration of the participant."));
+    parser.addOption(QCommandLineOption("calibrate", "Calibrate when no acceptable cached calibration exists."));
+    parser.addOption(QCommandLineOption("duration", "Stop after this many seconds, 0 waits for SIGINT/SIGTERM.", "seconds", "0"));
+    parser.addOption(QCommandLineOption("simulate", "Run this many synthetic devices instead of the tracker, a list runs each count in turn.", "n[,n...]"));
+    parser.addOption(QCommandLineOption("rate", "Synthetic sample rate, 0 runs unpaced.", "hz", "500"));
+    parser.addOption(QCommandLineOption("replay", "Replay a recorded session instead of the tracker.", "file"));
+    parser.addOption(QCommandLineOption("speed", "Replay speed factor, 0 replays as fast as possible.", "factor", "1"));
+    parser.addOption(QCommandLineOption("sync-interval", "Sync the recording to disk this often, 0 after every write.", "ms", "250"));
+    parser.addOption(QCommandLineOption("memory-budget", "Cap of all streaming buffers together.", "MB", "512"));
+    parser.addOption(QCommandLineOption("recording-buffer", "Recorded samples waiting for the disk, per session.", "MB", "64"));
+    parser.addOption(QCommandLineOption("overflow", "Full recording buffer: drop-oldest, decimate, spill or block.", "policy", "spill"));
+    parser.addOption(QCommandLineOption("metrics-port", "Serve Prometheus metrics on this localhost port, 0 disables it.", "n",
+                                        QString::number(defaultMetricsPort)));
+    parser.addOption(QCommandLineOption("commands", "Read validation target and marker commands from standard input."));
+    parser.addOption(QCommandLineOption("trace", "Write callback, queue and disk timing spans as Chrome trace JSON.", "file"));
+    parser.addOption(QCommandLineOption("screen", "Resolution of the stimulus screen the gaze refers to.", "WxH", "1920x1080"));
+    parser.process(arguments);
+
+    Options options;
+    options.participant = parser.value("participant");
+    options.output = parser.value("output");
+    options.pipe = parser.isSet("pipe");
+    options.useCalibration = parser.isSet("load-calibration") || parser.isSet("calibrate");
+    options.calibrate = parser.isSet("calibrate");
+    options.duration = parser.value("duration").toInt();
+    options.processStartMs = processStartMs;
+    options.rate = parser.value("rate").toInt();
+    options.replay = parser.value("replay");
+    options.speed = parser.value("speed").toDouble();
+    options.syncInterval = parser.value("sync-interval").toInt();
+    options.memoryBudget = (long long)(parser.value("memory-budget").toDouble() * 1024 * 1024);
+    options.recordingBuffer = (long long)(parser.value("recording-buffer").toDouble() * 1024 * 1024);
+    options.commands = parser.isSet("commands");
+    ScreenGeometry screen;
+    if(!ScreenGeometry::fromCommandLine(parser.value("screen"), QString(), &screen)) {
+        return 1;
+    }
+    options.screenWidth = screen.screenWidth;
+    options.screenHeight = screen.screenHeight;
+    if(!overflowPolicyFromName(parser.value("overflow"), options.overflow)) {
+        qWarning() << "Unknown overflow policy:" << parser.value("overflow");
+        return 1;
+    }
+    QStringList counts = splitList(parser.value("simulate"));
+    for(int i = 0; i < counts.size(); i++) {
+        int devices = counts[i].toInt();
+        if(devices < 1 || devices > CallbackRegistry::MaxSlots) {
+            qWarning() << "Simulated device count must be between 1 and" << CallbackRegistry::MaxSlots;
+            return 1;
+        }
+        options.simulate.push_back(devices);
+    }
+    if(options.simulate.size() > 1 && options.duration == 0) {
+        options.duration = 10; //a series of runs needs an end for each run
+    }
+    if(options.output.isEmpty() && !options.pipe && options.simulate.empty()) {
+        qWarning() << "Nothing to capture to, give --output and/or --pipe";
+        return 1;
+    }
+    if(options.pipe && !options.simulate.empty()) {
+        qWarning() << "--pipe streams a single device and cannot be combined with --simulate";
+        return 1;
+    }
+
+    MemoryBudget::global().setLimit(options.memoryBudget);
+    MetricsServer metricsServer;
+    int metricsPort = parser.value("metrics-port").toInt();
+    if(metricsPort > 0) {
+        if(metricsServer.start(metricsPort)) {
+            qDebug() << "Metrics served at" << metricsServer.url();
+        }
+        else {
+            qWarning() << "Metrics port" << metricsPort << "could not be bound";
+        }
+    }
+    QString tracePath = parser.value("trace");
+    if(!tracePath.isEmpty()) {
+        Tracing::start();
+    }
+    HeadlessCapture capture(options);
+    int status = capture.run();
+    if(!tracePath.isEmpty()) {
+        Tracing::finish(tracePath);
+    }
+    logMemory();
+    qDebug() << "Peak RSS" << MemoryBudget::peakResidentBytes() / (1024.0 * 1024.0) << "MB";
+    return status;
+}
@@ -0,0 +1,70 @@
+#ifndef HEADLESSCAPTURE_H
+#define HEADLESSCAPTURE_H
+
+//headlesscapture.h
+//Command line capture without any widget or Qt event loop, for acquisition machines without a display
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+#include <myGazeAPI.h>
+#include "memorybudget.h"
+
+class TrackerSession;
+
+class HeadlessCapture {
+
+public:
+    struct Options {
+        QString participant;
+        QString output;       //session file, empty to skip recording, numbered per device when simulating several
+        bool pipe;            //stream raw SampleStruct records to standard output
+        bool useCalibration;  //load the cached calibration of the participant
+        bool calibrate;       //run a calibration when no cached one is acceptable
+        int duration;         //seconds, 0 runs until SIGINT or SIGTERM
+        qint64 processStartMs; //wall clock at process start, used to report startup time
+        std::vector<int> simulate; //synthetic device counts to run one after another instead of the tracker
+        int rate;             //synthetic sample rate [Hz], 0 runs unpaced to measure pipeline throughput
+        QString replay;       //session file to replay instead of the tracker
+        double speed;         //replay speed, 0 replays as fast as possible
+        int syncInterval;     //recording sync interval [milliseconds], 0 syncs every write
+        long long memoryBudget; //cap of all streaming buffers [bytes]
+        long long recordingBuffer; //recorded samples waiting for the disk, per session [bytes]
+        OverflowPolicy overflow; //what the recording buffer does when it is full
+        bool commands;        //read validation target and marker commands from standard input, one per line
+        int screenWidth;      //resolution of the stimulus screen [pixel], 0 keeps the default geometry
+        int screenHeight;
+    };
+
+    explicit HeadlessCapture(const Options &options);
+    ~HeadlessCapture();
+
+    //connects, prepares calibration and streams until stopped, returns the process exit code
+    int run();
+    static void requestStop();
+
+    //entry point of the --headless command line mode, processStartMs is taken first thing in main
+    static int runFromCommandLine(const QStringList &arguments, qint64 processStartMs);
+
+private:
+    static void handleSignal(int signal);
+
+    int prepareCalibration(TrackerSession &session);
+    QString outputPath(int index, int count) const;
+    //streams all sessions until stopped, the duration elapsed or every source finished, returns elapsed seconds
+    double capture(std::vector<std::unique_ptr<TrackerSession> > &sessions);
+    void applyCommands(std::vector<std::unique_ptr<TrackerSession> > &sessions);
+    int runDevice();
+    int runReplay();
+    int runSimulation();
+
+    Options options;
+    FILE *pipe;
+
+    static std::atomic<bool> stopRequested;
+};
+
+#endif // HEADLESSCAPTURE_H
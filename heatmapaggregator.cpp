@@ -0,0 +1,303 @@
+//heatmapaggregator.cpp
+//Implements the parallel group heatmap aggregation
+
+#include "heatmapaggregator.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "sampleclassifier.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+static const char heatmapGridMagic[8] = { 'M', 'G', 'H', 'E', 'A', 'T', '0', '1' };
+
+//reads only the file header, so grouping an archive by participant does not map every session
+static QString sessionParticipant(const QString &path) {
+    QFile file(path);
+    SessionFileHeader header;
+    if(!file.open(QIODevice::ReadOnly) || file.read((char *)&header, sizeof(header)) != (qint64)sizeof(header)
+            || memcmp(header.magic, sessionFileMagic, sizeof(sessionFileMagic)) != 0) {
+        return QString();
+    }
+    header.participant[sizeof(header.participant) - 1] = 0;
+    return QString::fromUtf8(header.participant);
+}
+
+//Heatmap Aggregator Constructor, threads 0 uses every core
+HeatmapAggregator::HeatmapAggregator(int screenWidth, int screenHeight, int cellSize, double sigma, int threads)
+    : screenWidth(screenWidth), screenHeight(screenHeight), cellSize(std::max(1, cellSize)), sigma(sigma), mode(FixationDuration),
+      participants(0), pool(threads) {
+    columns = (screenWidth + this->cellSize - 1) / this->cellSize;
+    rows = (screenHeight + this->cellSize - 1) / this->cellSize;
+}
+
+void HeatmapAggregator::setWeighting(Weighting weighting) {
+    mode = weighting;
+}
+
+HeatmapAggregator::Weighting HeatmapAggregator::weighting() const {
+    return mode;
+}
+
+const std::vector<float> &HeatmapAggregator::grid() const {
+    return density;
+}
+
+int HeatmapAggregator::gridWidth() const {
+    return columns;
+}
+
+int HeatmapAggregator::gridHeight() const {
+    return rows;
+}
+
+int HeatmapAggregator::participantCount() const {
+    return participants;
+}
+
+//adds the raw weight of one session to cells, gaze outside the screen or not finite is dropped
+void HeatmapAggregator::accumulateSession(const SessionReader &session, std::vector<float> &cells) const {
+    int cols = columns;
+    int size = cellSize;
+    auto add = [&cells, cols, size, this](double x, double y, double weight) {
+        if(!(x >= 0 && x < screenWidth && y >= 0 && y < screenHeight)) {
+            return;
+        }
+        cells[(int)(y / size) * cols + (int)(x / size)] += (float)weight;
+    };
+    if(mode == FixationDuration) {
+        session.forEachEvent([&add](const EventStruct &event) {
+            if(event.eventType == 'F') {
+                add(event.positionX, event.positionY, event.duration / 1000.0); //weight in milliseconds
+            }
+        });
+        return;
+    }
+    session.forEachSample([&add](const SampleStruct &sample) {
+        double x, y;
+        if(trackedGaze(sample, trackedEyes(sample), x, y)) {
+            add(x, y, 1.0);
+        }
+    });
+}
+
+int HeatmapAggregator::aggregate(const QStringList &sessions) {
+    //sessions without a participant id count as a participant of their own
+    std::map<QString, QStringList> byParticipant;
+    for(int i = 0; i < sessions.size(); i++) {
+        QString participant = sessionParticipant(sessions[i]);
+        byParticipant[participant.isEmpty() ? "#" + sessions[i] : participant] << sessions[i];
+    }
+    std::vector<QStringList> groups;
+    for(std::map<QString, QStringList>::const_iterator it = byParticipant.begin(); it != byParticipant.end(); ++it) {
+        groups.push_back(it->second);
+    }
+
+    //one combined and one scratch grid per worker, allocated on first use, so memory follows the thread count
+    size_t cells = (size_t)columns * rows;
+    int workers = pool.threadCount();
+    std::vector<std::vector<float> > combined(workers);
+    std::vector<std::vector<float> > scratch(workers);
+    std::vector<int> contributed(workers, 0);
+
+    for(size_t g = 0; g < groups.size(); g++) {
+        const QStringList *group = &groups[g];
+        pool.submit([this, group, cells, &combined, &scratch, &contributed]() {
+            int worker = ThreadPool::currentWorker();
+            std::vector<float> &own = scratch[worker];
+            if(own.empty()) {
+                own.assign(cells, 0.0f);
+                combined[worker].assign(cells, 0.0f);
+            }
+            else {
+                std::fill(own.begin(), own.end(), 0.0f);
+            }
+            for(int s = 0; s < group->size(); s++) {
+                SessionReader session;
+                if(session.open(group->at(s))) {
+                    accumulateSession(session, own); //unmapped again before the next file of the participant
+                }
+            }
+            double total = 0;
+            for(size_t c = 0; c < cells; c++) {
+                total += own[c];
+            }
+            if(total <= 0) {
+                return; //nothing on screen, the participant adds no weight
+            }
+            float scale = (float)(1.0 / total);
+            std::vector<float> &sum = combined[worker];
+            for(size_t c = 0; c < cells; c++) {
+                sum[c] += own[c] * scale;
+            }
+            contributed[worker]++;
+        });
+    }
+    pool.waitForIdle();
+    scratch.clear();
+
+    participants = 0;
+    for(int w = 0; w < workers; w++) {
+        participants += contributed[w];
+    }
+    combined.erase(std::remove_if(combined.begin(), combined.end(), [](const std::vector<float> &v) { return v.empty(); }), combined.end());
+    reduce(combined);
+    if(combined.empty()) {
+        density.assign(cells, 0.0f);
+    }
+    else {
+        density.swap(combined[0]);
+    }
+    blur();
+    return participants;
+}
+
+//pairwise tree reduction into grids[0], each level adds the pairs of the level in parallel
+void HeatmapAggregator::reduce(std::vector<std::vector<float> > &grids) {
+    long long count = (long long)grids.size();
+    for(long long step = 1; step < count; step *= 2) {
+        long long pairs = (count - step + 2 * step - 1) / (2 * step);
+        pool.parallelFor(pairs, 1, [&grids, step, count](long long begin, long long end) {
+            for(long long p = begin; p < end; p++) {
+                long long target = p * 2 * step;
+                if(target + step >= count) {
+                    continue;
+                }
+                std::vector<float> &a = grids[target];
+                const std::vector<float> &b = grids[target + step];
+                for(size_t c = 0; c < a.size(); c++) {
+                    a[c] += b[c];
+                }
+            }
+        });
+        for(long long target = 0; target + step < count; target += 2 * step) {
+            std::vector<float>().swap(grids[target + step]); //free as soon as it is merged
+        }
+    }
+}
+
+//separable gaussian over the combined grid, applied once since blurring is linear
+void HeatmapAggregator::blur() {
+    double cellSigma = sigma / cellSize;
+    if(cellSigma <= 0 || density.empty()) {
+        return;
+    }
+    int radius = (int)std::ceil(3 * cellSigma);
+    std::vector<float> kernel(2 * radius + 1);
+    double kernelSum = 0;
+    for(int k = -radius; k <= radius; k++) {
+        kernel[k + radius] = (float)std::exp(-0.5 * k * k / (cellSigma * cellSigma));
+        kernelSum += kernel[k + radius];
+    }
+    for(size_t k = 0; k < kernel.size(); k++) {
+        kernel[k] = (float)(kernel[k] / kernelSum);
+    }
+
+    int cols = columns;
+    int rowCount = rows;
+    std::vector<float> horizontal(density.size());
+    std::vector<float> &source = density;
+    pool.parallelFor(rowCount, 16, [&](long long begin, long long end) {
+        for(long long y = begin; y < end; y++) {
+            const float *in = &source[y * cols];
+            float *out = &horizontal[y * cols];
+            for(int x = 0; x < cols; x++) {
+                float value = 0;
+                for(int k = std::max(-radius, -x); k <= std::min(radius, cols - 1 - x); k++) {
+                    value += in[x + k] * kernel[k + radius];
+                }
+                out[x] = value;
+            }
+        }
+    });
+    pool.parallelFor(rowCount, 16, [&](long long begin, long long end) {
+        for(long long y = begin; y < end; y++) {
+            float *out = &source[y * cols];
+            std::fill(out, out + cols, 0.0f);
+            for(int k = std::max<long long>(-radius, -y); k <= std::min<long long>(radius, rowCount - 1 - y); k++) {
+                const float *in = &horizontal[(y + k) * cols];
+                float weight = kernel[k + radius];
+                for(int x = 0; x < cols; x++) {
+                    out[x] += in[x] * weight;
+                }
+            }
+        }
+    });
+}
+
+//transparent blue through green and yellow to opaque red, scaled to the maximum density
+QImage HeatmapAggregator::toImage() const {
+    QImage image(columns, rows, QImage::Format_ARGB32);
+    float peak = density.empty() ? 0 : *std::max_element(density.begin(), density.end());
+    for(int y = 0; y < rows; y++) {
+        QRgb *line = (QRgb *)image.scanLine(y);
+        for(int x = 0; x < columns; x++) {
+            double v = peak > 0 ? density[y * columns + x] / peak : 0;
+            double hue = (1.0 - v) * 240.0 / 360.0;
+            QColor colour = QColor::fromHsvF(hue, 1.0, 1.0, std::min(1.0, v * 1.5));
+            line[x] = colour.rgba();
+        }
+    }
+    return image.scaled(screenWidth, screenHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+bool HeatmapAggregator::saveGrid(const QString &path) const {
+    FILE *file = fopen(QFile::encodeName(path).constData(), "wb");
+    if(!file) {
+        return false;
+    }
+    int header[4] = { columns, rows, cellSize, participants };
+    bool ok = fwrite(heatmapGridMagic, sizeof(heatmapGridMagic), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1
+        && (density.empty() || fwrite(density.data(), sizeof(float), density.size(), file) == density.size());
+    return fclose(file) == 0 && ok;
+}
+
+//--heatmap <directory> [--output image] [--grid file] [--screen WxH] [--cell px] [--sigma px] [--weight fixations|samples] [--threads n]
+int HeatmapAggregator::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Group heatmap of recorded MyGaze sessions");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("heatmap", "Directory scanned recursively for .mgs sessions.", "directory"));
+    parser.addOption(QCommandLineOption("output", "Heatmap image.", "file", "heatmap.png"));
+    parser.addOption(QCommandLineOption("grid", "Raw float density grid.", "file"));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("cell", "Grid cell size in pixels.", "px", "8"));
+    parser.addOption(QCommandLineOption("sigma", "Gaussian spread in pixels.", "px", "32"));
+    parser.addOption(QCommandLineOption("weight", "fixations (duration weighted) or samples.", "mode", "fixations"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    QStringList screen = parser.value("screen").split('x');
+    if(screen.size() != 2 || screen[0].toInt() <= 0 || screen[1].toInt() <= 0) {
+        qWarning() << "Screen size must be given as WIDTHxHEIGHT";
+        return 1;
+    }
+    HeatmapAggregator aggregator(screen[0].toInt(), screen[1].toInt(), parser.value("cell").toInt(),
+                                 parser.value("sigma").toDouble(), parser.value("threads").toInt());
+    if(parser.value("weight") == "samples") {
+        aggregator.setWeighting(GazeSamples);
+    }
+
+    QStringList sessions = BatchAnalyzer::findSessions(parser.value("heatmap"));
+
+    QElapsedTimer timer;
+    timer.start();
+    int count = aggregator.aggregate(sessions);
+    qDebug() << "Aggregated" << sessions.size() << "sessions of" << count << "participants on" << aggregator.pool.threadCount() << "threads in" << timer.elapsed() << "ms";
+
+    if(!aggregator.toImage().save(parser.value("output"))) {
+        qWarning() << "Could not write heatmap image:" << parser.value("output");
+        return 1;
+    }
+    if(parser.isSet("grid") && !aggregator.saveGrid(parser.value("grid"))) {
+        qWarning() << "Could not write heatmap grid:" << parser.value("grid");
+        return 1;
+    }
+    return 0;
+}
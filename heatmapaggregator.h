@@ -0,0 +1,65 @@
+#ifndef HEATMAPAGGREGATOR_H
+#define HEATMAPAGGREGATOR_H
+
+//heatmapaggregator.h
+//Builds group heatmaps from the recorded sessions of many participants. Every participant is normalized
+//to the same total weight so long recordings do not dominate, the result is a raw float density grid
+//and a colour mapped image of it.
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "threadpool.h"
+
+class SessionReader;
+
+class HeatmapAggregator {
+
+public:
+    enum Weighting {
+        FixationDuration, //fixation events weighted by their duration
+        GazeSamples       //every tracked sample counts once
+    };
+
+    //screen size and cell size [pixel], sigma is the gaussian spread applied to the combined grid [pixel]
+    explicit HeatmapAggregator(int screenWidth = 1920, int screenHeight = 1080, int cellSize = 8, double sigma = 32.0, int threads = 0);
+
+    void setWeighting(Weighting weighting);
+    Weighting weighting() const;
+
+    //accumulates all sessions, grouped by the participant stored in each file, returns the number of participants
+    int aggregate(const QStringList &sessions);
+
+    //combined density, each participant contributes a total of one before blurring
+    const std::vector<float> &grid() const;
+    int gridWidth() const;
+    int gridHeight() const;
+    int participantCount() const;
+
+    //colour mapped heatmap scaled to the screen size, transparent where nobody looked
+    QImage toImage() const;
+    //raw grid as "MGHEAT01", width, height, cell size, participants (int32 each) then float32 rows
+    bool saveGrid(const QString &path) const;
+
+    //entry point of the --heatmap command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    void accumulateSession(const SessionReader &session, std::vector<float> &cells) const;
+    void reduce(std::vector<std::vector<float> > &grids);
+    void blur();
+
+    int screenWidth;
+    int screenHeight;
+    int cellSize;
+    double sigma;
+    Weighting mode;
+    int columns;
+    int rows;
+    int participants;
+    std::vector<float> density;
+    ThreadPool pool;
+};
+
+#endif // HEATMAPAGGREGATOR_H
@@ -10,15 +10,139 @@
 #include <iostream>
 #include <stdlib.h>
 #include <mygazeqtwidget.h>
+#include <QCoreApplication>
+#include <string.h>
+#include "batchanalyzer.h"
+#include "sessionexporter.h"
+#include "headlesscapture.h"
+#include "heatmapaggregator.h"
+#include "scanpathsimilarity.h"
+#include "fixationclustering.h"
+#include "timelinewidget.h"
+#include "pupillometry.h"
+#include "headcompensation.h"
+#include "microsaccades.h"
+#include "pursuit.h"
+#include "savitzkygolay.h"
+#include "sessionquery.h"
+#include "sessionrecorder.h"
+#include "memorybudget.h"
+#include "gazeresampler.h"
+#include "clocksync.h"
+#include "tracing.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QTimer>
+
+//checks for a command line switch before any Qt application object exists
+static bool hasArgument(int argc, char *argv[], const char *name) {
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
 //Begin main program procedure
 int main(int argc, char *argv[]) {
+    qint64 processStartMs = QDateTime::currentMSecsSinceEpoch();
+
+    //batch analysis of recorded sessions runs without any GUI
+    if(hasArgument(argc, argv, "--batch")) {
+        QCoreApplication a(argc, argv);
+        return BatchAnalyzer::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--export")) {
+        QCoreApplication a(argc, argv);
+        return SessionExporter::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--heatmap")) {
+        QCoreApplication a(argc, argv);
+        return HeatmapAggregator::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--scanpath")) {
+        QCoreApplication a(argc, argv);
+        return ScanpathMatrix::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--cluster")) {
+        QCoreApplication a(argc, argv);
+        return FixationClustering::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--pupil")) {
+        QCoreApplication a(argc, argv);
+        return PupilProcessor::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--headmotion")) {
+        QCoreApplication a(argc, argv);
+        return HeadCompensation::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--microsaccades")) {
+        QCoreApplication a(argc, argv);
+        return MicrosaccadeDetector::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--pursuit")) {
+        QCoreApplication a(argc, argv);
+        return PursuitClassifier::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--derivatives") || hasArgument(argc, argv, "--derivatives-benchmark")) {
+        QCoreApplication a(argc, argv);
+        return SavitzkyGolayFilter::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--query")) {
+        QCoreApplication a(argc, argv);
+        return SessionQueryEngine::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--record-benchmark")) {
+        QCoreApplication a(argc, argv);
+        return SessionRecorder::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--resample-benchmark")) {
+        QCoreApplication a(argc, argv);
+        return GazeResampler::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--clock-benchmark")) {
+        QCoreApplication a(argc, argv);
+        return ClockSync::runFromCommandLine(a.arguments());
+    }
+    if(hasArgument(argc, argv, "--trace-benchmark")) {
+        QCoreApplication a(argc, argv);
+        return Tracing::runFromCommandLine(a.arguments());
+    }
+
+    //capture without constructing any widget machinery
+    if(hasArgument(argc, argv, "--headless")) {
+        QCoreApplication a(argc, argv);
+        return HeadlessCapture::runFromCommandLine(a.arguments(), processStartMs);
+    }
+
+    //browse a recorded session without connecting to the tracker
+    if(hasArgument(argc, argv, "--timeline")) {
+        QApplication a(argc, argv);
+        return TimelineWidget::runFromCommandLine(a.arguments());
+    }
 
     //create new QT application and widget then display
     QApplication a(argc, argv);
+    TRACE_THREAD("gui");
+    int traceArgument = a.arguments().indexOf("--trace");
+    QString tracePath = traceArgument > 0 && traceArgument + 1 < a.arguments().size() ? a.arguments()[traceArgument + 1] : QString();
+    if(!tracePath.isEmpty()) {
+        Tracing::start();
+    }
     MyGazeQTWidget w;
     w.show();
-    return a.exec(); //return from main
+
+    //same startup and memory figures as the headless mode for comparison
+    QTimer::singleShot(0, [processStartMs]() {
+        qDebug() << "Startup took" << QDateTime::currentMSecsSinceEpoch() - processStartMs << "ms";
+    });
+    int status = a.exec();
+    if(!tracePath.isEmpty()) {
+        Tracing::finish(tracePath);
+    }
+    qDebug() << "Peak RSS" << MemoryBudget::peakResidentBytes() / (1024.0 * 1024.0) << "MB";
+    return status; //return from main
 
 }//end main
 
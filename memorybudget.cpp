@@ -0,0 +1,298 @@
+//memorybudget.cpp
+//Implements the memory budget, its accounts and the spill file
+
+#include "memorybudget.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <QDir>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <stdio.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static const long long defaultBudgetBytes = 512LL * 1024 * 1024;
+
+const char *overflowPolicyName(OverflowPolicy policy) {
+    switch(policy) {
+    case DropOldest:
+        return "drop-oldest";
+    case Decimate:
+        return "decimate";
+    case SpillToDisk:
+        return "spill";
+    case BlockProducer:
+        return "block";
+    }
+    return "";
+}
+
+bool overflowPolicyFromName(const QString &name, OverflowPolicy &policy) {
+    for(int p = DropOldest; p <= BlockProducer; p++) {
+        if(name == overflowPolicyName((OverflowPolicy)p)) {
+            policy = (OverflowPolicy)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+//Memory Account Constructor
+MemoryAccount::MemoryAccount(MemoryBudget &budget, const QString &name, long long limit, OverflowPolicy policy) : budget(budget),
+    accountName(name), limitBytes(limit), overflow(policy), usedBytes(0), peakBytes(0), droppedItems(0), spilledItems(0), blockedWaits(0) {
+}
+
+//Memory Account Destructor
+MemoryAccount::~MemoryAccount() {
+    budget.usedBytes.fetch_sub(usedBytes.load());
+    budget.unregister(this);
+}
+
+QString MemoryAccount::name() const {
+    return accountName;
+}
+
+OverflowPolicy MemoryAccount::policy() const {
+    return overflow;
+}
+
+long long MemoryAccount::limit() const {
+    return limitBytes;
+}
+
+bool MemoryAccount::reserve(long long bytes) {
+    long long used = usedBytes.load(std::memory_order_relaxed) + bytes;
+    if(used > limitBytes || !budget.charge(bytes)) {
+        return false;
+    }
+    used = usedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    if(used > peakBytes.load(std::memory_order_relaxed)) {
+        peakBytes.store(used, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void MemoryAccount::release(long long bytes) {
+    usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    budget.usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccount::addDropped(long long items) {
+    droppedItems.fetch_add(items, std::memory_order_relaxed);
+    budget.droppedItems.fetch_add(items, std::memory_order_relaxed);
+}
+
+void MemoryAccount::addSpilled(long long items) {
+    spilledItems.fetch_add(items, std::memory_order_relaxed);
+    budget.spilledItems.fetch_add(items, std::memory_order_relaxed);
+}
+
+void MemoryAccount::addBlocked() {
+    blockedWaits.fetch_add(1, std::memory_order_relaxed);
+    budget.blockedWaits.fetch_add(1, std::memory_order_relaxed);
+}
+
+long long MemoryAccount::used() const {
+    return usedBytes.load(std::memory_order_relaxed);
+}
+
+long long MemoryAccount::peak() const {
+    return peakBytes.load(std::memory_order_relaxed);
+}
+
+long long MemoryAccount::dropped() const {
+    return droppedItems.load(std::memory_order_relaxed);
+}
+
+long long MemoryAccount::spilled() const {
+    return spilledItems.load(std::memory_order_relaxed);
+}
+
+long long MemoryAccount::blocked() const {
+    return blockedWaits.load(std::memory_order_relaxed);
+}
+
+//Memory Budget Constructor
+MemoryBudget::MemoryBudget() : limitBytes(defaultBudgetBytes), usedBytes(0), droppedItems(0), spilledItems(0), blockedWaits(0) {
+}
+
+//Exports the budget through the metrics registry, read when the metrics are scraped
+static bool registerMetrics(const MemoryBudget &budget) {
+    MetricsRegistry &registry = MetricsRegistry::global();
+    registry.callback("mygaze_memory_budget_bytes", "Cap of all streaming buffers together.", GaugeMetric,
+                      [&budget] { return (double)budget.limit(); });
+    registry.callback("mygaze_memory_used_bytes", "Memory charged by the streaming buffers.", GaugeMetric,
+                      [&budget] { return (double)budget.used(); });
+    registry.callback("mygaze_buffer_dropped_total", "Items dropped by buffer overflow policies.", CounterMetric,
+                      [&budget] { return (double)budget.dropped(); });
+    registry.callback("mygaze_buffer_spilled_total", "Items spilled to disk by buffer overflow policies.", CounterMetric,
+                      [&budget] { return (double)budget.spilled(); });
+    registry.callback("mygaze_buffer_blocked_total", "Producer waits on full buffers.", CounterMetric,
+                      [&budget] { return (double)budget.blocked(); });
+    registry.callback("mygaze_resident_bytes", "Resident set size of the process.", GaugeMetric,
+                      [] { return (double)MemoryBudget::residentBytes(); });
+    return true;
+}
+
+MemoryBudget &MemoryBudget::global() {
+    static MemoryBudget budget;
+    static bool registered = registerMetrics(budget);
+    (void)registered;
+    return budget;
+}
+
+void MemoryBudget::setLimit(long long bytes) {
+    limitBytes.store(std::max(0LL, bytes));
+}
+
+long long MemoryBudget::limit() const {
+    return limitBytes.load(std::memory_order_relaxed);
+}
+
+long long MemoryBudget::used() const {
+    return usedBytes.load(std::memory_order_relaxed);
+}
+
+long long MemoryBudget::dropped() const {
+    return droppedItems.load(std::memory_order_relaxed);
+}
+
+long long MemoryBudget::spilled() const {
+    return spilledItems.load(std::memory_order_relaxed);
+}
+
+long long MemoryBudget::blocked() const {
+    return blockedWaits.load(std::memory_order_relaxed);
+}
+
+std::shared_ptr<MemoryAccount> MemoryBudget::account(const QString &name, long long limit, OverflowPolicy policy) {
+    std::shared_ptr<MemoryAccount> account(new MemoryAccount(*this, name, limit, policy));
+    std::lock_guard<std::mutex> lock(mutex);
+    accounts.push_back(account.get());
+    return account;
+}
+
+void MemoryBudget::unregister(MemoryAccount *account) {
+    std::lock_guard<std::mutex> lock(mutex);
+    accounts.erase(std::remove(accounts.begin(), accounts.end(), account), accounts.end());
+}
+
+//the sum may pass the limit for a moment while a charge is rolled back, which only makes concurrent charges stricter
+bool MemoryBudget::charge(long long bytes) {
+    if(usedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes > limitBytes.load(std::memory_order_relaxed)) {
+        usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+QStringList MemoryBudget::report() const {
+    const double mb = 1024.0 * 1024.0;
+    QStringList lines;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i = 0; i < accounts.size(); i++) {
+            const MemoryAccount &account = *accounts[i];
+            lines << QString("%1 (%2): %3 of %4 MB, peak %5 MB, %6 dropped, %7 spilled, %8 blocked").arg(account.name())
+                         .arg(overflowPolicyName(account.policy())).arg(account.used() / mb, 0, 'f', 1).arg(account.limit() / mb, 0, 'f', 1)
+                         .arg(account.peak() / mb, 0, 'f', 1).arg(account.dropped()).arg(account.spilled()).arg(account.blocked());
+        }
+    }
+    lines << QString("Buffers %1 of %2 MB, %3 dropped, %4 spilled, %5 blocked, RSS %6 MB (peak %7 MB)").arg(used() / mb, 0, 'f', 1)
+                 .arg(limit() / mb, 0, 'f', 1).arg(dropped()).arg(spilled()).arg(blocked()).arg(residentBytes() / mb, 0, 'f', 1)
+                 .arg(peakResidentBytes() / mb, 0, 'f', 1);
+    return lines;
+}
+
+long long MemoryBudget::residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (long long)counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    long long pages = 0;
+    long long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(statm) {
+        if(fscanf(statm, "%lld %lld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+long long MemoryBudget::peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (long long)counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0) {
+        return (long long)usage.ru_maxrss * 1024;
+    }
+    return 0;
+#endif
+}
+
+//Spill File Constructor
+SpillFile::SpillFile() : readOffset(0), writeOffset(0), pendingBytes(0) {
+}
+
+//Spill File Destructor
+SpillFile::~SpillFile() {
+}
+
+bool SpillFile::write(const void *data, long long bytes) {
+    TRACE_SCOPE("spill write");
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!file) {
+        file.reset(new QTemporaryFile(QDir(QDir::tempPath()).filePath("mygaze_spill_XXXXXX.bin")));
+        if(!file->open()) {
+            file.reset();
+            return false;
+        }
+    }
+    if(!file->seek(writeOffset) || file->write(static_cast<const char *>(data), bytes) != bytes) {
+        return false;
+    }
+    writeOffset += bytes;
+    pendingBytes.store(writeOffset - readOffset, std::memory_order_relaxed);
+    return true;
+}
+
+long long SpillFile::read(void *data, long long bytes) {
+    TRACE_SCOPE("spill read");
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes = std::min(bytes, writeOffset - readOffset);
+    if(bytes <= 0 || !file->seek(readOffset) || file->read(static_cast<char *>(data), bytes) != bytes) {
+        return 0;
+    }
+    readOffset += bytes;
+    if(readOffset == writeOffset) {
+        readOffset = writeOffset = 0; //drained, the file space is reused from the start
+    }
+    pendingBytes.store(writeOffset - readOffset, std::memory_order_relaxed);
+    return bytes;
+}
+
+long long SpillFile::pending() const {
+    return pendingBytes.load(std::memory_order_relaxed);
+}
+
+void SpillFile::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    readOffset = writeOffset = 0;
+    pendingBytes.store(0, std::memory_order_relaxed);
+}
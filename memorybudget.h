@@ -0,0 +1,131 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+//memorybudget.h
+//Process wide memory budget. Every buffer that can grow while streaming holds a MemoryAccount with its own limit and
+//the overflow policy of its stage; the budget caps the sum of all accounts, so a stalled consumer costs data at the
+//declared stage instead of growing the process. The dropped, spilled and blocked counters are live.
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class QTemporaryFile;
+
+enum OverflowPolicy {
+    DropOldest,   //the oldest buffered items are discarded
+    Decimate,     //every second buffered item is discarded, the stream gets coarser instead of shorter
+    SpillToDisk,  //the buffered items move to a temporary file and are read back once the consumer catches up
+    BlockProducer //the producing thread waits for the consumer
+};
+
+const char *overflowPolicyName(OverflowPolicy policy); //"drop-oldest", "decimate", "spill", "block"
+bool overflowPolicyFromName(const QString &name, OverflowPolicy &policy);
+
+class MemoryBudget;
+
+//usage and overflow counters of one buffer, created through MemoryBudget::account and closed with its last reference
+class MemoryAccount {
+
+public:
+    ~MemoryAccount();
+
+    QString name() const;
+    OverflowPolicy policy() const;
+    long long limit() const;
+
+    //charges bytes if they fit both this account and the budget, called by the single producer of the buffer
+    bool reserve(long long bytes);
+    void release(long long bytes); //any thread
+
+    void addDropped(long long items);
+    void addSpilled(long long items);
+    void addBlocked(); //one producer wait
+
+    //live state, safe to read from any thread
+    long long used() const;
+    long long peak() const;
+    long long dropped() const;
+    long long spilled() const;
+    long long blocked() const;
+
+private:
+    friend class MemoryBudget;
+    MemoryAccount(MemoryBudget &budget, const QString &name, long long limit, OverflowPolicy policy);
+    MemoryAccount(const MemoryAccount &);
+    MemoryAccount &operator=(const MemoryAccount &);
+
+    MemoryBudget &budget;
+    QString accountName;
+    long long limitBytes;
+    OverflowPolicy overflow;
+    std::atomic<long long> usedBytes;
+    std::atomic<long long> peakBytes;
+    std::atomic<long long> droppedItems;
+    std::atomic<long long> spilledItems;
+    std::atomic<long long> blockedWaits;
+};
+
+class MemoryBudget {
+
+public:
+    MemoryBudget();
+
+    static MemoryBudget &global(); //the budget the streaming buffers register with
+
+    void setLimit(long long bytes); //cap of all accounts together, lowering it only affects new reservations
+    long long limit() const;
+    long long used() const;
+
+    //totals over all accounts including closed ones, safe to read from any thread
+    long long dropped() const;
+    long long spilled() const;
+    long long blocked() const;
+
+    std::shared_ptr<MemoryAccount> account(const QString &name, long long limit, OverflowPolicy policy);
+    QStringList report() const; //one line per open account, then the totals and the resident set
+
+    static long long residentBytes();     //current resident set of the process
+    static long long peakResidentBytes();
+
+private:
+    friend class MemoryAccount;
+    bool charge(long long bytes);
+    void unregister(MemoryAccount *account);
+
+    std::atomic<long long> limitBytes;
+    std::atomic<long long> usedBytes;
+    std::atomic<long long> droppedItems;
+    std::atomic<long long> spilledItems;
+    std::atomic<long long> blockedWaits;
+    mutable std::mutex mutex;
+    std::vector<MemoryAccount *> accounts;
+};
+
+//first in first out byte queue in a temporary file, for buffers with the SpillToDisk policy
+class SpillFile {
+
+public:
+    SpillFile();
+    ~SpillFile();
+
+    bool write(const void *data, long long bytes); //appends, the file is created on first use
+    long long read(void *data, long long bytes);   //oldest bytes first, returns how many were read
+    long long pending() const; //written and not yet read, lock free
+    void clear();
+
+private:
+    SpillFile(const SpillFile &);
+    SpillFile &operator=(const SpillFile &);
+
+    std::mutex mutex;
+    std::unique_ptr<QTemporaryFile> file;
+    long long readOffset;
+    long long writeOffset;
+    std::atomic<long long> pendingBytes;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,209 @@
+//metrics.cpp
+//Implements the metric types, the registry and its Prometheus rendering
+
+#include "metrics.h"
+#include <QByteArray>
+#include <algorithm>
+
+//Metric Counter Constructor
+MetricCounter::MetricCounter() {
+    for(int s = 0; s < metricShards; s++) {
+        shards[s].value.store(0, std::memory_order_relaxed);
+    }
+}
+
+long long MetricCounter::value() const {
+    long long total = 0;
+    for(int s = 0; s < metricShards; s++) {
+        total += shards[s].value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+//Metric Gauge Constructor
+MetricGauge::MetricGauge() : current(0) {
+}
+
+void MetricGauge::add(double delta) {
+    double expected = current.load(std::memory_order_relaxed);
+    while(!current.compare_exchange_weak(expected, expected + delta, std::memory_order_relaxed)) {
+    }
+}
+
+double MetricGauge::value() const {
+    return current.load(std::memory_order_relaxed);
+}
+
+//Metric Histogram Constructor
+MetricHistogram::MetricHistogram(const std::vector<long long> &upperBounds) : bucketCount(std::min((int)upperBounds.size(), (int)MaxBuckets)) {
+    for(int b = 0; b < bucketCount; b++) {
+        upper[b] = upperBounds[b];
+    }
+    for(int s = 0; s < metricShards; s++) {
+        for(int b = 0; b <= MaxBuckets; b++) {
+            shards[s].counts[b].store(0, std::memory_order_relaxed);
+        }
+        shards[s].sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+std::vector<long long> MetricHistogram::bounds() const {
+    return std::vector<long long>(upper, upper + bucketCount);
+}
+
+std::vector<long long> MetricHistogram::counts() const {
+    std::vector<long long> total(bucketCount + 1, 0);
+    for(int s = 0; s < metricShards; s++) {
+        for(int b = 0; b <= bucketCount; b++) {
+            total[b] += shards[s].counts[b].load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+long long MetricHistogram::sum() const {
+    long long total = 0;
+    for(int s = 0; s < metricShards; s++) {
+        total += shards[s].sum.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+MetricsRegistry &MetricsRegistry::global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+MetricsRegistry::Entry &MetricsRegistry::entry(const QString &name, const QString &help, MetricType type, const QString &labels) {
+    for(size_t e = 0; e < entries.size(); e++) {
+        if(entries[e]->name == name && entries[e]->labels == labels) {
+            return *entries[e];
+        }
+    }
+    std::unique_ptr<Entry> created(new Entry());
+    created->name = name;
+    created->labels = labels;
+    created->help = help;
+    created->type = type;
+    entries.push_back(std::move(created));
+    return *entries.back();
+}
+
+MetricCounter *MetricsRegistry::counter(const QString &name, const QString &help, const QString &labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = entry(name, help, CounterMetric, labels);
+    if(!e.counter) {
+        e.counter.reset(new MetricCounter());
+    }
+    return e.counter.get();
+}
+
+MetricGauge *MetricsRegistry::gauge(const QString &name, const QString &help, const QString &labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = entry(name, help, GaugeMetric, labels);
+    if(!e.gauge) {
+        e.gauge.reset(new MetricGauge());
+    }
+    return e.gauge.get();
+}
+
+MetricHistogram *MetricsRegistry::histogram(const QString &name, const QString &help, const std::vector<long long> &upperBounds,
+                                            const QString &labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = entry(name, help, HistogramMetric, labels);
+    if(!e.histogram) {
+        e.histogram.reset(new MetricHistogram(upperBounds));
+    }
+    return e.histogram.get();
+}
+
+void MetricsRegistry::callback(const QString &name, const QString &help, MetricType type, std::function<double()> read, const QString &labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entry(name, help, type, labels).read = read;
+}
+
+std::vector<MetricSample> MetricsRegistry::snapshot() const {
+    std::vector<MetricSample> samples;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples.reserve(entries.size());
+        for(size_t i = 0; i < entries.size(); i++) {
+            const Entry &e = *entries[i];
+            MetricSample sample;
+            sample.name = e.name;
+            sample.labels = e.labels;
+            sample.help = e.help;
+            sample.type = e.type;
+            sample.value = 0;
+            sample.sum = 0;
+            if(e.read) {
+                sample.value = e.read();
+            }
+            else if(e.counter) {
+                sample.value = (double)e.counter->value();
+            }
+            else if(e.gauge) {
+                sample.value = e.gauge->value();
+            }
+            else if(e.histogram) {
+                sample.bounds = e.histogram->bounds();
+                sample.counts = e.histogram->counts();
+                sample.sum = e.histogram->sum();
+                long long count = 0;
+                for(size_t b = 0; b < sample.counts.size(); b++) {
+                    count += sample.counts[b];
+                }
+                sample.value = (double)count;
+            }
+            samples.push_back(sample);
+        }
+    }
+    //a metric family has to be contiguous, registration order is kept within it
+    std::stable_sort(samples.begin(), samples.end(), [](const MetricSample &a, const MetricSample &b) {
+        return a.name < b.name;
+    });
+    return samples;
+}
+
+//name{labels,extra} value
+static void appendLine(QByteArray &text, const QString &name, const QString &labels, const QString &extra, const QString &value) {
+    text += name.toUtf8();
+    if(!labels.isEmpty() || !extra.isEmpty()) {
+        text += '{';
+        text += labels.toUtf8();
+        if(!labels.isEmpty() && !extra.isEmpty()) {
+            text += ',';
+        }
+        text += extra.toUtf8();
+        text += '}';
+    }
+    text += ' ';
+    text += value.toUtf8();
+    text += '\n';
+}
+
+QByteArray MetricsRegistry::prometheusText() const {
+    static const char *typeNames[] = { "counter", "gauge", "histogram" };
+    std::vector<MetricSample> samples = snapshot();
+    QByteArray text;
+    for(size_t i = 0; i < samples.size(); i++) {
+        const MetricSample &sample = samples[i];
+        if(i == 0 || samples[i - 1].name != sample.name) {
+            text += "# HELP " + sample.name.toUtf8() + ' ' + sample.help.toUtf8() + '\n';
+            text += "# TYPE " + sample.name.toUtf8() + ' ' + typeNames[sample.type] + '\n';
+        }
+        if(sample.type != HistogramMetric) {
+            appendLine(text, sample.name, sample.labels, QString(), QString::number(sample.value, 'g', 15));
+            continue;
+        }
+        long long cumulative = 0;
+        for(size_t b = 0; b < sample.counts.size(); b++) {
+            cumulative += sample.counts[b];
+            QString bound = b < sample.bounds.size() ? QString::number(sample.bounds[b]) : QString("+Inf");
+            appendLine(text, sample.name + "_bucket", sample.labels, "le=\"" + bound + "\"", QString::number(cumulative));
+        }
+        appendLine(text, sample.name + "_sum", sample.labels, QString(), QString::number(sample.sum));
+        appendLine(text, sample.name + "_count", sample.labels, QString(), QString::number(cumulative));
+    }
+    return text;
+}
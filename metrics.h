@@ -0,0 +1,145 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+//metrics.h
+//Process wide registry of counters, gauges and histograms describing the running capture. Hot path metrics are
+//sharded per thread (one cache line per shard, picked once per thread) and updated with relaxed atomics, readers add
+//the shards up. Metrics are registered once and live as long as the process; the registry renders the Prometheus
+//text format for MetricsServer and snapshots for DiagnosticsPanel.
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum MetricType {
+    CounterMetric,
+    GaugeMetric,
+    HistogramMetric
+};
+
+static const int metricShards = 16;
+
+//shard of the calling thread, threads are spread round robin
+inline int metricShard() {
+    static std::atomic<int> nextShard(0);
+    thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % metricShards;
+    return shard;
+}
+
+class MetricCounter {
+
+public:
+    MetricCounter();
+
+    void add(long long n = 1) {
+        shards[metricShard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    long long value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<long long> value;
+    };
+    Shard shards[metricShards];
+};
+
+//last value written, for state that has a single writer or is set rarely
+class MetricGauge {
+
+public:
+    MetricGauge();
+
+    void set(double value) {
+        current.store(value, std::memory_order_relaxed);
+    }
+    void add(double delta);
+    double value() const;
+
+private:
+    std::atomic<double> current;
+};
+
+//integer observations in fixed buckets, e.g. durations in nanoseconds
+class MetricHistogram {
+
+public:
+    enum { MaxBuckets = 15 };
+
+    explicit MetricHistogram(const std::vector<long long> &upperBounds); //ascending, at most MaxBuckets, +Inf is implied
+
+    void observe(long long value) {
+        Shard &shard = shards[metricShard()];
+        int bucket = 0;
+        while(bucket < bucketCount && value > upper[bucket]) {
+            bucket++;
+        }
+        shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::vector<long long> bounds() const;
+    std::vector<long long> counts() const; //per bucket, the last one is above every bound
+    long long sum() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<long long> counts[MaxBuckets + 1];
+        std::atomic<long long> sum;
+    };
+    long long upper[MaxBuckets];
+    int bucketCount;
+    Shard shards[metricShards];
+};
+
+//one rendered metric
+struct MetricSample {
+    QString name;
+    QString labels; //Prometheus label pairs without braces, e.g. eye="left"
+    QString help;
+    MetricType type;
+    double value;                //counter or gauge value, histogram count
+    std::vector<long long> bounds; //histograms only
+    std::vector<long long> counts;
+    long long sum;
+};
+
+class MetricsRegistry {
+
+public:
+    static MetricsRegistry &global();
+
+    //the same name and labels always return the same metric, the pointers stay valid for the life of the process
+    MetricCounter *counter(const QString &name, const QString &help, const QString &labels = QString());
+    MetricGauge *gauge(const QString &name, const QString &help, const QString &labels = QString());
+    MetricHistogram *histogram(const QString &name, const QString &help, const std::vector<long long> &upperBounds,
+                               const QString &labels = QString());
+    //read when the registry is rendered, for state that already keeps its own counters; read must stay callable for
+    //the life of the process, registering the same name and labels again replaces it
+    void callback(const QString &name, const QString &help, MetricType type, std::function<double()> read,
+                  const QString &labels = QString());
+
+    std::vector<MetricSample> snapshot() const; //grouped by name
+    QByteArray prometheusText() const;          //text exposition format 0.0.4
+
+private:
+    struct Entry {
+        QString name;
+        QString labels;
+        QString help;
+        MetricType type;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<MetricHistogram> histogram;
+        std::function<double()> read;
+    };
+    Entry &entry(const QString &name, const QString &help, MetricType type, const QString &labels); //called with mutex held
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Entry> > entries;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,104 @@
+//metricsserver.cpp
+//Implements the localhost metrics endpoint, one short lived connection at a time is enough for a scraper
+
+#include "metricsserver.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <QDebug>
+#include <QHostAddress>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <chrono>
+
+static const int acceptPollMs = 200; //how quickly stop() is noticed
+static const int requestTimeoutMs = 2000;
+static const int maxRequestBytes = 8192;
+
+//Metrics Server Constructor
+MetricsServer::MetricsServer() : stopping(false), listenPort(0) {
+}
+
+//Metrics Server Destructor
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+//the socket objects belong to the server thread, so the port is bound there and the result handed back
+bool MetricsServer::start(int port) {
+    stop();
+    std::atomic<int> bound(-1); //-1 pending, 0 failed, 1 listening
+    stopping.store(false);
+    server = std::thread(&MetricsServer::run, this, port, &bound);
+    while(bound.load() < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if(bound.load() == 0) {
+        server.join();
+        qWarning() << "Metrics endpoint could not listen on port" << port;
+        return false;
+    }
+    listenPort = port;
+    return true;
+}
+
+void MetricsServer::stop() {
+    if(!server.joinable()) {
+        return;
+    }
+    stopping.store(true);
+    server.join();
+    listenPort = 0;
+}
+
+bool MetricsServer::isRunning() const {
+    return listenPort != 0;
+}
+
+int MetricsServer::port() const {
+    return listenPort;
+}
+
+QString MetricsServer::url() const {
+    return isRunning() ? QString("http://127.0.0.1:%1/metrics").arg(listenPort) : QString();
+}
+
+void MetricsServer::run(int port, std::atomic<int> *bound) {
+    QTcpServer listener;
+    if(!listener.listen(QHostAddress::LocalHost, (quint16)port)) {
+        bound->store(0);
+        return;
+    }
+    bound->store(1); //start() returns, bound goes out of scope
+    TRACE_THREAD("metrics server");
+    while(!stopping.load()) {
+        if(!listener.waitForNewConnection(acceptPollMs)) {
+            continue;
+        }
+        TRACE_SCOPE("metrics request");
+        QTcpSocket *socket = listener.nextPendingConnection();
+        QByteArray request;
+        while(!request.contains("\r\n\r\n") && request.size() < maxRequestBytes && socket->waitForReadyRead(requestTimeoutMs)) {
+            request += socket->readAll();
+        }
+        QByteArray status = "200 OK";
+        QByteArray body;
+        if(request.startsWith("GET /metrics")) {
+            body = MetricsRegistry::global().prometheusText();
+        }
+        else if(request.startsWith("GET / ")) {
+            body = "MyGazeQT metrics are at /metrics\n";
+        }
+        else {
+            status = "404 Not Found";
+        }
+        QByteArray response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: "
+                              + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        socket->write(response);
+        socket->waitForBytesWritten(requestTimeoutMs);
+        socket->disconnectFromHost();
+        if(socket->state() != QAbstractSocket::UnconnectedState) {
+            socket->waitForDisconnected(requestTimeoutMs);
+        }
+        delete socket;
+    }
+}
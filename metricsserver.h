@@ -0,0 +1,37 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+//metricsserver.h
+//Serves the metrics registry as Prometheus text on http://127.0.0.1:<port>/metrics. The server runs blocking sockets
+//on its own thread, so it works the same with the widget event loop and in the headless mode that has none, and a
+//slow scraper never stalls the GUI.
+
+#include <QString>
+#include <atomic>
+#include <thread>
+
+static const int defaultMetricsPort = 9464;
+
+class MetricsServer {
+
+public:
+    MetricsServer();
+    ~MetricsServer();
+
+    bool start(int port = defaultMetricsPort); //false if the port cannot be bound on localhost
+    void stop();
+    bool isRunning() const;
+    int port() const;
+    QString url() const; //of the metrics page, empty while stopped
+
+private:
+    MetricsServer(const MetricsServer &);
+    MetricsServer &operator=(const MetricsServer &);
+    void run(int port, std::atomic<int> *bound);
+
+    std::thread server;
+    std::atomic<bool> stopping;
+    int listenPort; //0 while stopped
+};
+
+#endif // METRICSSERVER_H
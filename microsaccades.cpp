@@ -0,0 +1,574 @@
+//microsaccades.cpp
+//Implements the microsaccade stages, the batch detector over recorded sessions and the live stream
+
+#include "microsaccades.h"
+#include "sampleclassifier.h"
+#include "screengeometry.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "threadpool.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MICROSACCADES_SSE2
+#include <emmintrin.h>
+#endif
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+static const int liveThresholdValues = 512; //the live medians are taken over at most this many velocities per axis
+
+//samples a minimum duration covers at rate, at least two
+static int samplesFor(long long microseconds, double rate) {
+    return std::max(2, (int)std::ceil(microseconds * rate / 1e6 - 1e-9));
+}
+
+void MicrosaccadeRun::add(long long time, float x, float y, float vx, float vy) {
+    float squared = vx * vx + vy * vy;
+    if(samples++ == 0) {
+        start = time;
+        startX = minX = maxX = x;
+        startY = minY = maxY = y;
+        peak = squared;
+    }
+    end = time;
+    endX = x;
+    endY = y;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    peak = std::max(peak, squared);
+}
+
+bool MicrosaccadeRun::finish(int minSamples, const MicrosaccadeSettings &settings, int eye, Microsaccade &out) {
+    int length = samples;
+    samples = 0;
+    if(length < minSamples) {
+        return false;
+    }
+    out.trial = 0;
+    out.start = start;
+    out.end = end;
+    out.eyes = eye;
+    out.peakVelocity = std::sqrt(peak);
+    out.amplitude = std::hypot(maxX - minX, maxY - minY);
+    out.dx = endX - startX;
+    out.dy = endY - startY;
+    return out.amplitude <= settings.maxAmplitude;
+}
+
+//a missing centre sample makes the velocity missing too (x * 0 is NaN only for NaN)
+void microsaccadeVelocity(const float *position, int count, double sampleRate, float *velocity) {
+    const float scale = (float)(sampleRate / 6.0);
+    int last = count - 2; //velocities exist for [2, count - 2)
+    int i = 0;
+    for(; i < 2 && i < count; i++) {
+        velocity[i] = missing;
+    }
+#ifdef MICROSACCADES_SSE2
+    const __m128 factor = _mm_set1_ps(scale);
+    const __m128 zero = _mm_setzero_ps();
+    for(; i + 4 <= last; i += 4) {
+        __m128 ahead = _mm_add_ps(_mm_loadu_ps(position + i + 2), _mm_loadu_ps(position + i + 1));
+        __m128 behind = _mm_add_ps(_mm_loadu_ps(position + i - 1), _mm_loadu_ps(position + i - 2));
+        __m128 centre = _mm_mul_ps(_mm_loadu_ps(position + i), zero);
+        _mm_storeu_ps(velocity + i, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(ahead, behind), centre), factor));
+    }
+#endif
+    for(; i < last; i++) {
+        velocity[i] = (position[i + 2] + position[i + 1] - position[i - 1] - position[i - 2] + position[i] * 0.0f) * scale;
+    }
+    for(; i < count; i++) {
+        velocity[i] = missing;
+    }
+}
+
+//median of the first count values, reorders them
+static double medianOf(float *values, int count) {
+    std::nth_element(values, values + count / 2, values + count);
+    return values[count / 2];
+}
+
+static bool axisThreshold(const float *velocity, int count, const MicrosaccadeSettings &settings, double &threshold, std::vector<float> &scratch) {
+    if((int)scratch.size() < count) {
+        scratch.resize(count);
+    }
+    int finite = 0;
+    for(int i = 0; i < count; i++) {
+        if(!std::isnan(velocity[i])) {
+            scratch[finite++] = velocity[i];
+        }
+    }
+    if(finite == 0) {
+        return false;
+    }
+    double median = medianOf(scratch.data(), finite);
+    for(int i = 0; i < finite; i++) {
+        scratch[i] *= scratch[i];
+    }
+    double spread = std::sqrt(std::max(0.0, medianOf(scratch.data(), finite) - median * median));
+    threshold = std::max(settings.lambda * spread, settings.minThreshold);
+    return true;
+}
+
+bool microsaccadeThresholds(const float *vx, const float *vy, int count, const MicrosaccadeSettings &settings,
+                            double &thresholdX, double &thresholdY, std::vector<float> &scratch) {
+    return axisThreshold(vx, count, settings, thresholdX, scratch) && axisThreshold(vy, count, settings, thresholdY, scratch);
+}
+
+void aboveMicrosaccadeThreshold(const float *vx, const float *vy, int count, double thresholdX, double thresholdY, unsigned char *above) {
+    const float inverseX = (float)(1.0 / thresholdX), inverseY = (float)(1.0 / thresholdY);
+    int i = 0;
+#ifdef MICROSACCADES_SSE2
+    const __m128 scaleX = _mm_set1_ps(inverseX), scaleY = _mm_set1_ps(inverseY);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for(; i + 4 <= count; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(vx + i), scaleX);
+        __m128 y = _mm_mul_ps(_mm_loadu_ps(vy + i), scaleY);
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), one)); //false for NaN
+        above[i] = mask & 1;
+        above[i + 1] = (mask >> 1) & 1;
+        above[i + 2] = (mask >> 2) & 1;
+        above[i + 3] = (mask >> 3) & 1;
+    }
+#endif
+    for(; i < count; i++) {
+        float x = vx[i] * inverseX, y = vy[i] * inverseY;
+        above[i] = x * x + y * y > 1.0f;
+    }
+}
+
+void monocularMicrosaccades(const long long *time, const float *x, const float *y, const float *vx, const float *vy, const unsigned char *above,
+                            int count, int minSamples, int eye, const MicrosaccadeSettings &settings, std::vector<Microsaccade> &out) {
+    MicrosaccadeRun run;
+    Microsaccade microsaccade;
+    for(int i = 0; i < count; i++) {
+        if(above[i]) {
+            run.add(time[i], x[i], y[i], vx[i], vy[i]);
+        }
+        else if(run.samples > 0 && run.finish(minSamples, settings, eye, microsaccade)) {
+            out.push_back(microsaccade);
+        }
+    }
+    if(run.samples > 0 && run.finish(minSamples, settings, eye, microsaccade)) {
+        out.push_back(microsaccade);
+    }
+}
+
+static Microsaccade mergeEyes(const Microsaccade &left, const Microsaccade &right) {
+    Microsaccade merged;
+    merged.trial = left.trial;
+    merged.start = std::min(left.start, right.start);
+    merged.end = std::max(left.end, right.end);
+    merged.eyes = LeftEyeTracked | RightEyeTracked;
+    merged.peakVelocity = (left.peakVelocity + right.peakVelocity) / 2;
+    merged.amplitude = (left.amplitude + right.amplitude) / 2;
+    merged.dx = (left.dx + right.dx) / 2;
+    merged.dy = (left.dy + right.dy) / 2;
+    return merged;
+}
+
+//both lists are in time order, each movement is paired at most once
+std::vector<Microsaccade> binocularMicrosaccades(const std::vector<Microsaccade> &left, const std::vector<Microsaccade> &right) {
+    std::vector<Microsaccade> merged;
+    size_t l = 0, r = 0;
+    while(l < left.size() && r < right.size()) {
+        if(left[l].end < right[r].start) {
+            l++;
+        }
+        else if(right[r].end < left[l].start) {
+            r++;
+        }
+        else {
+            merged.push_back(mergeEyes(left[l++], right[r++]));
+        }
+    }
+    return merged;
+}
+
+MicrosaccadeSettings microsaccadePixelSettings(const MicrosaccadeSettings &settings, const VisualAngle &angle) {
+    MicrosaccadeSettings pixels = settings;
+    pixels.maxAmplitude = settings.maxAmplitude * angle.pixelsPerDegree();
+    pixels.minThreshold = settings.minThreshold * angle.pixelsPerDegree();
+    return pixels;
+}
+
+static bool byStart(const Microsaccade &a, const Microsaccade &b) {
+    return a.start < b.start;
+}
+
+//Microsaccade Detector Constructor
+MicrosaccadeDetector::MicrosaccadeDetector(const MicrosaccadeSettings &settings, const VisualAngle &angle) :
+    settings(microsaccadePixelSettings(settings, angle)) {
+}
+
+std::vector<Microsaccade> MicrosaccadeDetector::detect(const SessionReader &session, ThreadPool &pool) const {
+    long long count = session.sampleCount();
+    std::vector<long long> time(count);
+    std::vector<float> position[2][2];
+    std::vector<float> velocity[2][2];
+    for(int e = 0; e < 2; e++) {
+        for(int a = 0; a < 2; a++) {
+            position[e][a].resize(count);
+            velocity[e][a].resize(count);
+        }
+    }
+    long long n = 0;
+    unsigned char masks[512];
+    for(size_t b = 0; b < session.sampleBlocks().size(); b++) {
+        const SampleBlock &block = session.sampleBlocks()[b];
+        for(int first = 0; first < block.count; first += 512) {
+            int length = std::min(512, block.count - first);
+            trackedEyes(block.records + first, length, masks);
+            for(int i = 0; i < length; i++, n++) {
+                const SampleStruct &sample = block.records[first + i];
+                bool left = (masks[i] & LeftEyeTracked) != 0, right = (masks[i] & RightEyeTracked) != 0;
+                time[n] = sample.timestamp;
+                position[0][0][n] = left ? (float)sample.leftEye.gazeX : missing;
+                position[0][1][n] = left ? (float)sample.leftEye.gazeY : missing;
+                position[1][0][n] = right ? (float)sample.rightEye.gazeX : missing;
+                position[1][1][n] = right ? (float)sample.rightEye.gazeY : missing;
+            }
+        }
+    }
+
+    //the nominal rate, or the median sample interval of the start of older recordings without one
+    double rate = session.header().sampleRate;
+    if(rate <= 0 && count > 1) {
+        std::vector<long long> steps;
+        for(long long i = 1; i < std::min(count, 1001LL); i++) {
+            steps.push_back(time[i] - time[i - 1]);
+        }
+        std::nth_element(steps.begin(), steps.begin() + steps.size() / 2, steps.end());
+        rate = steps[steps.size() / 2] > 0 ? 1e6 / steps[steps.size() / 2] : 500;
+    }
+    int minSamples = samplesFor(settings.minDuration, rate);
+    pool.parallelFor(4, 1, [&](long long begin, long long end) {
+        for(long long c = begin; c < end; c++) {
+            microsaccadeVelocity(position[c / 2][c % 2].data(), (int)count, rate, velocity[c / 2][c % 2].data());
+        }
+    });
+
+    //trial boundaries as sample indices
+    std::vector<long long> bounds(1, 0);
+    std::vector<long long> markers;
+    session.forEachEvent([&markers](const EventStruct &event) {
+        if(event.eventType == 'M') {
+            markers.push_back(event.startTime);
+        }
+    });
+    std::sort(markers.begin(), markers.end());
+    if(markers.empty() && count > 0 && settings.trialLength > 0) {
+        for(long long t = time[0] + settings.trialLength; t <= time[count - 1]; t += settings.trialLength) {
+            markers.push_back(t);
+        }
+    }
+    for(size_t m = 0; m < markers.size(); m++) {
+        long long index = std::lower_bound(time.begin(), time.end(), markers[m]) - time.begin();
+        if(index > bounds.back() && index < count) {
+            bounds.push_back(index);
+        }
+    }
+    bounds.push_back(count);
+
+    int trials = (int)bounds.size() - 1;
+    std::vector<std::vector<Microsaccade> > found(trials);
+    pool.parallelFor(trials, 1, [&](long long begin, long long end) {
+        std::vector<float> scratch;
+        std::vector<unsigned char> above;
+        for(long long t = begin; t < end; t++) {
+            long long first = bounds[t];
+            int length = (int)(bounds[t + 1] - first);
+            above.resize(length);
+            std::vector<Microsaccade> eyes[2];
+            for(int e = 0; e < 2; e++) {
+                const float *vx = velocity[e][0].data() + first, *vy = velocity[e][1].data() + first;
+                double thresholdX, thresholdY;
+                if(!microsaccadeThresholds(vx, vy, length, settings, thresholdX, thresholdY, scratch)) {
+                    continue;
+                }
+                aboveMicrosaccadeThreshold(vx, vy, length, thresholdX, thresholdY, above.data());
+                monocularMicrosaccades(time.data() + first, position[e][0].data() + first, position[e][1].data() + first, vx, vy,
+                                       above.data(), length, minSamples, e == 0 ? LeftEyeTracked : RightEyeTracked, settings, eyes[e]);
+            }
+            if(settings.binocular) {
+                found[t] = binocularMicrosaccades(eyes[0], eyes[1]);
+            }
+            else {
+                found[t] = eyes[0];
+                found[t].insert(found[t].end(), eyes[1].begin(), eyes[1].end());
+                std::sort(found[t].begin(), found[t].end(), byStart);
+            }
+            for(size_t i = 0; i < found[t].size(); i++) {
+                found[t][i].trial = (int)t;
+            }
+        }
+    });
+
+    std::vector<Microsaccade> all;
+    for(int t = 0; t < trials; t++) {
+        all.insert(all.end(), found[t].begin(), found[t].end());
+    }
+    return all;
+}
+
+QStringList MicrosaccadeDetector::columns() {
+    return QStringList() << "session" << "participant" << "trial" << "start" << "end" << "duration_ms" << "eyes"
+                         << "peak_velocity" << "amplitude" << "dx" << "dy";
+}
+
+//--microsaccades <directory|session> [--output file] [--lambda n] [--min-duration ms] [--max-amplitude degree] [--trial s]
+//                [--monocular] [--screen WxH] [--geometry stimX,stimY,height,depth,angle] [--distance mm] [--threads n]
+int MicrosaccadeDetector::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microsaccade detection after Engbert and Kliegl");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("microsaccades", "Session file or directory scanned recursively for .mgs sessions.", "path"));
+    parser.addOption(QCommandLineOption("output", "Result table, one row per microsaccade.", "file", "microsaccades.csv"));
+    parser.addOption(QCommandLineOption("lambda", "Velocity threshold in median based standard deviations.", "n", "6"));
+    parser.addOption(QCommandLineOption("min-duration", "Shortest microsaccade.", "ms", "6"));
+    parser.addOption(QCommandLineOption("max-amplitude", "Largest microsaccade amplitude.", "degree", "1"));
+    parser.addOption(QCommandLineOption("trial", "Trial length of sessions without 'M' markers.", "s", "10"));
+    parser.addOption(QCommandLineOption("monocular", "Keep movements found in one eye only."));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels the sessions were recorded on.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("geometry", "Monitor attached geometry: stimulus width and height, device height below and "
+                                                    "depth in front of the screen [mm], inclination [degree].",
+                                        "stimX,stimY,height,depth,angle"));
+    parser.addOption(QCommandLineOption("distance", "Viewing distance.", "mm", "600"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    MicrosaccadeSettings settings;
+    settings.lambda = parser.value("lambda").toDouble();
+    settings.minDuration = (long long)(parser.value("min-duration").toDouble() * 1000);
+    settings.maxAmplitude = parser.value("max-amplitude").toDouble();
+    settings.trialLength = (long long)(parser.value("trial").toDouble() * 1e6);
+    settings.binocular = !parser.isSet("monocular");
+    if(settings.lambda <= 0 || settings.maxAmplitude <= 0 || parser.value("distance").toDouble() <= 0) {
+        qWarning() << "--lambda, --max-amplitude and --distance must be positive";
+        return 1;
+    }
+    ScreenGeometry geometry;
+    if(!ScreenGeometry::fromCommandLine(parser.value("screen"), parser.value("geometry"), &geometry)) {
+        return 1;
+    }
+    MicrosaccadeDetector detector(settings, VisualAngle(geometry, parser.value("distance").toDouble()));
+
+    QString input = parser.value("microsaccades");
+    QStringList sessions = QFileInfo(input).isDir() ? BatchAnalyzer::findSessions(input) : QStringList(input);
+
+    //sessions run as tasks, the trials of each session are spread over the pool again
+    QElapsedTimer timer;
+    timer.start();
+    ThreadPool pool(parser.value("threads").toInt());
+    std::vector<QStringList> rows(sessions.size());
+    std::atomic<long long> samples(0);
+    for(int s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            SessionReader session;
+            if(!session.open(sessions[s])) {
+                qWarning() << "Session could not be opened:" << sessions[s];
+                return;
+            }
+            std::vector<Microsaccade> found = detector.detect(session, pool);
+            samples.fetch_add(session.sampleCount());
+            for(size_t i = 0; i < found.size(); i++) {
+                const Microsaccade &m = found[i];
+                QStringList row;
+                row << sessions[s] << session.participant() << QString::number(m.trial) << QString::number(m.start) << QString::number(m.end)
+                    << QString::number((m.end - m.start) / 1000.0)
+                    << (m.eyes == (LeftEyeTracked | RightEyeTracked) ? "b" : m.eyes == LeftEyeTracked ? "l" : "r")
+                    << QString::number(m.peakVelocity) << QString::number(m.amplitude) << QString::number(m.dx) << QString::number(m.dy);
+                rows[s] << row.join(',');
+            }
+        });
+    }
+    pool.waitForIdle();
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    out << columns().join(',') << '\n';
+    int found = 0;
+    for(size_t s = 0; s < rows.size(); s++) {
+        for(int r = 0; r < rows[s].size(); r++) {
+            out << rows[s][r] << '\n';
+        }
+        found += rows[s].size();
+    }
+    double seconds = timer.elapsed() / 1000.0;
+    qDebug() << "Found" << found << "microsaccades in" << samples.load() << "samples of" << sessions.size() << "sessions in" << seconds << "s,"
+             << (seconds > 0 ? samples.load() / seconds : 0) << "samples/s";
+    return 0;
+}
+
+//Microsaccade Stream Constructor
+MicrosaccadeStream::MicrosaccadeStream(const MicrosaccadeSettings &settings) : degreeSettings(settings), detected(0), publishedRate(0),
+    publishedX(0), publishedY(0) {
+    setVisualAngle(*VisualAngle::current());
+    reset(0);
+}
+
+void MicrosaccadeStream::setVisualAngle(const VisualAngle &angle) {
+    settings = microsaccadePixelSettings(degreeSettings, angle);
+}
+
+void MicrosaccadeStream::reset(int rate) {
+    sampleRate = rate > 0 ? rate : 500;
+    minSamples = samplesFor(settings.minDuration, sampleRate);
+    capacity = std::max(16, (int)(settings.liveWindow * sampleRate / 1e6));
+    for(int e = 0; e < 2; e++) {
+        for(int a = 0; a < 2; a++) {
+            history[e][a].assign(capacity, missing);
+            limits[e][a] = 0;
+        }
+        runs[e] = MicrosaccadeRun();
+        waitingCount[e] = 0;
+    }
+    sampled[0].assign(liveThresholdValues, 0.0f); //sized once, the refreshes do not allocate
+    sampled[1].assign(liveThresholdValues, 0.0f);
+    scratch.assign(liveThresholdValues, 0.0f);
+    next = 0;
+    filled = 0;
+    seen = 0;
+    nextRefresh = 0;
+    firstTime = 0;
+    detected.store(0, std::memory_order_relaxed);
+    publishedRate.store(0, std::memory_order_relaxed);
+    publishedX.store(0, std::memory_order_relaxed);
+    publishedY.store(0, std::memory_order_relaxed);
+}
+
+void MicrosaccadeStream::setListener(std::function<void(const Microsaccade &)> listener) {
+    this->listener = listener;
+}
+
+//the velocity of the sample two before the newest one is complete once the newest arrives
+void MicrosaccadeStream::add(const SampleStruct &sample, int eyes) {
+    memmove(times, times + 1, 4 * sizeof(long long));
+    times[4] = sample.timestamp;
+    const EyeDataStruct *data[2] = { &sample.leftEye, &sample.rightEye };
+    for(int e = 0; e < 2; e++) {
+        bool tracked = (eyes & (1 << e)) != 0;
+        memmove(positions[e][0], positions[e][0] + 1, 4 * sizeof(float));
+        memmove(positions[e][1], positions[e][1] + 1, 4 * sizeof(float));
+        positions[e][0][4] = tracked ? (float)data[e]->gazeX : missing;
+        positions[e][1][4] = tracked ? (float)data[e]->gazeY : missing;
+    }
+    if(seen++ == 0) {
+        firstTime = sample.timestamp;
+    }
+    if(seen < 5) {
+        return;
+    }
+
+    long long time = times[2];
+    float velocity[2][2];
+    const float scale = (float)(sampleRate / 6.0);
+    for(int e = 0; e < 2; e++) {
+        for(int a = 0; a < 2; a++) {
+            const float *p = positions[e][a];
+            velocity[e][a] = (p[4] + p[3] - p[1] - p[0] + p[2] * 0.0f) * scale;
+            history[e][a][next] = velocity[e][a];
+        }
+    }
+    next = next + 1 == capacity ? 0 : next + 1;
+    filled = std::min(filled + 1, capacity);
+    if(time >= nextRefresh && filled >= capacity / 2) {
+        refreshThresholds();
+        nextRefresh = time + settings.liveRefresh;
+    }
+
+    for(int e = 0; e < 2; e++) {
+        if(limits[e][0] <= 0) {
+            continue;
+        }
+        float x = velocity[e][0] / (float)limits[e][0], y = velocity[e][1] / (float)limits[e][1];
+        Microsaccade microsaccade;
+        if(x * x + y * y > 1.0f) { //false while the velocity is missing
+            runs[e].add(time, positions[e][0][2], positions[e][1][2], velocity[e][0], velocity[e][1]);
+        }
+        else if(runs[e].samples > 0 && runs[e].finish(minSamples, settings, 1 << e, microsaccade)) {
+            finished(e, microsaccade);
+        }
+    }
+}
+
+//neighbouring velocities share most of their samples, so a strided subset gives nearly the same medians at a
+//fraction of the selection cost, which keeps the refresh from stalling the sample callback
+void MicrosaccadeStream::refreshThresholds() {
+    int stride = (filled + liveThresholdValues - 1) / liveThresholdValues;
+    for(int e = 0; e < 2; e++) {
+        int values = 0;
+        for(int i = 0; i < filled; i += stride, values++) {
+            sampled[0][values] = history[e][0][i];
+            sampled[1][values] = history[e][1][i];
+        }
+        double thresholdX, thresholdY;
+        if(microsaccadeThresholds(sampled[0].data(), sampled[1].data(), values, settings, thresholdX, thresholdY, scratch)) {
+            limits[e][0] = thresholdX;
+            limits[e][1] = thresholdY;
+        }
+    }
+    int eyes = (limits[0][0] > 0) + (limits[1][0] > 0);
+    if(eyes > 0) {
+        publishedX.store((limits[0][0] + limits[1][0]) / eyes, std::memory_order_relaxed);
+        publishedY.store((limits[0][1] + limits[1][1]) / eyes, std::memory_order_relaxed);
+    }
+}
+
+//binocular detections wait in a small ring for an overlapping one of the other eye, stale entries cannot overlap
+//anything that ends later, so they are simply overwritten
+void MicrosaccadeStream::finished(int eye, const Microsaccade &microsaccade) {
+    if(!settings.binocular) {
+        report(microsaccade);
+        return;
+    }
+    int other = 1 - eye;
+    for(int i = 0; i < std::min(waitingCount[other], 8); i++) {
+        const Microsaccade &candidate = waiting[other][i];
+        if(candidate.start <= microsaccade.end && microsaccade.start <= candidate.end) {
+            report(eye == 0 ? mergeEyes(microsaccade, candidate) : mergeEyes(candidate, microsaccade));
+            waiting[other][i].end = -1; //paired once
+            return;
+        }
+    }
+    waiting[eye][waitingCount[eye]++ % 8] = microsaccade;
+}
+
+void MicrosaccadeStream::report(Microsaccade microsaccade) {
+    microsaccade.trial = 0;
+    long long total = detected.fetch_add(1, std::memory_order_relaxed) + 1;
+    double seconds = (microsaccade.end - firstTime) / 1e6;
+    publishedRate.store(seconds > 0 ? total / seconds : 0, std::memory_order_relaxed);
+    if(listener) {
+        listener(microsaccade);
+    }
+}
+
+long long MicrosaccadeStream::count() const {
+    return detected.load(std::memory_order_relaxed);
+}
+
+double MicrosaccadeStream::rate() const {
+    return publishedRate.load(std::memory_order_relaxed);
+}
+
+double MicrosaccadeStream::thresholdX() const {
+    return publishedX.load(std::memory_order_relaxed);
+}
+
+double MicrosaccadeStream::thresholdY() const {
+    return publishedY.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,146 @@
+#ifndef MICROSACCADES_H
+#define MICROSACCADES_H
+
+//microsaccades.h
+//Microsaccade detection after Engbert and Kliegl (2003): 5 point smoothed 2D velocity, an elliptic threshold of
+//lambda times the median based velocity spread of each trial, a minimum duration and the binocular overlap check.
+//The column passes use SSE2 where available. MicrosaccadeDetector processes the trials of recorded sessions in
+//parallel, MicrosaccadeStream runs the same stages live with thresholds taken over a sliding window. The limits are set
+//in degrees of visual angle and converted once to the pixels the stages work in.
+
+#include <QStringList>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <myGazeAPI.h>
+
+class SessionReader;
+class ThreadPool;
+class VisualAngle;
+
+struct MicrosaccadeSettings {
+    MicrosaccadeSettings() : lambda(6.0), minDuration(6000), maxAmplitude(1.0), minThreshold(0.03), trialLength(10000000),
+        binocular(true), liveWindow(5000000), liveRefresh(500000) {}
+    double lambda;          //threshold as a multiple of the median based velocity spread
+    long long minDuration;  //[microseconds]
+    double maxAmplitude;    //larger movements are saccades [degree]
+    double minThreshold;    //lower bound of the threshold of each axis, keeps noise free data from triggering [degree/s]
+    long long trialLength;  //trial length of recordings without 'M' markers [microseconds]
+    bool binocular;         //keep only movements found in both eyes with temporal overlap
+    long long liveWindow;   //history the live thresholds are taken over [microseconds]
+    long long liveRefresh;  //interval of the live threshold updates [microseconds]
+};
+
+struct Microsaccade {
+    int trial;              //index of the trial in the recording, 0 live
+    long long start;        //tracker time [microseconds]
+    long long end;
+    int eyes;               //TrackedEye bits of the eyes it was found in, binocular values are the mean of both
+    double peakVelocity;    //[pixel/s]
+    double amplitude;       //largest excursion [pixel]
+    double dx;              //displacement from start to end [pixel]
+    double dy;
+};
+
+//candidate above the threshold, accumulated one sample at a time
+struct MicrosaccadeRun {
+    MicrosaccadeRun() : samples(0) {}
+    void add(long long time, float x, float y, float vx, float vy);
+    //true if the finished run lasted at least minSamples and stayed within the amplitude limit
+    bool finish(int minSamples, const MicrosaccadeSettings &settings, int eye, Microsaccade &out);
+
+    int samples;
+    long long start, end;
+    float startX, startY, endX, endY;
+    float minX, maxX, minY, maxY;
+    float peak; //squared velocity
+};
+
+//copy of settings with maxAmplitude and minThreshold converted to pixels at the stimulus centre, as the stages below take them
+MicrosaccadeSettings microsaccadePixelSettings(const MicrosaccadeSettings &settings, const VisualAngle &angle);
+
+//column stages, positions are float columns with NaN where the eye was not tracked
+//(x[i+2] + x[i+1] - x[i-1] - x[i-2]) * rate / 6, NaN within two samples of a gap or the ends
+void microsaccadeVelocity(const float *position, int count, double sampleRate, float *velocity);
+//lambda * sqrt(median(v^2) - median(v)^2) per axis over the finite velocities, false if there are none
+bool microsaccadeThresholds(const float *vx, const float *vy, int count, const MicrosaccadeSettings &settings,
+                            double &thresholdX, double &thresholdY, std::vector<float> &scratch);
+//1 where (vx / thresholdX)^2 + (vy / thresholdY)^2 > 1
+void aboveMicrosaccadeThreshold(const float *vx, const float *vy, int count, double thresholdX, double thresholdY, unsigned char *above);
+void monocularMicrosaccades(const long long *time, const float *x, const float *y, const float *vx, const float *vy, const unsigned char *above,
+                            int count, int minSamples, int eye, const MicrosaccadeSettings &settings, std::vector<Microsaccade> &out);
+//movements of both eyes overlapping in time, merged into one
+std::vector<Microsaccade> binocularMicrosaccades(const std::vector<Microsaccade> &left, const std::vector<Microsaccade> &right);
+
+class MicrosaccadeDetector {
+
+public:
+    //angle converts the degree limits of settings for the screen the sessions were recorded on
+    MicrosaccadeDetector(const MicrosaccadeSettings &settings, const VisualAngle &angle);
+
+    //trials run from one 'M' marker to the next, or over trialLength without markers, and are processed in parallel
+    std::vector<Microsaccade> detect(const SessionReader &session, ThreadPool &pool) const;
+    static QStringList columns(); //result table header
+
+    //entry point of the --microsaccades command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    MicrosaccadeSettings settings; //[pixel]
+};
+
+class MicrosaccadeStream {
+
+public:
+    explicit MicrosaccadeStream(const MicrosaccadeSettings &settings = MicrosaccadeSettings());
+
+    //producer side, must be called from a single thread (the sample callback), reset and setup before streaming
+    void reset(int sampleRate); //0 assumes 500 Hz
+    void setVisualAngle(const VisualAngle &angle); //converts the degree limits, VisualAngle::current() until called
+    void add(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+    //called when a microsaccade has ended, detections lag two samples plus the binocular match
+    void setListener(std::function<void(const Microsaccade &)> listener);
+
+    //lock free and safe to read from any thread
+    long long count() const;
+    double rate() const; //microsaccades per second of stream
+    double thresholdX() const; //current velocity thresholds, mean of the eyes [pixel/s], 0 until the window is half full
+    double thresholdY() const;
+
+private:
+    void refreshThresholds();
+    void report(Microsaccade microsaccade);
+    void finished(int eye, const Microsaccade &microsaccade);
+
+    MicrosaccadeSettings degreeSettings; //as given
+    MicrosaccadeSettings settings;       //limits converted to pixels
+    double sampleRate;
+    int minSamples;
+    int capacity;     //velocities kept for the thresholds
+    std::function<void(const Microsaccade &)> listener;
+
+    //last five positions and timestamps, newest last
+    float positions[2][2][5]; //[eye][axis]
+    long long times[5];
+    int seen;
+    //velocity history of each eye and axis, ring of capacity values
+    std::vector<float> history[2][2];
+    int next;
+    int filled;
+    std::vector<float> sampled[2]; //every few velocities of the history, the thresholds are taken over these
+    std::vector<float> scratch;
+    long long nextRefresh;
+    double limits[2][2]; //velocity threshold of each eye and axis, 0 until the first refresh
+    MicrosaccadeRun runs[2];
+    //monocular detections waiting for an overlapping one of the other eye
+    Microsaccade waiting[2][8];
+    int waitingCount[2];
+    long long firstTime;
+
+    std::atomic<long long> detected;
+    std::atomic<double> publishedRate;
+    std::atomic<double> publishedX;
+    std::atomic<double> publishedY;
+};
+
+#endif // MICROSACCADES_H
@@ -12,41 +12,62 @@
 #include <iostream>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <QMessageBox>
 #include <QDebug>
 #include <QLCDNumber>
 #include <thread>
 #include <QThread>
 #include <Windows.h>
-
-//create new struct variables for calibration, accuracy, and system info data sets
-CalibrationStruct calibrationData;
-AccuracyStruct accuracyData;
-SystemInfoStruct systemInfoData;
-
-// Create and define values for device status identifiers
-// which will be later checked against defined status constants
-// in the myGazeAPI in order to determine the devices state
-int ret_calibrate = 0;
-int ret_validate = 0;
-int ret_connect = 0;
-
-double sLeftEyeX = 0;
-double sLeftEyeY = 0;
-double sRightEyeX = 0;
-double sRightEyeY = 0;
-double eLeftEyeX = 0;
-double eLeftEyeY = 0;
-double eRightEyeX = 0;
-double eRightEyeY = 0;
+#include "trackersession.h"
+#include "gazesource.h"
+#include "calibrationcache.h"
+#include "metricsserver.h"
+#include "diagnosticspanel.h"
+#include "tracing.h"
+#include "validationtargets.h"
+#include <QDateTime>
+#include <QGuiApplication>
+#include <QScreen>
+#include <QDir>
+#include <QTimer>
+#include <QShortcut>
 
 //MyGaze Widget UI Setup Constructor
-MyGazeQTWidget::MyGazeQTWidget(QWidget *parent) : QWidget(parent), ui(new Ui::MyGazeQTWidget) {
+MyGazeQTWidget::MyGazeQTWidget(QWidget *parent) : QWidget(parent), ui(new Ui::MyGazeQTWidget), session(new TrackerSession(new MyGazeSource())),
+    metricsServer(new MetricsServer()), calibrationCache(new CalibrationCache()), diagnostics(0) {
     ui->setupUi(this);
+    session->setLogSamples(true);
+    SessionRecorder::recoverDirectory("sessions"); //repairs recordings a crash left open
+    if(metricsServer->start(defaultMetricsPort)) {
+        qDebug() << "Metrics served at" << metricsServer->url();
+    }
+
+    //the displays read the lock free session state, so a GUI timer is enough
+    displayTimer = new QTimer(this);
+    connect(displayTimer, &QTimer::timeout, this, &MyGazeQTWidget::numDisplayUpdater);
+    displayTimer->start(100);
+
+    //validation targets again at any time of the session, e.g. after the participant moved
+    QShortcut *validationShortcut = new QShortcut(QKeySequence("Ctrl+T"), this);
+    connect(validationShortcut, &QShortcut::activated, this, &MyGazeQTWidget::showValidationTargets);
+
+    //Ctrl+1 to Ctrl+9 record an experiment event marker with that code
+    for(int code = 1; code <= 9; code++) {
+        QShortcut *markerShortcut = new QShortcut(QKeySequence(QString("Ctrl+%1").arg(code)), this);
+        connect(markerShortcut, &QShortcut::activated, this, [this, code]() {
+            if(session->isStreaming()) {
+                session->addMarkerNow(code);
+            }
+        });
+    }
 }
 
 //MyGaze Widget Destructor
 MyGazeQTWidget::~MyGazeQTWidget() {
+    delete metricsServer;
+    delete calibrationCache;
+    delete session;
     delete ui;
 }
 
@@ -58,14 +79,18 @@ void MyGazeQTWidget::on_connectButton_clicked() {
     ui->connectButton->setEnabled(false);
     connectEyetracker();
 
-    //start calibration process
-    //ui->connectButton->setText("Calibrating...");
-    //if(ret_connect == RET_SUCCESS) {
-    //    calibrateEyetracker();
-    //}
+    //reuse a recent calibration of this participant, otherwise run the full calibration process
+    bool calibrated = false;
+    if(session->isConnected()) {
+        ui->connectButton->setText("Calibrating...");
+        calibrated = calibrateEyetracker();
+        if(!calibrated) {
+            session->disconnect(); //the next click starts over with a fresh connection
+        }
+    }
 
     //update button text to connected or reset if connection or calibration fails
-    if(ret_connect == RET_SUCCESS ) {
+    if(calibrated) {
         ui->connectButton->setText("Connected");
         ui->startSessionButton->setEnabled(true);
     }
@@ -75,25 +100,9 @@ void MyGazeQTWidget::on_connectButton_clicked() {
     }
 }
 
-//static callback function to refresh sample data
-int MyGazeQTWidget::sampleCallbackFunction(SampleStruct sampleData) {
-
-    sLeftEyeX = sampleData.leftEye.gazeX;
-    sLeftEyeY = sampleData.leftEye.gazeY;
-    sRightEyeX = sampleData.rightEye.gazeX;
-    sRightEyeY = sampleData.rightEye.gazeY;
-
-    //log left and right eye sample coordinates
-    qDebug() << "Left eye X: " << sampleData.leftEye.gazeX << " Left eye Y: " << sampleData.leftEye.gazeY << "\n";
-    qDebug() << "Right eye X: " << sampleData.rightEye.gazeX << " Right eye Y: " << sampleData.rightEye.gazeY<< "\n";
-    return 1; //returns successful operation status
-}
-
-//static callback function to refresh event data
-int MyGazeQTWidget::eventCallbackFunction(EventStruct eventData)
-{
-    qDebug() << "Fixation event - X: " << eventData.positionX << " Y: " << eventData.positionY << "\n"; //log event data
-    return 1; //returns successful operation status
+//gives consumers access to the resampled gaze stream, clock mapping and device status
+TrackerSession &MyGazeQTWidget::trackerSession() const {
+    return *session;
 }
 
 //Starts an eyetracking session and logs data to file
@@ -104,55 +113,52 @@ void MyGazeQTWidget::on_startSessionButton_clicked() {
     iV_GetSample(&currentSample); //get the sample data and store in currentSample
     iV_GetEvent(&currentEvent);   //get the event data and store in currentEvent
 
-    pDLLSetSample setSample = &MyGazeQTWidget::sampleCallbackFunction;
-    pDLLSetEvent setEvent = &MyGazeQTWidget::eventCallbackFunction;
+    //record into sessions/ next to the working directory, one file per session
+    QDir().mkpath("sessions");
+    QString sessionPath = QDir("sessions").filePath("session_" + QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss") + ".mgs");
+    session->stopStreaming(); //a new session replaces the running one
+    session->startStreaming(sessionPath, ui->participantLineEdit->text().trimmed()); //routes the sample and event callbacks to this session
 
-    iV_SetSampleCallback(setSample); // pass sample callback function into setup function
-    iV_SetEventCallback(setEvent); //pass event callback function into setup function
+    //every session starts with a validation, the head movement compensation fits its model to the targets
+    showValidationTargets();
 }
 
-//Open settings pannel (calibration data, toggle switches for different output)
-void MyGazeQTWidget::on_settingsButton_clicked() {
-    //TODO
+void MyGazeQTWidget::showValidationTargets() {
+    if(!session->isStreaming()) {
+        return;
+    }
+    ValidationTargets *targets = new ValidationTargets(session, this);
+    targets->start();
 }
 
-//In progress: Sets up calibration of the eyetracking device and validates the calibration data
-void MyGazeQTWidget::calibrateEyetracker() {
-    iV_SetupCalibration(&calibrationData);
-    ret_calibrate = iV_Calibrate(); //get calibration status
-    if (ret_calibrate == RET_SUCCESS) {
-        qDebug() << "Calibration done successfully"; //update debug log
-        ret_validate = iV_Validate(); //validate calibration data
-        if (ret_validate == RET_SUCCESS) {
-            //  read out the accuracy values
-            if (iV_GetAccuracy(&accuracyData) == RET_SUCCESS) {
-                qDebug() << "AccuracyData - dev left X: " << accuracyData.deviationLX << " dev left Y: " << accuracyData.deviationLY;
-            }
-        }
-        else {
-            qDebug() << "Validation could not be finished: " << ret_validate ;
-            displayErrorMessageBox();
-            return;
-        }
+//Opens the diagnostics panel: the live metrics of the session (callbacks, loss, recording, memory budget) with their rates
+void MyGazeQTWidget::on_settingsButton_clicked() {
+    if(!diagnostics) {
+        diagnostics = new DiagnosticsPanel(metricsServer, this);
     }
-    else {
-        qDebug() << "Calibration could not be finished: " << ret_calibrate ; //write status to debug log
+    diagnostics->show();
+    diagnostics->raise();
+    diagnostics->activateWindow();
+}
+
+//Sets up calibration of the eyetracking device and validates the calibration data, false if either failed
+bool MyGazeQTWidget::calibrateEyetracker() {
+    QString participant = ui->participantLineEdit->text().trimmed();
+    if(session->calibrateWithCache(*calibrationCache, participant) != RET_SUCCESS) {
         displayErrorMessageBox();
-        return;
+        return false;
     }
+    return true;
 }
 
 //Connects MyGaze EyeTracker to the MyGaze Server and returns int status
 void MyGazeQTWidget::connectEyetracker() {
-    iV_Start();
-
-    //Connect to the eye tracking server and print the outcome to console
-    ret_connect = iV_Connect();
-    if(ret_connect == RET_SUCCESS) {
-        qDebug() << "Eyetracker Connected"; //write connection status to debug log
+    QScreen *screen = QGuiApplication::primaryScreen(); //gaze is reported in device pixels of the primary screen
+    if(screen) {
+        session->setScreenSize((int)(screen->geometry().width() * screen->devicePixelRatio()),
+                               (int)(screen->geometry().height() * screen->devicePixelRatio()));
     }
-    else {
-        qDebug() << "Eyetracker Could Not Be Connected";
+    if(session->connect() != RET_SUCCESS) {
         displayErrorMessageBox();
     }
 }
@@ -160,6 +166,8 @@ void MyGazeQTWidget::connectEyetracker() {
 //Displays a messagebox with appropiate error message
 void MyGazeQTWidget::displayErrorMessageBox() {
     QMessageBox *msgBox = new QMessageBox();
+    int ret_connect = session->connectStatus();
+    int ret_calibrate = session->calibrateStatus();
 
     if(ret_connect == ERR_CONNECTION_NOT_ESTABLISHED) {
         msgBox->setText("Connection Error: Connection to eye tracking hardware was not established.");
@@ -194,7 +202,59 @@ void MyGazeQTWidget::displayErrorMessageBox() {
     msgBox->exec();
 }
 
+//shows a value with the given decimals, values that cannot be measured yet (-1) as a dash
+static void displayValue(QLCDNumber *number, double value, int decimals) {
+    if(value < 0) {
+        number->display("-");
+    }
+    else {
+        number->display(QString::number(value, 'f', decimals));
+    }
+}
+
+//Updates the number displays with the live gaze and the data quality of the session
+void MyGazeQTWidget::numDisplayUpdater() {
+    TRACE_SCOPE("display update");
+    if(!session->isStreaming()) {
+        return;
+    }
+    session->advanceResampledGaze(); //stalled input still closes ticks when no fixed rate consumer is attached
+    QualityMonitor &quality = session->quality();
+    ui->gazeXNumber->display((int)((session->leftGazeX() + session->rightGazeX()) / 2));
+    ui->gazeYNumber->display((int)((session->leftGazeY() + session->rightGazeY()) / 2));
+    displayValue(ui->rmsNumber, quality.rmsS2S(), 2); //degrees
+    displayValue(ui->stdNumber, quality.stdPrecision(), 2);
+    displayValue(ui->lossNumber, quality.lossPercent(), 1);
+    displayValue(ui->accuracyNumber, quality.accuracy(), 2);
+
+    //calibration deviation as reported by the server, followed by the raised alerts
+    QString status;
+    if(session->validateStatus() == RET_SUCCESS) {
+        const AccuracyStruct &accuracy = session->accuracy();
+        status = QString("Calibration deviation L %1/%2 R %3/%4 deg").arg(accuracy.deviationLX, 0, 'f', 2).arg(accuracy.deviationLY, 0, 'f', 2)
+                     .arg(accuracy.deviationRX, 0, 'f', 2).arg(accuracy.deviationRY, 0, 'f', 2);
+    }
+    int alerts = quality.activeAlerts();
+    QStringList raised;
+    for(int metric = 0; metric < QualityMetricCount; metric++) {
+        if(alerts & (1 << metric)) {
+            raised << qualityMetricName((QualityMetric)metric);
+        }
+    }
+    if(!raised.isEmpty()) {
+        status += (status.isEmpty() ? "" : "\n") + QString("Quality alert: ") + raised.join(", ");
+    }
+    MemoryBudget &budget = MemoryBudget::global(); //items the full buffers gave up or moved to disk since start
+    if(budget.dropped() > 0 || budget.spilled() > 0 || budget.blocked() > 0) {
+        status += (status.isEmpty() ? "" : "\n") + QString("Buffers: %1 dropped, %2 spilled, %3 blocked").arg(budget.dropped())
+                      .arg(budget.spilled()).arg(budget.blocked());
+    }
+    ui->qualityStatusLabel->setText(status.isEmpty() ? "Streaming" : status);
+    ui->qualityStatusLabel->setStyleSheet(raised.isEmpty() ? "" : "color: red;");
+}
+
 void MyGazeQTWidget::on_quitButton_clicked() {
-    iV_Disconnect(); //disconnect hardware from server
+    session->stopStreaming(); //stop the data streams before the recorder is closed
+    session->disconnect(); //disconnect hardware from server
     QApplication::quit(); //quit qt application
 }
@@ -4,6 +4,12 @@
 #include <QWidget>
 #include <myGazeAPI.h>
 
+class TrackerSession;
+class MetricsServer;
+class CalibrationCache;
+class DiagnosticsPanel;
+class QTimer;
+
 namespace Ui {
     class MyGazeQTWidget;
 }
@@ -14,11 +20,14 @@ class MyGazeQTWidget : public QWidget {
 public:
     explicit MyGazeQTWidget(QWidget *parent = 0);
     ~MyGazeQTWidget();
+    //gives consumers access to the resampled stream, clock mapping and status,
+    //fixed rate consumers call advanceResampledGaze() on every tick
+    TrackerSession &trackerSession() const;
 
 
 protected:
     void connectEyetracker();
-    void calibrateEyetracker();
+    bool calibrateEyetracker();
     void displayErrorMessageBox();
 
 private slots:
@@ -30,9 +39,13 @@ private slots:
 
 private:
     Ui::MyGazeQTWidget *ui;
-    static int sampleCallbackFunction(SampleStruct);
-    static int eventCallbackFunction(EventStruct);
+    TrackerSession *session;
+    QTimer *displayTimer;
+    MetricsServer *metricsServer;
+    CalibrationCache *calibrationCache; //calibrations saved per participant and geometry profile, reloaded instead of recalibrating
+    DiagnosticsPanel *diagnostics; //created on the first click on settings
     void numDisplayUpdater();
+    void showValidationTargets(); //while streaming, feeds the accuracy monitor and the head movement compensation
 };
 
 #endif // MYGAZEQTWIDGET_H
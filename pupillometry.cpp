@@ -0,0 +1,553 @@
+//pupillometry.cpp
+//Implements the pupil diameter stages, the batch processor over recorded sessions and the live stream
+
+#include "pupillometry.h"
+#include "sampleclassifier.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "threadpool.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PUPILLOMETRY_SSE2
+#include <emmintrin.h>
+#endif
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+static const double pi = 3.14159265358979323846;
+
+//memory held by a finished epoch of the live stream
+static long long epochBytes(const PupilEpoch &epoch) {
+    return sizeof(PupilEpoch) + epoch.bins.size() * sizeof(float) + epoch.label.size() * 2;
+}
+
+//microseconds to a sample count at rate
+static int samplesFor(long long microseconds, int rate) {
+    return (int)(microseconds * rate / 1000000);
+}
+
+std::vector<float> pupilLowPassKernel(int sampleRate, double cutoff) {
+    if(cutoff <= 0 || cutoff * 2 >= sampleRate) {
+        return std::vector<float>(1, 1.0f);
+    }
+    int half = std::max(1, (int)std::lround(sampleRate / cutoff)); //the Hamming transition band, 3.3 * rate / taps, is about 1.6 times the cutoff
+    double fc = cutoff / sampleRate;
+    std::vector<double> taps(2 * half + 1);
+    double sum = 0;
+    for(int n = -half; n <= half; n++) {
+        double sinc = n == 0 ? 2 * fc : std::sin(2 * pi * fc * n) / (pi * n);
+        double window = 0.54 + 0.46 * std::cos(pi * n / half);
+        taps[n + half] = sinc * window;
+        sum += taps[n + half];
+    }
+    std::vector<float> kernel(taps.size());
+    for(size_t i = 0; i < taps.size(); i++) {
+        kernel[i] = (float)(taps[i] / sum);
+    }
+    return kernel;
+}
+
+void extractPupilColumns(const SampleStruct *samples, int count, const PupilSettings &settings, long long *time, float *left, float *right) {
+    unsigned char masks[512];
+    for(int first = 0; first < count; first += 512) {
+        int n = std::min(512, count - first);
+        trackedEyes(samples + first, n, masks);
+        for(int i = 0; i < n; i++) {
+            const SampleStruct &sample = samples[first + i];
+            double l = sample.leftEye.diam, r = sample.rightEye.diam;
+            time[first + i] = sample.timestamp;
+            left[first + i] = (masks[i] & LeftEyeTracked) && l >= settings.minDiameter && l <= settings.maxDiameter ? (float)l : missing;
+            right[first + i] = (masks[i] & RightEyeTracked) && r >= settings.minDiameter && r <= settings.maxDiameter ? (float)r : missing;
+        }
+    }
+}
+
+//gaps are widened by padding on both sides, gaps whose padding touches are joined, then every gap of at most
+//maxGap samples with data on both sides is bridged linearly, gaps at the ends stay missing. Single pass
+//without allocation since the live stream runs it on every step.
+int interpolatePupilGaps(float *values, int count, int padding, int maxGap) {
+    int filled = 0;
+    int i = 0;
+    while(i < count) {
+        if(!std::isnan(values[i])) {
+            i++;
+            continue;
+        }
+        int begin = std::max(0, i - padding);
+        int last = i; //last missing value of the joined gap
+        for(int j = i + 1; j < count && j <= last + 2 * padding + 1; j++) {
+            if(std::isnan(values[j])) {
+                last = j;
+            }
+        }
+        int end = std::min(count, last + 1 + padding);
+        if(begin > 0 && end < count && end - begin <= maxGap) {
+            float from = values[begin - 1], to = values[end];
+            float step = (to - from) / (end - begin + 1);
+            for(int k = begin; k < end; k++) {
+                values[k] = from + step * (k - begin + 1);
+            }
+            filled++;
+        }
+        else {
+            std::fill(values + begin, values + end, missing);
+        }
+        i = end;
+    }
+    return filled;
+}
+
+//sixteen outputs are accumulated in four registers over all taps, so each tap costs one broadcast and four
+//unaligned loads and the output is written once, the rest of the range is done one output at a time
+void filterPupil(const float *in, const std::vector<float> &kernel, int first, int last, float *out) {
+    int half = (int)kernel.size() / 2;
+    int taps = (int)kernel.size();
+    const float *weights = kernel.data();
+    int i = first;
+#ifdef PUPILLOMETRY_SSE2
+    for(; i + 16 <= last; i += 16) {
+        __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+        const float *source = in + i - half;
+        for(int t = 0; t < taps; t++) {
+            __m128 w = _mm_set1_ps(weights[t]);
+            a0 = _mm_add_ps(a0, _mm_mul_ps(w, _mm_loadu_ps(source + t)));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(w, _mm_loadu_ps(source + t + 4)));
+            a2 = _mm_add_ps(a2, _mm_mul_ps(w, _mm_loadu_ps(source + t + 8)));
+            a3 = _mm_add_ps(a3, _mm_mul_ps(w, _mm_loadu_ps(source + t + 12)));
+        }
+        _mm_storeu_ps(out + i - first, a0);
+        _mm_storeu_ps(out + i - first + 4, a1);
+        _mm_storeu_ps(out + i - first + 8, a2);
+        _mm_storeu_ps(out + i - first + 12, a3);
+    }
+#endif
+    for(; i < last; i++) {
+        const float *source = in + i - half;
+        float sum = 0;
+        for(int t = 0; t < taps; t++) {
+            sum += weights[t] * source[t];
+        }
+        out[i - first] = sum;
+    }
+}
+
+void combinePupils(const float *left, const float *right, int count, float *diameter) {
+    for(int i = 0; i < count; i++) {
+        bool l = !std::isnan(left[i]), r = !std::isnan(right[i]);
+        diameter[i] = l && r ? (left[i] + right[i]) * 0.5f : (l ? left[i] : right[i]);
+    }
+}
+
+bool cutPupilEpoch(const long long *time, const float *diameter, int count, const PupilMarker &marker, const PupilSettings &settings,
+                   PupilEpoch &epoch) {
+    const long long *end = time + count;
+    const long long *epochBegin = std::lower_bound(time, end, marker.time + settings.epochStart);
+    const long long *epochEnd = std::lower_bound(time, end, marker.time + settings.epochEnd);
+    if(epochBegin == epochEnd) {
+        return false;
+    }
+
+    double sum = 0;
+    int used = 0;
+    const long long *baselineBegin = std::lower_bound(time, end, marker.time + settings.baselineStart);
+    const long long *baselineEnd = std::lower_bound(time, end, marker.time + settings.baselineEnd);
+    for(const long long *t = baselineBegin; t < baselineEnd; t++) {
+        float value = diameter[t - time];
+        if(!std::isnan(value)) {
+            sum += value;
+            used++;
+        }
+    }
+    epoch.marker = marker.time;
+    epoch.label = marker.label;
+    epoch.baseline = used ? sum / used : std::numeric_limits<double>::quiet_NaN();
+
+    int bins = std::max(1, (int)((settings.epochEnd - settings.epochStart) / std::max(1LL, settings.bin)));
+    std::vector<double> sums(bins, 0.0);
+    std::vector<int> counts(bins, 0);
+    int valid = 0;
+    for(const long long *t = epochBegin; t < epochEnd; t++) {
+        float value = diameter[t - time];
+        if(std::isnan(value)) {
+            continue;
+        }
+        int bin = std::min(bins - 1, (int)((*t - marker.time - settings.epochStart) / std::max(1LL, settings.bin)));
+        sums[bin] += value;
+        counts[bin]++;
+        valid++;
+    }
+    epoch.valid = (double)valid / (epochEnd - epochBegin);
+    epoch.bins.assign(bins, missing);
+    for(int b = 0; b < bins; b++) {
+        if(counts[b] && used) {
+            double mean = sums[b] / counts[b];
+            epoch.bins[b] = (float)(settings.divisive ? mean / epoch.baseline : mean - epoch.baseline);
+        }
+    }
+    return true;
+}
+
+//Pupil Processor Constructor
+PupilProcessor::PupilProcessor(const PupilSettings &settings) : settings(settings) {
+}
+
+void PupilProcessor::process(const SessionReader &session, PupilTrace &trace) const {
+    int count = (int)session.sampleCount();
+    trace.time.resize(count);
+    trace.left.resize(count);
+    trace.right.resize(count);
+    trace.diameter.resize(count);
+    int offset = 0;
+    const std::vector<SampleBlock> &blocks = session.sampleBlocks();
+    for(size_t b = 0; b < blocks.size(); b++) {
+        extractPupilColumns(blocks[b].records, blocks[b].count, settings, &trace.time[offset], &trace.left[offset], &trace.right[offset]);
+        offset += blocks[b].count;
+    }
+    if(count < 2) {
+        return;
+    }
+
+    //the rate of the header, or the mean spacing for sessions recorded without one
+    int rate = session.header().sampleRate;
+    if(rate <= 0) {
+        rate = std::max(1, (int)std::lround((count - 1) * 1e6 / std::max(1LL, trace.time.back() - trace.time.front())));
+    }
+    std::vector<float> kernel = pupilLowPassKernel(rate, settings.cutoff);
+    int half = (int)kernel.size() / 2;
+    std::vector<float> padded(count + 2 * half);
+    std::vector<float> *eyes[2] = { &trace.left, &trace.right };
+    for(int e = 0; e < 2; e++) {
+        std::vector<float> &values = *eyes[e];
+        interpolatePupilGaps(values.data(), count, samplesFor(settings.padding, rate), samplesFor(settings.maxGap, rate));
+        std::fill(padded.begin(), padded.begin() + half, values.front()); //the ends are held for the filter
+        std::copy(values.begin(), values.end(), padded.begin() + half);
+        std::fill(padded.begin() + half + count, padded.end(), values.back());
+        filterPupil(padded.data(), kernel, half, half + count, values.data());
+    }
+    combinePupils(trace.left.data(), trace.right.data(), count, trace.diameter.data());
+}
+
+std::vector<PupilEpoch> PupilProcessor::epochs(const PupilTrace &trace, const std::vector<PupilMarker> &markers) const {
+    std::vector<PupilEpoch> result;
+    for(size_t m = 0; m < markers.size(); m++) {
+        PupilEpoch epoch;
+        if(cutPupilEpoch(trace.time.data(), trace.diameter.data(), (int)trace.time.size(), markers[m], settings, epoch)) {
+            result.push_back(epoch);
+        }
+    }
+    return result;
+}
+
+std::vector<PupilMarker> PupilProcessor::sessionMarkers(const SessionReader &session) {
+    std::vector<PupilMarker> markers;
+    session.forEachEvent([&markers](const EventStruct &event) {
+        if(event.eventType == 'M') {
+            PupilMarker marker;
+            marker.time = event.startTime;
+            marker.label = QString::number((int)event.positionX);
+            markers.push_back(marker);
+        }
+    });
+    return markers;
+}
+
+std::vector<PupilMarker> PupilProcessor::loadMarkers(const QString &path) {
+    std::vector<PupilMarker> markers;
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return markers;
+    }
+    QTextStream in(&file);
+    while(!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QStringList fields = line.split(QRegExp("\\s+"));
+        PupilMarker marker;
+        marker.time = fields[0].toLongLong();
+        marker.label = fields.size() > 1 ? fields[1] : QString();
+        markers.push_back(marker);
+    }
+    return markers;
+}
+
+QStringList PupilProcessor::columns() const {
+    QStringList names;
+    names << "session" << "participant" << "marker" << "label" << "baseline_mm" << "valid";
+    int bins = std::max(1, (int)((settings.epochEnd - settings.epochStart) / std::max(1LL, settings.bin)));
+    for(int b = 0; b < bins; b++) {
+        names << QString("t%1").arg((settings.epochStart + b * settings.bin) / 1000); //bin start relative to the marker [ms]
+    }
+    return names;
+}
+
+//--pupil <directory|session> [--output file] [--markers file] [--cutoff hz] [--baseline from,to] [--epoch from,to]
+//        [--bin ms] [--max-gap ms] [--divisive] [--threads n]
+int PupilProcessor::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Baseline corrected pupil epochs around event markers");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("pupil", "Session file or directory scanned recursively for .mgs sessions.", "path"));
+    parser.addOption(QCommandLineOption("output", "Epoch table, one row per marker.", "file", "pupil.csv"));
+    parser.addOption(QCommandLineOption("markers", "Marker file (\"timestamp label\" per line) used instead of the 'M' events of a single session.", "file"));
+    parser.addOption(QCommandLineOption("cutoff", "Low pass cutoff, 0 disables the filter.", "hz", "10"));
+    parser.addOption(QCommandLineOption("baseline", "Baseline window relative to the marker.", "from,to ms", "-200,0"));
+    parser.addOption(QCommandLineOption("epoch", "Epoch window relative to the marker.", "from,to ms", "-200,3000"));
+    parser.addOption(QCommandLineOption("bin", "Epoch bin length.", "ms", "20"));
+    parser.addOption(QCommandLineOption("max-gap", "Longest gap that is interpolated.", "ms", "500"));
+    parser.addOption(QCommandLineOption("divisive", "Divide by the baseline instead of subtracting it."));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    PupilSettings settings;
+    QStringList baseline = parser.value("baseline").split(',');
+    QStringList epoch = parser.value("epoch").split(',');
+    if(baseline.size() != 2 || epoch.size() != 2 || parser.value("bin").toInt() <= 0) {
+        qWarning() << "--baseline and --epoch take from,to in milliseconds and --bin must be positive";
+        return 1;
+    }
+    settings.baselineStart = baseline[0].toLongLong() * 1000;
+    settings.baselineEnd = baseline[1].toLongLong() * 1000;
+    settings.epochStart = epoch[0].toLongLong() * 1000;
+    settings.epochEnd = epoch[1].toLongLong() * 1000;
+    settings.bin = parser.value("bin").toLongLong() * 1000;
+    settings.cutoff = parser.value("cutoff").toDouble();
+    settings.maxGap = parser.value("max-gap").toLongLong() * 1000;
+    settings.divisive = parser.isSet("divisive");
+    PupilProcessor processor(settings);
+
+    QString input = parser.value("pupil");
+    QStringList sessions = QFileInfo(input).isDir() ? BatchAnalyzer::findSessions(input) : QStringList(input);
+    if(parser.isSet("markers") && sessions.size() != 1) {
+        qWarning() << "--markers applies to a single session";
+        return 1;
+    }
+    std::vector<PupilMarker> fileMarkers = parser.isSet("markers") ? loadMarkers(parser.value("markers")) : std::vector<PupilMarker>();
+
+    //every session is processed on its own task, rows are collected per session to keep the output in order
+    QElapsedTimer timer;
+    timer.start();
+    ThreadPool pool(parser.value("threads").toInt());
+    std::vector<QStringList> rows(sessions.size());
+    std::atomic<long long> samples(0);
+    for(int s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            SessionReader session;
+            if(!session.open(sessions[s])) {
+                qWarning() << "Session could not be opened:" << sessions[s];
+                return;
+            }
+            PupilTrace trace;
+            processor.process(session, trace);
+            samples.fetch_add(session.sampleCount());
+            std::vector<PupilEpoch> epochs = processor.epochs(trace, fileMarkers.empty() ? sessionMarkers(session) : fileMarkers);
+            for(size_t e = 0; e < epochs.size(); e++) {
+                QStringList row;
+                row << sessions[s] << session.participant() << QString::number(epochs[e].marker) << epochs[e].label
+                    << QString::number(epochs[e].baseline) << QString::number(epochs[e].valid);
+                for(size_t b = 0; b < epochs[e].bins.size(); b++) {
+                    row << (std::isnan(epochs[e].bins[b]) ? QString() : QString::number(epochs[e].bins[b]));
+                }
+                rows[s] << row.join(',');
+            }
+        });
+    }
+    pool.waitForIdle();
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    out << processor.columns().join(',') << '\n';
+    int epochs = 0;
+    for(size_t s = 0; s < rows.size(); s++) {
+        for(int r = 0; r < rows[s].size(); r++) {
+            out << rows[s][r] << '\n';
+        }
+        epochs += rows[s].size();
+    }
+    double seconds = timer.elapsed() / 1000.0;
+    qDebug() << "Processed" << samples.load() << "samples of" << sessions.size() << "sessions into" << epochs << "epochs in" << seconds << "s,"
+             << (seconds > 0 ? samples.load() / seconds : 0) << "samples/s";
+    return 0;
+}
+
+//Pupil Stream Constructor
+PupilStream::PupilStream(const PupilSettings &settings) : settings(settings),
+    epochAccount(MemoryBudget::global().account("pupil epochs", settings.epochMemory, DropOldest)), latestDiameter(0), latestTime(0) {
+    reset(0);
+}
+
+//the window holds context raw samples already output, then delay + chunk samples waiting, so every output
+//sample sees the same neighbourhood the batch processor would up to the delay
+void PupilStream::reset(int sampleRate) {
+    rate = sampleRate > 0 ? sampleRate : 500;
+    kernel = pupilLowPassKernel(rate, settings.cutoff);
+    int half = (int)kernel.size() / 2;
+    padding = samplesFor(settings.padding, rate);
+    maxGap = samplesFor(settings.maxGap, rate);
+    chunk = (rate / 50 + 15) / 16 * 16; //about 20 ms, whole filter blocks
+    delay = std::max(samplesFor(settings.liveDelay, rate), half + padding + 1);
+    context = half + padding + maxGap + 1;
+    delayTime = (long long)delay * 1000000 / rate;
+
+    int window = context + delay + chunk;
+    rawTime.assign(context, 0); //missing context until real samples arrive, the first outputs start after it
+    rawLeft.assign(context, missing);
+    rawRight.assign(context, missing);
+    rawTime.reserve(2 * window);
+    rawLeft.reserve(2 * window);
+    rawRight.reserve(2 * window);
+    pending = 0;
+    scratchLeft.resize(2 * window);
+    scratchRight.resize(2 * window);
+    filteredLeft.resize(chunk);
+    filteredRight.resize(chunk);
+
+    long long keep = settings.epochEnd - std::min(settings.epochStart, settings.baselineStart);
+    outputTime.clear();
+    outputDiameter.clear();
+    outputTime.reserve(2 * (samplesFor(keep, rate) + chunk));
+    outputDiameter.reserve(2 * (samplesFor(keep, rate) + chunk));
+    {
+        std::lock_guard<std::mutex> lock(markerMutex);
+        markers.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(epochMutex);
+        for(size_t e = 0; e < finished.size(); e++) {
+            epochAccount->release(epochBytes(finished[e]));
+        }
+        finished.clear();
+    }
+    latestDiameter.store(std::numeric_limits<double>::quiet_NaN());
+    latestTime.store(0);
+}
+
+void PupilStream::setEpochListener(std::function<void(const PupilEpoch &)> listener) {
+    epochListener = listener;
+}
+
+void PupilStream::add(const SampleStruct &sample) {
+    long long time;
+    float left, right;
+    extractPupilColumns(&sample, 1, settings, &time, &left, &right);
+    rawTime.push_back(time);
+    rawLeft.push_back(left);
+    rawRight.push_back(right);
+    if(++pending >= delay + chunk) {
+        processChunk();
+    }
+}
+
+void PupilStream::processChunk() {
+    int count = (int)rawTime.size();
+    int first = count - pending;
+    std::copy(rawLeft.begin(), rawLeft.end(), scratchLeft.begin());
+    std::copy(rawRight.begin(), rawRight.end(), scratchRight.begin());
+    interpolatePupilGaps(scratchLeft.data(), count, padding, maxGap);
+    interpolatePupilGaps(scratchRight.data(), count, padding, maxGap);
+    filterPupil(scratchLeft.data(), kernel, first, first + chunk, filteredLeft.data());
+    filterPupil(scratchRight.data(), kernel, first, first + chunk, filteredRight.data());
+
+    size_t start = outputTime.size();
+    outputTime.insert(outputTime.end(), rawTime.begin() + first, rawTime.begin() + first + chunk);
+    outputDiameter.resize(start + chunk);
+    combinePupils(filteredLeft.data(), filteredRight.data(), chunk, &outputDiameter[start]);
+    pending -= chunk;
+    latestDiameter.store(outputDiameter.back(), std::memory_order_relaxed);
+    latestTime.store(outputTime.back(), std::memory_order_relaxed);
+
+    //epochs whose end has been output are cut from the history
+    std::vector<PupilMarker> due;
+    {
+        std::lock_guard<std::mutex> lock(markerMutex);
+        for(size_t m = 0; m < markers.size();) {
+            if(markers[m].time + settings.epochEnd <= outputTime.back()) {
+                due.push_back(markers[m]);
+                markers.erase(markers.begin() + m);
+            }
+            else {
+                m++;
+            }
+        }
+    }
+    for(size_t m = 0; m < due.size(); m++) {
+        PupilEpoch epoch;
+        if(!cutPupilEpoch(outputTime.data(), outputDiameter.data(), (int)outputTime.size(), due[m], settings, epoch)) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(epochMutex);
+            long long bytes = epochBytes(epoch);
+            size_t drop = 0;
+            bool fits;
+            while(!(fits = epochAccount->reserve(bytes)) && drop < finished.size()) {
+                epochAccount->release(epochBytes(finished[drop++]));
+            }
+            finished.erase(finished.begin(), finished.begin() + drop);
+            if(fits) {
+                finished.push_back(epoch);
+            }
+            if(drop > 0 || !fits) {
+                epochAccount->addDropped(drop + (fits ? 0 : 1));
+            }
+        }
+        if(epochListener) {
+            epochListener(epoch);
+        }
+    }
+    trimHistory();
+}
+
+//drops data nothing can need anymore once the buffers are half full, so the reserved capacity is never exceeded
+void PupilStream::trimHistory() {
+    size_t keepRaw = context + pending;
+    if(rawTime.size() + chunk > rawTime.capacity() && rawTime.size() > keepRaw) {
+        size_t drop = rawTime.size() - keepRaw;
+        rawTime.erase(rawTime.begin(), rawTime.begin() + drop);
+        rawLeft.erase(rawLeft.begin(), rawLeft.begin() + drop);
+        rawRight.erase(rawRight.begin(), rawRight.begin() + drop);
+    }
+    if(outputTime.size() + chunk > outputTime.capacity()) {
+        size_t drop = outputTime.size() / 2;
+        outputTime.erase(outputTime.begin(), outputTime.begin() + drop);
+        outputDiameter.erase(outputDiameter.begin(), outputDiameter.begin() + drop);
+    }
+}
+
+void PupilStream::mark(long long trackerTime, const QString &label) {
+    PupilMarker marker;
+    marker.time = trackerTime;
+    marker.label = label;
+    std::lock_guard<std::mutex> lock(markerMutex);
+    markers.push_back(marker);
+}
+
+double PupilStream::diameter() const {
+    return latestDiameter.load(std::memory_order_relaxed);
+}
+
+long long PupilStream::timestamp() const {
+    return latestTime.load(std::memory_order_relaxed);
+}
+
+long long PupilStream::latency() const {
+    return delayTime;
+}
+
+std::vector<PupilEpoch> PupilStream::epochs() const {
+    std::lock_guard<std::mutex> lock(epochMutex);
+    return finished;
+}
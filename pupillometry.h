@@ -0,0 +1,149 @@
+#ifndef PUPILLOMETRY_H
+#define PUPILLOMETRY_H
+
+//pupillometry.h
+//Pupil diameter processing for cognitive load measures: blink and gap interpolation, zero phase low pass
+//filtering, per trial baseline correction and epoching around event markers. The stages work on contiguous
+//float columns with NaN for missing values so the filter loops vectorize. PupilProcessor runs them over
+//recorded sessions, PupilStream runs the same stages live on a sliding window with a fixed delay.
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <myGazeAPI.h>
+#include "memorybudget.h"
+
+class SessionReader;
+
+struct PupilSettings {
+    PupilSettings() : minDiameter(1.5), maxDiameter(9.0), padding(50000), maxGap(500000), cutoff(10.0),
+        baselineStart(-200000), baselineEnd(0), epochStart(-200000), epochEnd(3000000), bin(20000), divisive(false), liveDelay(250000),
+        epochMemory(4 * 1024 * 1024) {}
+    double minDiameter;      //plausible pupil diameter range [mm], values outside count as missing
+    double maxDiameter;
+    long long padding;       //removed around every gap, the pupil is distorted next to blinks [microseconds]
+    long long maxGap;        //longest gap that is interpolated [microseconds]
+    double cutoff;           //low pass cutoff [Hz]
+    long long baselineStart; //baseline window relative to the marker [microseconds]
+    long long baselineEnd;
+    long long epochStart;    //epoch window relative to the marker [microseconds]
+    long long epochEnd;
+    long long bin;           //epochs are averaged into bins of this length so rates can be mixed [microseconds]
+    bool divisive;           //baseline correction by division instead of subtraction
+    long long liveDelay;     //output delay of the live stream, gaps not closed within it stay missing [microseconds]
+    long long epochMemory;   //finished epochs the live stream keeps, the oldest are dropped beyond it [bytes]
+};
+
+//processed diameters of a recording, one entry per sample
+struct PupilTrace {
+    std::vector<long long> time; //tracker time [microseconds]
+    std::vector<float> left;     //[mm], NaN where missing
+    std::vector<float> right;
+    std::vector<float> diameter; //mean of the eyes present
+};
+
+//event marker an epoch is cut around, recorded as 'M' events with the marker code in positionX
+struct PupilMarker {
+    long long time; //tracker time [microseconds]
+    QString label;
+};
+
+struct PupilEpoch {
+    long long marker; //[microseconds]
+    QString label;
+    double baseline;  //mean diameter in the baseline window [mm], NaN if it had no data
+    std::vector<float> bins; //baseline corrected mean per bin from epochStart on, NaN for empty bins
+    double valid;     //share of the epoch samples with a diameter [0..1]
+};
+
+//column stages, counts and windows are in samples
+std::vector<float> pupilLowPassKernel(int sampleRate, double cutoff); //Hamming windowed sinc, unit gain
+void extractPupilColumns(const SampleStruct *samples, int count, const PupilSettings &settings, long long *time, float *left, float *right);
+int interpolatePupilGaps(float *values, int count, int padding, int maxGap); //returns the number of gaps filled
+//filters in[first, last) into out[0, last - first), in must hold kernel.size() / 2 samples on both sides of the range
+void filterPupil(const float *in, const std::vector<float> &kernel, int first, int last, float *out);
+void combinePupils(const float *left, const float *right, int count, float *diameter);
+bool cutPupilEpoch(const long long *time, const float *diameter, int count, const PupilMarker &marker, const PupilSettings &settings,
+                   PupilEpoch &epoch);
+
+class PupilProcessor {
+
+public:
+    explicit PupilProcessor(const PupilSettings &settings = PupilSettings());
+
+    void process(const SessionReader &session, PupilTrace &trace) const;
+    std::vector<PupilEpoch> epochs(const PupilTrace &trace, const std::vector<PupilMarker> &markers) const;
+    static std::vector<PupilMarker> sessionMarkers(const SessionReader &session); //the 'M' events of the session
+    static std::vector<PupilMarker> loadMarkers(const QString &path); //"timestamp label" per line, '#' starts a comment
+    QStringList columns() const; //epoch table header
+
+    //entry point of the --pupil command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    PupilSettings settings;
+};
+
+class PupilStream {
+
+public:
+    explicit PupilStream(const PupilSettings &settings = PupilSettings());
+
+    //producer side, must be called from a single thread (the sample callback), reset before streaming
+    void reset(int sampleRate); //0 assumes 500 Hz
+    void add(const SampleStruct &sample);
+    void setEpochListener(std::function<void(const PupilEpoch &)> listener);
+
+    //markers may be added from any thread, the epoch is cut once its end has been processed
+    void mark(long long trackerTime, const QString &label);
+
+    //newest processed value, lock free and safe to read from any thread
+    double diameter() const;   //[mm], NaN while missing
+    long long timestamp() const; //tracker time of that value, 0 before the first output
+    long long latency() const; //fixed output delay [microseconds]
+    std::vector<PupilEpoch> epochs() const; //the newest that fit PupilSettings::epochMemory
+
+private:
+    void processChunk();
+    void trimHistory();
+
+    PupilSettings settings;
+    std::vector<float> kernel;
+    int rate;
+    int padding;      //settings in samples at rate
+    int maxGap;
+    int chunk;        //samples processed per step
+    int delay;        //samples between the newest input and the newest output
+    int context;      //raw samples kept before the output range
+    std::function<void(const PupilEpoch &)> epochListener;
+
+    //raw input since the last output, plus context
+    std::vector<long long> rawTime;
+    std::vector<float> rawLeft;
+    std::vector<float> rawRight;
+    int pending;      //raw samples not yet output
+    std::vector<float> scratchLeft;
+    std::vector<float> scratchRight;
+    std::vector<float> filteredLeft;
+    std::vector<float> filteredRight;
+
+    //processed output kept for cutting epochs
+    std::vector<long long> outputTime;
+    std::vector<float> outputDiameter;
+
+    std::mutex markerMutex;
+    std::vector<PupilMarker> markers;
+    mutable std::mutex epochMutex;
+    std::vector<PupilEpoch> finished;
+    std::shared_ptr<MemoryAccount> epochAccount; //drops the oldest finished epochs
+
+    std::atomic<double> latestDiameter;
+    std::atomic<long long> latestTime;
+    long long delayTime;
+};
+
+#endif // PUPILLOMETRY_H
@@ -0,0 +1,399 @@
+//pursuit.cpp
+//Implements the fixation, saccade and smooth pursuit classifier and the --pursuit batch mode over recorded sessions
+
+#include "pursuit.h"
+#include "sampleclassifier.h"
+#include "screengeometry.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "threadpool.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string.h>
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+static const int windowParts = 4;    //the window means the pursuit features are taken from
+static const int minWindowSamples = 8; //shorter windows between two saccades are fixations
+static const int saccadeMargin = 2;  //samples next to a saccade still belong to its flanks and are left out of the windows
+
+const char *gazeMovementName(GazeMovement movement) {
+    switch(movement) {
+    case MovementFixation:
+        return "fixation";
+    case MovementSaccade:
+        return "saccade";
+    case MovementPursuit:
+        return "pursuit";
+    default:
+        return "lost";
+    }
+}
+
+//Pursuit Classifier Constructor
+PursuitClassifier::PursuitClassifier(const PursuitSettings &settings) : settings(settings), labelOutput(0), sharedCurrent(MovementLost) {
+    setVisualAngle(*VisualAngle::current());
+    reset(0);
+}
+
+void PursuitClassifier::setVisualAngle(const VisualAngle &angle) {
+    saccadeLimit = settings.saccadeVelocity * angle.pixelsPerDegree();
+    pursuitLimit = settings.pursuitVelocity * angle.pixelsPerDegree();
+}
+
+void PursuitClassifier::reset(int rate) {
+    sampleRate = rate > 0 ? rate : 500;
+    half = std::max(minWindowSamples / 2, (int)std::lround(settings.window * sampleRate / 2e6));
+    //the window, the sum before it and the two samples the velocity stencil looks ahead, a power of two so slots are masked
+    capacity = 16;
+    while(capacity < 2 * half + 8) {
+        capacity *= 2;
+    }
+    ring.assign(capacity, Slot());
+    added = 0;
+    labelled = 0;
+    scanned = 0;
+    nextSaccade = -1;
+    open = MovementLost;
+    openCount = 0;
+    sharedCurrent.store(MovementLost, std::memory_order_relaxed);
+    for(int m = 0; m < 4; m++) {
+        sharedSamples[m].store(0, std::memory_order_relaxed);
+        sharedSegments[m].store(0, std::memory_order_relaxed);
+    }
+}
+
+void PursuitClassifier::setListener(std::function<void(const EventStruct &)> listener) {
+    this->listener = listener;
+}
+
+long long PursuitClassifier::delay() const {
+    return (long long)((half + 2) * 1e6 / sampleRate);
+}
+
+PursuitClassifier::Slot &PursuitClassifier::slot(long long index) {
+    return ring[index & (capacity - 1)];
+}
+
+void PursuitClassifier::flagSaccade(long long index, bool saccade) {
+    Slot &s = slot(index);
+    s.saccade = saccade;
+    s.lastSaccade = saccade ? index : index > 0 ? slot(index - 1).lastSaccade : -1;
+}
+
+//the 5 point velocity of a sample is known two samples later, its label once the window after it is flagged
+void PursuitClassifier::add(const SampleStruct &sample, int eyes) {
+    double x, y;
+    bool tracked = trackedGaze(sample, eyes, x, y);
+    long long n = added++;
+    Slot &s = slot(n);
+    const Slot *previous = n > 0 ? &slot(n - 1) : 0;
+    s.time = sample.timestamp;
+    s.x = tracked ? (float)x : missing;
+    s.y = tracked ? (float)y : missing;
+    s.sumX = (previous ? previous->sumX : 0) + (tracked ? x : 0);
+    s.sumY = (previous ? previous->sumY : 0) + (tracked ? y : 0);
+    s.tracked = (previous ? previous->tracked : 0) + (tracked ? 1 : 0);
+    s.saccade = false;
+    if(n < 2) {
+        return;
+    }
+
+    long long j = n - 2;
+    bool saccade = false;
+    if(j >= 2) {
+        const Slot &p0 = slot(j - 2), &p1 = slot(j - 1), &p3 = slot(j + 1), &p4 = slot(j + 2);
+        float vx = (p4.x + p3.x - p1.x - p0.x) * (float)(sampleRate / 6.0);
+        float vy = (p4.y + p3.y - p1.y - p0.y) * (float)(sampleRate / 6.0);
+        saccade = vx * vx + vy * vy > saccadeLimit * saccadeLimit; //false next to gaps
+    }
+    flagSaccade(j, saccade);
+    if(j - half >= labelled) {
+        label(labelled++, j);
+    }
+}
+
+void PursuitClassifier::finish() {
+    for(long long j = std::max(0LL, added - 2); j < added; j++) {
+        flagSaccade(j, false);
+    }
+    while(labelled < added) {
+        label(labelled++, added - 1);
+    }
+    endSegment();
+}
+
+//known is the newest sample with its saccade flag set
+void PursuitClassifier::label(long long index, long long known) {
+    const Slot &s = slot(index);
+    GazeMovement movement;
+    if(std::isnan(s.x)) {
+        movement = MovementLost;
+    }
+    else if(s.saccade) {
+        movement = MovementSaccade;
+    }
+    else {
+        //the next saccade is searched for incrementally, every flag is looked at once
+        if(nextSaccade >= 0 && nextSaccade <= index) {
+            nextSaccade = -1;
+        }
+        scanned = std::max(scanned, index + 1);
+        while(nextSaccade < 0 && scanned <= known) {
+            if(slot(scanned).saccade) {
+                nextSaccade = scanned;
+            }
+            scanned++;
+        }
+        long long first = std::max(index - half, s.lastSaccade >= 0 ? s.lastSaccade + saccadeMargin + 1 : 0);
+        long long last = std::min(index + half, known);
+        if(nextSaccade >= 0) {
+            last = std::min(last, nextSaccade - saccadeMargin - 1);
+        }
+        movement = pursuitOrFixation(first, last);
+    }
+
+    sharedSamples[movement].fetch_add(1, std::memory_order_relaxed);
+    sharedCurrent.store(movement, std::memory_order_relaxed);
+    if(labelOutput) {
+        (*labelOutput)[index] = (unsigned char)movement;
+    }
+    segment(movement, s);
+}
+
+//pursuit moves the part means a long way in one direction, fixation noise and drift move them little or back and forth
+GazeMovement PursuitClassifier::pursuitOrFixation(long long first, long long last) {
+    long long count = last - first + 1;
+    if(count < minWindowSamples) {
+        return MovementFixation;
+    }
+    double meanX[windowParts], meanY[windowParts];
+    const Slot *before = first > 0 ? &slot(first - 1) : 0;
+    for(int k = 0; k < windowParts; k++) {
+        const Slot &end = slot(first + count * (k + 1) / windowParts - 1);
+        long long tracked = end.tracked - (before ? before->tracked : 0);
+        if(tracked == 0) {
+            return MovementFixation;
+        }
+        meanX[k] = (end.sumX - (before ? before->sumX : 0)) / tracked;
+        meanY[k] = (end.sumY - (before ? before->sumY : 0)) / tracked;
+        before = &end;
+    }
+    double netX = meanX[windowParts - 1] - meanX[0], netY = meanY[windowParts - 1] - meanY[0];
+    double net = std::sqrt(netX * netX + netY * netY);
+    double path = 0;
+    for(int k = 1; k < windowParts; k++) {
+        double dx = meanX[k] - meanX[k - 1], dy = meanY[k] - meanY[k - 1];
+        path += std::sqrt(dx * dx + dy * dy);
+    }
+    double span = count * (windowParts - 1) / (windowParts * sampleRate); //between the centres of the first and last part [s]
+    if(net < pursuitLimit * span || net < settings.minCoherence * path) {
+        return MovementFixation;
+    }
+    return MovementPursuit;
+}
+
+void PursuitClassifier::segment(GazeMovement movement, const Slot &sample) {
+    if(movement != open) {
+        endSegment();
+        open = movement;
+        openStart = sample.time;
+        openX = 0;
+        openY = 0;
+        openCount = 0;
+    }
+    openEnd = sample.time;
+    if(movement != MovementLost) {
+        openX += sample.x;
+        openY += sample.y;
+        openCount++;
+    }
+}
+
+void PursuitClassifier::endSegment() {
+    GazeMovement ended = open;
+    open = MovementLost;
+    if(ended == MovementLost || openCount == 0) {
+        return;
+    }
+    long long duration = openEnd - openStart;
+    if((ended == MovementFixation && duration < settings.minFixation) || (ended == MovementPursuit && duration < settings.minPursuit)) {
+        return;
+    }
+    static const char types[4] = { 0, 'F', 'S', 'P' };
+    EventStruct event;
+    memset(&event, 0, sizeof(event));
+    event.eventType = types[ended];
+    event.eye = 'b';
+    event.startTime = openStart;
+    event.endTime = openEnd;
+    event.duration = duration;
+    event.positionX = openX / openCount;
+    event.positionY = openY / openCount;
+    sharedSegments[ended].fetch_add(1, std::memory_order_relaxed);
+    if(listener) {
+        listener(event);
+    }
+}
+
+GazeMovement PursuitClassifier::current() const {
+    return (GazeMovement)sharedCurrent.load(std::memory_order_relaxed);
+}
+
+long long PursuitClassifier::samplesOf(GazeMovement movement) const {
+    return sharedSamples[movement].load(std::memory_order_relaxed);
+}
+
+long long PursuitClassifier::segmentsOf(GazeMovement movement) const {
+    return sharedSegments[movement].load(std::memory_order_relaxed);
+}
+
+void classifyMovements(const SessionReader &session, PursuitClassifier &classifier, std::vector<unsigned char> *labels,
+                       std::vector<EventStruct> *segments) {
+    std::function<void(const EventStruct &)> listener = classifier.listener;
+    classifier.listener = [segments, &listener](const EventStruct &segment) {
+        if(segments) {
+            segments->push_back(segment);
+        }
+        if(listener) {
+            listener(segment);
+        }
+    };
+    if(labels) {
+        labels->assign(session.sampleCount(), MovementLost);
+    }
+    classifier.labelOutput = labels;
+    classifier.reset(session.header().sampleRate);
+    session.forEachSample([&classifier](const SampleStruct &sample) {
+        classifier.add(sample, trackedEyes(sample));
+    });
+    classifier.finish();
+    classifier.labelOutput = 0;
+    classifier.listener = listener;
+}
+
+QStringList PursuitClassifier::columns() {
+    QStringList columns;
+    columns << "session" << "participant" << "movement" << "start" << "end" << "duration_ms" << "x" << "y";
+    return columns;
+}
+
+int PursuitClassifier::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Fixation, saccade and smooth pursuit classification");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("pursuit", "Session file or directory scanned recursively for .mgs sessions.", "path"));
+    parser.addOption(QCommandLineOption("output", "Result table, one row per segment.", "file", "pursuit.csv"));
+    parser.addOption(QCommandLineOption("window", "Window the pursuit features are taken over.", "ms", "100"));
+    parser.addOption(QCommandLineOption("saccade-velocity", "Saccade velocity threshold.", "degree/s", "30"));
+    parser.addOption(QCommandLineOption("pursuit-velocity", "Lowest pursuit velocity.", "degree/s", "2"));
+    parser.addOption(QCommandLineOption("coherence", "Lowest direction coherence of pursuit, 0-1.", "c", "0.6"));
+    parser.addOption(QCommandLineOption("min-fixation", "Shortest reported fixation.", "ms", "50"));
+    parser.addOption(QCommandLineOption("min-pursuit", "Shortest reported pursuit.", "ms", "80"));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels the sessions were recorded on.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("geometry", "Monitor attached geometry: stimulus width and height, device height below and "
+                                                    "depth in front of the screen [mm], inclination [degree].",
+                                        "stimX,stimY,height,depth,angle"));
+    parser.addOption(QCommandLineOption("distance", "Viewing distance.", "mm", "600"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    PursuitSettings settings;
+    settings.window = (long long)(parser.value("window").toDouble() * 1000);
+    settings.saccadeVelocity = parser.value("saccade-velocity").toDouble();
+    settings.pursuitVelocity = parser.value("pursuit-velocity").toDouble();
+    settings.minCoherence = parser.value("coherence").toDouble();
+    settings.minFixation = (long long)(parser.value("min-fixation").toDouble() * 1000);
+    settings.minPursuit = (long long)(parser.value("min-pursuit").toDouble() * 1000);
+    if(settings.window <= 0 || settings.saccadeVelocity <= 0 || settings.pursuitVelocity <= 0 || parser.value("distance").toDouble() <= 0) {
+        qWarning() << "--window, --saccade-velocity, --pursuit-velocity and --distance must be positive";
+        return 1;
+    }
+    ScreenGeometry geometry;
+    if(!ScreenGeometry::fromCommandLine(parser.value("screen"), parser.value("geometry"), &geometry)) {
+        return 1;
+    }
+    VisualAngle angle(geometry, parser.value("distance").toDouble());
+
+    QString input = parser.value("pursuit");
+    QStringList sessions = QFileInfo(input).isDir() ? BatchAnalyzer::findSessions(input) : QStringList(input);
+
+    //the classifier keeps running state, so every session is one task
+    QElapsedTimer timer;
+    timer.start();
+    ThreadPool pool(parser.value("threads").toInt());
+    std::vector<QStringList> rows(sessions.size());
+    std::atomic<long long> samples(0);
+    std::atomic<long long> pursuits(0);
+    std::atomic<long long> splitFixations(0);
+    for(int s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            SessionReader session;
+            if(!session.open(sessions[s])) {
+                qWarning() << "Session could not be opened:" << sessions[s];
+                return;
+            }
+            PursuitClassifier classifier(settings);
+            classifier.setVisualAngle(angle);
+            std::vector<EventStruct> segments;
+            classifyMovements(session, classifier, 0, &segments);
+            samples.fetch_add(session.sampleCount());
+
+            //server fixations centred inside a pursuit are the ones it split the pursuit into
+            std::vector<EventStruct> pursuit;
+            for(size_t i = 0; i < segments.size(); i++) {
+                if(segments[i].eventType == 'P') {
+                    pursuit.push_back(segments[i]);
+                }
+            }
+            pursuits.fetch_add(pursuit.size());
+            long long split = 0;
+            session.forEachEvent([&pursuit, &split](const EventStruct &event) {
+                if(event.eventType != 'F') {
+                    return;
+                }
+                long long centre = (event.startTime + event.endTime) / 2;
+                std::vector<EventStruct>::const_iterator after = std::upper_bound(pursuit.begin(), pursuit.end(), centre,
+                    [](long long time, const EventStruct &segment) { return time < segment.startTime; });
+                if(after != pursuit.begin() && centre <= (after - 1)->endTime) {
+                    split++;
+                }
+            });
+            splitFixations.fetch_add(split);
+
+            for(size_t i = 0; i < segments.size(); i++) {
+                const EventStruct &e = segments[i];
+                GazeMovement movement = e.eventType == 'P' ? MovementPursuit : e.eventType == 'S' ? MovementSaccade : MovementFixation;
+                QStringList row;
+                row << sessions[s] << session.participant() << gazeMovementName(movement) << QString::number(e.startTime)
+                    << QString::number(e.endTime) << QString::number(e.duration / 1000.0) << QString::number(e.positionX)
+                    << QString::number(e.positionY);
+                rows[s] << row.join(',');
+            }
+        });
+    }
+    pool.waitForIdle();
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    out << columns().join(',') << '\n';
+    for(size_t s = 0; s < rows.size(); s++) {
+        for(int r = 0; r < rows[s].size(); r++) {
+            out << rows[s][r] << '\n';
+        }
+    }
+    double seconds = timer.elapsed() / 1000.0;
+    qDebug() << "Found" << pursuits.load() << "pursuits covering" << splitFixations.load() << "server fixations in" << samples.load()
+             << "samples of" << sessions.size() << "sessions in" << seconds << "s," << (seconds > 0 ? samples.load() / seconds : 0) << "samples/s";
+    return 0;
+}
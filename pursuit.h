@@ -0,0 +1,115 @@
+#ifndef PURSUIT_H
+#define PURSUIT_H
+
+//pursuit.h
+//Separates fixations, saccades and smooth pursuit, which the server reports as chains of short fixations. A sample is a
+//saccade when its 5 point velocity exceeds a threshold; otherwise the window around it (clipped at neighbouring saccades)
+//is split into four parts and the means of these decide: a net velocity above the pursuit threshold along a coherent
+//direction is pursuit, anything else a fixation. The means come from running sums, so every sample costs the same
+//whatever the window length. The same classifier runs live, with a fixed delay of half a window, and over recordings.
+//Velocities are set in degrees of visual angle per second and converted once to pixels for the screen.
+
+#include <QStringList>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <myGazeAPI.h>
+
+class SessionReader;
+class VisualAngle;
+
+enum GazeMovement {
+    MovementLost = 0,     //no eye tracked
+    MovementFixation = 1,
+    MovementSaccade = 2,
+    MovementPursuit = 3
+};
+
+struct PursuitSettings {
+    PursuitSettings() : window(100000), saccadeVelocity(30.0), pursuitVelocity(2.0), minCoherence(0.6), minFixation(50000),
+        minPursuit(80000) {}
+    long long window;       //pursuit features are taken over this window centred on the sample [microseconds]
+    double saccadeVelocity; //5 point velocity above which a sample belongs to a saccade [degree/s]
+    double pursuitVelocity; //net velocity over the window above which a coherent movement is pursuit [degree/s]
+    double minCoherence;    //net displacement over path length of the window part means, 1 for a straight movement
+    long long minFixation;  //shorter fixation and pursuit segments are labelled but not reported [microseconds]
+    long long minPursuit;
+};
+
+const char *gazeMovementName(GazeMovement movement);
+
+class PursuitClassifier {
+
+public:
+    explicit PursuitClassifier(const PursuitSettings &settings = PursuitSettings());
+
+    //producer side, must be called from a single thread (the sample callback or an analysis), reset before streaming
+    void reset(int sampleRate); //0 assumes 500 Hz
+    void setVisualAngle(const VisualAngle &angle); //converts the degree velocities, VisualAngle::current() until called
+    void add(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+    void finish(); //labels the samples still inside the window and ends the open segment
+    //called with an 'F', 'S' or 'P' EventStruct (eye 'b', mean gaze of the segment) whenever a segment ends
+    void setListener(std::function<void(const EventStruct &)> listener);
+    long long delay() const; //lag of the labels behind the newest sample [microseconds]
+
+    //lock free and safe to read from any thread
+    GazeMovement current() const; //label of the most recently classified sample
+    long long samplesOf(GazeMovement movement) const;
+    long long segmentsOf(GazeMovement movement) const; //reported segments
+
+    static QStringList columns(); //result table header of the --pursuit mode
+    //entry point of the --pursuit command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    //one entry of the sample ring, the sums run over the tracked samples since reset
+    struct Slot {
+        long long time;
+        float x, y;          //NaN when lost
+        double sumX, sumY;
+        long long tracked;
+        long long lastSaccade; //index of the last saccade sample up to this one, -1 before the first
+        bool saccade;
+    };
+
+    Slot &slot(long long index);
+    void flagSaccade(long long index, bool saccade);
+    void label(long long index, long long known);
+    GazeMovement pursuitOrFixation(long long first, long long last);
+    void segment(GazeMovement movement, const Slot &sample);
+    void endSegment();
+
+    friend void classifyMovements(const SessionReader &, PursuitClassifier &, std::vector<unsigned char> *, std::vector<EventStruct> *);
+
+    PursuitSettings settings;
+    double saccadeLimit;  //velocities of settings converted [pixel/s]
+    double pursuitLimit;
+    double sampleRate;
+    int half;       //samples on each side of the labelled one
+    int capacity;
+    std::function<void(const EventStruct &)> listener;
+    std::vector<unsigned char> *labelOutput; //set while a recording is classified
+
+    std::vector<Slot> ring;
+    long long added;
+    long long labelled;
+    long long scanned;      //saccade flags up to here were searched for the next saccade
+    long long nextSaccade;  //first saccade sample after the labelled one, -1 if none is known yet
+
+    //open segment
+    GazeMovement open;
+    long long openStart, openEnd;
+    double openX, openY;
+    int openCount;
+
+    std::atomic<int> sharedCurrent;
+    std::atomic<long long> sharedSamples[4];
+    std::atomic<long long> sharedSegments[4];
+};
+
+//classifies a recorded session, labels (optional) receives one GazeMovement per sample,
+//segments (optional) the reported fixation, saccade and pursuit events in time order
+void classifyMovements(const SessionReader &session, PursuitClassifier &classifier, std::vector<unsigned char> *labels = 0,
+                       std::vector<EventStruct> *segments = 0);
+
+#endif // PURSUIT_H
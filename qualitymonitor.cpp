@@ -0,0 +1,274 @@
+//qualitymonitor.cpp
+//Implements the sliding window precision and data loss estimates, target accuracy and quality alerts
+
+#include "qualitymonitor.h"
+#include "sampleclassifier.h"
+#include "screengeometry.h"
+#include <algorithm>
+#include <cmath>
+
+const char *qualityMetricName(QualityMetric metric) {
+    static const char *const names[QualityMetricCount] = { "loss", "rms_s2s", "std", "accuracy" };
+    return metric >= 0 && metric < QualityMetricCount ? names[metric] : "";
+}
+
+//Quality Monitor Constructor
+QualityMonitor::QualityMonitor(int windowMs, int settleMs) : windowMs(windowMs), settle(settleMs * 1000LL),
+    angle(VisualAngle::current()), targetGeneration(0), targetActive(false), targetX(0), targetY(0) {
+    reset(0);
+}
+
+void QualityMonitor::reset(int sampleRate) {
+    int rate = sampleRate > 0 ? sampleRate : 500;
+    window.assign(std::max(16, (int)((long long)rate * windowMs / 1000)), WindowEntry());
+    next = 0;
+    fill = 0;
+    tracked = 0;
+    meanX = meanY = 0;
+    m2X = m2Y = 0;
+    steps = 0;
+    stepSum = 0;
+    previousTracked = false;
+    previousX = previousY = 0;
+
+    seenGeneration = targetGeneration.load() + 1; //the first sample picks up a target set before streaming
+    targetShown = false;
+    shownX = shownY = 0;
+    shownDegX = shownDegY = 0;
+    targetStart = 0;
+    targetSamples = 0;
+    targetMeanX = targetMeanY = 0;
+    {
+        std::lock_guard<std::mutex> lock(resultsMutex);
+        results.clear();
+    }
+
+    for(int i = 0; i < QualityMetricCount; i++) {
+        outSince[i] = -1;
+        published[i].store(-1, std::memory_order_relaxed);
+    }
+    raised = 0;
+    publishedAlerts.store(0, std::memory_order_relaxed);
+}
+
+void QualityMonitor::setThresholds(const QualityThresholds &thresholds) {
+    limits = thresholds;
+}
+
+void QualityMonitor::setVisualAngle(std::shared_ptr<const VisualAngle> angle) {
+    this->angle = angle;
+}
+
+void QualityMonitor::setAlertListener(std::function<void(const QualityAlert &)> listener) {
+    alertListener = listener;
+}
+
+void QualityMonitor::add(const SampleStruct &sample, int eyes) {
+    followTarget(sample.timestamp);
+
+    WindowEntry entry;
+    entry.x = entry.y = 0;
+    entry.tracked = trackedGaze(sample, eyes, entry.x, entry.y);
+    if(entry.tracked) {
+        entry.x = angle->degreesX(entry.x);
+        entry.y = angle->degreesY(entry.y);
+    }
+    entry.hasStep = entry.tracked && previousTracked;
+    entry.step = entry.hasStep ? (entry.x - previousX) * (entry.x - previousX) + (entry.y - previousY) * (entry.y - previousY) : 0;
+    previousTracked = entry.tracked;
+    previousX = entry.x;
+    previousY = entry.y;
+
+    if(fill == (int)window.size()) {
+        addEntry(window[next], -1); //the oldest entry leaves the window
+    }
+    else {
+        fill++;
+    }
+    window[next] = entry;
+    addEntry(entry, 1);
+    next = next + 1 == (int)window.size() ? 0 : next + 1;
+    if(next == 0) {
+        refresh();
+    }
+
+    if(targetShown && entry.tracked && sample.timestamp - targetStart >= settle) {
+        targetSamples++;
+        targetMeanX += (entry.x - targetMeanX) / targetSamples;
+        targetMeanY += (entry.y - targetMeanY) / targetSamples;
+    }
+
+    double values[QualityMetricCount];
+    values[QualityLoss] = 100.0 * (fill - tracked) / fill;
+    values[QualityRmsS2S] = steps > 0 ? std::sqrt(std::max(0.0, stepSum) / steps) : -1;
+    values[QualityStd] = tracked > 1 ? std::sqrt((m2X + m2Y) / tracked) : -1;
+    values[QualityAccuracy] = targetShown && targetSamples > 0 ? std::hypot(targetMeanX - shownDegX, targetMeanY - shownDegY) : -1;
+    for(int i = 0; i < QualityMetricCount; i++) {
+        published[i].store(values[i], std::memory_order_relaxed);
+    }
+
+    //window metrics are only judged once the window is full
+    if(fill == (int)window.size()) {
+        checkAlert(QualityLoss, values[QualityLoss], limits.maxLossPercent, sample.timestamp);
+        checkAlert(QualityRmsS2S, values[QualityRmsS2S], limits.maxRmsS2S, sample.timestamp);
+        checkAlert(QualityStd, values[QualityStd], limits.maxStd, sample.timestamp);
+    }
+    checkAlert(QualityAccuracy, values[QualityAccuracy], limits.maxAccuracy, sample.timestamp);
+    publishedAlerts.store(raised, std::memory_order_relaxed);
+}
+
+//sign 1 adds the entry to the running statistics, -1 removes it
+void QualityMonitor::addEntry(const WindowEntry &entry, int sign) {
+    if(entry.hasStep) {
+        steps += sign;
+        stepSum += sign * entry.step;
+    }
+    if(!entry.tracked) {
+        return;
+    }
+    if(sign > 0) {
+        tracked++;
+        double dx = entry.x - meanX, dy = entry.y - meanY;
+        meanX += dx / tracked;
+        meanY += dy / tracked;
+        m2X += dx * (entry.x - meanX);
+        m2Y += dy * (entry.y - meanY);
+    }
+    else if(--tracked == 0) {
+        meanX = meanY = 0;
+        m2X = m2Y = 0;
+    }
+    else {
+        double dx = entry.x - meanX, dy = entry.y - meanY;
+        meanX -= dx / tracked;
+        meanY -= dy / tracked;
+        m2X = std::max(0.0, m2X - dx * (entry.x - meanX));
+        m2Y = std::max(0.0, m2Y - dy * (entry.y - meanY));
+    }
+}
+
+//recomputes the running statistics from the window once per window length, so rounding does not accumulate
+void QualityMonitor::refresh() {
+    tracked = 0;
+    meanX = meanY = 0;
+    m2X = m2Y = 0;
+    steps = 0;
+    stepSum = 0;
+    for(int i = 0; i < fill; i++) {
+        addEntry(window[i], 1);
+    }
+}
+
+void QualityMonitor::setTarget(double x, double y) {
+    std::lock_guard<std::mutex> lock(targetMutex);
+    targetX = x;
+    targetY = y;
+    targetActive = true;
+    targetGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void QualityMonitor::clearTarget() {
+    std::lock_guard<std::mutex> lock(targetMutex);
+    targetActive = false;
+    targetGeneration.fetch_add(1, std::memory_order_release);
+}
+
+std::vector<TargetAccuracy> QualityMonitor::targetResults() const {
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    return results;
+}
+
+//picks up target changes made by other threads, the accuracy of the previous target is kept as a result
+void QualityMonitor::followTarget(long long timestamp) {
+    unsigned int generation = targetGeneration.load(std::memory_order_acquire);
+    if(generation == seenGeneration) {
+        return;
+    }
+    finishTarget();
+    {
+        std::lock_guard<std::mutex> lock(targetMutex);
+        seenGeneration = targetGeneration.load(std::memory_order_relaxed); //a change after the check above is taken now
+        targetShown = targetActive;
+        shownX = targetX;
+        shownY = targetY;
+    }
+    shownDegX = angle->degreesX(shownX);
+    shownDegY = angle->degreesY(shownY);
+    targetStart = timestamp;
+    targetSamples = 0;
+    targetMeanX = targetMeanY = 0;
+    outSince[QualityAccuracy] = -1;
+}
+
+void QualityMonitor::finishTarget() {
+    if(!targetShown || targetSamples == 0) {
+        return;
+    }
+    TargetAccuracy result;
+    result.targetX = shownX;
+    result.targetY = shownY;
+    result.offsetX = targetMeanX - shownDegX;
+    result.offsetY = targetMeanY - shownDegY;
+    result.accuracy = std::hypot(result.offsetX, result.offsetY);
+    result.samples = targetSamples;
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    results.push_back(result);
+}
+
+//values that cannot be measured (-1) count as within bounds, total loss is caught by the loss metric
+void QualityMonitor::checkAlert(QualityMetric metric, double value, double threshold, long long timestamp) {
+    int bit = 1 << metric;
+    if(threshold > 0 && value > threshold) {
+        if(outSince[metric] < 0) {
+            outSince[metric] = timestamp;
+        }
+        if((raised & bit) || timestamp - outSince[metric] < limits.sustain) {
+            return;
+        }
+        raised |= bit;
+    }
+    else {
+        outSince[metric] = -1;
+        if(!(raised & bit)) {
+            return;
+        }
+        raised &= ~bit;
+    }
+    if(alertListener) {
+        QualityAlert alert;
+        alert.metric = metric;
+        alert.raised = (raised & bit) != 0;
+        alert.value = value;
+        alert.threshold = threshold;
+        alert.timestamp = timestamp;
+        alertListener(alert);
+    }
+}
+
+double QualityMonitor::value(QualityMetric metric) const {
+    return published[metric].load(std::memory_order_relaxed);
+}
+
+double QualityMonitor::rmsS2S() const {
+    return value(QualityRmsS2S);
+}
+
+double QualityMonitor::stdPrecision() const {
+    return value(QualityStd);
+}
+
+double QualityMonitor::lossPercent() const {
+    return value(QualityLoss);
+}
+
+double QualityMonitor::accuracy() const {
+    return value(QualityAccuracy);
+}
+
+int QualityMonitor::activeAlerts() const {
+    return publishedAlerts.load(std::memory_order_relaxed);
+}
+
+const QualityThresholds &QualityMonitor::thresholds() const {
+    return limits;
+}
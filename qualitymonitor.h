@@ -0,0 +1,141 @@
+#ifndef QUALITYMONITOR_H
+#define QUALITYMONITOR_H
+
+//qualitymonitor.h
+//Streaming data quality of a tracker session: precision (RMS sample to sample, STD) and data loss over a sliding
+//window, accuracy against target points shown to the participant, and alerts when a value stays out of bounds.
+//Gaze arrives in pixels and is measured in degrees of visual angle, so the thresholds do not depend on the screen.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <myGazeAPI.h>
+
+class VisualAngle;
+
+enum QualityMetric {
+    QualityLoss = 0,    //lost share of the window [%]
+    QualityRmsS2S = 1,  //root mean square of the sample to sample distances [degree]
+    QualityStd = 2,     //standard deviation of the gaze position [degree]
+    QualityAccuracy = 3, //distance of the mean gaze from the current target [degree]
+    QualityMetricCount = 4
+};
+
+const char *qualityMetricName(QualityMetric metric);
+
+//a threshold of 0 disables the alert of that metric
+struct QualityThresholds {
+    QualityThresholds() : maxLossPercent(20), maxRmsS2S(0.25), maxStd(0.6), maxAccuracy(1.3), sustain(2000000) {}
+    double maxLossPercent;
+    double maxRmsS2S;  //[degree]
+    double maxStd;
+    double maxAccuracy;
+    long long sustain; //how long a value must stay out of bounds before it alerts [microseconds]
+};
+
+//raised once a metric stayed above its threshold for the sustain time, cleared when it is back within bounds
+struct QualityAlert {
+    QualityMetric metric;
+    bool raised;
+    double value;
+    double threshold;
+    long long timestamp; //tracker time of the sample that changed the alert [microseconds]
+};
+
+//accuracy measured over the time one target was shown
+struct TargetAccuracy {
+    double targetX;      //[pixel]
+    double targetY;
+    double offsetX;      //mean gaze minus target [degree]
+    double offsetY;
+    double accuracy;     //length of the offset [degree]
+    long long samples;   //tracked samples that were averaged
+};
+
+class QualityMonitor {
+
+public:
+    //windowMs is the sliding window length, settleMs the time after a target appears that is not used for accuracy
+    explicit QualityMonitor(int windowMs = 500, int settleMs = 300);
+
+    //producer side, must be called from a single thread (the sample callback), reset and setup before streaming
+    void reset(int sampleRate); //sizes the window for the rate, 0 assumes 500 Hz
+    void setThresholds(const QualityThresholds &thresholds);
+    void setVisualAngle(std::shared_ptr<const VisualAngle> angle); //pixel to degree conversion, VisualAngle::current() until called
+    void setAlertListener(std::function<void(const QualityAlert &)> listener);
+    void add(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+
+    //target points, safe to call from any thread
+    void setTarget(double x, double y);
+    void clearTarget();
+    std::vector<TargetAccuracy> targetResults() const; //one entry per finished target
+
+    //current values, lock free and safe to read from any thread, -1 while not measurable
+    double value(QualityMetric metric) const;
+    double rmsS2S() const;
+    double stdPrecision() const;
+    double lossPercent() const;
+    double accuracy() const;
+    int activeAlerts() const; //bit (1 << QualityMetric) per raised alert
+    const QualityThresholds &thresholds() const;
+
+private:
+    struct WindowEntry {
+        double x, y;   //[degree]
+        double step;   //squared distance to the previous sample, if both were tracked
+        bool tracked;
+        bool hasStep;
+    };
+
+    void addEntry(const WindowEntry &entry, int sign);
+    void refresh();
+    void followTarget(long long timestamp);
+    void finishTarget();
+    void checkAlert(QualityMetric metric, double value, double threshold, long long timestamp);
+
+    int windowMs;
+    long long settle;
+    QualityThresholds limits;
+    std::shared_ptr<const VisualAngle> angle;
+    std::function<void(const QualityAlert &)> alertListener;
+
+    //sliding window, Welford running mean and squared deviation with removal of the oldest entry
+    std::vector<WindowEntry> window;
+    int next;
+    int fill;
+    long long tracked;
+    double meanX, meanY;
+    double m2X, m2Y;
+    long long steps;
+    double stepSum;
+    bool previousTracked;
+    double previousX, previousY;
+
+    //accuracy of the current target, cumulative since it appeared
+    unsigned int seenGeneration;
+    bool targetShown;
+    double shownX, shownY;         //[pixel]
+    double shownDegX, shownDegY;
+    long long targetStart;
+    long long targetSamples;
+    double targetMeanX, targetMeanY;
+
+    long long outSince[QualityMetricCount]; //start of the current out of bounds stretch, -1 if within bounds
+    int raised;
+
+    //target set by other threads, read as one unit under targetMutex once the generation changed
+    std::atomic<unsigned int> targetGeneration;
+    std::mutex targetMutex;
+    bool targetActive;
+    double targetX;
+    double targetY;
+    mutable std::mutex resultsMutex;
+    std::vector<TargetAccuracy> results;
+
+    std::atomic<double> published[QualityMetricCount];
+    std::atomic<int> publishedAlerts;
+};
+
+#endif // QUALITYMONITOR_H
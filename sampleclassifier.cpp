@@ -0,0 +1,303 @@
+//sampleclassifier.cpp
+//Implements the sample validity classification, the blink detection and the incremental loss statistics
+
+#include "sampleclassifier.h"
+#include "sessionreader.h"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAMPLECLASSIFIER_SSE2
+#include <emmintrin.h>
+#endif
+
+static const int blockMasks = 512; //masks classified per kernel call when adding blocks
+
+//validity of a tracked eye mask
+static const unsigned char validityOf[4] = { SampleLost, SamplePartial, SamplePartial, SampleValid };
+
+static bool isEyeTracked(const EyeDataStruct &eye) {
+    return (eye.gazeX != 0 || eye.gazeY != 0) && std::isfinite(eye.gazeX) && std::isfinite(eye.gazeY) && eye.diam > 0;
+}
+
+bool trackedGaze(const SampleStruct &sample, int eyes, double &x, double &y) {
+    if(eyes == (LeftEyeTracked | RightEyeTracked)) {
+        x = (sample.leftEye.gazeX + sample.rightEye.gazeX) / 2;
+        y = (sample.leftEye.gazeY + sample.rightEye.gazeY) / 2;
+    }
+    else if(eyes == LeftEyeTracked) {
+        x = sample.leftEye.gazeX;
+        y = sample.leftEye.gazeY;
+    }
+    else if(eyes == RightEyeTracked) {
+        x = sample.rightEye.gazeX;
+        y = sample.rightEye.gazeY;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+int trackedEyes(const SampleStruct &sample) {
+    return (isEyeTracked(sample.leftEye) ? LeftEyeTracked : 0) | (isEyeTracked(sample.rightEye) ? RightEyeTracked : 0);
+}
+
+//both eyes are tested in the two lanes of one register, lane 0 the left eye and lane 1 the right one,
+//so the movemask of the result is the tracked eye mask without any branch
+void trackedEyes(const SampleStruct *samples, int count, unsigned char *masks) {
+#ifdef SAMPLECLASSIFIER_SSE2
+    const __m128d zero = _mm_setzero_pd();
+    for(int i = 0; i < count; i++) {
+        const SampleStruct &sample = samples[i];
+        __m128d left = _mm_loadu_pd(&sample.leftEye.gazeX); //gazeX, gazeY
+        __m128d right = _mm_loadu_pd(&sample.rightEye.gazeX);
+        __m128d x = _mm_unpacklo_pd(left, right);
+        __m128d y = _mm_unpackhi_pd(left, right);
+        __m128d diam = _mm_unpacklo_pd(_mm_load_sd(&sample.leftEye.diam), _mm_load_sd(&sample.rightEye.diam));
+        __m128d moved = _mm_or_pd(_mm_cmpneq_pd(x, zero), _mm_cmpneq_pd(y, zero));
+        __m128d finite = _mm_and_pd(_mm_cmpeq_pd(_mm_sub_pd(x, x), zero), _mm_cmpeq_pd(_mm_sub_pd(y, y), zero)); //inf and NaN give NaN
+        __m128d open = _mm_cmpgt_pd(diam, zero);
+        masks[i] = (unsigned char)_mm_movemask_pd(_mm_and_pd(_mm_and_pd(moved, finite), open));
+    }
+#else
+    for(int i = 0; i < count; i++) {
+        masks[i] = (unsigned char)trackedEyes(samples[i]);
+    }
+#endif
+}
+
+//Sample Classifier Constructor
+SampleClassifier::SampleClassifier(long long minimumBlink, long long maximumBlink, long long mergeGap, int window)
+    : minimumBlink(minimumBlink), maximumBlink(maximumBlink), mergeGap(mergeGap), recent(std::max(1, window)) {
+    reset();
+}
+
+void SampleClassifier::reset() {
+    inLoss = false;
+    lossStart = 0;
+    gapStart = -1;
+    lossLength = 0;
+    lossX = lossY = 0;
+    lastTimestamp = 0;
+    lastX = lastY = 0;
+    memset(counts, 0, sizeof(counts));
+    blinkSampleCount = 0;
+    blinks = 0;
+    longest = 0;
+    std::fill(recent.begin(), recent.end(), 0);
+    recentIndex = 0;
+    recentFill = 0;
+    recentLost = 0;
+    publish();
+}
+
+void SampleClassifier::setBlinkListener(std::function<void(const EventStruct &)> listener) {
+    blinkListener = listener;
+}
+
+SampleValidity SampleClassifier::add(const SampleStruct &sample) {
+    return add(sample, trackedEyes(sample));
+}
+
+SampleValidity SampleClassifier::add(const SampleStruct &sample, int eyes) {
+    advance(sample.timestamp, eyes);
+    if(eyes) {
+        trackedGaze(sample, eyes, lastX, lastY);
+    }
+    publish();
+    return (SampleValidity)validityOf[eyes];
+}
+
+void SampleClassifier::addBlock(const SampleStruct *samples, int count) {
+    unsigned char masks[blockMasks];
+    for(int first = 0; first < count; first += blockMasks) {
+        int n = std::min(blockMasks, count - first);
+        trackedEyes(samples + first, n, masks);
+        addMasks(samples + first, masks, n);
+    }
+    publish();
+}
+
+void SampleClassifier::addMasks(const SampleStruct *samples, const unsigned char *masks, int count) {
+    const SampleStruct *lastTracked = 0; //gaze is only needed where a loss starts, so it is taken lazily
+    for(int i = 0; i < count; i++) {
+        int eyes = masks[i];
+        if(!eyes && !inLoss && lastTracked) {
+            trackedGaze(*lastTracked, trackedEyes(*lastTracked), lastX, lastY);
+            lastTracked = 0;
+        }
+        advance(samples[i].timestamp, eyes);
+        if(eyes) {
+            lastTracked = samples + i;
+        }
+    }
+    if(lastTracked) {
+        trackedGaze(*lastTracked, trackedEyes(*lastTracked), lastX, lastY);
+    }
+}
+
+void SampleClassifier::finish() {
+    if(inLoss) {
+        endLoss(gapStart >= 0 ? gapStart : lastTimestamp);
+    }
+    publish();
+}
+
+//counts the sample and follows the loss runs, a loss ends once the eyes were tracked again for mergeGap
+void SampleClassifier::advance(long long timestamp, int eyes) {
+    counts[validityOf[eyes]]++;
+    lastTimestamp = timestamp;
+    if(!eyes) {
+        if(!inLoss) {
+            inLoss = true;
+            lossStart = timestamp;
+            lossLength = 0;
+            lossX = lastX;
+            lossY = lastY;
+        }
+        gapStart = -1;
+        lossLength++;
+    }
+    else if(inLoss) {
+        if(gapStart < 0) {
+            gapStart = timestamp;
+        }
+        if(timestamp - gapStart >= mergeGap) {
+            endLoss(gapStart);
+        }
+    }
+
+    unsigned char lost = eyes ? 0 : 1;
+    recentLost += lost - recent[recentIndex];
+    recent[recentIndex] = lost;
+    recentIndex = recentIndex + 1 == (int)recent.size() ? 0 : recentIndex + 1;
+    recentFill = std::min(recentFill + 1, (int)recent.size());
+}
+
+void SampleClassifier::endLoss(long long endTime) {
+    inLoss = false;
+    long long duration = endTime - lossStart;
+    longest = std::max(longest, duration);
+    if(duration < minimumBlink || duration > maximumBlink) {
+        return;
+    }
+    blinks++;
+    blinkSampleCount += lossLength;
+    if(blinkListener) {
+        EventStruct blink;
+        memset(&blink, 0, sizeof(blink));
+        blink.eventType = 'B';
+        blink.eye = 'b';
+        blink.startTime = lossStart;
+        blink.endTime = endTime;
+        blink.duration = duration;
+        blink.positionX = lossX;
+        blink.positionY = lossY;
+        blinkListener(blink);
+    }
+}
+
+//single producer, so plain stores are enough for readers on other threads
+void SampleClassifier::publish() {
+    for(int i = 0; i < 4; i++) {
+        sharedCounts[i].store(counts[i], std::memory_order_relaxed);
+    }
+    sharedBlinkSamples.store(blinkSampleCount, std::memory_order_relaxed);
+    sharedBlinks.store(blinks, std::memory_order_relaxed);
+    sharedLongest.store(longest, std::memory_order_relaxed);
+    sharedRecentFill.store(recentFill, std::memory_order_relaxed);
+    sharedRecentLost.store(recentLost, std::memory_order_relaxed);
+}
+
+long long SampleClassifier::totalSamples() const {
+    return validSamples() + partialSamples() + lostSamples();
+}
+
+long long SampleClassifier::validSamples() const {
+    return sharedCounts[SampleValid].load(std::memory_order_relaxed);
+}
+
+long long SampleClassifier::partialSamples() const {
+    return sharedCounts[SamplePartial].load(std::memory_order_relaxed);
+}
+
+long long SampleClassifier::lostSamples() const {
+    return sharedCounts[SampleLost].load(std::memory_order_relaxed);
+}
+
+long long SampleClassifier::blinkSamples() const {
+    return sharedBlinkSamples.load(std::memory_order_relaxed);
+}
+
+long long SampleClassifier::blinkCount() const {
+    return sharedBlinks.load(std::memory_order_relaxed);
+}
+
+long long SampleClassifier::longestLoss() const {
+    return sharedLongest.load(std::memory_order_relaxed);
+}
+
+double SampleClassifier::lossPercent() const {
+    long long total = totalSamples();
+    return total ? 100.0 * lostSamples() / total : 0;
+}
+
+double SampleClassifier::lossExcludingBlinksPercent() const {
+    long long total = totalSamples();
+    return total ? 100.0 * (lostSamples() - blinkSamples()) / total : 0;
+}
+
+double SampleClassifier::recentLossPercent() const {
+    int fill = sharedRecentFill.load(std::memory_order_relaxed);
+    return fill ? 100.0 * sharedRecentLost.load(std::memory_order_relaxed) / fill : 0;
+}
+
+void classifySession(const SessionReader &session, SampleClassifier &classifier, std::vector<unsigned char> *labels,
+                     std::vector<EventStruct> *blinks) {
+    std::vector<EventStruct> found;
+    std::function<void(const EventStruct &)> listener = classifier.blinkListener;
+    classifier.blinkListener = [&found, &listener](const EventStruct &blink) {
+        found.push_back(blink);
+        if(listener) {
+            listener(blink);
+        }
+    };
+
+    std::vector<unsigned char> masks;
+    if(labels) {
+        labels->resize(session.sampleCount());
+    }
+    size_t offset = 0;
+    const std::vector<SampleBlock> &blocks = session.sampleBlocks();
+    for(size_t b = 0; b < blocks.size(); b++) {
+        masks.resize(blocks[b].count);
+        trackedEyes(blocks[b].records, blocks[b].count, masks.data());
+        classifier.addMasks(blocks[b].records, masks.data(), blocks[b].count);
+        if(labels) {
+            for(int i = 0; i < blocks[b].count; i++) {
+                (*labels)[offset + i] = validityOf[masks[i]];
+            }
+        }
+        offset += blocks[b].count;
+    }
+    classifier.finish();
+    classifier.blinkListener = listener;
+
+    //blinks are only known at their end, so their samples are relabelled afterwards
+    if(labels && !found.empty()) {
+        size_t index = 0, blink = 0;
+        session.forEachSample([&](const SampleStruct &sample) {
+            while(blink < found.size() && found[blink].endTime <= sample.timestamp) {
+                blink++;
+            }
+            if(blink < found.size() && sample.timestamp >= found[blink].startTime && (*labels)[index] == SampleLost) {
+                (*labels)[index] = SampleBlink;
+            }
+            index++;
+        });
+    }
+    if(blinks) {
+        blinks->swap(found);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef SAMPLECLASSIFIER_H
+#define SAMPLECLASSIFIER_H
+
+//sampleclassifier.h
+//Classifies gaze samples as valid, partially valid, blink or lost. The live stream is classified one sample at a time,
+//recorded blocks go through a batch kernel (SSE2 where available). Loss runs of blink length become blink events and
+//the loss statistics are kept incrementally, so they can be read while streaming.
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <myGazeAPI.h>
+
+class SessionReader;
+
+enum SampleValidity {
+    SampleValid = 0,   //both eyes tracked
+    SamplePartial = 1, //one eye tracked
+    SampleBlink = 2,   //no eye tracked, inside a loss of blink length (only known once the loss has ended)
+    SampleLost = 3     //no eye tracked
+};
+
+//tracked eye bits, an eye is tracked when its gaze is finite and not (0, 0) and its pupil diameter is positive
+enum TrackedEye {
+    LeftEyeTracked = 1,
+    RightEyeTracked = 2
+};
+
+int trackedEyes(const SampleStruct &sample);
+//mean gaze of the tracked eyes [pixel], false if no eye is tracked
+bool trackedGaze(const SampleStruct &sample, int eyes, double &x, double &y);
+//batch form of trackedEyes(), writes one bit mask per sample
+void trackedEyes(const SampleStruct *samples, int count, unsigned char *masks);
+
+class SampleClassifier {
+
+public:
+    //losses lasting minimumBlink..maximumBlink [microseconds] are blinks, tracked gaps shorter than mergeGap do not end a loss,
+    //window is the number of recent samples the running loss share is taken over
+    explicit SampleClassifier(long long minimumBlink = 50000, long long maximumBlink = 500000, long long mergeGap = 20000, int window = 1000);
+
+    //producer side, must be called from a single thread (the sample callback or an analysis)
+    void reset();
+    SampleValidity add(const SampleStruct &sample); //lost samples return SampleLost, a blink is reported when it ends
+    SampleValidity add(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+    void addBlock(const SampleStruct *samples, int count);
+    void finish(); //ends a loss still open at the end of the stream
+    //called with a 'B' EventStruct (eye 'b', position of the last tracked gaze) whenever a blink ends, set before adding samples
+    void setBlinkListener(std::function<void(const EventStruct &)> listener);
+
+    //statistics, lock free and safe to read from any thread
+    long long totalSamples() const;
+    long long validSamples() const;
+    long long partialSamples() const;
+    long long lostSamples() const;     //including blink samples
+    long long blinkSamples() const;
+    long long blinkCount() const;
+    long long longestLoss() const;     //[microseconds]
+    double lossPercent() const;        //lost share of all samples [%]
+    double lossExcludingBlinksPercent() const;
+    double recentLossPercent() const;  //lost share of the last window samples [%]
+
+private:
+    void addMasks(const SampleStruct *samples, const unsigned char *masks, int count);
+    void advance(long long timestamp, int eyes);
+    void endLoss(long long endTime);
+    void publish();
+
+    friend void classifySession(const SessionReader &, SampleClassifier &, std::vector<unsigned char> *, std::vector<EventStruct> *);
+
+    long long minimumBlink;
+    long long maximumBlink;
+    long long mergeGap;
+    std::function<void(const EventStruct &)> blinkListener;
+
+    //producer state
+    bool inLoss;
+    long long lossStart;    //first lost sample of the open loss
+    long long gapStart;     //first tracked sample after it, -1 while still lost
+    long long lossLength;   //lost samples of the open loss
+    double lossX, lossY;    //last tracked gaze before the open loss
+    long long lastTimestamp;
+    double lastX, lastY;    //last tracked gaze
+    long long counts[4];    //per SampleValidity, blink samples are counted as lost
+    long long blinkSampleCount;
+    long long blinks;
+    long long longest;
+    std::vector<unsigned char> recent; //lost flags of the last window samples
+    int recentIndex;
+    int recentFill;
+    int recentLost;
+
+    std::atomic<long long> sharedCounts[4];
+    std::atomic<long long> sharedBlinkSamples;
+    std::atomic<long long> sharedBlinks;
+    std::atomic<long long> sharedLongest;
+    std::atomic<int> sharedRecentFill;
+    std::atomic<int> sharedRecentLost;
+};
+
+//classifies a recorded session with the batch kernel, labels (optional) receives one SampleValidity per sample with blinks marked,
+//blinks (optional) receives the blink events in time order
+void classifySession(const SessionReader &session, SampleClassifier &classifier, std::vector<unsigned char> *labels = 0,
+                     std::vector<EventStruct> *blinks = 0);
+
+#endif // SAMPLECLASSIFIER_H
@@ -0,0 +1,235 @@
+//samplepyramid.cpp
+//Implements the incremental min / max / mean pyramid and its file format
+
+#include "samplepyramid.h"
+#include "sessionreader.h"
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+
+static const char pyramidFileMagic[8] = { 'M', 'G', 'P', 'Y', 'R', '0', '0', '1' };
+
+void PyramidEntry::clear() {
+    min = std::numeric_limits<float>::max();
+    max = -std::numeric_limits<float>::max();
+    mean = 0;
+    valid = 0;
+}
+
+void PyramidEntry::add(float value) {
+    min = std::min(min, value);
+    max = std::max(max, value);
+    valid++;
+    mean += (value - mean) / valid;
+}
+
+void PyramidEntry::merge(const PyramidEntry &other) {
+    if(!other.valid) {
+        return;
+    }
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    unsigned int total = valid + other.valid;
+    mean = (float)(((double)mean * valid + (double)other.mean * other.valid) / total);
+    valid = total;
+}
+
+//Sample Pyramid Constructor
+SamplePyramid::SamplePyramid() : samples(0) {
+}
+
+void SamplePyramid::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    samples = 0;
+    for(int l = 0; l < MaxLevels; l++) {
+        for(int c = 0; c < ColumnCount; c++) {
+            levels[l][c].clear();
+        }
+    }
+    blockTimes.clear();
+}
+
+long long SamplePyramid::blockSize(int level) {
+    return (long long)BlockSamples << (2 * level);
+}
+
+//updates the open level 0 entries, higher levels only change when a level 0 block closes
+void SamplePyramid::appendLocked(const SampleStruct &sample) {
+    if(samples % BlockSamples == 0) {
+        PyramidEntry empty;
+        empty.clear();
+        for(int c = 0; c < ColumnCount; c++) {
+            levels[0][c].push_back(empty);
+        }
+        blockTimes.push_back(sample.timestamp);
+    }
+    std::vector<PyramidEntry> *level = levels[0];
+    if(sample.leftEye.gazeX != 0 || sample.leftEye.gazeY != 0) {
+        level[LeftGazeX].back().add((float)sample.leftEye.gazeX);
+        level[LeftGazeY].back().add((float)sample.leftEye.gazeY);
+    }
+    if(sample.leftEye.diam != 0) {
+        level[LeftDiameter].back().add((float)sample.leftEye.diam);
+    }
+    if(sample.rightEye.gazeX != 0 || sample.rightEye.gazeY != 0) {
+        level[RightGazeX].back().add((float)sample.rightEye.gazeX);
+        level[RightGazeY].back().add((float)sample.rightEye.gazeY);
+    }
+    if(sample.rightEye.diam != 0) {
+        level[RightDiameter].back().add((float)sample.rightEye.diam);
+    }
+    samples++;
+    if(samples % BlockSamples == 0) {
+        closeBlock();
+    }
+}
+
+//merges the block that just closed into the open entry of every higher level
+void SamplePyramid::closeBlock() {
+    long long block = samples / BlockSamples - 1;
+    for(int l = 1; l < MaxLevels; l++) {
+        long long index = block >> (2 * l);
+        for(int c = 0; c < ColumnCount; c++) {
+            std::vector<PyramidEntry> &entries = levels[l][c];
+            if((long long)entries.size() <= index) {
+                PyramidEntry empty;
+                empty.clear();
+                entries.push_back(empty);
+            }
+            entries.back().merge(levels[0][c][block]);
+        }
+    }
+}
+
+void SamplePyramid::append(const SampleStruct *records, int count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int i = 0; i < count; i++) {
+        appendLocked(records[i]);
+    }
+}
+
+void SamplePyramid::build(const SessionReader &session) {
+    clear();
+    const std::vector<SampleBlock> &blocks = session.sampleBlocks();
+    for(size_t b = 0; b < blocks.size(); b++) {
+        append(blocks[b].records, blocks[b].count);
+    }
+}
+
+long long SamplePyramid::sampleCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return samples;
+}
+
+int SamplePyramid::levelCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    int count = 0;
+    while(count < MaxLevels && !levels[count][0].empty()) {
+        count++;
+    }
+    return count;
+}
+
+long long SamplePyramid::timestampAt(long long sample) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    long long block = sample / BlockSamples;
+    return sample >= 0 && block < (long long)blockTimes.size() ? blockTimes[block] : 0;
+}
+
+int SamplePyramid::query(Column column, double first, double last, int buckets, PyramidEntry *out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    first = std::max(0.0, first);
+    last = std::min((double)samples, last);
+    if(buckets <= 0 || last <= first) {
+        return 0;
+    }
+    double span = (last - first) / buckets;
+    int level = 0;
+    while(level + 1 < MaxLevels && !levels[level + 1][column].empty() && blockSize(level + 1) <= span) {
+        level++;
+    }
+    const std::vector<PyramidEntry> &entries = levels[level][column];
+    double size = (double)blockSize(level);
+    long long available = (long long)entries.size();
+    for(int b = 0; b < buckets; b++) {
+        double start = first + b * span;
+        long long begin = (long long)std::floor(start / size);
+        long long end = std::max(begin + 1, (long long)std::ceil((start + span) / size));
+        out[b].clear();
+        for(long long e = begin; e < end && e < available; e++) {
+            out[b].merge(entries[e]);
+        }
+    }
+    return buckets;
+}
+
+QString SamplePyramid::pathFor(const QString &sessionPath) {
+    QString path = sessionPath;
+    if(path.endsWith(".mgs")) {
+        path.chop(4);
+    }
+    return path + ".mgp";
+}
+
+//"MGPYR001", sample count, level count (int64 each), block times, then per level and column an entry count and the entries
+bool SamplePyramid::save(const QString &path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    FILE *file = fopen(QFile::encodeName(path).constData(), "wb");
+    if(!file) {
+        return false;
+    }
+    long long header[3] = { samples, MaxLevels, (long long)blockTimes.size() };
+    bool ok = fwrite(pyramidFileMagic, sizeof(pyramidFileMagic), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1
+        && (blockTimes.empty() || fwrite(blockTimes.data(), sizeof(long long), blockTimes.size(), file) == blockTimes.size());
+    for(int l = 0; l < MaxLevels && ok; l++) {
+        for(int c = 0; c < ColumnCount && ok; c++) {
+            long long count = (long long)levels[l][c].size();
+            ok = fwrite(&count, sizeof(count), 1, file) == 1
+                && (count == 0 || fwrite(levels[l][c].data(), sizeof(PyramidEntry), (size_t)count, file) == (size_t)count);
+        }
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool SamplePyramid::load(const QString &path) {
+    clear();
+    FILE *file = fopen(QFile::encodeName(path).constData(), "rb");
+    if(!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    char magic[8];
+    long long header[3];
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, pyramidFileMagic, sizeof(magic)) == 0
+        && fread(header, sizeof(header), 1, file) == 1 && header[1] == MaxLevels && header[0] >= 0 && header[2] >= 0;
+    if(ok) {
+        blockTimes.resize((size_t)header[2]);
+        ok = blockTimes.empty() || fread(blockTimes.data(), sizeof(long long), blockTimes.size(), file) == blockTimes.size();
+    }
+    for(int l = 0; l < MaxLevels && ok; l++) {
+        for(int c = 0; c < ColumnCount && ok; c++) {
+            long long count = 0;
+            ok = fread(&count, sizeof(count), 1, file) == 1 && count >= 0 && count <= (long long)blockTimes.size();
+            if(ok) {
+                levels[l][c].resize((size_t)count);
+                ok = count == 0 || fread(levels[l][c].data(), sizeof(PyramidEntry), (size_t)count, file) == (size_t)count;
+            }
+        }
+    }
+    fclose(file);
+    if(!ok) {
+        samples = 0;
+        blockTimes.clear();
+        for(int l = 0; l < MaxLevels; l++) {
+            for(int c = 0; c < ColumnCount; c++) {
+                levels[l][c].clear();
+            }
+        }
+        return false;
+    }
+    samples = header[0];
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef SAMPLEPYRAMID_H
+#define SAMPLEPYRAMID_H
+
+//samplepyramid.h
+//Multi-resolution min / max / mean summary of the sample columns of a session. Level 0 summarizes blocks
+//of 16 samples and every further level combines 4 entries of the level below, so any zoom level can be
+//drawn from about one entry per pixel. Built incrementally while recording and stored next to the
+//session file (session.mgs -> session.mgp).
+
+#include <QString>
+#include <mutex>
+#include <vector>
+#include <myGazeAPI.h>
+
+class SessionReader;
+
+//summary of one column over a block of samples, lost samples are left out
+struct PyramidEntry {
+    float min;
+    float max;
+    float mean;
+    unsigned int valid; //samples that contributed
+
+    void clear();
+    void add(float value);
+    void merge(const PyramidEntry &other);
+};
+
+class SamplePyramid {
+
+public:
+    enum Column { LeftGazeX, LeftGazeY, LeftDiameter, RightGazeX, RightGazeY, RightDiameter, ColumnCount };
+    enum { BlockSamples = 16, FanOut = 4, MaxLevels = 12 }; //the top level entry spans 67M samples
+
+    SamplePyramid();
+
+    void clear();
+    void append(const SampleStruct *samples, int count); //called by the recorder writer thread
+    void build(const SessionReader &session);            //whole session at once, for files recorded without one
+
+    long long sampleCount() const;
+    int levelCount() const;
+    static long long blockSize(int level); //samples per entry at level
+    //first timestamp of the level 0 block holding sample, 0 if out of range [microseconds]
+    long long timestampAt(long long sample) const;
+
+    //summarizes [first, last) in buckets equal slices from the coarsest level that still resolves a bucket,
+    //reads at most a handful of entries per bucket, returns the number of buckets written to out
+    int query(Column column, double first, double last, int buckets, PyramidEntry *out) const;
+
+    bool save(const QString &path) const;
+    bool load(const QString &path);
+    static QString pathFor(const QString &sessionPath);
+
+private:
+    void appendLocked(const SampleStruct &sample);
+    void closeBlock();
+
+    mutable std::mutex mutex;
+    long long samples;
+    std::vector<PyramidEntry> levels[MaxLevels][ColumnCount]; //the last entry of every level may still be open
+    std::vector<long long> blockTimes;
+};
+
+#endif // SAMPLEPYRAMID_H
@@ -0,0 +1,323 @@
+//savitzkygolay.cpp
+//Implements the Savitzky-Golay column kernels, the live stream, the benchmark and the --derivatives command line mode
+
+#include "savitzkygolay.h"
+#include "sampleclassifier.h"
+#include "sessionreader.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SAVITZKYGOLAY_SSE2
+#include <emmintrin.h>
+#endif
+
+static const float missing = std::numeric_limits<float>::quiet_NaN();
+
+//fit at centre; the position weights sum to one and the acceleration weights to zero, so the pairs enter relative to the
+//centre, which keeps the float sums small at screen coordinates. The velocity takes the centre times zero so a gap there
+//still gives NaN.
+static inline void evaluate(const float *centre, int half, const float *wp, const float *wv, const float *wa, float &p, float &v, float &a) {
+    float twice = centre[0] + centre[0];
+    p = centre[0];
+    v = 0.0f * centre[0];
+    a = 0.0f * centre[0];
+    for(int k = 1; k <= half; k++) {
+        float sum = centre[k] + centre[-k] - twice;
+        float difference = centre[k] - centre[-k];
+        p += wp[k] * sum;
+        v += wv[k] * difference;
+        a += wa[k] * sum;
+    }
+}
+
+//Savitzky Golay Filter Constructor
+SavitzkyGolayFilter::SavitzkyGolayFilter(int window, double sampleRate) {
+    length = std::max(savitzkyGolayMinWindow, window | 1);
+    halfLength = length / 2;
+    double scale[3] = { 1.0, sampleRate, sampleRate * sampleRate };
+    for(int derivative = 0; derivative < 3; derivative++) {
+        scaled[derivative].resize(halfLength + 1);
+        for(int offset = 0; offset <= halfLength; offset++) {
+            double weight = length <= savitzkyGolayTableWindow
+                ? savitzkyGolayTables.weights[(length - savitzkyGolayMinWindow) / 2][derivative][offset]
+                : savitzkyGolayWeight(derivative, halfLength, offset);
+            scaled[derivative][offset] = (float)(weight * scale[derivative]);
+        }
+    }
+}
+
+int SavitzkyGolayFilter::window() const {
+    return length;
+}
+
+int SavitzkyGolayFilter::half() const {
+    return halfLength;
+}
+
+const float *SavitzkyGolayFilter::weights(SavitzkyGolayDerivative derivative) const {
+    return scaled[derivative].data();
+}
+
+//outputs from..to-1, every one of them has a full window inside the column
+static void applyRange(const float *input, int from, int to, int half, const std::vector<float> *weights, float *position, float *velocity,
+                       float *acceleration) {
+    const float *wp = weights[0].data(), *wv = weights[1].data(), *wa = weights[2].data();
+    for(int i = from; i < to; i++) {
+        float p, v, a;
+        evaluate(input + i, half, wp, wv, wa, p, v, a);
+        if(position) {
+            position[i] = p;
+        }
+        if(velocity) {
+            velocity[i] = v;
+        }
+        if(acceleration) {
+            acceleration[i] = a;
+        }
+    }
+}
+
+//the first and last half window of a column have no full window
+static void fillEnds(int count, int half, float *position, float *velocity, float *acceleration) {
+    float *outputs[3] = { position, velocity, acceleration };
+    for(int c = 0; c < 3; c++) {
+        if(outputs[c]) {
+            std::fill(outputs[c], outputs[c] + std::min(half, count), missing);
+            std::fill(outputs[c] + std::max(half, count - half), outputs[c] + count, missing);
+        }
+    }
+}
+
+void SavitzkyGolayFilter::applyScalar(const float *input, int count, float *position, float *velocity, float *acceleration) const {
+    fillEnds(count, halfLength, position, velocity, acceleration);
+    applyRange(input, halfLength, count - halfLength, halfLength, scaled, position, velocity, acceleration);
+}
+
+//four outputs per step with the same operation order as the scalar path, which finishes the tail
+void SavitzkyGolayFilter::apply(const float *input, int count, float *position, float *velocity, float *acceleration) const {
+    fillEnds(count, halfLength, position, velocity, acceleration);
+    int vectorEnd = halfLength;
+#ifdef SAVITZKYGOLAY_SSE2
+    vectorEnd += std::max(0, count - 2 * halfLength) / 4 * 4;
+    const float *wp = scaled[0].data(), *wv = scaled[1].data(), *wa = scaled[2].data();
+    const __m128 zero = _mm_setzero_ps();
+    for(int i = halfLength; i < vectorEnd; i += 4) {
+        __m128 centre = _mm_loadu_ps(input + i);
+        __m128 twice = _mm_add_ps(centre, centre);
+        __m128 p = centre;
+        __m128 v = _mm_mul_ps(zero, centre);
+        __m128 a = v;
+        for(int k = 1; k <= halfLength; k++) {
+            __m128 after = _mm_loadu_ps(input + i + k);
+            __m128 before = _mm_loadu_ps(input + i - k);
+            __m128 sum = _mm_sub_ps(_mm_add_ps(after, before), twice);
+            p = _mm_add_ps(p, _mm_mul_ps(_mm_set1_ps(wp[k]), sum));
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(wv[k]), _mm_sub_ps(after, before)));
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(wa[k]), sum));
+        }
+        if(position) {
+            _mm_storeu_ps(position + i, p);
+        }
+        if(velocity) {
+            _mm_storeu_ps(velocity + i, v);
+        }
+        if(acceleration) {
+            _mm_storeu_ps(acceleration + i, a);
+        }
+    }
+#endif
+    applyRange(input, vectorEnd, count - halfLength, halfLength, scaled, position, velocity, acceleration);
+}
+
+//Savitzky Golay Stream Constructor
+SavitzkyGolayStream::SavitzkyGolayStream(int window) : length(std::max(savitzkyGolayMinWindow, window | 1)), filter(window) {
+    reset(0);
+}
+
+void SavitzkyGolayStream::reset(int rate) {
+    sampleRate = rate > 0 ? rate : 500;
+    filter = SavitzkyGolayFilter(length, sampleRate);
+    xs.assign(2 * length, missing);
+    ys.assign(2 * length, missing);
+    times.assign(length, 0);
+    next = 0;
+    seen = 0;
+}
+
+long long SavitzkyGolayStream::delay() const {
+    return (long long)(filter.half() * 1e6 / sampleRate);
+}
+
+bool SavitzkyGolayStream::add(const SampleStruct &sample, int eyes, SmoothedGaze &out) {
+    double x, y;
+    bool tracked = trackedGaze(sample, eyes, x, y);
+    xs[next] = xs[next + length] = tracked ? (float)x : missing;
+    ys[next] = ys[next + length] = tracked ? (float)y : missing;
+    times[next] = sample.timestamp;
+    next = next + 1 == length ? 0 : next + 1;
+    if(++seen < length) {
+        return false;
+    }
+
+    //the window now runs from next (oldest) to next + length - 1 (newest)
+    int half = filter.half();
+    const float *wp = filter.weights(SmoothedPosition), *wv = filter.weights(SmoothedVelocity), *wa = filter.weights(SmoothedAcceleration);
+    evaluate(&xs[next + half], half, wp, wv, wa, out.x, out.velocityX, out.accelerationX);
+    evaluate(&ys[next + half], half, wp, wv, wa, out.y, out.velocityY, out.accelerationY);
+    out.timestamp = times[(next + half) % length];
+    out.valid = !std::isnan(out.velocityX) && !std::isnan(out.velocityY);
+    return true;
+}
+
+QStringList SavitzkyGolayFilter::benchmark(int samples) {
+    //fixations and saccades with tremor noise and a short loss every 10000 samples
+    std::mt19937 random(1);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<SampleStruct> stream(samples);
+    std::vector<float> column(samples);
+    float gaze = 960;
+    for(int i = 0; i < samples; i++) {
+        if(i % 250 == 0) {
+            gaze = 200 + (float)(random() % 1500);
+        }
+        column[i] = i % 10000 < 25 ? missing : gaze + noise(random);
+        memset(&stream[i], 0, sizeof(SampleStruct));
+        stream[i].timestamp = i * 2000LL;
+        if(!std::isnan(column[i])) {
+            stream[i].leftEye.gazeX = stream[i].rightEye.gazeX = column[i];
+            stream[i].leftEye.gazeY = stream[i].rightEye.gazeY = 540;
+            stream[i].leftEye.diam = stream[i].rightEye.diam = 3.5;
+        }
+    }
+    std::vector<float> position(samples), velocity(samples), acceleration(samples);
+    std::vector<float> reference[3] = { position, velocity, acceleration };
+
+    QStringList rows;
+    rows << "window,scalar_ns,simd_ns,stream_ns,max_difference";
+    for(int window = savitzkyGolayMinWindow; window <= savitzkyGolayTableWindow; window += 2) {
+        SavitzkyGolayFilter filter(window, 500);
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        filter.applyScalar(column.data(), samples, reference[0].data(), reference[1].data(), reference[2].data());
+        std::chrono::steady_clock::time_point scalar = std::chrono::steady_clock::now();
+        filter.apply(column.data(), samples, position.data(), velocity.data(), acceleration.data());
+        std::chrono::steady_clock::time_point simd = std::chrono::steady_clock::now();
+        SavitzkyGolayStream live(window);
+        live.reset(500);
+        SmoothedGaze smoothed;
+        float checksum = 0;
+        for(int i = 0; i < samples; i++) {
+            if(live.add(stream[i], trackedEyes(stream[i]), smoothed) && smoothed.valid) {
+                checksum += smoothed.velocityX;
+            }
+        }
+        std::chrono::steady_clock::time_point streamed = std::chrono::steady_clock::now();
+        volatile float sink = checksum; //keeps the stream loop from being optimized away
+        (void)sink;
+
+        double difference = 0;
+        const std::vector<float> *outputs[3] = { &position, &velocity, &acceleration };
+        for(int c = 0; c < 3; c++) {
+            for(int i = 0; i < samples; i++) {
+                float a = reference[c][i], b = (*outputs[c])[i];
+                if(std::isnan(a) != std::isnan(b)) {
+                    difference = std::numeric_limits<double>::infinity();
+                }
+                else if(!std::isnan(a)) {
+                    difference = std::max(difference, (double)std::fabs(a - b));
+                }
+            }
+        }
+        QStringList row;
+        row << QString::number(window)
+            << QString::number(std::chrono::duration<double, std::nano>(scalar - started).count() / samples)
+            << QString::number(std::chrono::duration<double, std::nano>(simd - scalar).count() / samples)
+            << QString::number(std::chrono::duration<double, std::nano>(streamed - simd).count() / samples)
+            << QString::number(difference);
+        rows << row.join(',');
+    }
+    return rows;
+}
+
+int SavitzkyGolayFilter::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Savitzky-Golay smoothed gaze, velocity and acceleration");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("derivatives", "Session file to filter.", "session"));
+    parser.addOption(QCommandLineOption("derivatives-benchmark", "Time the kernels for the windows 5 to 31 instead."));
+    parser.addOption(QCommandLineOption("output", "Per sample table, or the benchmark table.", "file", "derivatives.csv"));
+    parser.addOption(QCommandLineOption("window", "Odd filter length in samples.", "n", "11"));
+    parser.addOption(QCommandLineOption("samples", "Benchmark column length.", "n", "2000000"));
+    parser.process(arguments);
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+
+    if(parser.isSet("derivatives-benchmark")) {
+        QStringList rows = benchmark(std::max(1000, parser.value("samples").toInt()));
+        for(int r = 0; r < rows.size(); r++) {
+            out << rows[r] << '\n';
+            qDebug().noquote() << rows[r];
+        }
+        return 0;
+    }
+
+    SessionReader session;
+    if(!session.open(parser.value("derivatives"))) {
+        qWarning() << "Session could not be opened:" << parser.value("derivatives");
+        return 1;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    int count = (int)session.sampleCount();
+    std::vector<long long> times;
+    std::vector<float> columns[2];
+    times.reserve(count);
+    columns[0].reserve(count);
+    columns[1].reserve(count);
+    session.forEachSample([&](const SampleStruct &sample) {
+        double x, y;
+        bool tracked = trackedGaze(sample, trackedEyes(sample), x, y);
+        times.push_back(sample.timestamp);
+        columns[0].push_back(tracked ? (float)x : missing);
+        columns[1].push_back(tracked ? (float)y : missing);
+    });
+    SavitzkyGolayFilter filter(parser.value("window").toInt(), session.header().sampleRate > 0 ? session.header().sampleRate : 500);
+    std::vector<float> smoothed[2][3];
+    for(int axis = 0; axis < 2; axis++) {
+        for(int c = 0; c < 3; c++) {
+            smoothed[axis][c].resize(count);
+        }
+        filter.apply(columns[axis].data(), count, smoothed[axis][0].data(), smoothed[axis][1].data(), smoothed[axis][2].data());
+    }
+    double filtered = timer.elapsed() / 1000.0;
+
+    //lost samples and their neighbours within half a window are written as empty values
+    out << "timestamp,x,y,velocity_x,velocity_y,acceleration_x,acceleration_y\n";
+    for(int i = 0; i < count; i++) {
+        out << times[i];
+        for(int c = 0; c < 3; c++) {
+            for(int axis = 0; axis < 2; axis++) {
+                out << ',';
+                if(!std::isnan(smoothed[axis][c][i])) {
+                    out << smoothed[axis][c][i];
+                }
+            }
+        }
+        out << '\n';
+    }
+    qDebug() << "Filtered" << count << "samples with a" << filter.window() << "sample window in" << filtered << "s";
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef SAVITZKYGOLAY_H
+#define SAVITZKYGOLAY_H
+
+//savitzkygolay.h
+//Savitzky-Golay smoothed position, velocity and acceleration from the quadratic least squares fit over an odd window of
+//samples. The weights of the odd windows 5..31 are computed at compile time, longer windows when the filter is built.
+//SavitzkyGolayFilter runs over contiguous float columns (SSE2 where available), SavitzkyGolayStream filters the live gaze
+//with a fixed delay of half a window.
+
+#include <QStringList>
+#include <vector>
+#include <myGazeAPI.h>
+
+enum SavitzkyGolayDerivative {
+    SmoothedPosition = 0,
+    SmoothedVelocity = 1,
+    SmoothedAcceleration = 2
+};
+
+//weight of the sample at offset -half..half for the fit evaluated at the window centre, derivatives per sample step;
+//the position and acceleration weights are even in offset, the velocity weights odd
+constexpr double savitzkyGolayWeight(int derivative, int half, int offset) {
+    double n = 2.0 * half + 1;
+    double s2 = half * (half + 1.0) * (2.0 * half + 1) / 3;                                  //sum of offset^2
+    double s4 = half * (half + 1.0) * (2.0 * half + 1) * (3.0 * half * half + 3.0 * half - 1) / 15; //sum of offset^4
+    double d = n * s4 - s2 * s2;
+    double i = offset;
+    return derivative == SmoothedPosition ? (s4 - s2 * i * i) / d
+         : derivative == SmoothedVelocity ? i / s2
+         : 2 * (n * i * i - s2) / d;
+}
+
+static const int savitzkyGolayMinWindow = 5;
+static const int savitzkyGolayTableWindow = 31; //longest window with compile time weights
+
+//weights of offsets 0..half for the odd windows 5..31, the negative offsets follow from the symmetry
+struct SavitzkyGolayTables {
+    float weights[(savitzkyGolayTableWindow - savitzkyGolayMinWindow) / 2 + 1][3][savitzkyGolayTableWindow / 2 + 1];
+};
+
+constexpr SavitzkyGolayTables makeSavitzkyGolayTables() {
+    SavitzkyGolayTables tables = {};
+    for(int w = 0; w <= (savitzkyGolayTableWindow - savitzkyGolayMinWindow) / 2; w++) {
+        int half = savitzkyGolayMinWindow / 2 + w;
+        for(int derivative = 0; derivative < 3; derivative++) {
+            for(int offset = 0; offset <= half; offset++) {
+                tables.weights[w][derivative][offset] = (float)savitzkyGolayWeight(derivative, half, offset);
+            }
+        }
+    }
+    return tables;
+}
+
+inline constexpr SavitzkyGolayTables savitzkyGolayTables = makeSavitzkyGolayTables();
+static_assert(savitzkyGolayTables.weights[0][0][0] > 0.4857f && savitzkyGolayTables.weights[0][0][0] < 0.4858f,
+              "window 5 smoothing weight is 17/35");
+
+class SavitzkyGolayFilter {
+
+public:
+    //window is rounded up to an odd length of at least 5, derivatives are scaled to pixel/s and pixel/s^2 at sampleRate
+    explicit SavitzkyGolayFilter(int window = 11, double sampleRate = 500);
+
+    int window() const;
+    int half() const;
+    const float *weights(SavitzkyGolayDerivative derivative) const; //offsets 0..half, scaled to the sample rate
+
+    //outputs are NaN within half a window of a gap (NaN input) or the column ends, null outputs are skipped
+    void apply(const float *input, int count, float *position, float *velocity, float *acceleration) const;
+    void applyScalar(const float *input, int count, float *position, float *velocity, float *acceleration) const;
+
+    //times the column and stream paths for the odd windows 5..31 on synthetic gaze, one result row per window
+    static QStringList benchmark(int samples);
+    //entry point of the --derivatives and --derivatives-benchmark command line modes, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    int length;
+    int halfLength;
+    std::vector<float> scaled[3];
+};
+
+struct SmoothedGaze {
+    long long timestamp;
+    bool valid;          //false within half a window of a lost sample
+    float x, y;          //[pixel]
+    float velocityX, velocityY;         //[pixel/s]
+    float accelerationX, accelerationY; //[pixel/s^2]
+};
+
+class SavitzkyGolayStream {
+
+public:
+    explicit SavitzkyGolayStream(int window = 11);
+
+    //producer side, must be called from a single thread, reset before streaming
+    void reset(int sampleRate); //0 assumes 500 Hz
+    //adds the newest sample (eyes as returned by trackedEyes(sample)), out receives the sample half a window before it;
+    //false until a full window was seen
+    bool add(const SampleStruct &sample, int eyes, SmoothedGaze &out);
+    long long delay() const; //[microseconds]
+
+private:
+    int length;
+    SavitzkyGolayFilter filter;
+    //every value is stored twice, window apart, so the newest window is always contiguous
+    std::vector<float> xs, ys;
+    std::vector<long long> times;
+    int next;
+    long long seen;
+    double sampleRate;
+};
+
+#endif // SAVITZKYGOLAY_H
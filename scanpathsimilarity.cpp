@@ -0,0 +1,461 @@
+//scanpathsimilarity.cpp
+//Implements the scanpath measures and the tiled parallel similarity matrix
+
+#include "scanpathsimilarity.h"
+#include "sessionreader.h"
+#include "batchanalyzer.h"
+#include "csvutil.h"
+#include "statsutil.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+typedef unsigned long long Word;
+
+static const int scanpathTile = 16; //scanpaths per tile side, a tile covers up to 256 pairs
+
+//edit distance of a pattern of length m given as per symbol match masks against text, one 64 bit block
+//per 64 pattern symbols, horizontal deltas carry from block to block (Hyyro's block extension of Myers)
+static int myersDistance(const Word *masks, int m, int alphabet, const std::vector<int> &text) {
+    if(m == 0) {
+        return (int)text.size();
+    }
+    const Word highBit = 1ULL << 63;
+    int blocks = (m + 63) / 64;
+    Word lastBit = 1ULL << ((m - 1) % 64);
+    std::vector<Word> positive(blocks, ~0ULL);
+    std::vector<Word> negative(blocks, 0);
+    int score = m;
+    for(size_t t = 0; t < text.size(); t++) {
+        int c = text[t];
+        const Word *eqs = c >= 0 && c < alphabet ? masks + (size_t)c * blocks : 0;
+        int carry = 1; //first row of the distance matrix grows by one per text symbol
+        for(int b = 0; b < blocks; b++) {
+            Word eq = eqs ? eqs[b] : 0;
+            Word pv = positive[b];
+            Word mv = negative[b];
+            Word carryNegative = carry < 0 ? 1 : 0;
+            Word xv = eq | mv;
+            eq |= carryNegative;
+            Word xh = (((eq & pv) + pv) ^ pv) | eq;
+            Word ph = mv | ~(xh | pv);
+            Word mh = pv & xh;
+            Word outBit = b == blocks - 1 ? lastBit : highBit;
+            int out = (ph & outBit) ? 1 : ((mh & outBit) ? -1 : 0);
+            ph = (ph << 1) | (carry > 0 ? 1 : 0);
+            mh = (mh << 1) | carryNegative;
+            positive[b] = mh | ~(xv | ph);
+            negative[b] = ph & xv;
+            carry = out;
+        }
+        score += carry;
+    }
+    return score;
+}
+
+static void fillMasks(const std::vector<int> &symbols, int alphabet, std::vector<Word> &masks) {
+    int blocks = ((int)symbols.size() + 63) / 64;
+    masks.assign((size_t)alphabet * blocks, 0);
+    for(size_t i = 0; i < symbols.size(); i++) {
+        if(symbols[i] >= 0 && symbols[i] < alphabet) {
+            masks[(size_t)symbols[i] * blocks + i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+//Scanpath Comparator Constructor, builds the symbol centres and ScanMatch substitution table
+ScanpathComparator::ScanpathComparator(const std::vector<AreaOfInterest> &areas, int screenWidth, int screenHeight, int gridSize)
+    : areas(areas), screenWidth(screenWidth), screenHeight(screenHeight), gridSize(std::max(1, gridSize)), binMs(50), maxFixations(0) {
+    std::vector<double> x, y;
+    if(!areas.empty()) {
+        for(size_t i = 0; i < areas.size(); i++) {
+            x.push_back(areas[i].rect.center().x());
+            y.push_back(areas[i].rect.center().y());
+        }
+    }
+    else {
+        for(int row = 0; row < this->gridSize; row++) {
+            for(int column = 0; column < this->gridSize; column++) {
+                x.push_back((column + 0.5) * screenWidth / this->gridSize);
+                y.push_back((row + 0.5) * screenHeight / this->gridSize);
+            }
+        }
+    }
+    int labelled = (int)x.size();
+    alphabet = labelled + 1; //last symbol marks fixations outside every area
+
+    //identical symbols score 1, falling linearly to -1 at half the screen diagonal, outside only matches itself
+    double threshold = std::sqrt((double)screenWidth * screenWidth + (double)screenHeight * screenHeight) / 2;
+    substitution.assign((size_t)alphabet * alphabet, -1.0f);
+    for(int a = 0; a < alphabet; a++) {
+        for(int b = 0; b < alphabet; b++) {
+            if(a == b) {
+                substitution[a * alphabet + b] = 1.0f;
+            }
+            else if(a < labelled && b < labelled) {
+                double distance = std::hypot(x[a] - x[b], y[a] - y[b]);
+                substitution[a * alphabet + b] = (float)(1.0 - 2.0 * std::min(1.0, distance / threshold));
+            }
+        }
+    }
+}
+
+void ScanpathComparator::setScanMatchBin(double milliseconds) {
+    binMs = milliseconds > 0 ? milliseconds : 50;
+}
+
+void ScanpathComparator::setMaxFixations(int count) {
+    maxFixations = std::max(0, count);
+}
+
+int ScanpathComparator::symbolOf(double x, double y) const {
+    if(!areas.empty()) {
+        for(size_t i = 0; i < areas.size(); i++) {
+            if(areas[i].rect.contains(QPointF(x, y))) {
+                return (int)i;
+            }
+        }
+        return alphabet - 1;
+    }
+    if(x < 0 || y < 0 || x >= screenWidth || y >= screenHeight) {
+        return alphabet - 1;
+    }
+    return (int)(y * gridSize / screenHeight) * gridSize + (int)(x * gridSize / screenWidth);
+}
+
+void ScanpathComparator::buildMasks(Scanpath &scanpath) const {
+    fillMasks(scanpath.symbols, alphabet, scanpath.matchMasks);
+}
+
+bool ScanpathComparator::load(const QString &path, Scanpath &scanpath) const {
+    scanpath = Scanpath();
+    scanpath.session = path;
+    SessionReader session;
+    if(!session.open(path)) {
+        return false;
+    }
+    scanpath.participant = session.participant();
+    session.forEachEvent([&scanpath, this](const EventStruct &event) {
+        if(event.eventType != 'F' || (maxFixations > 0 && (int)scanpath.fixations.size() >= maxFixations)) {
+            return;
+        }
+        ScanpathFixation fixation;
+        fixation.x = event.positionX;
+        fixation.y = event.positionY;
+        fixation.duration = event.duration / 1000.0;
+        scanpath.fixations.push_back(fixation);
+        int symbol = symbolOf(event.positionX, event.positionY);
+        scanpath.symbols.push_back(symbol);
+        int bins = std::max(1, (int)std::lround(fixation.duration / binMs));
+        scanpath.binned.insert(scanpath.binned.end(), bins, symbol);
+    });
+    buildMasks(scanpath);
+    return true;
+}
+
+int ScanpathComparator::editDistance(const Scanpath &pattern, const std::vector<int> &text) {
+    int m = (int)pattern.symbols.size();
+    int blocks = (m + 63) / 64;
+    int alphabet = blocks ? (int)(pattern.matchMasks.size() / blocks) : 0;
+    return myersDistance(pattern.matchMasks.data(), m, alphabet, text);
+}
+
+int ScanpathComparator::editDistance(const std::vector<int> &a, const std::vector<int> &b) {
+    int alphabet = 0;
+    for(size_t i = 0; i < a.size(); i++) {
+        alphabet = std::max(alphabet, a[i] + 1);
+    }
+    std::vector<Word> masks;
+    fillMasks(a, alphabet, masks);
+    return myersDistance(masks.data(), (int)a.size(), alphabet, b);
+}
+
+//Needleman-Wunsch over the duration binned strings with zero gap cost, one rolling row
+double ScanpathComparator::scanMatch(const Scanpath &a, const Scanpath &b) const {
+    size_t n = b.binned.size();
+    std::vector<float> row(n + 1, 0.0f);
+    for(size_t i = 0; i < a.binned.size(); i++) {
+        const float *scores = &substitution[(size_t)a.binned[i] * alphabet];
+        float diagonal = 0; //row[j - 1] of the previous row
+        for(size_t j = 1; j <= n; j++) {
+            float up = row[j];
+            float best = std::max(up, row[j - 1]);
+            best = std::max(best, diagonal + scores[b.binned[j - 1]]);
+            diagonal = up;
+            row[j] = best;
+        }
+    }
+    return row[n] / std::max(a.binned.size(), n);
+}
+
+//aligns the saccade vectors with the cheapest monotone path, then compares the aligned pairs per dimension
+double ScanpathComparator::multiMatch(const Scanpath &a, const Scanpath &b, Measure measure) const {
+    int m = (int)a.fixations.size() - 1;
+    int n = (int)b.fixations.size() - 1;
+    if(m < 1 || n < 1) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    std::vector<double> ax(m), ay(m), bx(n), by(n);
+    for(int i = 0; i < m; i++) {
+        ax[i] = a.fixations[i + 1].x - a.fixations[i].x;
+        ay[i] = a.fixations[i + 1].y - a.fixations[i].y;
+    }
+    for(int j = 0; j < n; j++) {
+        bx[j] = b.fixations[j + 1].x - b.fixations[j].x;
+        by[j] = b.fixations[j + 1].y - b.fixations[j].y;
+    }
+
+    //cost[j] holds the cheapest path to (i, j), step[] remembers 0 diagonal, 1 from above, 2 from the left
+    std::vector<double> cost(n);
+    std::vector<unsigned char> step((size_t)m * n);
+    for(int i = 0; i < m; i++) {
+        double previousDiagonal = 0;
+        for(int j = 0; j < n; j++) {
+            double local = std::hypot(ax[i] - bx[j], ay[i] - by[j]);
+            double best;
+            unsigned char from;
+            if(i == 0 && j == 0) {
+                best = 0;
+                from = 0;
+            }
+            else if(i == 0) {
+                best = cost[j - 1];
+                from = 2;
+            }
+            else if(j == 0) {
+                best = cost[j];
+                from = 1;
+            }
+            else {
+                best = previousDiagonal;
+                from = 0;
+                if(cost[j] < best) {
+                    best = cost[j];
+                    from = 1;
+                }
+                if(cost[j - 1] < best) {
+                    best = cost[j - 1];
+                    from = 2;
+                }
+            }
+            previousDiagonal = cost[j];
+            cost[j] = best + local;
+            step[(size_t)i * n + j] = from;
+        }
+    }
+
+    double diagonal = std::sqrt((double)screenWidth * screenWidth + (double)screenHeight * screenHeight);
+    const double pi = 3.14159265358979323846;
+    std::vector<double> values[5];
+    int i = m - 1, j = n - 1;
+    while(true) {
+        double lengthA = std::hypot(ax[i], ay[i]);
+        double lengthB = std::hypot(bx[j], by[j]);
+        double angle = std::fabs(std::atan2(ay[i], ax[i]) - std::atan2(by[j], bx[j]));
+        if(angle > pi) {
+            angle = 2 * pi - angle;
+        }
+        double durationA = a.fixations[i].duration;
+        double durationB = b.fixations[j].duration;
+        values[0].push_back(std::hypot(ax[i] - bx[j], ay[i] - by[j]) / (2 * diagonal));
+        values[1].push_back(angle / pi);
+        values[2].push_back(std::fabs(lengthA - lengthB) / diagonal);
+        values[3].push_back(std::hypot(a.fixations[i].x - b.fixations[j].x, a.fixations[i].y - b.fixations[j].y) / diagonal);
+        values[4].push_back(std::max(durationA, durationB) > 0 ? std::fabs(durationA - durationB) / std::max(durationA, durationB) : 0);
+        if(i == 0 && j == 0) {
+            break;
+        }
+        unsigned char from = step[(size_t)i * n + j];
+        if(from == 0) {
+            i--;
+            j--;
+        }
+        else if(from == 1) {
+            i--;
+        }
+        else {
+            j--;
+        }
+    }
+
+    if(measure != MultiMatch) {
+        return 1.0 - std::min(1.0, median(values[measure - MultiMatchVector]));
+    }
+    double sum = 0;
+    for(int d = 0; d < 5; d++) {
+        sum += 1.0 - std::min(1.0, median(values[d]));
+    }
+    return sum / 5;
+}
+
+double ScanpathComparator::similarity(const Scanpath &a, const Scanpath &b, Measure measure) const {
+    switch(measure) {
+    case Levenshtein: {
+        size_t longer = std::max(a.symbols.size(), b.symbols.size());
+        if(longer == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return 1.0 - (double)editDistance(a, b.symbols) / longer;
+    }
+    case ScanMatch:
+        if(a.binned.empty() || b.binned.empty()) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return scanMatch(a, b);
+    default:
+        return multiMatch(a, b, measure);
+    }
+}
+
+static const char *const measureNames[] = {
+    "levenshtein", "scanmatch", "multimatch-vector", "multimatch-direction", "multimatch-length",
+    "multimatch-position", "multimatch-duration", "multimatch"
+};
+
+bool ScanpathComparator::measureFromName(const QString &name, Measure &measure) {
+    for(int i = 0; i <= MultiMatch; i++) {
+        if(name == measureNames[i]) {
+            measure = (Measure)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+QString ScanpathComparator::measureName(Measure measure) {
+    return measureNames[measure];
+}
+
+//Scanpath Matrix Constructor, threads 0 uses every core
+ScanpathMatrix::ScanpathMatrix(int threads) : pool(threads) {
+}
+
+std::vector<Scanpath> ScanpathMatrix::load(const QStringList &sessions, const ScanpathComparator &comparator) {
+    std::vector<Scanpath> scanpaths(sessions.size());
+    pool.parallelFor(sessions.size(), 1, [&](long long begin, long long end) {
+        for(long long i = begin; i < end; i++) {
+            if(!comparator.load(sessions[(int)i], scanpaths[i])) {
+                qWarning() << "Session could not be read:" << sessions[(int)i];
+            }
+        }
+    });
+    return scanpaths;
+}
+
+std::vector<float> ScanpathMatrix::compute(const std::vector<Scanpath> &scanpaths, const ScanpathComparator &comparator,
+                                           ScanpathComparator::Measure measure, double *pairsPerSecond) {
+    long long n = (long long)scanpaths.size();
+    std::vector<float> matrix((size_t)(n * n), 0.0f);
+
+    //upper triangle of tiles including the diagonal ones, each pair is computed once and mirrored
+    long long tilesPerSide = (n + scanpathTile - 1) / scanpathTile;
+    std::vector<std::pair<int, int> > tiles;
+    for(long long r = 0; r < tilesPerSide; r++) {
+        for(long long c = r; c < tilesPerSide; c++) {
+            tiles.push_back(std::make_pair((int)r, (int)c));
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    pool.parallelFor((long long)tiles.size(), 1, [&](long long begin, long long end) {
+        for(long long t = begin; t < end; t++) {
+            long long rowStart = (long long)tiles[t].first * scanpathTile;
+            long long columnStart = (long long)tiles[t].second * scanpathTile;
+            long long rowEnd = std::min(n, rowStart + scanpathTile);
+            long long columnEnd = std::min(n, columnStart + scanpathTile);
+            for(long long i = rowStart; i < rowEnd; i++) {
+                for(long long j = std::max(columnStart, i); j < columnEnd; j++) {
+                    float value = (float)comparator.similarity(scanpaths[i], scanpaths[j], measure);
+                    matrix[i * n + j] = value;
+                    matrix[j * n + i] = value;
+                }
+            }
+        }
+    });
+    double seconds = timer.nsecsElapsed() / 1e9;
+    if(pairsPerSecond) {
+        double pairs = n * (n + 1) / 2.0;
+        *pairsPerSecond = seconds > 0 ? pairs / seconds : 0;
+    }
+    return matrix;
+}
+
+//--scanpath <directory> [--output file] [--measure name] [--aoi file] [--grid n] [--screen WxH] [--bin ms] [--max-fixations n] [--threads n]
+int ScanpathMatrix::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Pairwise scanpath similarity of recorded MyGaze sessions");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("scanpath", "Directory scanned recursively for .mgs sessions.", "directory"));
+    parser.addOption(QCommandLineOption("output", "Similarity matrix, standard output if omitted.", "file"));
+    parser.addOption(QCommandLineOption("measure", "levenshtein, scanmatch, multimatch or multimatch-vector/direction/length/position/duration.", "name", "levenshtein"));
+    parser.addOption(QCommandLineOption("aoi", "Areas of interest labelling the fixations.", "file"));
+    parser.addOption(QCommandLineOption("grid", "Grid cells per side when no areas of interest are given.", "n", "5"));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("bin", "ScanMatch time bin in milliseconds.", "ms", "50"));
+    parser.addOption(QCommandLineOption("max-fixations", "Compare only the first n fixations, 0 keeps all.", "n", "0"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    ScanpathComparator::Measure measure;
+    if(!ScanpathComparator::measureFromName(parser.value("measure"), measure)) {
+        qWarning() << "Unknown measure:" << parser.value("measure");
+        return 1;
+    }
+    QStringList screen = parser.value("screen").split('x');
+    if(screen.size() != 2 || screen[0].toInt() <= 0 || screen[1].toInt() <= 0) {
+        qWarning() << "Screen size must be given as WIDTHxHEIGHT";
+        return 1;
+    }
+    std::vector<AreaOfInterest> areas;
+    if(parser.isSet("aoi")) {
+        areas = loadAreasOfInterest(parser.value("aoi"));
+    }
+    ScanpathComparator comparator(areas, screen[0].toInt(), screen[1].toInt(), parser.value("grid").toInt());
+    comparator.setScanMatchBin(parser.value("bin").toDouble());
+    comparator.setMaxFixations(parser.value("max-fixations").toInt());
+
+    ScanpathMatrix engine(parser.value("threads").toInt());
+    QStringList sessions = BatchAnalyzer::findSessions(parser.value("scanpath"));
+    std::vector<Scanpath> scanpaths = engine.load(sessions, comparator);
+    double pairsPerSecond = 0;
+    std::vector<float> matrix = engine.compute(scanpaths, comparator, measure, &pairsPerSecond);
+    qDebug() << "Compared" << sessions.size() << "sessions," << pairsPerSecond << "pairs/s";
+
+    QFile file;
+    if(parser.isSet("output")) {
+        file.setFileName(parser.value("output"));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            qWarning() << "Could not open output file:" << file.fileName();
+            return 1;
+        }
+    }
+    else {
+        file.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+    QTextStream out(&file);
+    out << "session,participant";
+    for(int i = 0; i < sessions.size(); i++) {
+        out << ',' << csvField(sessions[i]);
+    }
+    out << '\n';
+    int n = sessions.size();
+    for(int i = 0; i < n; i++) {
+        out << csvField(sessions[i]) << ',' << csvField(scanpaths[i].participant);
+        for(int j = 0; j < n; j++) {
+            float value = matrix[(size_t)i * n + j];
+            out << ',';
+            if(value == value) {
+                out << value; //undefined pairs stay empty
+            }
+        }
+        out << '\n';
+    }
+    out.flush();
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef SCANPATHSIMILARITY_H
+#define SCANPATHSIMILARITY_H
+
+//scanpathsimilarity.h
+//Pairwise comparison of the fixation sequences of recorded sessions. Scanpaths are compared as AOI strings
+//(edit distance, ScanMatch-like alignment) or as saccade vectors (MultiMatch-like dimensions), and a whole
+//session set is turned into a similarity matrix on the thread pool.
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+#include "sessionanalysis.h"
+#include "threadpool.h"
+
+struct ScanpathFixation {
+    double x;        //fixation position [pixel]
+    double y;
+    double duration; //[milliseconds]
+};
+
+//fixation sequence of one session with its symbol strings, built by ScanpathComparator::load()
+struct Scanpath {
+    QString session;
+    QString participant;
+    std::vector<ScanpathFixation> fixations;
+    std::vector<int> symbols;                  //AOI (or grid cell) index per fixation
+    std::vector<int> binned;                   //symbols repeated once per ScanMatch time bin
+    std::vector<unsigned long long> matchMasks; //bit-parallel edit distance masks, alphabet x 64 bit blocks
+};
+
+class ScanpathComparator {
+
+public:
+    enum Measure {
+        Levenshtein,         //1 - edit distance / longer string length
+        ScanMatch,           //duration binned alignment with distance based substitution, normalized to the longer string
+        MultiMatchVector,    //MultiMatch-like dimensions over aligned saccade vectors, 1 is identical
+        MultiMatchDirection,
+        MultiMatchLength,
+        MultiMatchPosition,
+        MultiMatchDuration,
+        MultiMatch           //mean of the five MultiMatch-like dimensions
+    };
+
+    //fixations are labelled by the first area containing them, without areas the screen is cut into gridSize x gridSize cells,
+    //everything outside gets one extra symbol
+    explicit ScanpathComparator(const std::vector<AreaOfInterest> &areas = std::vector<AreaOfInterest>(),
+                                int screenWidth = 1920, int screenHeight = 1080, int gridSize = 5);
+
+    void setScanMatchBin(double milliseconds); //default 50 ms
+    void setMaxFixations(int count);           //compare only the first count fixations, 0 keeps all
+
+    bool load(const QString &path, Scanpath &scanpath) const;
+    //similarity in [0, 1] for every measure except ScanMatch which can go below 0, NaN if undefined for the pair
+    double similarity(const Scanpath &a, const Scanpath &b, Measure measure) const;
+
+    //bit-parallel (Myers / Hyyro) edit distance, pattern masks come from load()
+    static int editDistance(const Scanpath &pattern, const std::vector<int> &text);
+    static int editDistance(const std::vector<int> &a, const std::vector<int> &b);
+
+    static bool measureFromName(const QString &name, Measure &measure);
+    static QString measureName(Measure measure);
+
+private:
+    int symbolOf(double x, double y) const;
+    void buildMasks(Scanpath &scanpath) const;
+    double scanMatch(const Scanpath &a, const Scanpath &b) const;
+    double multiMatch(const Scanpath &a, const Scanpath &b, Measure measure) const;
+
+    std::vector<AreaOfInterest> areas;
+    std::vector<float> substitution; //ScanMatch score of every symbol pair, alphabet x alphabet
+    int screenWidth;
+    int screenHeight;
+    int gridSize;
+    int alphabet;
+    double binMs;
+    int maxFixations;
+};
+
+class ScanpathMatrix {
+
+public:
+    explicit ScanpathMatrix(int threads = 0);
+
+    //loads the sessions in parallel, sessions without fixations are kept with empty scanpaths
+    std::vector<Scanpath> load(const QStringList &sessions, const ScanpathComparator &comparator);
+
+    //symmetric n x n matrix in row major order, pairs are scheduled in square tiles so both scanpaths of
+    //a tile stay in cache, pairsPerSecond receives the measured throughput
+    std::vector<float> compute(const std::vector<Scanpath> &scanpaths, const ScanpathComparator &comparator,
+                               ScanpathComparator::Measure measure, double *pairsPerSecond = 0);
+
+    //entry point of the --scanpath command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    ThreadPool pool;
+};
+
+#endif // SCANPATHSIMILARITY_H
@@ -0,0 +1,182 @@
+//screengeometry.cpp
+//Implements the conversions between the myGaze geometry profile and ScreenGeometry and the visual angle tables
+
+#include "screengeometry.h"
+#include <QDebug>
+#include <QStringList>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <string.h>
+
+static const double radiansToDegrees = 57.29577951308232;
+static const double pixelStep = 1.0;          //pixel -> degree table spacing [pixel]
+static const double degreeStep = 1.0 / 64.0;  //degree -> pixel table spacing [degree]
+
+ScreenGeometry ScreenGeometry::fromProfile(const MonitorAttachedGeometryStruct &profile, int screenWidth, int screenHeight) {
+    ScreenGeometry geometry;
+    geometry.screenWidth = screenWidth;
+    geometry.screenHeight = screenHeight;
+    geometry.stimulusWidth = profile.stimX;
+    geometry.stimulusHeight = profile.stimY;
+    geometry.deviceBelow = profile.redStimDistHeight;
+    geometry.deviceInFront = profile.redStimDistDepth;
+    geometry.inclination = profile.redInclAngle;
+    return geometry;
+}
+
+bool ScreenGeometry::current(ScreenGeometry *geometry) {
+    MonitorAttachedGeometryStruct profile;
+    memset(&profile, 0, sizeof(profile));
+    if(iV_GetCurrentMonitorAttachedGeometry(&profile) != RET_SUCCESS || profile.stimX <= 0 || profile.stimY <= 0) {
+        return false;
+    }
+    *geometry = fromProfile(profile, geometry->screenWidth, geometry->screenHeight);
+    return true;
+}
+
+bool ScreenGeometry::fromCommandLine(const QString &screen, const QString &profile, ScreenGeometry *geometry) {
+    QStringList size = screen.split('x');
+    if(size.size() != 2 || size[0].toInt() <= 0 || size[1].toInt() <= 0) {
+        qWarning() << "Screen size must be given as WIDTHxHEIGHT";
+        return false;
+    }
+    geometry->screenWidth = size[0].toInt();
+    geometry->screenHeight = size[1].toInt();
+    if(!profile.isEmpty()) {
+        QStringList values = profile.split(',');
+        if(values.size() != 5 || values[0].toDouble() <= 0 || values[1].toDouble() <= 0) {
+            qWarning() << "Geometry must be given as stimX,stimY,height,depth,angle";
+            return false;
+        }
+        geometry->stimulusWidth = values[0].toDouble();
+        geometry->stimulusHeight = values[1].toDouble();
+        geometry->deviceBelow = values[2].toDouble();
+        geometry->deviceInFront = values[3].toDouble();
+        geometry->inclination = values[4].toDouble();
+    }
+    return true;
+}
+
+//angle of pixel for centre c and millimetres per pixel over the viewing distance
+static double pixelToDegree(double pixel, double centre, double mmPerDistance) {
+    return std::atan((pixel - centre) * mmPerDistance) * radiansToDegrees;
+}
+
+static double degreeToPixel(double degree, double centre, double mmPerDistance) {
+    return centre + std::tan(degree / radiansToDegrees) / mmPerDistance;
+}
+
+//Visual Angle Constructor, the tables cover gaze up to half a screen beyond each edge
+VisualAngle::VisualAngle(const ScreenGeometry &geometry, double viewingDistance) : screen(geometry), distance(viewingDistance) {
+    int pixels[2] = { geometry.screenWidth, geometry.screenHeight };
+    double millimetres[2] = { geometry.stimulusWidth, geometry.stimulusHeight };
+    for(int axis = 0; axis < 2; axis++) {
+        double centre = pixels[axis] / 2.0;
+        double mmPerDistance = millimetres[axis] / pixels[axis] / distance;
+        degreeTables[axis] = tabulate(-centre, pixels[axis] + centre, pixelStep, pixelToDegree, centre, mmPerDistance);
+        double lowest = pixelToDegree(-centre, centre, mmPerDistance);
+        pixelTables[axis] = tabulate(std::floor(lowest / degreeStep) * degreeStep, -std::floor(lowest / degreeStep) * degreeStep, degreeStep,
+                                     degreeToPixel, centre, mmPerDistance);
+    }
+}
+
+VisualAngle::Table VisualAngle::tabulate(double first, double last, double step, double (*function)(double, double, double), double centre,
+                                         double mmPerDistance) {
+    Table table;
+    table.origin = (float)first;
+    table.scale = (float)(1.0 / step);
+    table.function = function;
+    table.centre = centre;
+    table.mmPerDistance = mmPerDistance;
+    int entries = (int)std::ceil((last - first) / step) + 1;
+    table.values.resize(entries);
+    for(int i = 0; i < entries; i++) {
+        table.values[i] = (float)function(first + i * step, centre, mmPerDistance);
+    }
+    return table;
+}
+
+//the in range test is false for NaN, which the exact function passes through
+float VisualAngle::lookup(const Table &table, float value) {
+    float position = (value - table.origin) * table.scale;
+    if(position >= 0 && position < (float)(table.values.size() - 1)) {
+        int index = (int)position;
+        float fraction = position - index;
+        const float *values = table.values.data() + index;
+        return values[0] + (values[1] - values[0]) * fraction;
+    }
+    return (float)table.function(value, table.centre, table.mmPerDistance); //gaze far off the screen
+}
+
+void VisualAngle::lookup(const Table &table, const float *input, int count, float *output) {
+    const float *values = table.values.data();
+    const float origin = table.origin, scale = table.scale, last = (float)(table.values.size() - 1);
+    for(int i = 0; i < count; i++) {
+        float position = (input[i] - origin) * scale;
+        if(position >= 0 && position < last) {
+            int index = (int)position;
+            float fraction = position - index;
+            output[i] = values[index] + (values[index + 1] - values[index]) * fraction;
+        }
+        else {
+            output[i] = lookup(table, input[i]);
+        }
+    }
+}
+
+const ScreenGeometry &VisualAngle::geometry() const {
+    return screen;
+}
+
+double VisualAngle::viewingDistance() const {
+    return distance;
+}
+
+double VisualAngle::pixelsPerDegree() const {
+    double perMillimetre = (screen.screenWidth / screen.stimulusWidth + screen.screenHeight / screen.stimulusHeight) / 2;
+    return perMillimetre * distance * std::tan(1.0 / radiansToDegrees);
+}
+
+double VisualAngle::degreesX(double x) const {
+    return lookup(degreeTables[0], (float)x);
+}
+
+double VisualAngle::degreesY(double y) const {
+    return lookup(degreeTables[1], (float)y);
+}
+
+double VisualAngle::pixelsX(double degrees) const {
+    return lookup(pixelTables[0], (float)degrees);
+}
+
+double VisualAngle::pixelsY(double degrees) const {
+    return lookup(pixelTables[1], (float)degrees);
+}
+
+void VisualAngle::toDegrees(const float *x, const float *y, int count, float *degreesX, float *degreesY) const {
+    lookup(degreeTables[0], x, count, degreesX);
+    lookup(degreeTables[1], y, count, degreesY);
+}
+
+void VisualAngle::toPixels(const float *degreesX, const float *degreesY, int count, float *x, float *y) const {
+    lookup(pixelTables[0], degreesX, count, x);
+    lookup(pixelTables[1], degreesY, count, y);
+}
+
+static std::mutex currentMutex;
+static std::shared_ptr<const VisualAngle> currentAngle;
+
+std::shared_ptr<const VisualAngle> VisualAngle::current() {
+    std::lock_guard<std::mutex> lock(currentMutex);
+    if(!currentAngle) {
+        currentAngle = std::make_shared<const VisualAngle>();
+    }
+    return currentAngle;
+}
+
+void VisualAngle::setCurrent(const ScreenGeometry &geometry, double viewingDistance) {
+    std::shared_ptr<const VisualAngle> angle = std::make_shared<const VisualAngle>(geometry, viewingDistance);
+    std::lock_guard<std::mutex> lock(currentMutex);
+    currentAngle = angle;
+}
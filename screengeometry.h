@@ -0,0 +1,82 @@
+#ifndef SCREENGEOMETRY_H
+#define SCREENGEOMETRY_H
+
+//screengeometry.h
+//Physical layout of the stimulus screen and the myGaze device below it, taken from the monitor attached geometry
+//profile of the server (see the myGaze SDK Manual) plus the screen resolution, which the profile does not carry.
+//VisualAngle converts gaze between pixels and degrees of visual angle through tables built once per geometry.
+
+#include <QString>
+#include <memory>
+#include <vector>
+#include <myGazeAPI.h>
+
+struct ScreenGeometry {
+    ScreenGeometry() : screenWidth(1920), screenHeight(1080), stimulusWidth(531), stimulusHeight(299),
+        deviceBelow(20), deviceInFront(30), inclination(0) {}
+    int screenWidth;       //[pixel]
+    int screenHeight;
+    double stimulusWidth;  //size of the stimulus area [mm]
+    double stimulusHeight;
+    double deviceBelow;    //vertical distance from the device to the lower edge of the stimulus area [mm]
+    double deviceInFront;  //horizontal distance from the screen plane to the device [mm]
+    double inclination;    //upward tilt of the device [degree]
+
+    //profile values with the given resolution [pixel]
+    static ScreenGeometry fromProfile(const MonitorAttachedGeometryStruct &profile, int screenWidth = 1920, int screenHeight = 1080);
+    //reads the active profile from the server into geometry, keeping its resolution, false if the server has none
+    static bool current(ScreenGeometry *geometry);
+    //command line form, screen "WxH" and unless empty profile "stimX,stimY,height,depth,angle", false with a warning if malformed
+    static bool fromCommandLine(const QString &screen, const QString &profile, ScreenGeometry *geometry);
+};
+
+//Per axis visual angle of gaze positions for an eye viewingDistance in front of the stimulus centre, 0 at the centre and
+//positive right and down like the pixel axes. The atan and tan of both axes are tabulated when the object is built, the
+//conversions only interpolate linearly between table entries (about 1e-5 degree and 1e-3 pixel off the exact values),
+//so detectors can convert whole columns without trig in their loops. Objects are immutable and safe to share between threads.
+class VisualAngle {
+
+public:
+    explicit VisualAngle(const ScreenGeometry &geometry = ScreenGeometry(), double viewingDistance = 600.0);
+
+    const ScreenGeometry &geometry() const;
+    double viewingDistance() const; //[mm]
+    double pixelsPerDegree() const; //at the stimulus centre, mean of both axes
+
+    //single values [pixel] <-> [degree]
+    double degreesX(double x) const;
+    double degreesY(double y) const;
+    double pixelsX(double degrees) const;
+    double pixelsY(double degrees) const;
+
+    //columns, NaN stays NaN and the outputs may alias the inputs
+    void toDegrees(const float *x, const float *y, int count, float *degreesX, float *degreesY) const;
+    void toPixels(const float *degreesX, const float *degreesY, int count, float *x, float *y) const;
+
+    //conversion for the active profile, the default geometry until setCurrent is called (TrackerSession does so on connect);
+    //never queries the server, so offline modes build their own VisualAngle. The returned object stays valid while it is held
+    static std::shared_ptr<const VisualAngle> current();
+    static void setCurrent(const ScreenGeometry &geometry, double viewingDistance = 600.0);
+
+private:
+    //values[i] belongs to origin + i / scale, positions outside are computed exactly
+    struct Table {
+        float origin;
+        float scale;
+        std::vector<float> values;
+        double (*function)(double, double, double);
+        double centre;
+        double mmPerDistance;
+    };
+
+    static Table tabulate(double first, double last, double step, double (*function)(double, double, double), double centre, double mmPerDistance);
+    static float lookup(const Table &table, float value);
+    static void lookup(const Table &table, const float *input, int count, float *output);
+
+    ScreenGeometry screen;
+    double distance;
+    Table degreeTables[2]; //[axis] pixel -> degree
+    Table pixelTables[2];  //[axis] degree -> pixel
+};
+
+#endif // SCREENGEOMETRY_H
@@ -0,0 +1,186 @@
+//sessionanalysis.cpp
+//Implements the built in per session analyses and AOI file handling
+
+#include "sessionanalysis.h"
+#include "sessionreader.h"
+#include "sampleclassifier.h"
+#include <QFile>
+#include <QRegExp>
+#include <QTextStream>
+#include <cmath>
+
+//first and last sample timestamps, falls back to the event range for sessions without samples
+static void sessionTimeRange(const SessionReader &session, long long &first, long long &last) {
+    first = 0;
+    last = 0;
+    bool found = false;
+    const std::vector<SampleBlock> &samples = session.sampleBlocks();
+    if(!samples.empty()) {
+        first = samples.front().records[0].timestamp;
+        last = samples.back().records[samples.back().count - 1].timestamp;
+        return;
+    }
+    session.forEachEvent([&](const EventStruct &event) {
+        if(!found || event.startTime < first) {
+            first = event.startTime;
+        }
+        if(!found || event.endTime > last) {
+            last = event.endTime;
+        }
+        found = true;
+    });
+}
+
+std::vector<AreaOfInterest> loadAreasOfInterest(const QString &path) {
+    std::vector<AreaOfInterest> areas;
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return areas;
+    }
+    QTextStream in(&file);
+    while(!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QStringList fields = line.split(QRegExp("\\s+"));
+        if(fields.size() != 5) {
+            continue;
+        }
+        AreaOfInterest area;
+        area.name = fields[0];
+        area.rect = QRectF(fields[1].toDouble(), fields[2].toDouble(), fields[3].toDouble(), fields[4].toDouble());
+        areas.push_back(area);
+    }
+    return areas;
+}
+
+bool saveAreasOfInterest(const QString &path, const std::vector<AreaOfInterest> &areas) {
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+    out << "# name x y width height [pixel]\n";
+    for(size_t i = 0; i < areas.size(); i++) {
+        const QRectF &r = areas[i].rect;
+        out << areas[i].name << ' ' << r.x() << ' ' << r.y() << ' ' << r.width() << ' ' << r.height() << '\n';
+    }
+    return true;
+}
+
+QString FixationStatsAnalysis::name() const {
+    return "fixations";
+}
+
+QStringList FixationStatsAnalysis::columns() const {
+    return QStringList() << "fixation_count" << "fixation_mean_ms" << "fixation_sd_ms" << "fixation_total_ms" << "fixations_per_minute";
+}
+
+QStringList FixationStatsAnalysis::analyze(const SessionReader &session) const {
+    long long count = 0;
+    double sum = 0, sumSquares = 0;
+    session.forEachEvent([&](const EventStruct &event) {
+        if(event.eventType != 'F') {
+            return;
+        }
+        double ms = event.duration / 1000.0;
+        count++;
+        sum += ms;
+        sumSquares += ms * ms;
+    });
+    long long first, last;
+    sessionTimeRange(session, first, last);
+    double minutes = (last - first) / 60000000.0;
+    double mean = count ? sum / count : 0;
+    double variance = count > 1 ? (sumSquares - sum * mean) / (count - 1) : 0;
+    return QStringList() << QString::number(count) << QString::number(mean) << QString::number(std::sqrt(variance > 0 ? variance : 0))
+                         << QString::number(sum) << QString::number(minutes > 0 ? count / minutes : 0);
+}
+
+QString DataLossAnalysis::name() const {
+    return "dataloss";
+}
+
+QStringList DataLossAnalysis::columns() const {
+    return QStringList() << "sample_count" << "lost_samples" << "lost_percent" << "longest_loss_ms" << "duration_s"
+                         << "partial_samples" << "blink_count" << "blink_mean_ms" << "lost_excluding_blinks_percent";
+}
+
+//lost samples are those without any tracked eye (see sampleclassifier.h), classified with the batch kernel
+QStringList DataLossAnalysis::analyze(const SessionReader &session) const {
+    SampleClassifier classifier;
+    std::vector<EventStruct> blinks;
+    classifySession(session, classifier, 0, &blinks);
+    double blinkTotal = 0;
+    for(size_t i = 0; i < blinks.size(); i++) {
+        blinkTotal += blinks[i].duration / 1000.0;
+    }
+    long long first, last;
+    sessionTimeRange(session, first, last);
+    return QStringList() << QString::number(classifier.totalSamples()) << QString::number(classifier.lostSamples())
+                         << QString::number(classifier.lossPercent()) << QString::number(classifier.longestLoss() / 1000.0)
+                         << QString::number((last - first) / 1000000.0) << QString::number(classifier.partialSamples())
+                         << QString::number(classifier.blinkCount()) << QString::number(blinks.empty() ? 0 : blinkTotal / blinks.size())
+                         << QString::number(classifier.lossExcludingBlinksPercent());
+}
+
+AoiMetricsAnalysis::AoiMetricsAnalysis(const std::vector<AreaOfInterest> &areas) : areas(areas) {
+}
+
+QString AoiMetricsAnalysis::name() const {
+    return "aoi";
+}
+
+QStringList AoiMetricsAnalysis::columns() const {
+    QStringList names;
+    for(size_t i = 0; i < areas.size(); i++) {
+        names << areas[i].name + "_fixations" << areas[i].name + "_dwell_ms" << areas[i].name + "_first_fixation_ms";
+    }
+    return names;
+}
+
+QStringList AoiMetricsAnalysis::analyze(const SessionReader &session) const {
+    std::vector<long long> fixations(areas.size(), 0);
+    std::vector<double> dwell(areas.size(), 0);
+    std::vector<long long> first(areas.size(), -1);
+    long long start, end;
+    sessionTimeRange(session, start, end);
+
+    session.forEachEvent([&](const EventStruct &event) {
+        if(event.eventType != 'F') {
+            return;
+        }
+        QPointF position(event.positionX, event.positionY);
+        for(size_t i = 0; i < areas.size(); i++) {
+            if(!areas[i].rect.contains(position)) {
+                continue;
+            }
+            fixations[i]++;
+            dwell[i] += event.duration / 1000.0;
+            if(first[i] < 0 || event.startTime < first[i]) {
+                first[i] = event.startTime;
+            }
+        }
+    });
+
+    QStringList values;
+    for(size_t i = 0; i < areas.size(); i++) {
+        values << QString::number(fixations[i]) << QString::number(dwell[i])
+               << (first[i] < 0 ? QString() : QString::number((first[i] - start) / 1000.0));
+    }
+    return values;
+}
+
+SessionAnalysis *createSessionAnalysis(const QString &name, const std::vector<AreaOfInterest> &areas) {
+    if(name == "fixations") {
+        return new FixationStatsAnalysis();
+    }
+    if(name == "dataloss") {
+        return new DataLossAnalysis();
+    }
+    if(name == "aoi") {
+        return new AoiMetricsAnalysis(areas);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef SESSIONANALYSIS_H
+#define SESSIONANALYSIS_H
+
+//sessionanalysis.h
+//Per session analyses run by the batch analyzer, each one turns a recorded session into a few result columns
+
+#include <QRectF>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+class SessionReader;
+
+//named screen region used by the AOI metrics [pixel]
+struct AreaOfInterest {
+    QString name;
+    QRectF rect;
+};
+
+//AOI files hold one "name x y width height" line per area, '#' starts a comment
+std::vector<AreaOfInterest> loadAreasOfInterest(const QString &path);
+bool saveAreasOfInterest(const QString &path, const std::vector<AreaOfInterest> &areas);
+
+//analyses must be stateless during analyze() since sessions are analysed concurrently
+class SessionAnalysis {
+
+public:
+    virtual ~SessionAnalysis() {}
+    virtual QString name() const = 0;
+    virtual QStringList columns() const = 0;
+    virtual QStringList analyze(const SessionReader &session) const = 0; //one value per column
+};
+
+//fixation count, duration statistics and rate over the vendor fixation events
+class FixationStatsAnalysis : public SessionAnalysis {
+
+public:
+    QString name() const;
+    QStringList columns() const;
+    QStringList analyze(const SessionReader &session) const;
+};
+
+//share of samples with lost tracking, the longest continuous loss and the blinks among the losses
+class DataLossAnalysis : public SessionAnalysis {
+
+public:
+    QString name() const;
+    QStringList columns() const;
+    QStringList analyze(const SessionReader &session) const;
+};
+
+//fixation count, dwell time and time to first fixation per area of interest
+class AoiMetricsAnalysis : public SessionAnalysis {
+
+public:
+    explicit AoiMetricsAnalysis(const std::vector<AreaOfInterest> &areas);
+    QString name() const;
+    QStringList columns() const;
+    QStringList analyze(const SessionReader &session) const;
+
+private:
+    std::vector<AreaOfInterest> areas;
+};
+
+//creates an analysis by its command line name (fixations, dataloss, aoi), 0 if unknown
+SessionAnalysis *createSessionAnalysis(const QString &name, const std::vector<AreaOfInterest> &areas);
+
+#endif // SESSIONANALYSIS_H
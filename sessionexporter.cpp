@@ -0,0 +1,343 @@
+//sessionexporter.cpp
+//Implements the text exporter, slices of the session are formatted in parallel with std::to_chars into
+//reused buffers and concatenated in order through one large stdio buffer
+
+#include "sessionexporter.h"
+#include "sessionreader.h"
+#include "threadpool.h"
+#include "csvutil.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <charconv>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+
+static const long long recordsPerSlice = 16384;      //a few MB of text per slice
+static const size_t outputBufferBytes = 4 << 20;     //stdio buffer so each slice reaches the disk in few writes
+static const int maxFieldBytes = 32;                 //upper bound reserved per formatted field (shortest double is at most 24)
+static const int slicesInFlightPerThread = 2;
+
+static const char *const sampleColumnNames[] = {
+    "timestamp",
+    "left_gaze_x", "left_gaze_y", "left_diam", "left_eye_x", "left_eye_y", "left_eye_z",
+    "right_gaze_x", "right_gaze_y", "right_diam", "right_eye_x", "right_eye_y", "right_eye_z",
+    "vergence", "depth", "fixation_x", "fixation_y", "fixation_z", "head_distance", "interocular"
+};
+static const char *const eventColumnNames[] = { "type", "eye", "start", "end", "duration", "x", "y" };
+static const int sampleColumnCount = sizeof(sampleColumnNames) / sizeof(sampleColumnNames[0]);
+static const int recordedSampleColumns = 13; //the columns after these are derived by VergenceEstimator
+static const int eventColumnCount = sizeof(eventColumnNames) / sizeof(eventColumnNames[0]);
+
+static double EyeDataStruct::*const eyeFields[6] = {
+    &EyeDataStruct::gazeX, &EyeDataStruct::gazeY, &EyeDataStruct::diam,
+    &EyeDataStruct::eyePositionX, &EyeDataStruct::eyePositionY, &EyeDataStruct::eyePositionZ
+};
+static double VergenceSample::*const vergenceFields[7] = {
+    &VergenceSample::vergence, &VergenceSample::depth, &VergenceSample::fixationX, &VergenceSample::fixationY,
+    &VergenceSample::fixationZ, &VergenceSample::headDistance, &VergenceSample::interocular
+};
+
+static inline char *writeInteger(char *p, long long value) {
+    return std::to_chars(p, p + maxFieldBytes, value).ptr;
+}
+
+//fixed notation when a precision is set, falls back to the shortest exact form if the value does not fit
+static inline char *writeDouble(char *p, double value, int precision) {
+    if(precision >= 0) {
+        std::to_chars_result result = std::to_chars(p, p + maxFieldBytes, value, std::chars_format::fixed, precision);
+        if(result.ec == std::errc()) {
+            return result.ptr;
+        }
+    }
+    return std::to_chars(p, p + maxFieldBytes, value).ptr;
+}
+
+//Session Exporter Constructor, selects every recorded column of the table
+SessionExporter::SessionExporter(Table table) : table(table), separator(','), precision(-1), vergenceSelected(false) {
+    int count = table == Samples ? recordedSampleColumns : eventColumnCount;
+    for(int i = 0; i < count; i++) {
+        selected.push_back(i);
+    }
+}
+
+QStringList SessionExporter::availableColumns(Table table) {
+    QStringList names;
+    if(table == Samples) {
+        for(int i = 0; i < sampleColumnCount; i++) {
+            names << sampleColumnNames[i];
+        }
+    }
+    else {
+        for(int i = 0; i < eventColumnCount; i++) {
+            names << eventColumnNames[i];
+        }
+    }
+    return names;
+}
+
+bool SessionExporter::setColumns(const QStringList &names) {
+    QStringList available = availableColumns(table);
+    std::vector<int> indices;
+    for(int i = 0; i < names.size(); i++) {
+        int index = available.indexOf(names[i].trimmed());
+        if(index < 0) {
+            return false;
+        }
+        indices.push_back(index);
+    }
+    if(indices.empty()) {
+        return false;
+    }
+    selected = indices;
+    vergenceSelected = false;
+    for(size_t i = 0; i < selected.size(); i++) {
+        vergenceSelected = vergenceSelected || (table == Samples && selected[i] >= recordedSampleColumns);
+    }
+    return true;
+}
+
+QStringList SessionExporter::columns() const {
+    QStringList available = availableColumns(table);
+    QStringList names;
+    for(size_t i = 0; i < selected.size(); i++) {
+        names << available[selected[i]];
+    }
+    return names;
+}
+
+void SessionExporter::setSeparator(char separator) {
+    this->separator = separator;
+}
+
+void SessionExporter::setPrecision(int decimals) {
+    precision = decimals;
+}
+
+void SessionExporter::setGeometry(const ScreenGeometry &geometry) {
+    vergenceEstimator.setGeometry(geometry);
+}
+
+void SessionExporter::formatHeader(std::string &out) const {
+    QStringList names = columns();
+    for(int i = 0; i < names.size(); i++) {
+        if(i) {
+            out += separator;
+        }
+        out += names[i].toStdString();
+    }
+    out += '\n';
+}
+
+//vergence is only read when a vergence column is selected, invalid samples leave those columns empty
+char *SessionExporter::formatSample(char *p, const void *record, const VergenceSample *vergence) const {
+    const SampleStruct &sample = *static_cast<const SampleStruct *>(record);
+    for(size_t c = 0; c < selected.size(); c++) {
+        if(c) {
+            *p++ = separator;
+        }
+        int column = selected[c];
+        if(column == 0) {
+            p = writeInteger(p, sample.timestamp);
+        }
+        else if(column >= recordedSampleColumns) {
+            if(vergence->valid) {
+                p = writeDouble(p, vergence->*vergenceFields[column - recordedSampleColumns], precision);
+            }
+        }
+        else {
+            const EyeDataStruct &eye = column <= 6 ? sample.leftEye : sample.rightEye;
+            p = writeDouble(p, eye.*eyeFields[(column - 1) % 6], precision);
+        }
+    }
+    *p++ = '\n';
+    return p;
+}
+
+char *SessionExporter::formatEvent(char *p, const void *record) const {
+    const EventStruct &event = *static_cast<const EventStruct *>(record);
+    for(size_t c = 0; c < selected.size(); c++) {
+        if(c) {
+            *p++ = separator;
+        }
+        switch(selected[c]) {
+        case 0: *p++ = event.eventType ? event.eventType : '?'; break;
+        case 1: *p++ = event.eye ? event.eye : '?'; break;
+        case 2: p = writeInteger(p, event.startTime); break;
+        case 3: p = writeInteger(p, event.endTime); break;
+        case 4: p = writeInteger(p, event.duration); break;
+        case 5: p = writeDouble(p, event.positionX, precision); break;
+        default: p = writeDouble(p, event.positionY, precision); break;
+        }
+    }
+    *p++ = '\n';
+    return p;
+}
+
+//Formats every record of the slice into out, which only grows (uninitialised) when the worst case does not fit
+void SessionExporter::formatSlice(const SessionReader &session, const Slice &slice, TextBuffer &out) const {
+    size_t bound = (size_t)slice.records * (selected.size() * (maxFieldBytes + 1) + 1);
+    if(out.capacity < bound) {
+        out.data.reset(new char[bound]);
+        out.capacity = bound;
+    }
+    char *begin = out.data.get();
+    char *p = begin;
+    for(int b = slice.firstBlock; b < slice.lastBlock; b++) {
+        if(table == Samples) {
+            const SampleBlock &block = session.sampleBlocks()[b];
+            if(vergenceSelected) {
+                out.vergence.resize(block.count);
+                vergenceEstimator.estimate(block.records, block.count, out.vergence.data());
+            }
+            for(int i = 0; i < block.count; i++) {
+                p = formatSample(p, &block.records[i], vergenceSelected ? &out.vergence[i] : 0);
+            }
+        }
+        else {
+            const EventBlock &block = session.eventBlocks()[b];
+            for(int i = 0; i < block.count; i++) {
+                p = formatEvent(p, &block.records[i]);
+            }
+        }
+    }
+    out.size = p - begin;
+}
+
+bool SessionExporter::exportTo(const SessionReader &session, const QString &path, ThreadPool &pool) const {
+    //group consecutive recorder chunks into slices of similar size
+    std::vector<Slice> slices;
+    int blockCount = table == Samples ? (int)session.sampleBlocks().size() : (int)session.eventBlocks().size();
+    Slice current = { 0, 0, 0 };
+    for(int b = 0; b < blockCount; b++) {
+        current.records += table == Samples ? session.sampleBlocks()[b].count : session.eventBlocks()[b].count;
+        current.lastBlock = b + 1;
+        if(current.records >= recordsPerSlice || b + 1 == blockCount) {
+            slices.push_back(current);
+            current.firstBlock = b + 1;
+            current.records = 0;
+        }
+    }
+
+    FILE *file = fopen(QFile::encodeName(path).constData(), "wb");
+    if(!file) {
+        return false;
+    }
+    std::vector<char> outputBuffer(outputBufferBytes);
+    setvbuf(file, outputBuffer.data(), _IOFBF, outputBuffer.size());
+
+    std::string header;
+    formatHeader(header);
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+
+    std::mutex resultMutex;
+    std::condition_variable resultReady;
+    std::map<int, std::shared_ptr<TextBuffer> > finished;
+    std::vector<std::shared_ptr<TextBuffer> > spare; //buffers handed back after writing so later slices reuse them
+    int total = (int)slices.size();
+    int submitted = 0;
+    int written = 0;
+    int window = pool.threadCount() * slicesInFlightPerThread;
+
+    while(written < total) {
+        while(submitted < total && submitted - written < window) {
+            int index = submitted++;
+            std::shared_ptr<TextBuffer> text;
+            {
+                std::lock_guard<std::mutex> lock(resultMutex);
+                if(!spare.empty()) {
+                    text = spare.back();
+                    spare.pop_back();
+                }
+            }
+            if(!text) {
+                text.reset(new TextBuffer());
+            }
+            pool.submit([this, &session, &slices, index, text, &resultMutex, &resultReady, &finished]() {
+                formatSlice(session, slices[index], *text);
+                std::lock_guard<std::mutex> lock(resultMutex);
+                finished[index] = text;
+                resultReady.notify_one();
+            });
+        }
+
+        std::shared_ptr<TextBuffer> text;
+        {
+            std::unique_lock<std::mutex> lock(resultMutex);
+            resultReady.wait(lock, [&finished, written] { return finished.count(written) > 0; });
+            text = finished[written];
+            finished.erase(written);
+        }
+        if(ok && fwrite(text->data.get(), 1, text->size, file) != text->size) {
+            ok = false;
+        }
+        written++;
+        std::lock_guard<std::mutex> lock(resultMutex);
+        spare.push_back(text);
+    }
+
+    if(fclose(file) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+//--export <session> --output <file> [--format csv|tsv] [--events] [--columns list] [--precision n] [--threads n]
+//        [--screen WxH] [--geometry stimX,stimY,height,depth,angle]
+int SessionExporter::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Text export of a recorded MyGaze session");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("export", "Session file to export.", "session"));
+    parser.addOption(QCommandLineOption("output", "Text file to write.", "file"));
+    parser.addOption(QCommandLineOption("format", "csv or tsv.", "format", "csv"));
+    parser.addOption(QCommandLineOption("events", "Export fixation events instead of samples."));
+    parser.addOption(QCommandLineOption("columns", "Comma separated column list, all recorded columns if omitted.", "list"));
+    parser.addOption(QCommandLineOption("precision", "Fixed decimals for floating point columns, shortest exact form if omitted.", "decimals", "-1"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.addOption(QCommandLineOption("screen", "Screen size in pixels for the vergence columns.", "WxH", "1920x1080"));
+    parser.addOption(QCommandLineOption("geometry", "Monitor attached geometry for the vergence columns: stimulus width and height, "
+                                                    "device height below and depth in front of the screen [mm], inclination [degree].",
+                                        "stimX,stimY,height,depth,angle"));
+    parser.process(arguments);
+
+    ScreenGeometry geometry;
+    if(!ScreenGeometry::fromCommandLine(parser.value("screen"), parser.value("geometry"), &geometry)) {
+        return 1;
+    }
+
+    SessionExporter exporter(parser.isSet("events") ? Events : Samples);
+    if(parser.isSet("columns") && !exporter.setColumns(splitList(parser.value("columns")))) {
+        qWarning() << "Unknown column, available:" << availableColumns(parser.isSet("events") ? Events : Samples).join(',');
+        return 1;
+    }
+    exporter.setSeparator(parser.value("format") == "tsv" ? '\t' : ',');
+    exporter.setPrecision(parser.value("precision").toInt());
+    exporter.setGeometry(geometry);
+
+    SessionReader session;
+    if(!session.open(parser.value("export"))) {
+        qWarning() << "Could not open session:" << parser.value("export");
+        return 1;
+    }
+    if(!parser.isSet("output")) {
+        qWarning() << "No output file given";
+        return 1;
+    }
+
+    ThreadPool pool(parser.value("threads").toInt());
+    QElapsedTimer timer;
+    timer.start();
+    if(!exporter.exportTo(session, parser.value("output"), pool)) {
+        qWarning() << "Export failed:" << parser.value("output");
+        return 1;
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+    qint64 bytes = QFile(parser.value("output")).size();
+    qDebug() << "Exported" << bytes / 1e6 << "MB in" << seconds << "s (" << bytes / 1e6 / seconds << "MB/s )";
+    return 0;
+}
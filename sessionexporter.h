@@ -0,0 +1,70 @@
+#ifndef SESSIONEXPORTER_H
+#define SESSIONEXPORTER_H
+
+//sessionexporter.h
+//Exports recorded sessions as CSV or TSV text with a selectable set of SampleStruct or EventStruct columns
+
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <string>
+#include <vector>
+#include "vergence.h"
+
+class SessionReader;
+class ThreadPool;
+
+class SessionExporter {
+
+public:
+    enum Table { Samples, Events };
+
+    //sample columns: timestamp, left_gaze_x, left_gaze_y, left_diam, left_eye_x, left_eye_y, left_eye_z, right_... (same six),
+    //plus the VergenceSample values vergence, depth, fixation_x, fixation_y, fixation_z, head_distance, interocular
+    //which are only exported when selected
+    //event columns: type, eye, start, end, duration, x, y
+    explicit SessionExporter(Table table = Samples);
+
+    static QStringList availableColumns(Table table);
+    bool setColumns(const QStringList &names); //false if a name is unknown for the table
+    QStringList columns() const;
+    void setSeparator(char separator);  //',' for csv, '\t' for tsv
+    void setPrecision(int decimals);    //fixed decimals for floating point columns, -1 keeps the shortest exact form
+    void setGeometry(const ScreenGeometry &geometry); //screen layout the vergence columns are computed for
+
+    //formats slices of the session on the pool and writes them in order, returns false on write errors
+    bool exportTo(const SessionReader &session, const QString &path, ThreadPool &pool) const;
+
+    //entry point of the --export command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    struct Slice {
+        int firstBlock;
+        int lastBlock; //exclusive
+        long long records;
+    };
+
+    //formatted text of one slice, capacity is kept when the buffer is reused
+    struct TextBuffer {
+        TextBuffer() : capacity(0), size(0) {}
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t size;
+        std::vector<VergenceSample> vergence; //vergence columns of the current block
+    };
+
+    void formatHeader(std::string &out) const;
+    void formatSlice(const SessionReader &session, const Slice &slice, TextBuffer &out) const;
+    char *formatSample(char *p, const void *record, const VergenceSample *vergence) const;
+    char *formatEvent(char *p, const void *record) const;
+
+    Table table;
+    std::vector<int> selected; //column indices in output order
+    char separator;
+    int precision;
+    bool vergenceSelected;
+    VergenceEstimator vergenceEstimator;
+};
+
+#endif // SESSIONEXPORTER_H
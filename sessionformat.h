@@ -0,0 +1,112 @@
+#ifndef SESSIONFORMAT_H
+#define SESSIONFORMAT_H
+
+//sessionformat.h
+//On disk layout of recorded eyetracking sessions (.mgs files)
+//
+//A session file is a SessionFileHeader followed by any number of chunks. Each chunk is a
+//SessionChunkHeader followed by count raw SampleStruct or EventStruct records, all records
+//are multiples of 8 bytes so chunk payloads stay aligned when the file is memory mapped.
+//Event chunks hold the fixations of the server ('F'), the blinks detected while recording ('B', see sampleclassifier.h),
+//the smooth pursuits detected while recording ('P', see pursuit.h) and the event markers of the experiment
+//('M', marker code in positionX, see TrackerSession::addMarker).
+//
+//Since version 2 every chunk carries a sequence number and a CRC-32 of its header and payload, and a journal
+//(session.mgs -> session.mgj) exists next to the file while it is recorded. The journal is a ring of
+//SessionJournalEntry slots, one written after every sync of the session file. The recording process also holds a
+//QLockFile (session.mgl, owner PID and host) for as long as it records. A journal left behind whose lock is not held by
+//a running process marks a recording that did not close; SessionRecorder::recover keeps the chunks that verify and
+//truncates the rest.
+
+#include <stddef.h>
+#include <myGazeAPI.h>
+
+static const char sessionFileMagic[8] = { 'M', 'G', 'S', 'E', 'S', 'S', '0', '1' };
+static const unsigned int sessionChunkMagic = 0x4B4E4843; //"CHNK"
+static const unsigned int sessionFileVersion = 2;
+
+enum SessionChunkType {
+    SampleChunk = 1, //payload is SampleStruct[count]
+    EventChunk = 2   //payload is EventStruct[count]
+};
+
+struct SessionFileHeader {
+    char magic[8];
+    unsigned int version;
+    int sampleRate;          //tracker sample rate [Hz], 0 if unknown
+    long long createdMs;     //host wall clock at recording start [milliseconds since epoch]
+    char participant[64];    //participant identifier, zero terminated
+};
+
+struct SessionChunkHeader {
+    unsigned int magic;
+    unsigned int type;         //SessionChunkType
+    unsigned int count;        //number of records
+    unsigned int payloadBytes; //count * record size
+    unsigned int sequence;     //0 for the first chunk of the file, version 2
+    unsigned int crc;          //sessionCrc32 of the fields above and the payload, version 2
+};
+static const unsigned int sessionChunkHeaderV1Bytes = 16; //version 1 headers end after payloadBytes
+
+//one journal slot, the valid slot with the most syncs is the latest
+struct SessionJournalEntry {
+    unsigned long long syncs; //0 for an unused slot
+    long long durableBytes;   //session file bytes known to be on disk
+    long long samples;        //records in those bytes
+    long long events;
+    long long lastTimestamp;  //newest durable sample [microseconds]
+    unsigned int chunks;
+    unsigned int crc;         //sessionCrc32 of the fields above
+};
+static const int sessionJournalSlots = 8;
+
+//CRC-32 (IEEE 802.3) tables for slicing by 8, built at compile time
+struct SessionCrcTable {
+    unsigned int entries[8][256];
+};
+
+constexpr SessionCrcTable makeSessionCrcTable() {
+    SessionCrcTable table = {};
+    for(unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+        table.entries[0][i] = crc;
+    }
+    for(int slice = 1; slice < 8; slice++) {
+        for(int i = 0; i < 256; i++) {
+            unsigned int previous = table.entries[slice - 1][i];
+            table.entries[slice][i] = (previous >> 8) ^ table.entries[0][previous & 0xFF];
+        }
+    }
+    return table;
+}
+
+inline constexpr SessionCrcTable sessionCrcTable = makeSessionCrcTable();
+
+//CRC-32 of bytes, continuing from crc (0 to start a new one)
+inline unsigned int sessionCrc32(const void *data, size_t bytes, unsigned int crc = 0) {
+    const unsigned int (*t)[256] = sessionCrcTable.entries;
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for(; bytes >= 8; bytes -= 8, p += 8) {
+        unsigned int low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24);
+        unsigned int high = p[4] | p[5] << 8 | p[6] << 16 | (unsigned int)p[7] << 24;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for(; bytes > 0; bytes--, p++) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+    }
+    return ~crc;
+}
+
+static_assert(sizeof(SampleStruct) % 8 == 0, "sample records must keep chunks 8 byte aligned");
+static_assert(sizeof(EventStruct) % 8 == 0, "event records must keep chunks 8 byte aligned");
+static_assert(sizeof(SessionFileHeader) % 8 == 0, "file header must keep chunks 8 byte aligned");
+static_assert(sizeof(SessionChunkHeader) % 8 == 0, "chunk header must keep payloads 8 byte aligned");
+static_assert(sessionChunkHeaderV1Bytes % 8 == 0, "version 1 chunk headers keep payloads 8 byte aligned");
+static_assert(offsetof(SessionChunkHeader, crc) == sizeof(SessionChunkHeader) - 4, "the chunk crc covers everything before it");
+
+#endif // SESSIONFORMAT_H
@@ -0,0 +1,534 @@
+//sessionquery.cpp
+//Implements the session indices, the parallel query engine and the --query command line mode
+
+#include "sessionquery.h"
+#include "sessionreader.h"
+#include "sampleclassifier.h"
+#include "batchanalyzer.h"
+#include "threadpool.h"
+#include "csvutil.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+static const char indexFileMagic[8] = { 'M', 'G', 'I', 'D', 'X', '0', '0', '1' };
+static const size_t matchBatch = 1024; //matches handed to the listener at once
+
+//TrackedEye bits of an event eye, events of both or no particular eye count for both
+static int eventEyes(const EventStruct &event) {
+    return event.eye == 'l' ? LeftEyeTracked : event.eye == 'r' ? RightEyeTracked : LeftEyeTracked | RightEyeTracked;
+}
+
+static unsigned int typeBit(char type) {
+    return type >= 'A' && type <= 'Z' ? 1u << (type - 'A') : 0;
+}
+
+static bool inside(const SessionQuery &query, double x, double y) {
+    return !query.region || (x >= query.left && x < query.right && y >= query.top && y < query.bottom);
+}
+
+static bool eventMatches(const EventStruct &event, const SessionQuery &query, long long from, long long to) {
+    return event.startTime <= to && event.endTime >= from && (!query.eventType || event.eventType == query.eventType)
+        && (eventEyes(event) & query.eyes) && event.duration >= query.minDuration && event.duration <= query.maxDuration
+        && inside(query, event.positionX, event.positionY);
+}
+
+static bool sampleMatches(const SampleStruct &sample, const SessionQuery &query, long long from, long long to) {
+    if(sample.timestamp < from || sample.timestamp > to) {
+        return false;
+    }
+    int tracked = trackedEyes(sample) & query.eyes;
+    return ((tracked & LeftEyeTracked) && inside(query, sample.leftEye.gazeX, sample.leftEye.gazeY))
+        || ((tracked & RightEyeTracked) && inside(query, sample.rightEye.gazeX, sample.rightEye.gazeY));
+}
+
+//Session Index Constructor
+SessionIndex::SessionIndex() : sampleTotal(0), eventTotal(0), fileBytes(0), width(1920), height(1080), origin(0) {
+}
+
+//gaze beyond the screen falls into the edge tiles
+unsigned long long SessionIndex::tilesOf(double x, double y) const {
+    int column = std::min(TileGrid - 1, std::max(0, (int)(x * TileGrid / width)));
+    int row = std::min(TileGrid - 1, std::max(0, (int)(y * TileGrid / height)));
+    return 1ULL << (row * TileGrid + column);
+}
+
+unsigned long long SessionIndex::tilesOf(const SessionQuery &query) const {
+    if(!query.region) {
+        return ~0ULL;
+    }
+    int firstColumn = std::min(TileGrid - 1, std::max(0, (int)(query.left * TileGrid / width)));
+    int lastColumn = std::min(TileGrid - 1, std::max(0, (int)(query.right * TileGrid / width)));
+    int firstRow = std::min(TileGrid - 1, std::max(0, (int)(query.top * TileGrid / height)));
+    int lastRow = std::min(TileGrid - 1, std::max(0, (int)(query.bottom * TileGrid / height)));
+    unsigned long long tiles = 0;
+    for(int row = firstRow; row <= lastRow; row++) {
+        for(int column = firstColumn; column <= lastColumn; column++) {
+            tiles |= 1ULL << (row * TileGrid + column);
+        }
+    }
+    return tiles;
+}
+
+void SessionIndex::build(const SessionReader &session, int screenWidth, int screenHeight) {
+    sampleTotal = session.sampleCount();
+    eventTotal = session.eventCount();
+    fileBytes = session.fileSize();
+    width = std::max(1, screenWidth);
+    height = std::max(1, screenHeight);
+    samples.clear();
+    events.clear();
+    eventBlocks.clear();
+
+    const std::vector<SampleBlock> &sampleChunks = session.sampleBlocks();
+    origin = !sampleChunks.empty() && sampleChunks[0].count > 0 ? sampleChunks[0].records[0].timestamp : 0;
+    for(size_t c = 0; c < sampleChunks.size(); c++) {
+        for(int offset = 0; offset < sampleChunks[c].count; offset += RunSamples) {
+            SampleEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.chunk = (int)c;
+            entry.offset = offset;
+            entry.count = std::min((int)RunSamples, sampleChunks[c].count - offset);
+            const SampleStruct *run = sampleChunks[c].records + offset;
+            entry.firstTime = run[0].timestamp;
+            entry.lastTime = run[entry.count - 1].timestamp;
+            for(int i = 0; i < entry.count; i++) {
+                int eyes = trackedEyes(run[i]);
+                if(eyes & LeftEyeTracked) {
+                    entry.tiles[0] |= tilesOf(run[i].leftEye.gazeX, run[i].leftEye.gazeY);
+                }
+                if(eyes & RightEyeTracked) {
+                    entry.tiles[1] |= tilesOf(run[i].rightEye.gazeX, run[i].rightEye.gazeY);
+                }
+            }
+            samples.push_back(entry);
+        }
+    }
+
+    //events are recorded as they end, so they are sorted by start time here
+    const std::vector<EventBlock> &eventChunks = session.eventBlocks();
+    for(size_t c = 0; c < eventChunks.size(); c++) {
+        for(int i = 0; i < eventChunks[c].count; i++) {
+            EventRef ref;
+            ref.start = eventChunks[c].records[i].startTime;
+            ref.end = eventChunks[c].records[i].endTime;
+            ref.chunk = (int)c;
+            ref.offset = i;
+            events.push_back(ref);
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [](const EventRef &a, const EventRef &b) { return a.start < b.start; });
+    long long lastEnd = -unboundedTime;
+    for(size_t first = 0; first < events.size(); first += BlockEvents) {
+        EventSummary summary;
+        memset(&summary, 0, sizeof(summary));
+        size_t last = std::min(events.size(), first + BlockEvents);
+        summary.firstStart = events[first].start;
+        summary.lastStart = events[last - 1].start;
+        summary.minDuration = unboundedTime;
+        summary.maxDuration = -unboundedTime;
+        for(size_t e = first; e < last; e++) {
+            const EventStruct &event = eventChunks[events[e].chunk].records[events[e].offset];
+            lastEnd = std::max(lastEnd, event.endTime);
+            summary.minDuration = std::min(summary.minDuration, event.duration);
+            summary.maxDuration = std::max(summary.maxDuration, event.duration);
+            summary.tiles |= tilesOf(event.positionX, event.positionY);
+            summary.types |= typeBit(event.eventType);
+            summary.eyes |= eventEyes(event);
+        }
+        summary.lastEnd = lastEnd;
+        eventBlocks.push_back(summary);
+    }
+}
+
+//samples and events are visited in time order, the summaries let whole runs and blocks be skipped
+void SessionIndex::query(const SessionReader &session, const SessionQuery &query, const std::function<void(const QueryMatch &)> &match,
+                         bool useIndex) const {
+    long long from = query.from > -unboundedTime ? origin + query.from : query.from;
+    long long to = query.to < unboundedTime ? origin + query.to : query.to;
+    unsigned long long regionTiles = tilesOf(query);
+    QueryMatch found;
+    found.session = 0;
+
+    if(query.target == SessionQuery::Samples) {
+        const std::vector<SampleBlock> &chunks = session.sampleBlocks();
+        std::vector<SampleEntry>::const_iterator entry = samples.begin();
+        if(useIndex) {
+            entry = std::partition_point(samples.begin(), samples.end(), [from](const SampleEntry &e) { return e.lastTime < from; });
+        }
+        found.event = 0;
+        for(; entry != samples.end(); ++entry) {
+            if(useIndex) {
+                if(entry->firstTime > to) {
+                    break;
+                }
+                unsigned long long tiles = ((query.eyes & LeftEyeTracked) ? entry->tiles[0] : 0)
+                    | ((query.eyes & RightEyeTracked) ? entry->tiles[1] : 0);
+                if(!(tiles & regionTiles)) {
+                    continue;
+                }
+            }
+            const SampleStruct *run = chunks[entry->chunk].records + entry->offset;
+            for(int i = 0; i < entry->count; i++) {
+                if(sampleMatches(run[i], query, from, to)) {
+                    found.time = run[i].timestamp - origin;
+                    found.sample = &run[i];
+                    match(found);
+                }
+            }
+        }
+        return;
+    }
+
+    const std::vector<EventBlock> &chunks = session.eventBlocks();
+    size_t block = 0;
+    if(useIndex) {
+        block = std::partition_point(eventBlocks.begin(), eventBlocks.end(), [from](const EventSummary &b) { return b.lastEnd < from; })
+            - eventBlocks.begin();
+    }
+    unsigned int types = query.eventType ? typeBit(query.eventType) : ~0u;
+    found.sample = 0;
+    for(; block < eventBlocks.size(); block++) {
+        if(useIndex) {
+            const EventSummary &summary = eventBlocks[block];
+            if(summary.firstStart > to) {
+                break;
+            }
+            if(!(summary.tiles & regionTiles) || !(summary.types & types) || !(summary.eyes & query.eyes)
+               || summary.maxDuration < query.minDuration || summary.minDuration > query.maxDuration) {
+                continue;
+            }
+        }
+        size_t last = std::min(events.size(), (block + 1) * BlockEvents);
+        for(size_t e = block * BlockEvents; e < last; e++) {
+            const EventStruct &event = chunks[events[e].chunk].records[events[e].offset];
+            if(eventMatches(event, query, from, to)) {
+                found.time = event.startTime - origin;
+                found.event = &event;
+                match(found);
+            }
+        }
+    }
+}
+
+//the header identifies the session the index was built for, the arrays follow as they are in memory
+bool SessionIndex::save(const QString &path) const {
+    FILE *file = fopen(QFile::encodeName(path).constData(), "wb");
+    if(!file) {
+        return false;
+    }
+    long long header[9] = { sampleTotal, eventTotal, fileBytes, width, height, origin, (long long)samples.size(), (long long)events.size(),
+                            (long long)eventBlocks.size() };
+    bool ok = fwrite(indexFileMagic, sizeof(indexFileMagic), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1
+        && (samples.empty() || fwrite(samples.data(), sizeof(SampleEntry), samples.size(), file) == samples.size())
+        && (events.empty() || fwrite(events.data(), sizeof(EventRef), events.size(), file) == events.size())
+        && (eventBlocks.empty() || fwrite(eventBlocks.data(), sizeof(EventSummary), eventBlocks.size(), file) == eventBlocks.size());
+    return fclose(file) == 0 && ok;
+}
+
+bool SessionIndex::load(const QString &path, const SessionReader &session) {
+    FILE *file = fopen(QFile::encodeName(path).constData(), "rb");
+    if(!file) {
+        return false;
+    }
+    char magic[8];
+    long long header[9];
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, indexFileMagic, sizeof(magic)) == 0
+        && fread(header, sizeof(header), 1, file) == 1 && header[0] == session.sampleCount() && header[1] == session.eventCount()
+        && header[2] == session.fileSize() && header[6] >= 0 && header[7] >= 0 && header[8] >= 0;
+    if(ok) {
+        sampleTotal = header[0];
+        eventTotal = header[1];
+        fileBytes = header[2];
+        width = (int)header[3];
+        height = (int)header[4];
+        origin = header[5];
+        samples.resize((size_t)header[6]);
+        events.resize((size_t)header[7]);
+        eventBlocks.resize((size_t)header[8]);
+        ok = (samples.empty() || fread(samples.data(), sizeof(SampleEntry), samples.size(), file) == samples.size())
+            && (events.empty() || fread(events.data(), sizeof(EventRef), events.size(), file) == events.size())
+            && (eventBlocks.empty() || fread(eventBlocks.data(), sizeof(EventSummary), eventBlocks.size(), file) == eventBlocks.size());
+    }
+    fclose(file);
+    //references into the mapped file are checked once so queries can follow them unchecked
+    const std::vector<SampleBlock> &sampleChunks = session.sampleBlocks();
+    const std::vector<EventBlock> &eventChunks = session.eventBlocks();
+    for(size_t i = 0; ok && i < samples.size(); i++) {
+        ok = samples[i].chunk >= 0 && samples[i].chunk < (int)sampleChunks.size() && samples[i].offset >= 0 && samples[i].count > 0
+            && samples[i].offset + samples[i].count <= sampleChunks[samples[i].chunk].count;
+    }
+    for(size_t i = 0; ok && i < events.size(); i++) {
+        ok = events[i].chunk >= 0 && events[i].chunk < (int)eventChunks.size() && events[i].offset >= 0
+            && events[i].offset < eventChunks[events[i].chunk].count;
+    }
+    ok = ok && eventBlocks.size() == (events.size() + BlockEvents - 1) / BlockEvents;
+    if(!ok) {
+        samples.clear();
+        events.clear();
+        eventBlocks.clear();
+    }
+    return ok;
+}
+
+QString SessionIndex::pathFor(const QString &sessionPath) {
+    QString path = sessionPath;
+    if(path.endsWith(".mgs")) {
+        path.chop(4);
+    }
+    return path + ".mgi";
+}
+
+long long SessionIndex::bytes() const {
+    return (long long)(sizeof(indexFileMagic) + 9 * sizeof(long long) + samples.size() * sizeof(SampleEntry) + events.size() * sizeof(EventRef)
+                       + eventBlocks.size() * sizeof(EventSummary));
+}
+
+struct SessionQueryEngine::Session {
+    QString path;
+    SessionReader reader;
+    SessionIndex index;
+};
+
+//Session Query Engine Constructor
+SessionQueryEngine::SessionQueryEngine(ThreadPool &pool) : pool(pool), buildTime(0), built(0) {
+}
+
+SessionQueryEngine::~SessionQueryEngine() {
+}
+
+int SessionQueryEngine::open(const QStringList &paths, bool rebuild, bool saveIndices) {
+    sessions.clear();
+    for(int i = 0; i < paths.size(); i++) {
+        sessions.push_back(std::unique_ptr<Session>(new Session()));
+        sessions.back()->path = paths[i];
+    }
+    std::atomic<long long> buildNanoseconds(0);
+    std::atomic<int> builtIndices(0);
+    for(size_t s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            Session &session = *sessions[s];
+            if(!session.reader.open(session.path)) {
+                qWarning() << "Session could not be opened:" << session.path;
+                return;
+            }
+            QString indexPath = SessionIndex::pathFor(session.path);
+            if(rebuild || !session.index.load(indexPath, session.reader)) {
+                QElapsedTimer timer;
+                timer.start();
+                session.index.build(session.reader);
+                buildNanoseconds.fetch_add(timer.nsecsElapsed());
+                builtIndices.fetch_add(1);
+                if(saveIndices && !session.index.save(indexPath)) {
+                    qWarning() << "Index could not be saved:" << indexPath;
+                }
+            }
+        });
+    }
+    pool.waitForIdle();
+    sessions.erase(std::remove_if(sessions.begin(), sessions.end(), [](const std::unique_ptr<Session> &session) {
+        return !session->reader.isOpen();
+    }), sessions.end());
+    buildTime = buildNanoseconds.load() / 1e9;
+    built = builtIndices.load();
+    return (int)sessions.size();
+}
+
+int SessionQueryEngine::sessionCount() const {
+    return (int)sessions.size();
+}
+
+QString SessionQueryEngine::path(int session) const {
+    return sessions[session]->path;
+}
+
+long long SessionQueryEngine::indexBytes() const {
+    long long total = 0;
+    for(size_t s = 0; s < sessions.size(); s++) {
+        total += sessions[s]->index.bytes();
+    }
+    return total;
+}
+
+double SessionQueryEngine::buildSeconds() const {
+    return buildTime;
+}
+
+int SessionQueryEngine::builtCount() const {
+    return built;
+}
+
+long long SessionQueryEngine::run(const SessionQuery &query, const std::function<void(const std::vector<QueryMatch> &)> &listener,
+                                  bool useIndex) const {
+    std::atomic<long long> matches(0);
+    for(size_t s = 0; s < sessions.size(); s++) {
+        pool.submit([&, s]() {
+            std::vector<QueryMatch> batch;
+            batch.reserve(matchBatch);
+            std::function<void()> flush = [&]() {
+                if(!batch.empty()) {
+                    matches.fetch_add(batch.size());
+                    if(listener) {
+                        std::lock_guard<std::mutex> lock(listenerMutex);
+                        listener(batch);
+                    }
+                    batch.clear();
+                }
+            };
+            sessions[s]->index.query(sessions[s]->reader, query, [&](const QueryMatch &match) {
+                batch.push_back(match);
+                batch.back().session = (int)s;
+                if(batch.size() == matchBatch) {
+                    flush();
+                }
+            }, useIndex);
+            flush();
+        });
+    }
+    pool.waitForIdle();
+    return matches.load();
+}
+
+//random time and region queries, alternating samples and fixations, timed with and without the index summaries
+static void benchmarkQueries(const SessionQueryEngine &engine, int count) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double indexed = 0, scanned = 0;
+    long long matches = 0;
+    int mismatches = 0;
+    for(int q = 0; q < count; q++) {
+        SessionQuery query;
+        query.target = q % 2 ? SessionQuery::Samples : SessionQuery::Events;
+        query.from = (long long)(uniform(random) * 600e6);
+        query.to = query.from + (long long)((5 + uniform(random) * 55) * 1e6);
+        query.region = true;
+        query.left = uniform(random) * 1620;
+        query.top = uniform(random) * 780;
+        query.right = query.left + 300;
+        query.bottom = query.top + 300;
+        QElapsedTimer timer;
+        timer.start();
+        long long found = engine.run(query, std::function<void(const std::vector<QueryMatch> &)>());
+        indexed += timer.nsecsElapsed() / 1e6;
+        timer.restart();
+        long long reference = engine.run(query, std::function<void(const std::vector<QueryMatch> &)>(), false);
+        scanned += timer.nsecsElapsed() / 1e6;
+        matches += found;
+        mismatches += found != reference;
+    }
+    qDebug() << "Benchmark of" << count << "queries:" << indexed / count << "ms with the index," << scanned / count << "ms scanning,"
+             << matches << "matches," << mismatches << "mismatches";
+}
+
+int SessionQueryEngine::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Time, region, eye and duration queries over recorded sessions");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("query", "Session file or directory scanned recursively for .mgs sessions.", "path"));
+    parser.addOption(QCommandLineOption("output", "Result table, one row per match.", "file", "query.csv"));
+    parser.addOption(QCommandLineOption("target", "fixations, events or samples.", "target", "fixations"));
+    parser.addOption(QCommandLineOption("from", "Window start after the first sample of each session.", "ms"));
+    parser.addOption(QCommandLineOption("to", "Window end after the first sample of each session.", "ms"));
+    parser.addOption(QCommandLineOption("region", "Screen rectangle x,y,width,height.", "px"));
+    parser.addOption(QCommandLineOption("eye", "left, right or any.", "eye", "any"));
+    parser.addOption(QCommandLineOption("type", "Event type of --target events, for example F, B, P or M.", "c"));
+    parser.addOption(QCommandLineOption("min-duration", "Shortest event.", "ms"));
+    parser.addOption(QCommandLineOption("max-duration", "Longest event.", "ms"));
+    parser.addOption(QCommandLineOption("rebuild", "Rebuild the indices even if they are up to date."));
+    parser.addOption(QCommandLineOption("no-save", "Do not write built indices next to the sessions."));
+    parser.addOption(QCommandLineOption("benchmark", "Also time count random queries with and without the index.", "count", "0"));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 uses every core.", "count", "0"));
+    parser.process(arguments);
+
+    SessionQuery query;
+    QString target = parser.value("target");
+    query.target = target == "samples" ? SessionQuery::Samples : SessionQuery::Events;
+    query.eventType = target == "fixations" ? 'F' : parser.value("type").toLatin1().constData()[0];
+    if(target != "fixations" && target != "events" && target != "samples") {
+        qWarning() << "Unknown --target:" << target;
+        return 1;
+    }
+    if(parser.isSet("from")) {
+        query.from = (long long)(parser.value("from").toDouble() * 1000);
+    }
+    if(parser.isSet("to")) {
+        query.to = (long long)(parser.value("to").toDouble() * 1000);
+    }
+    if(parser.isSet("region")) {
+        QStringList values = parser.value("region").split(',');
+        if(values.size() != 4) {
+            qWarning() << "--region needs x,y,width,height";
+            return 1;
+        }
+        query.region = true;
+        query.left = values[0].toDouble();
+        query.top = values[1].toDouble();
+        query.right = query.left + values[2].toDouble();
+        query.bottom = query.top + values[3].toDouble();
+    }
+    QString eye = parser.value("eye");
+    query.eyes = eye == "left" ? LeftEyeTracked : eye == "right" ? RightEyeTracked : LeftEyeTracked | RightEyeTracked;
+    if(parser.isSet("min-duration")) {
+        query.minDuration = (long long)(parser.value("min-duration").toDouble() * 1000);
+    }
+    if(parser.isSet("max-duration")) {
+        query.maxDuration = (long long)(parser.value("max-duration").toDouble() * 1000);
+    }
+
+    QString input = parser.value("query");
+    QStringList paths = QFileInfo(input).isDir() ? BatchAnalyzer::findSessions(input) : QStringList(input);
+    ThreadPool pool(parser.value("threads").toInt());
+    SessionQueryEngine engine(pool);
+    QElapsedTimer timer;
+    timer.start();
+    engine.open(paths, parser.isSet("rebuild"), !parser.isSet("no-save"));
+    double opened = timer.elapsed() / 1000.0;
+    qDebug() << "Opened" << engine.sessionCount() << "sessions in" << opened << "s, built" << engine.builtCount() << "indices in"
+             << engine.buildSeconds() << "s of worker time, index size" << engine.indexBytes() / 1024.0 << "KiB";
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    if(query.target == SessionQuery::Samples) {
+        out << "session,time_ms,timestamp,left_x,left_y,right_x,right_y\n";
+    }
+    else {
+        out << "session,time_ms,type,eye,start,end,duration_ms,x,y\n";
+    }
+
+    //rows are written as the sessions report them
+    timer.restart();
+    long long matches = engine.run(query, [&](const std::vector<QueryMatch> &batch) {
+        for(size_t i = 0; i < batch.size(); i++) {
+            const QueryMatch &match = batch[i];
+            out << csvField(engine.path(match.session)) << ',' << match.time / 1000.0 << ',';
+            if(match.sample) {
+                const SampleStruct &s = *match.sample;
+                out << s.timestamp << ',' << s.leftEye.gazeX << ',' << s.leftEye.gazeY << ',' << s.rightEye.gazeX << ',' << s.rightEye.gazeY << '\n';
+            }
+            else {
+                const EventStruct &e = *match.event;
+                out << (e.eventType ? QString(QChar(e.eventType)) : QString()) << ',' << (e.eye ? QString(QChar(e.eye)) : QString()) << ','
+                    << e.startTime << ',' << e.endTime << ',' << e.duration / 1000.0 << ',' << e.positionX << ',' << e.positionY << '\n';
+            }
+        }
+    });
+    qDebug() << "Query matched" << matches << "records in" << timer.nsecsElapsed() / 1e6 << "ms";
+
+    int benchmark = parser.value("benchmark").toInt();
+    if(benchmark > 0) {
+        benchmarkQueries(engine, benchmark);
+    }
+    return 0;
+}
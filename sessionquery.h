@@ -0,0 +1,140 @@
+#ifndef SESSIONQUERY_H
+#define SESSIONQUERY_H
+
+//sessionquery.h
+//Time, region, eye and duration queries over many recorded sessions without scanning whole files. Every session gets an
+//index (saved next to it, session.mgs -> session.mgi) with the time range and per eye 8 x 8 screen tile mask of every
+//run of up to 256 samples, and its events sorted by start time in blocks of 64 with the same summaries plus their
+//type, eye and duration ranges. Queries skip every block whose summary cannot match, run one task per session and
+//hand the matches to the listener as they are found.
+
+#include <QString>
+#include <QStringList>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <myGazeAPI.h>
+
+class SessionReader;
+class ThreadPool;
+
+static const long long unboundedTime = 1LL << 62; //open ends of the query time window and duration range
+
+struct SessionQuery {
+    enum Target { Samples, Events };
+
+    SessionQuery() : target(Events), from(-unboundedTime), to(unboundedTime), region(false), left(0), top(0), right(0), bottom(0),
+        eyes(3), eventType('F'), minDuration(0), maxDuration(unboundedTime) {}
+    Target target;
+    long long from;        //time window relative to the first sample of each session [microseconds], events overlapping it match
+    long long to;
+    bool region;           //restrict to gaze (samples) or event positions inside left <= x < right, top <= y < bottom [pixel]
+    double left, top, right, bottom;
+    int eyes;              //TrackedEye bits, samples need one of these eyes tracked (and inside the region), events 'l', 'r' or 'b'
+    char eventType;        //0 for any event type
+    long long minDuration; //events only [microseconds]
+    long long maxDuration;
+};
+
+struct QueryMatch {
+    int session;                //index into the opened paths
+    long long time;             //relative to the first sample of the session [microseconds]
+    const SampleStruct *sample; //the matching record inside the mapped session, the other one is 0
+    const EventStruct *event;
+};
+
+class SessionIndex {
+
+public:
+    enum { RunSamples = 256, BlockEvents = 64, TileGrid = 8 };
+
+    //summary of a run of samples inside one chunk
+    struct SampleEntry {
+        long long firstTime;
+        long long lastTime;
+        int chunk;           //sample block of the session
+        int offset;
+        int count;
+        int padding;
+        unsigned long long tiles[2]; //[eye] tiles holding tracked gaze
+    };
+    struct EventRef {
+        long long start;
+        long long end;
+        int chunk;
+        int offset;
+    };
+    struct EventSummary {
+        long long firstStart;
+        long long lastStart;
+        long long lastEnd;   //latest end of this and every earlier block, so blocks can be binary searched by end
+        long long minDuration;
+        long long maxDuration;
+        unsigned long long tiles;
+        unsigned int types; //bit eventType - 'A'
+        int eyes;           //TrackedEye bits
+    };
+
+    SessionIndex();
+
+    void build(const SessionReader &session, int screenWidth = 1920, int screenHeight = 1080);
+    bool save(const QString &path) const;
+    //false if the file is missing, damaged or was built for another version of the session
+    bool load(const QString &path, const SessionReader &session);
+    static QString pathFor(const QString &sessionPath);
+    long long bytes() const; //in memory and on disk size of the index
+
+    //calls match for every record the query selects, in time order
+    void query(const SessionReader &session, const SessionQuery &query, const std::function<void(const QueryMatch &)> &match,
+               bool useIndex = true) const;
+
+private:
+    unsigned long long tilesOf(double x, double y) const;
+    unsigned long long tilesOf(const SessionQuery &query) const;
+
+    long long sampleTotal;
+    long long eventTotal;
+    long long fileBytes;
+    int width;
+    int height;
+    long long origin; //first sample timestamp
+    std::vector<SampleEntry> samples;
+    std::vector<EventRef> events;
+    std::vector<EventSummary> eventBlocks;
+};
+
+class SessionQueryEngine {
+
+public:
+    explicit SessionQueryEngine(ThreadPool &pool);
+    ~SessionQueryEngine();
+
+    //opens the sessions and loads their indices, missing or outdated ones are built (and saved unless disabled) in parallel,
+    //returns the number of sessions opened
+    int open(const QStringList &paths, bool rebuild = false, bool saveIndices = true);
+    int sessionCount() const;
+    QString path(int session) const;
+    long long indexBytes() const;
+    double buildSeconds() const; //time spent building indices in the last open
+    int builtCount() const;      //indices built in the last open, the others were loaded
+
+    //runs the query over every session in parallel, listener receives batches of matches of one session in time order,
+    //batches of different sessions interleave but never overlap; returns the number of matches
+    long long run(const SessionQuery &query, const std::function<void(const std::vector<QueryMatch> &)> &listener,
+                  bool useIndex = true) const;
+
+    //entry point of the --query command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    struct Session;
+
+    ThreadPool &pool;
+    std::vector<std::unique_ptr<Session>> sessions;
+    double buildTime;
+    int built;
+    mutable std::mutex listenerMutex;
+};
+
+#endif // SESSIONQUERY_H
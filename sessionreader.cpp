@@ -0,0 +1,126 @@
+//sessionreader.cpp
+//Implements read only access to recorded session files through a memory mapping
+
+#include "sessionreader.h"
+#include <string.h>
+
+//Session Reader Constructor
+SessionReader::SessionReader() : data(0), size(0), truncated(false), totalSamples(0), totalEvents(0) {
+    memset(&fileHeader, 0, sizeof(fileHeader));
+}
+
+//Session Reader Constructor, opens path right away
+SessionReader::SessionReader(const QString &path) : data(0), size(0), truncated(false), totalSamples(0), totalEvents(0) {
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    open(path);
+}
+
+//Session Reader Destructor
+SessionReader::~SessionReader() {
+    close();
+}
+
+//Maps the file and indexes its chunks, returns false if it is not a session file
+bool SessionReader::open(const QString &path) {
+    close();
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    size = file.size();
+    if(size < (qint64)sizeof(SessionFileHeader)) {
+        close();
+        return false;
+    }
+    data = file.map(0, size);
+    if(!data) {
+        close();
+        return false;
+    }
+    memcpy(&fileHeader, data, sizeof(fileHeader));
+    if(memcmp(fileHeader.magic, sessionFileMagic, sizeof(fileHeader.magic)) != 0 || fileHeader.version > sessionFileVersion) {
+        close();
+        return false;
+    }
+    fileHeader.participant[sizeof(fileHeader.participant) - 1] = 0;
+
+    //walk the chunk headers, a partially written trailing chunk is ignored; checksums are left to SessionRecorder::recover
+    qint64 headerBytes = fileHeader.version >= 2 ? sizeof(SessionChunkHeader) : sessionChunkHeaderV1Bytes;
+    qint64 offset = sizeof(SessionFileHeader);
+    while(offset + headerBytes <= size) {
+        const SessionChunkHeader *chunk = reinterpret_cast<const SessionChunkHeader *>(data + offset); //fields up to payloadBytes
+        qint64 payload = offset + headerBytes;
+        if(chunk->magic != sessionChunkMagic || payload + chunk->payloadBytes > size) {
+            break;
+        }
+        if(chunk->type == SampleChunk && chunk->payloadBytes == chunk->count * sizeof(SampleStruct)) {
+            SampleBlock block = { reinterpret_cast<const SampleStruct *>(data + payload), (int)chunk->count };
+            samples.push_back(block);
+            totalSamples += chunk->count;
+        }
+        else if(chunk->type == EventChunk && chunk->payloadBytes == chunk->count * sizeof(EventStruct)) {
+            EventBlock block = { reinterpret_cast<const EventStruct *>(data + payload), (int)chunk->count };
+            events.push_back(block);
+            totalEvents += chunk->count;
+        }
+        offset = payload + chunk->payloadBytes; //unknown chunk types are skipped
+    }
+    truncated = offset != size;
+    return true;
+}
+
+void SessionReader::close() {
+    if(data) {
+        file.unmap(const_cast<uchar *>(data));
+        data = 0;
+    }
+    if(file.isOpen()) {
+        file.close();
+    }
+    size = 0;
+    truncated = false;
+    samples.clear();
+    events.clear();
+    totalSamples = 0;
+    totalEvents = 0;
+}
+
+bool SessionReader::isOpen() const {
+    return data != 0;
+}
+
+bool SessionReader::isTruncated() const {
+    return truncated;
+}
+
+QString SessionReader::path() const {
+    return file.fileName();
+}
+
+qint64 SessionReader::fileSize() const {
+    return size;
+}
+
+const SessionFileHeader &SessionReader::header() const {
+    return fileHeader;
+}
+
+QString SessionReader::participant() const {
+    return QString::fromUtf8(fileHeader.participant);
+}
+
+const std::vector<SampleBlock> &SessionReader::sampleBlocks() const {
+    return samples;
+}
+
+const std::vector<EventBlock> &SessionReader::eventBlocks() const {
+    return events;
+}
+
+long long SessionReader::sampleCount() const {
+    return totalSamples;
+}
+
+long long SessionReader::eventCount() const {
+    return totalEvents;
+}
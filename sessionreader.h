@@ -0,0 +1,75 @@
+#ifndef SESSIONREADER_H
+#define SESSIONREADER_H
+
+//sessionreader.h
+//Memory maps a recorded session file and exposes its sample and event chunks without copying
+
+#include <QFile>
+#include <QString>
+#include <vector>
+#include "sessionformat.h"
+
+//contiguous run of records inside the mapped file
+template<typename Record>
+struct RecordBlock {
+    const Record *records;
+    int count;
+};
+
+typedef RecordBlock<SampleStruct> SampleBlock;
+typedef RecordBlock<EventStruct> EventBlock;
+
+class SessionReader {
+
+public:
+    SessionReader();
+    explicit SessionReader(const QString &path);
+    ~SessionReader();
+
+    bool open(const QString &path);
+    void close(); //unmaps the file, all blocks become invalid
+    bool isOpen() const;
+    bool isTruncated() const; //true if the file ends inside a chunk
+    QString path() const;
+    qint64 fileSize() const;
+
+    const SessionFileHeader &header() const;
+    QString participant() const;
+
+    const std::vector<SampleBlock> &sampleBlocks() const;
+    const std::vector<EventBlock> &eventBlocks() const;
+    long long sampleCount() const;
+    long long eventCount() const;
+
+    //calls f(const SampleStruct &) / f(const EventStruct &) for every record in file order
+    template<typename Function> void forEachSample(Function f) const {
+        for(size_t b = 0; b < samples.size(); b++) {
+            for(int i = 0; i < samples[b].count; i++) {
+                f(samples[b].records[i]);
+            }
+        }
+    }
+    template<typename Function> void forEachEvent(Function f) const {
+        for(size_t b = 0; b < events.size(); b++) {
+            for(int i = 0; i < events[b].count; i++) {
+                f(events[b].records[i]);
+            }
+        }
+    }
+
+private:
+    SessionReader(const SessionReader &);
+    SessionReader &operator=(const SessionReader &);
+
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    bool truncated;
+    SessionFileHeader fileHeader;
+    std::vector<SampleBlock> samples;
+    std::vector<EventBlock> events;
+    long long totalSamples;
+    long long totalEvents;
+};
+
+#endif // SESSIONREADER_H
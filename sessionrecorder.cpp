@@ -0,0 +1,696 @@
+//sessionrecorder.cpp
+//Implements the session recorder, callbacks only append to a pending chunk and a writer thread does the disk io and the syncs
+
+#include "sessionrecorder.h"
+#include "sessionreader.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "csvutil.h"
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QTextStream>
+#include <algorithm>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const size_t samplesPerChunk = 512; //about one second of data at the highest myGaze rates
+static const int flushIntervalMs = 250;    //pending data older than this is written even if the chunk is not full
+static const int defaultSyncIntervalMs = 250;
+static const long long defaultBufferBytes = 64LL * 1024 * 1024; //minutes of samples at the highest rates
+static const size_t spillReadSamples = 8 * samplesPerChunk;
+static const std::vector<long long> syncBuckets = { 100, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000 };
+
+//metrics of all recorders together
+struct RecorderMetrics {
+    RecorderMetrics() {
+        MetricsRegistry &registry = MetricsRegistry::global();
+        samples = registry.counter("mygaze_recorded_samples_total", "Samples written to session files.");
+        events = registry.counter("mygaze_recorded_events_total", "Events written to session files.");
+        bytes = registry.counter("mygaze_recorded_bytes_total", "Bytes written to session files.");
+        syncs = registry.counter("mygaze_recording_syncs_total", "Session file and journal syncs.");
+        syncFailures = registry.counter("mygaze_recording_sync_failures_total", "Session files that could not be synced.");
+        syncDuration = registry.histogram("mygaze_recording_sync_duration_microseconds", "Time of a file and journal sync.", syncBuckets);
+        queue = registry.gauge("mygaze_recording_queue_samples", "Samples taken by the writers or spilled and not yet written.");
+    }
+    MetricCounter *samples;
+    MetricCounter *events;
+    MetricCounter *bytes;
+    MetricCounter *syncs;
+    MetricCounter *syncFailures;
+    MetricHistogram *syncDuration;
+    MetricGauge *queue;
+};
+static RecorderMetrics metrics;
+
+//flushes the stdio buffer and asks the os to put the file on the disk
+static bool syncToDisk(FILE *file) {
+    if(fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static unsigned int journalEntryCrc(const SessionJournalEntry &entry) {
+    return sessionCrc32(&entry, offsetof(SessionJournalEntry, crc));
+}
+
+//Session Recorder Constructor
+SessionRecorder::SessionRecorder() : file(0), journal(0), syncMilliseconds(defaultSyncIntervalMs), pendingCount(0),
+    bufferLimit(defaultBufferBytes), bufferPolicy(SpillToDisk), stopping(false), unsynced(false), writtenSamples(0), writtenEvents(0), syncCount(0), longestWait(0), sequence(0), chunks(0), writtenBytes(0), lastTimestamp(0) {
+}
+
+//Session Recorder Destructor
+SessionRecorder::~SessionRecorder() {
+    close();
+}
+
+void SessionRecorder::setSyncInterval(int milliseconds) {
+    syncMilliseconds = std::max(0, milliseconds);
+}
+
+int SessionRecorder::syncInterval() const {
+    return syncMilliseconds;
+}
+
+void SessionRecorder::setBufferLimit(long long bytes, OverflowPolicy policy) {
+    bufferLimit = std::max(bytes, (long long)(samplesPerChunk * sizeof(SampleStruct)));
+    bufferPolicy = policy;
+}
+
+//Creates the session file and its journal, writes the header and starts the writer thread
+bool SessionRecorder::open(const QString &path, const QString &participant, int sampleRate) {
+    close();
+    //taken before the journal exists, so another process never sees the journal of a live recording unlocked
+    owner.reset(new QLockFile(lockPathFor(path)));
+    owner->setStaleLockTime(0); //only a dead owner process makes the lock stale, recordings run for hours
+    if(!owner->tryLock(0)) {
+        qWarning() << "Session is being recorded by another process:" << path;
+        owner.reset();
+        return false;
+    }
+    //producers test file under pendingMutex, so it is only published once the recording is set up
+    FILE *created = fopen(QFile::encodeName(path).constData(), "wb");
+    if(!created) {
+        owner.reset();
+        return false;
+    }
+
+    SessionFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sessionFileMagic, sizeof(header.magic));
+    header.version = sessionFileVersion;
+    header.sampleRate = sampleRate;
+    header.createdMs = QDateTime::currentMSecsSinceEpoch();
+    QByteArray id = participant.toUtf8().left(sizeof(header.participant) - 1);
+    memcpy(header.participant, id.constData(), id.size());
+
+    //a recording without its journal could not be told apart from a closed one after a crash
+    SessionJournalEntry entries[sessionJournalSlots];
+    memset(entries, 0, sizeof(entries));
+    journal = fopen(QFile::encodeName(journalPathFor(path)).constData(), "wb");
+    if(fwrite(&header, sizeof(header), 1, created) != 1 || !journal || fwrite(entries, sizeof(entries), 1, journal) != 1 || !syncToDisk(journal)) {
+        fclose(created);
+        if(journal) {
+            fclose(journal);
+            journal = 0;
+        }
+        QFile::remove(journalPathFor(path));
+        owner.reset();
+        return false;
+    }
+
+    filePath = path;
+    writtenSamples.store(0);
+    writtenEvents.store(0);
+    syncCount.store(0);
+    longestWait.store(0);
+    sequence = 0;
+    chunks = 0;
+    writtenBytes = sizeof(header);
+    lastTimestamp = 0;
+    pendingChunks.clear();
+    pendingCount = 0;
+    bufferAccount = MemoryBudget::global().account("recording " + QFileInfo(path).fileName(), bufferLimit, bufferPolicy);
+    samplePyramid.clear();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        file = created;
+        stopping = false;
+        unsynced = false;
+    }
+    writer = std::thread(&SessionRecorder::run, this);
+    return true;
+}
+
+//Writes and syncs everything still pending, then removes the journal since the file is complete; callers stop their
+//producers first (TrackerSession releases its callback slot), records arriving meanwhile are dropped
+void SessionRecorder::close() {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if(!file) {
+            return;
+        }
+        stopping = true;
+    }
+    pendingCondition.notify_all();
+    drainedCondition.notify_all();
+    writer.join();
+    bufferAccount.reset();
+    spill.clear();
+    FILE *closing;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        closing = file;
+        file = 0;
+    }
+    fclose(closing);
+    fclose(journal);
+    journal = 0;
+    QFile::remove(journalPathFor(filePath));
+    owner.reset(); //unlocks and removes the lock file once the journal is gone
+    samplePyramid.save(SamplePyramid::pathFor(filePath)); //the session stays usable without it, viewers rebuild it
+}
+
+bool SessionRecorder::isOpen() const {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    return file != 0;
+}
+
+QString SessionRecorder::path() const {
+    return filePath;
+}
+
+void SessionRecorder::markUnsynced() {
+    if(!unsynced) {
+        unsynced = true;
+        pendingSince = std::chrono::steady_clock::now();
+    }
+}
+
+void SessionRecorder::addSample(const SampleStruct &sample) {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    if(!file || stopping) {
+        return;
+    }
+    markUnsynced();
+    TRACE_SCOPE("recorder enqueue");
+    if((pendingChunks.empty() || pendingChunks.back().size() == samplesPerChunk) && !makeRoom(sample, lock)) {
+        return;
+    }
+    pendingChunks.back().push_back(sample);
+    pendingCount++;
+    if(pendingCount >= samplesPerChunk) {
+        pendingCondition.notify_one();
+    }
+}
+
+void SessionRecorder::addPendingChunk() {
+    pendingChunks.push_back(std::vector<SampleStruct>());
+    pendingChunks.back().reserve(samplesPerChunk);
+}
+
+//Charges and adds the next chunk of the pending buffer, or applies the overflow policy once the account or the budget is
+//exhausted; the buffer is only ever changed a whole chunk at a time, so no policy moves the samples of the other chunks.
+//true if the newest chunk has room for sample, false if the sample was dropped or spilled instead
+bool SessionRecorder::makeRoom(const SampleStruct &sample, std::unique_lock<std::mutex> &lock) {
+    TRACE_SCOPE("recorder make room");
+    const long long chunkBytes = samplesPerChunk * sizeof(SampleStruct);
+    if(bufferAccount->reserve(chunkBytes)) {
+        addPendingChunk();
+        return true;
+    }
+    pendingCondition.notify_one(); //a stalled writer is the usual cause, make sure it is not waiting for a full chunk
+    switch(bufferAccount->policy()) {
+    case DropOldest: {
+        if(pendingChunks.empty()) {
+            bufferAccount->addDropped(1);
+            return false;
+        }
+        //the oldest chunk is emptied and reused as the newest one, its charge moves with it
+        std::vector<SampleStruct> oldest;
+        oldest.swap(pendingChunks.front());
+        pendingChunks.pop_front();
+        bufferAccount->addDropped((long long)oldest.size());
+        pendingCount -= oldest.size();
+        oldest.clear();
+        pendingChunks.push_back(std::vector<SampleStruct>());
+        pendingChunks.back().swap(oldest);
+        return true;
+    }
+    case Decimate: {
+        if(pendingChunks.empty()) {
+            bufferAccount->addDropped(1);
+            return false;
+        }
+        size_t kept = 0;
+        size_t index = 0;
+        for(size_t c = 0; c < pendingChunks.size(); c++) {
+            for(size_t i = 0; i < pendingChunks[c].size(); i++, index++) {
+                if(index % 2 == 1) {
+                    pendingChunks[kept / samplesPerChunk][kept % samplesPerChunk] = pendingChunks[c][i];
+                    kept++;
+                }
+            }
+        }
+        bufferAccount->addDropped((long long)(pendingCount - kept));
+        pendingCount = kept;
+        //keep the chunks the remaining samples need plus room for the next one, hand the others back to the budget
+        size_t needed = kept / samplesPerChunk + 1;
+        for(size_t c = 0; c < pendingChunks.size(); c++) {
+            size_t start = c * samplesPerChunk;
+            pendingChunks[c].resize(kept > start ? std::min(kept - start, samplesPerChunk) : 0);
+        }
+        size_t freed = pendingChunks.size() > needed ? pendingChunks.size() - needed : 0;
+        pendingChunks.resize(pendingChunks.size() - freed);
+        bufferAccount->release((long long)freed * chunkBytes);
+        return true;
+    }
+    case SpillToDisk: {
+        //the whole buffer moves so the spill file always holds the oldest samples
+        if(pendingChunks.empty()) {
+            if(spill.write(&sample, sizeof(SampleStruct))) {
+                bufferAccount->addSpilled(1);
+            }
+            else {
+                bufferAccount->addDropped(1);
+            }
+            return false;
+        }
+        for(size_t c = 0; c < pendingChunks.size(); c++) {
+            long long count = (long long)pendingChunks[c].size();
+            if(spill.write(pendingChunks[c].data(), count * (long long)sizeof(SampleStruct))) {
+                bufferAccount->addSpilled(count);
+            }
+            else {
+                bufferAccount->addDropped(count);
+            }
+        }
+        //the oldest chunk stays charged for the samples that follow
+        size_t freed = pendingChunks.size() - 1;
+        pendingChunks.resize(1);
+        pendingChunks.front().clear();
+        pendingCount = 0;
+        bufferAccount->release((long long)freed * chunkBytes);
+        return true;
+    }
+    case BlockProducer:
+        bufferAccount->addBlocked();
+        while(!stopping) {
+            drainedCondition.wait(lock);
+            if(!pendingChunks.empty() && pendingChunks.back().size() < samplesPerChunk) {
+                return true;
+            }
+            if(bufferAccount->reserve(chunkBytes)) {
+                addPendingChunk();
+                return true;
+            }
+        }
+        bufferAccount->addDropped(1);
+        return false;
+    }
+    return false;
+}
+
+void SessionRecorder::addEvent(const EventStruct &event) {
+    EventStruct record;
+    memset(&record, 0, sizeof(record)); //keep struct padding out of the file
+    record.eventType = event.eventType;
+    record.eye = event.eye;
+    record.startTime = event.startTime;
+    record.endTime = event.endTime;
+    record.duration = event.duration;
+    record.positionX = event.positionX;
+    record.positionY = event.positionY;
+
+    TRACE_SCOPE("recorder enqueue event");
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if(!file || stopping) {
+        return;
+    }
+    markUnsynced();
+    pendingEvents.push_back(record);
+}
+
+long long SessionRecorder::samplesWritten() const {
+    return writtenSamples.load();
+}
+
+long long SessionRecorder::eventsWritten() const {
+    return writtenEvents.load();
+}
+
+long long SessionRecorder::syncs() const {
+    return syncCount.load(std::memory_order_relaxed);
+}
+
+double SessionRecorder::longestUnsynced() const {
+    return longestWait.load(std::memory_order_relaxed);
+}
+
+const SamplePyramid &SessionRecorder::pyramid() const {
+    return samplePyramid;
+}
+
+//Writer thread: swaps the pending buffers out under the lock, or reads back spilled samples first, writes them as chunks
+//and syncs once the oldest record written since the last sync has waited for the sync interval. The taken chunks are freed
+//before their charge is released, so the samples held in memory never exceed what the budget was charged
+void SessionRecorder::run() {
+    TRACE_THREAD("session writer");
+    typedef std::chrono::steady_clock Clock;
+    std::deque<std::vector<SampleStruct> > chunks;
+    std::vector<SampleStruct> spilledSamples; //fixed size read buffer of the spill file
+    std::vector<EventStruct> events;
+    int waitMs = syncMilliseconds > 0 ? std::min(flushIntervalMs, syncMilliseconds) : flushIntervalMs;
+    bool exposed = false; //records are written but not synced
+    Clock::time_point exposedSince;
+    long long queued = 0; //this writer's share of the queue gauge
+    bool done = false;
+    while(!done) {
+        size_t charged = 0;
+        bool spilled;
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingCondition.wait_for(lock, std::chrono::milliseconds(waitMs), [this] {
+                return stopping || pendingCount >= samplesPerChunk || spill.pending() > 0;
+            });
+            spilled = spill.pending() > 0;
+            if(!spilled) {
+                chunks.swap(pendingChunks);
+                charged = chunks.size();
+                pendingCount = 0;
+            }
+            events.swap(pendingEvents);
+            done = stopping && !spilled;
+            if(unsynced && !exposed) {
+                exposed = true;
+                exposedSince = pendingSince;
+            }
+            unsynced = false;
+        }
+        if(spilled) {
+            TRACE_SCOPE("recorder read spill");
+            spilledSamples.resize(spillReadSamples);
+            spilledSamples.resize(spill.read(spilledSamples.data(), spillReadSamples * sizeof(SampleStruct)) / sizeof(SampleStruct));
+            chunks.push_back(std::vector<SampleStruct>());
+            chunks.back().swap(spilledSamples);
+        }
+        long long depth = spill.pending() / (long long)sizeof(SampleStruct);
+        for(size_t c = 0; c < chunks.size(); c++) {
+            depth += (long long)chunks[c].size();
+        }
+        metrics.queue->add((double)(depth - queued));
+        queued = depth;
+        for(size_t c = 0; c < chunks.size(); c++) {
+            const std::vector<SampleStruct> &samples = chunks[c];
+            if(samples.empty()) {
+                continue;
+            }
+            writeChunk(SampleChunk, samples.data(), (unsigned int)samples.size(), sizeof(SampleStruct));
+            writtenSamples.fetch_add(samples.size());
+            metrics.samples->add(samples.size());
+            lastTimestamp = samples.back().timestamp;
+            samplePyramid.append(samples.data(), (int)samples.size()); //built off the callback thread, one chunk at a time
+        }
+        if(spilled) {
+            spilledSamples.swap(chunks.back()); //keeps the read buffer for the next spilled batch
+        }
+        chunks.clear();
+        if(!events.empty()) {
+            writeChunk(EventChunk, events.data(), (unsigned int)events.size(), sizeof(EventStruct));
+            writtenEvents.fetch_add(events.size());
+            metrics.events->add(events.size());
+            events.clear();
+        }
+        if(charged > 0) {
+            bufferAccount->release((long long)(charged * samplesPerChunk * sizeof(SampleStruct)));
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            drainedCondition.notify_all();
+        }
+        if(exposed && (done || syncMilliseconds == 0 || Clock::now() - exposedSince >= std::chrono::milliseconds(syncMilliseconds))) {
+            sync();
+            double waited = std::chrono::duration<double, std::milli>(Clock::now() - exposedSince).count();
+            if(waited > longestWait.load(std::memory_order_relaxed)) {
+                longestWait.store(waited, std::memory_order_relaxed);
+            }
+            exposed = false;
+        }
+        else {
+            TRACE_SCOPE("recorder flush");
+            fflush(file); //readers of the growing file see whole chunks, only the sync makes them durable
+        }
+    }
+    metrics.queue->add((double)-queued);
+}
+
+void SessionRecorder::writeChunk(unsigned int type, const void *records, unsigned int count, unsigned int recordSize) {
+    TRACE_SCOPE("recorder write chunk");
+    SessionChunkHeader chunk;
+    chunk.magic = sessionChunkMagic;
+    chunk.type = type;
+    chunk.count = count;
+    chunk.payloadBytes = count * recordSize;
+    chunk.sequence = sequence++;
+    chunk.crc = sessionCrc32(records, chunk.payloadBytes, sessionCrc32(&chunk, offsetof(SessionChunkHeader, crc)));
+    fwrite(&chunk, sizeof(chunk), 1, file);
+    fwrite(records, recordSize, count, file);
+    writtenBytes += sizeof(chunk) + chunk.payloadBytes;
+    metrics.bytes->add(sizeof(chunk) + chunk.payloadBytes);
+    chunks++;
+}
+
+//Syncs the session file, then records what is now durable in the next journal slot and syncs the journal
+void SessionRecorder::sync() {
+    TRACE_SCOPE("recorder sync");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(!syncToDisk(file)) {
+        qWarning() << "Session file could not be synced:" << filePath;
+        metrics.syncFailures->add();
+        return;
+    }
+    SessionJournalEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.syncs = syncCount.load(std::memory_order_relaxed) + 1;
+    entry.durableBytes = writtenBytes;
+    entry.samples = writtenSamples.load(std::memory_order_relaxed);
+    entry.events = writtenEvents.load(std::memory_order_relaxed);
+    entry.lastTimestamp = lastTimestamp;
+    entry.chunks = chunks;
+    entry.crc = journalEntryCrc(entry);
+    fseek(journal, (long)(entry.syncs % sessionJournalSlots) * (long)sizeof(entry), SEEK_SET);
+    fwrite(&entry, sizeof(entry), 1, journal);
+    syncToDisk(journal);
+    syncCount.store(entry.syncs, std::memory_order_relaxed);
+    metrics.syncs->add();
+    metrics.syncDuration->observe(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+QString SessionRecorder::journalPathFor(const QString &sessionPath) {
+    QString path = sessionPath;
+    if(path.endsWith(".mgs")) {
+        path.chop(4);
+    }
+    return path + ".mgj";
+}
+
+QString SessionRecorder::lockPathFor(const QString &sessionPath) {
+    QString path = sessionPath;
+    if(path.endsWith(".mgs")) {
+        path.chop(4);
+    }
+    return path + ".mgl";
+}
+
+//Walks the chunks of a session whose journal was left behind and keeps the longest prefix that verifies
+RecoveryResult SessionRecorder::recover(const QString &path) {
+    RecoveryResult result;
+    QString journalPath = journalPathFor(path);
+    if(!QFile::exists(journalPath)) {
+        return result;
+    }
+    //a live recorder holds the lock; the lock of a crashed one is stale and taken over, which also keeps two
+    //processes from repairing the same session
+    QLockFile owner(lockPathFor(path));
+    owner.setStaleLockTime(0);
+    if(!owner.tryLock(0)) {
+        qDebug() << "Session is still being recorded, not recovered:" << path;
+        return result;
+    }
+
+    //the newest slot whose checksum holds, a torn slot write leaves the one before it
+    FILE *journalFile = fopen(QFile::encodeName(journalPath).constData(), "rb");
+    if(journalFile) {
+        SessionJournalEntry entries[sessionJournalSlots];
+        size_t entryCount = fread(entries, sizeof(SessionJournalEntry), sessionJournalSlots, journalFile);
+        fclose(journalFile);
+        unsigned long long newest = 0;
+        for(size_t i = 0; i < entryCount; i++) {
+            if(entries[i].syncs > newest && entries[i].crc == journalEntryCrc(entries[i])) {
+                newest = entries[i].syncs;
+                result.durableBytes = entries[i].durableBytes;
+            }
+        }
+    }
+
+    qint64 size = QFileInfo(path).size();
+    FILE *session = fopen(QFile::encodeName(path).constData(), "rb");
+    if(!session) {
+        QFile::remove(journalPath); //nothing left to repair
+        return result;
+    }
+    SessionFileHeader header;
+    if(fread(&header, sizeof(header), 1, session) != 1 || memcmp(header.magic, sessionFileMagic, sizeof(header.magic)) != 0) {
+        fclose(session);
+        qWarning() << "Not a session file, left as it is:" << path;
+        return result;
+    }
+
+    qint64 headerBytes = header.version >= 2 ? sizeof(SessionChunkHeader) : sessionChunkHeaderV1Bytes;
+    qint64 offset = sizeof(header);
+    unsigned int expected = 0;
+    std::vector<char> payload;
+    while(offset + headerBytes <= size) {
+        SessionChunkHeader chunk;
+        memset(&chunk, 0, sizeof(chunk));
+        if(fread(&chunk, (size_t)headerBytes, 1, session) != 1 || chunk.magic != sessionChunkMagic) {
+            break;
+        }
+        qint64 recordBytes = chunk.type == SampleChunk ? sizeof(SampleStruct) : chunk.type == EventChunk ? sizeof(EventStruct) : 0;
+        if(recordBytes == 0 || (qint64)chunk.count * recordBytes != chunk.payloadBytes || offset + headerBytes + chunk.payloadBytes > size) {
+            break;
+        }
+        payload.resize(chunk.payloadBytes);
+        if(chunk.payloadBytes > 0 && fread(payload.data(), chunk.payloadBytes, 1, session) != 1) {
+            break;
+        }
+        if(header.version >= 2) {
+            unsigned int crc = sessionCrc32(payload.data(), payload.size(), sessionCrc32(&chunk, offsetof(SessionChunkHeader, crc)));
+            if(chunk.sequence != expected || chunk.crc != crc) {
+                break;
+            }
+        }
+        expected++;
+        (chunk.type == SampleChunk ? result.samples : result.events) += chunk.count;
+        offset += headerBytes + chunk.payloadBytes;
+    }
+    fclose(session);
+
+    if(offset < size && !QFile::resize(path, offset)) {
+        qWarning() << "Session could not be truncated:" << path;
+        return result;
+    }
+    result.recovered = true;
+    result.keptBytes = offset;
+    result.droppedBytes = size - offset;
+
+    SessionReader reader;
+    if(reader.open(path)) {
+        SamplePyramid pyramid;
+        pyramid.build(reader);
+        pyramid.save(SamplePyramid::pathFor(path));
+    }
+    QFile::remove(journalPath);
+    qDebug() << "Recovered" << path << ":" << result.samples << "samples," << result.events << "events," << result.droppedBytes
+             << "bytes dropped," << result.durableBytes << "bytes were synced";
+    return result;
+}
+
+int SessionRecorder::recoverDirectory(const QString &directory) {
+    int recovered = 0;
+    QDir dir(directory);
+    QStringList journals = dir.entryList(QStringList() << "*.mgj", QDir::Files);
+    for(int i = 0; i < journals.size(); i++) {
+        QString name = journals[i];
+        name.chop(4);
+        if(recover(dir.filePath(name + ".mgs")).recovered) {
+            recovered++;
+        }
+    }
+    return recovered;
+}
+
+//Feeds 512 sample bursts while the writer keeps up to 64 chunks behind, so the rate is what the disk and the syncs allow
+QStringList SessionRecorder::benchmark(const QString &directory, const std::vector<int> &intervals, double seconds) {
+    typedef std::chrono::steady_clock Clock;
+    const long long maxBehind = 64 * (long long)samplesPerChunk;
+    QStringList rows;
+    rows << "sync_interval_ms,samples_per_s,mb_per_s,syncs,worst_loss_ms";
+    SampleStruct sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.leftEye.diam = sample.rightEye.diam = 3.5;
+    for(size_t i = 0; i < intervals.size(); i++) {
+        QString path = QDir(directory).filePath(QString("record_benchmark_%1.mgs").arg(intervals[i]));
+        SessionRecorder recorder;
+        recorder.setSyncInterval(intervals[i]);
+        if(!recorder.open(path, "benchmark", 2000)) {
+            qWarning() << "Could not record to:" << path;
+            continue;
+        }
+        Clock::time_point start = Clock::now();
+        long long produced = 0;
+        while(std::chrono::duration<double>(Clock::now() - start).count() < seconds) {
+            for(size_t s = 0; s < samplesPerChunk; s++, produced++) {
+                sample.timestamp = produced * 500;
+                sample.leftEye.gazeX = sample.rightEye.gazeX = 960 + (double)(produced % 400);
+                sample.leftEye.gazeY = sample.rightEye.gazeY = 540 + (double)(produced % 300);
+                recorder.addSample(sample);
+            }
+            while(produced - recorder.samplesWritten() > maxBehind) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        recorder.close();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        double bytes = (double)QFileInfo(path).size();
+        QStringList row;
+        row << QString::number(intervals[i]) << QString::number(recorder.samplesWritten() / elapsed, 'f', 0)
+            << QString::number(bytes / elapsed / 1e6, 'f', 1) << QString::number(recorder.syncs())
+            << QString::number(recorder.longestUnsynced(), 'f', 1);
+        rows << row.join(",");
+        QFile::remove(path);
+        QFile::remove(SamplePyramid::pathFor(path));
+    }
+    return rows;
+}
+
+int SessionRecorder::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Session recording throughput and loss window per sync interval");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("record-benchmark", "Benchmark the session recorder."));
+    parser.addOption(QCommandLineOption("output", "Result table.", "file", "record_benchmark.csv"));
+    parser.addOption(QCommandLineOption("directory", "Where the benchmark sessions are written, the disk under test.", "path", "."));
+    parser.addOption(QCommandLineOption("intervals", "Comma separated sync intervals, 0 syncs every write.", "ms", "0,10,50,100,250,1000"));
+    parser.addOption(QCommandLineOption("seconds", "Recording time per interval.", "s", "5"));
+    parser.process(arguments);
+
+    std::vector<int> intervals;
+    QStringList values = splitList(parser.value("intervals"));
+    for(int i = 0; i < values.size(); i++) {
+        intervals.push_back(values[i].toInt());
+    }
+    QFile file(parser.value("output"));
+    if(intervals.empty() || !file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    QStringList rows = benchmark(parser.value("directory"), intervals, std::max(0.1, parser.value("seconds").toDouble()));
+    for(int r = 0; r < rows.size(); r++) {
+        out << rows[r] << '\n';
+        qDebug().noquote() << rows[r];
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+//sessionrecorder.h
+//Records the sample and event callback streams into a session file (see sessionformat.h). Chunks are checksummed and the
+//file is synced on an interval with a journal of the durable state next to it, so a crash or power loss costs at most
+//the last interval; recover() repairs sessions whose recording never closed. Samples waiting for the writer are charged to
+//the memory budget and handled by the overflow policy of the recorder once it runs out.
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "sessionformat.h"
+#include "samplepyramid.h"
+#include "memorybudget.h"
+
+class QLockFile;
+
+struct RecoveryResult {
+    RecoveryResult() : recovered(false), keptBytes(0), droppedBytes(0), durableBytes(-1), samples(0), events(0) {}
+    bool recovered;         //the session had been left open and was repaired
+    long long keptBytes;    //file size after the repair
+    long long droppedBytes; //partial or damaged chunks cut off the end
+    long long durableBytes; //bytes the journal last reported synced, -1 without a readable journal
+    long long samples;      //records kept
+    long long events;
+};
+
+class SessionRecorder {
+
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    //interval of the file and journal syncs, 0 syncs after every write; set before open
+    void setSyncInterval(int milliseconds);
+    int syncInterval() const;
+    //memory for the samples waiting for the writer and the policy beyond it, set before open
+    void setBufferLimit(long long bytes, OverflowPolicy policy);
+
+    bool open(const QString &path, const QString &participant = QString(), int sampleRate = 0);
+    void close(); //writes everything still pending and closes the file
+    bool isOpen() const;
+    QString path() const;
+
+    //called from the myGaze callback threads, only copies into the pending chunk
+    void addSample(const SampleStruct &sample);
+    void addEvent(const EventStruct &event);
+
+    long long samplesWritten() const;
+    long long eventsWritten() const;
+    long long syncs() const;
+    double longestUnsynced() const; //longest time a record waited between arriving and being synced [milliseconds]
+
+    //summary of everything written so far, saved next to the session file on close
+    const SamplePyramid &pyramid() const;
+
+    static QString journalPathFor(const QString &sessionPath);
+    static QString lockPathFor(const QString &sessionPath); //held by the recording process while the session is open
+    //keeps the chunks of a session left open by a crash that verify, truncates the rest, rebuilds its pyramid and removes the journal;
+    //sessions that were closed, and sessions another running process is still recording, are left alone
+    static RecoveryResult recover(const QString &path);
+    static int recoverDirectory(const QString &directory); //recovers every session with a journal, returns how many
+
+    //records synthetic samples as fast as the writer sustains them for each sync interval, one result row per interval
+    static QStringList benchmark(const QString &directory, const std::vector<int> &intervals, double seconds);
+    //entry point of the --record-benchmark command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    void run();
+    void writeChunk(unsigned int type, const void *records, unsigned int count, unsigned int recordSize);
+    void sync();
+    void markUnsynced(); //called with pendingMutex held
+    bool makeRoom(const SampleStruct &sample, std::unique_lock<std::mutex> &lock);
+    void addPendingChunk(); //called with pendingMutex held, after the chunk was charged
+
+    FILE *file;
+    FILE *journal;
+    std::unique_ptr<QLockFile> owner; //tells recover() in other processes that this recording is live
+    QString filePath;
+    int syncMilliseconds;
+    std::thread writer;
+    mutable std::mutex pendingMutex; //also guards file, which producers test
+    std::condition_variable pendingCondition;
+    std::condition_variable drainedCondition; //a blocked producer waits for the writer
+    std::deque<std::vector<SampleStruct> > pendingChunks; //oldest first, each allocated and charged for samplesPerChunk
+    size_t pendingCount; //samples in pendingChunks
+    std::vector<EventStruct> pendingEvents; //a few per second, never dropped and not charged
+    long long bufferLimit;
+    OverflowPolicy bufferPolicy;
+    std::shared_ptr<MemoryAccount> bufferAccount;
+    SpillFile spill; //samples older than pendingChunks when the buffer spilled
+    bool stopping;
+    bool unsynced;  //pendingSince holds the arrival of the oldest pending record
+    std::chrono::steady_clock::time_point pendingSince;
+    std::atomic<long long> writtenSamples;
+    std::atomic<long long> writtenEvents;
+    std::atomic<long long> syncCount;
+    std::atomic<double> longestWait;
+    SamplePyramid samplePyramid;
+
+    //writer thread state
+    unsigned int sequence;
+    unsigned int chunks;
+    long long writtenBytes;
+    long long lastTimestamp;
+};
+
+#endif // SESSIONRECORDER_H
@@ -0,0 +1,15 @@
+//statsutil.cpp
+//Implements the shared robust statistics
+
+#include "statsutil.h"
+#include <algorithm>
+
+double median(std::vector<double> &values) {
+    size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    double upper = values[middle];
+    if(values.size() % 2 == 1) {
+        return upper;
+    }
+    return (upper + *std::max_element(values.begin(), values.begin() + middle)) / 2;
+}
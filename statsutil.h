@@ -0,0 +1,12 @@
+#ifndef STATSUTIL_H
+#define STATSUTIL_H
+
+//statsutil.h
+//Robust statistics shared by the clock synchronization and the analysis modes
+
+#include <vector>
+
+//median of a non empty set, the mean of the two middle values for an even count; reorders values
+double median(std::vector<double> &values);
+
+#endif // STATSUTIL_H
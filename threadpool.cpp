@@ -0,0 +1,168 @@
+//threadpool.cpp
+//Implements the work stealing thread pool
+
+#include "threadpool.h"
+#include "tracing.h"
+
+static thread_local int workerIndex = -1;
+
+//Thread Pool Constructor, starts the workers
+ThreadPool::ThreadPool(int threads) : queued(0), pending(0), stopping(false), nextQueue(0) {
+    if(threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    if(threads <= 0) {
+        threads = 1;
+    }
+    for(int i = 0; i < threads; i++) {
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+    for(int i = 0; i < threads; i++) {
+        this->threads.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+}
+
+//Thread Pool Destructor, finishes queued work before joining the workers
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        idleCondition.wait(lock, [this] { return pending == 0; });
+        stopping = true;
+    }
+    sleepCondition.notify_all();
+    for(size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+int ThreadPool::threadCount() const {
+    return (int)threads.size();
+}
+
+int ThreadPool::currentWorker() {
+    return workerIndex;
+}
+
+void ThreadPool::submit(Task task) {
+    TRACE_SCOPE("pool submit");
+    int target = workerIndex;
+    if(target < 0 || target >= (int)queues.size()) {
+        target = (int)(nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+        pending++;
+    }
+    sleepCondition.notify_one();
+}
+
+void ThreadPool::waitForIdle() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idleCondition.wait(lock, [this] { return pending == 0; });
+}
+
+//Own queue is used newest first for cache locality, stealing takes the oldest task of a victim
+bool ThreadPool::takeTask(int index, Task &task) {
+    TRACE_SCOPE("pool take");
+    {
+        WorkQueue &own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for(size_t i = 1; i < queues.size(); i++) {
+        WorkQueue &victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(int index) {
+    workerIndex = index;
+    TRACE_THREAD("pool worker");
+    for(;;) {
+        Task task;
+        if(takeTask(index, task)) {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                queued--;
+            }
+            {
+                TRACE_SCOPE("pool task");
+                task();
+            }
+            bool idle;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                idle = --pending == 0;
+            }
+            if(idle) {
+                idleCondition.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this] { return stopping || queued > 0; });
+        if(stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(long long count, long long grain, const std::function<void(long long, long long)> &body) {
+    if(count <= 0) {
+        return;
+    }
+    if(grain < 1) {
+        grain = 1;
+    }
+    long long slices = (count + grain - 1) / grain;
+
+    struct SharedRange {
+        std::atomic<long long> next;
+        std::atomic<long long> done;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<SharedRange> range(new SharedRange());
+    range->next.store(0);
+    range->done.store(0);
+
+    //every participant takes slices until none are left
+    auto work = [range, slices, grain, count, &body]() {
+        for(;;) {
+            long long slice = range->next.fetch_add(1);
+            if(slice >= slices) {
+                return;
+            }
+            long long begin = slice * grain;
+            long long end = begin + grain < count ? begin + grain : count;
+            body(begin, end);
+            if(range->done.fetch_add(1) + 1 == slices) {
+                std::lock_guard<std::mutex> lock(range->mutex);
+                range->finished.notify_all();
+            }
+        }
+    };
+
+    long long helpers = slices - 1 < (long long)threads.size() ? slices - 1 : (long long)threads.size();
+    for(long long i = 0; i < helpers; i++) {
+        submit(work);
+    }
+    work();
+    std::unique_lock<std::mutex> lock(range->mutex);
+    range->finished.wait(lock, [&range, slices] { return range->done.load() == slices; });
+}
@@ -0,0 +1,57 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+//threadpool.h
+//Work stealing thread pool shared by the offline analysis tools
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+
+public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(int threads = 0); //0 uses one thread per hardware core
+    ~ThreadPool();
+
+    int threadCount() const;
+
+    //tasks submitted from a worker go to that worker's own queue, others are spread round robin,
+    //idle workers steal from the front of other queues
+    void submit(Task task);
+    void waitForIdle(); //blocks until every submitted task has finished, must not be called from a worker
+
+    //runs body(begin, end) over [0, count) in slices of grain, the calling thread takes slices too
+    //so it is safe to use from inside a task
+    void parallelFor(long long count, long long grain, const std::function<void(long long, long long)> &body);
+
+    static int currentWorker(); //index of the calling worker thread, -1 outside the pool
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(int index);
+    bool takeTask(int index, Task &task);
+
+    std::vector<std::unique_ptr<WorkQueue> > queues;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::condition_variable idleCondition;
+    long long queued;  //tasks sitting in queues, guarded by sleepMutex
+    long long pending; //tasks submitted and not finished yet, guarded by sleepMutex
+    bool stopping;
+    std::atomic<unsigned> nextQueue;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,244 @@
+//timelinewidget.cpp
+//Implements the pyramid backed session timeline
+
+#include "timelinewidget.h"
+#include "sessionreader.h"
+#include "tracing.h"
+#include <QApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QWheelEvent>
+#include <algorithm>
+#include <cmath>
+
+static const int laneCount = 3;          //gaze X, gaze Y, pupil diameter
+static const int axisHeight = 18;        //time labels at the bottom
+static const double zoomStep = 1.25;     //per wheel notch
+static const double minimumSpan = 32.0;  //samples visible at the deepest zoom
+static const qint64 frameBudgetUs = 16000;
+
+//Timeline Widget Constructor
+TimelineWidget::TimelineWidget(QWidget *parent) : QWidget(parent), pyramid(0), session(0), first(0), last(0),
+    dragging(false), dragX(0), paintMicroseconds(0) {
+    setMinimumSize(400, 240);
+}
+
+void TimelineWidget::setPyramid(const SamplePyramid *pyramid, const SessionReader *session) {
+    this->pyramid = pyramid;
+    this->session = session;
+    blockStarts.clear();
+    if(session) {
+        long long start = 0;
+        const std::vector<SampleBlock> &blocks = session->sampleBlocks();
+        for(size_t b = 0; b < blocks.size(); b++) {
+            blockStarts.push_back(start);
+            start += blocks[b].count;
+        }
+    }
+    setVisibleRange(0, pyramid ? (double)pyramid->sampleCount() : 0);
+}
+
+void TimelineWidget::setVisibleRange(double first, double last) {
+    double count = pyramid ? (double)pyramid->sampleCount() : 0;
+    double span = std::min(count, std::max(minimumSpan, last - first));
+    this->first = std::max(0.0, std::min(first, count - span));
+    this->last = this->first + span;
+    update();
+}
+
+double TimelineWidget::firstVisible() const {
+    return first;
+}
+
+double TimelineWidget::lastVisible() const {
+    return last;
+}
+
+qint64 TimelineWidget::lastPaintMicroseconds() const {
+    return paintMicroseconds;
+}
+
+float TimelineWidget::columnValue(const SampleStruct &sample, SamplePyramid::Column column) {
+    switch(column) {
+    case SamplePyramid::LeftGazeX: return (float)sample.leftEye.gazeX;
+    case SamplePyramid::LeftGazeY: return (float)sample.leftEye.gazeY;
+    case SamplePyramid::LeftDiameter: return (float)sample.leftEye.diam;
+    case SamplePyramid::RightGazeX: return (float)sample.rightEye.gazeX;
+    case SamplePyramid::RightGazeY: return (float)sample.rightEye.gazeY;
+    default: return (float)sample.rightEye.diam;
+    }
+}
+
+//sample level summary straight from the mapped session, used when a bucket is narrower than a pyramid block
+int TimelineWidget::rawSummary(SamplePyramid::Column column, int count, PyramidEntry *out) const {
+    const std::vector<SampleBlock> &blocks = session->sampleBlocks();
+    double span = (last - first) / count;
+    for(int b = 0; b < count; b++) {
+        out[b].clear();
+        long long begin = (long long)std::floor(first + b * span);
+        long long end = std::max(begin + 1, (long long)std::ceil(first + (b + 1) * span));
+        size_t block = std::upper_bound(blockStarts.begin(), blockStarts.end(), begin) - blockStarts.begin() - 1;
+        for(long long i = begin; i < end && block < blocks.size(); i++) {
+            while(block < blocks.size() && i >= blockStarts[block] + blocks[block].count) {
+                block++;
+            }
+            if(block >= blocks.size()) {
+                break;
+            }
+            float value = columnValue(blocks[block].records[i - blockStarts[block]], column);
+            if(value != 0) {
+                out[b].add(value); //zero marks lost tracking, as in the pyramid
+            }
+        }
+    }
+    return count;
+}
+
+int TimelineWidget::summarize(SamplePyramid::Column column, int count, PyramidEntry *out) const {
+    if(session && !blockStarts.empty() && (last - first) / count < SamplePyramid::BlockSamples) {
+        return rawSummary(column, count, out);
+    }
+    return pyramid->query(column, first, last, count, out);
+}
+
+void TimelineWidget::paintEvent(QPaintEvent *) {
+    TRACE_SCOPE("timeline paint");
+    QElapsedTimer timer;
+    timer.start();
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::white);
+    if(!pyramid || last <= first) {
+        return;
+    }
+
+    int pixels = std::max(1, width());
+    int laneHeight = (height() - axisHeight) / laneCount;
+    buckets.resize(pixels);
+    static const SamplePyramid::Column lanes[laneCount][2] = {
+        { SamplePyramid::LeftGazeX, SamplePyramid::RightGazeX },
+        { SamplePyramid::LeftGazeY, SamplePyramid::RightGazeY },
+        { SamplePyramid::LeftDiameter, SamplePyramid::RightDiameter }
+    };
+    static const char *const laneNames[laneCount] = { "gaze X", "gaze Y", "pupil" };
+    QColor eyeColours[2] = { QColor(40, 90, 200, 160), QColor(200, 50, 40, 160) };
+
+    for(int lane = 0; lane < laneCount; lane++) {
+        int top = lane * laneHeight;
+        //both eyes share the scale of the whole session so the lanes do not jump while panning
+        PyramidEntry range;
+        range.clear();
+        for(int eye = 0; eye < 2; eye++) {
+            PyramidEntry whole;
+            if(pyramid->query(lanes[lane][eye], 0, (double)pyramid->sampleCount(), 1, &whole) == 1) {
+                range.merge(whole);
+            }
+        }
+        painter.setPen(Qt::gray);
+        painter.drawLine(0, top + laneHeight - 1, pixels, top + laneHeight - 1);
+        painter.drawText(4, top + 12, laneNames[lane]);
+        if(!range.valid || range.max <= range.min) {
+            continue;
+        }
+        double scale = (laneHeight - 4) / (double)(range.max - range.min);
+
+        for(int eye = 0; eye < 2; eye++) {
+            int count = summarize(lanes[lane][eye], pixels, buckets.data());
+            QVector<QLineF> extent;
+            QPolygonF means;
+            extent.reserve(count);
+            for(int x = 0; x < count; x++) {
+                const PyramidEntry &entry = buckets[x];
+                if(!entry.valid) {
+                    continue;
+                }
+                double yMin = top + laneHeight - 2 - (entry.min - range.min) * scale;
+                double yMax = top + laneHeight - 2 - (entry.max - range.min) * scale;
+                extent.append(QLineF(x + 0.5, yMin, x + 0.5, yMax));
+                means.append(QPointF(x + 0.5, top + laneHeight - 2 - (entry.mean - range.min) * scale));
+            }
+            painter.setPen(eyeColours[eye]);
+            painter.drawLines(extent);
+            painter.setPen(eyeColours[eye].darker());
+            painter.drawPolyline(means);
+        }
+    }
+
+    //seconds since the first sample at a few ticks
+    long long origin = pyramid->timestampAt(0);
+    painter.setPen(Qt::black);
+    for(int tick = 0; tick < 5; tick++) {
+        int x = tick * (pixels - 60) / 4;
+        double sample = first + (last - first) * x / pixels;
+        double seconds = (pyramid->timestampAt((long long)sample) - origin) / 1e6;
+        painter.drawText(x + 2, height() - 4, QString::number(seconds, 'f', 2) + " s");
+    }
+
+    paintMicroseconds = timer.nsecsElapsed() / 1000;
+    if(paintMicroseconds > frameBudgetUs) {
+        qDebug() << "Timeline repaint took" << paintMicroseconds / 1000.0 << "ms";
+    }
+}
+
+//zooms around the sample under the cursor
+void TimelineWidget::wheelEvent(QWheelEvent *event) {
+    double notches = event->angleDelta().y() / 120.0;
+    double factor = std::pow(zoomStep, -notches);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    double x = event->position().x();
+#else
+    double x = event->pos().x(); //position() is not available before Qt 5.14
+#endif
+    double anchor = first + (last - first) * x / std::max(1, width());
+    setVisibleRange(anchor - (anchor - first) * factor, anchor + (last - anchor) * factor);
+    event->accept();
+}
+
+void TimelineWidget::mousePressEvent(QMouseEvent *event) {
+    dragging = true;
+    dragX = event->pos().x();
+}
+
+void TimelineWidget::mouseMoveEvent(QMouseEvent *event) {
+    if(!dragging) {
+        return;
+    }
+    double shift = (dragX - event->pos().x()) * (last - first) / std::max(1, width());
+    dragX = event->pos().x();
+    setVisibleRange(first + shift, last + shift);
+}
+
+void TimelineWidget::mouseReleaseEvent(QMouseEvent *) {
+    dragging = false;
+}
+
+//--timeline <session.mgs>, loads the stored pyramid or builds and stores it first
+int TimelineWidget::runFromCommandLine(const QStringList &arguments) {
+    int index = arguments.indexOf("--timeline");
+    if(index < 0 || index + 1 >= arguments.size()) {
+        qWarning() << "Usage: --timeline <session.mgs>";
+        return 1;
+    }
+    QString path = arguments[index + 1];
+    SessionReader session;
+    if(!session.open(path)) {
+        qWarning() << "Session could not be opened:" << path;
+        return 1;
+    }
+    SamplePyramid pyramid;
+    if(!pyramid.load(SamplePyramid::pathFor(path)) || pyramid.sampleCount() != session.sampleCount()) {
+        QElapsedTimer timer;
+        timer.start();
+        pyramid.build(session);
+        pyramid.save(SamplePyramid::pathFor(path));
+        qDebug() << "Pyramid of" << session.sampleCount() << "samples built in" << timer.elapsed() << "ms";
+    }
+
+    TimelineWidget timeline;
+    timeline.setWindowTitle(path);
+    timeline.setPyramid(&pyramid, &session);
+    timeline.resize(1200, 480);
+    timeline.show();
+    return QApplication::exec();
+}
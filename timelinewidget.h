@@ -0,0 +1,55 @@
+#ifndef TIMELINEWIDGET_H
+#define TIMELINEWIDGET_H
+
+//timelinewidget.h
+//Zoomable timeline of a session's gaze and pupil columns drawn from its sample pyramid. Each repaint reads
+//about one pyramid entry per pixel and lane, raw samples are only touched once a pixel covers less than
+//one pyramid block.
+
+#include <QWidget>
+#include <QStringList>
+#include <vector>
+#include "samplepyramid.h"
+
+class SessionReader;
+
+class TimelineWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit TimelineWidget(QWidget *parent = 0);
+
+    //pyramid must outlive the widget, session is optional and only used for sample level zoom
+    void setPyramid(const SamplePyramid *pyramid, const SessionReader *session = 0);
+    void setVisibleRange(double first, double last); //[sample index]
+    double firstVisible() const;
+    double lastVisible() const;
+    qint64 lastPaintMicroseconds() const;
+
+    //entry point of the --timeline mode, expects the QApplication to exist, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseReleaseEvent(QMouseEvent *event);
+
+private:
+    int summarize(SamplePyramid::Column column, int buckets, PyramidEntry *out) const;
+    int rawSummary(SamplePyramid::Column column, int buckets, PyramidEntry *out) const;
+    static float columnValue(const SampleStruct &sample, SamplePyramid::Column column);
+
+    const SamplePyramid *pyramid;
+    const SessionReader *session;
+    std::vector<long long> blockStarts; //first sample index of every sample block of the session
+    double first;
+    double last;
+    bool dragging;
+    int dragX;
+    qint64 paintMicroseconds;
+    std::vector<PyramidEntry> buckets; //reused between repaints
+};
+
+#endif // TIMELINEWIDGET_H
@@ -0,0 +1,322 @@
+//tracing.cpp
+//Implements the per thread span buffers, the Chrome trace writer and the tracing benchmark
+
+#include "tracing.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int chunkSpans = 4096; //buffers grow by this many spans, allocated by the owning thread
+static const int maxChunks = 256;   //about a million spans or 25 MB per thread, later spans are counted as dropped
+static const size_t writeBlock = 1 << 16;
+static const long long calibrationNs = 10000000; //shortest stretch of both clocks the span clock rate is measured over
+
+struct TraceEvent {
+    const char *name;
+    long long begin;
+    long long duration;
+};
+
+//Written only by the thread that owns it; used is published with release after each span so the writer can read
+//everything below it while the thread keeps recording. Buffers of exited threads stay readable and are reused by new
+//threads once a later recording has started.
+struct TraceBuffer {
+    TraceBuffer() : used(0), generation(0), dropped(0), owned(true), track(0) {
+        memset(chunks, 0, sizeof(chunks));
+        name[0] = 0;
+    }
+    TraceEvent *chunks[maxChunks];
+    std::atomic<int> used;
+    std::atomic<unsigned> generation; //recording the spans belong to
+    std::atomic<long long> dropped;
+    std::atomic<bool> owned;
+    int track;     //tid in the trace, guarded by buffersMutex
+    char name[48]; //guarded by buffersMutex
+};
+
+struct TraceBufferOwner {
+    TraceBufferOwner() : buffer(0) {}
+    ~TraceBufferOwner() {
+        if(buffer) {
+            buffer->owned.store(false);
+        }
+    }
+    TraceBuffer *buffer;
+};
+
+std::atomic<bool> Tracing::recording(false);
+static std::atomic<unsigned> generation(0);
+static std::atomic<long long> origin(0);   //span clock at start
+static std::atomic<long long> originNs(0); //steady clock at start
+static std::mutex buffersMutex;
+static std::vector<TraceBuffer *> buffers; //never freed, spans of exited threads are still written
+static int nextTrack = 1;
+static thread_local TraceBufferOwner owner;
+
+static long long steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static TraceBuffer *claimBuffer() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    TraceBuffer *buffer = 0;
+    unsigned current = generation.load();
+    for(size_t i = 0; i < buffers.size() && !buffer; i++) {
+        if(!buffers[i]->owned.load() && buffers[i]->generation.load() != current) {
+            buffer = buffers[i];
+            buffer->owned.store(true);
+            buffer->name[0] = 0;
+        }
+    }
+    if(!buffer) {
+        buffer = new TraceBuffer();
+        buffers.push_back(buffer);
+    }
+    buffer->track = nextTrack++;
+    return buffer;
+}
+
+static TraceBuffer *threadBuffer() {
+    if(!owner.buffer) {
+        owner.buffer = claimBuffer();
+    }
+    return owner.buffer;
+}
+
+bool Tracing::compiledIn() {
+#ifdef MYGAZE_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Tracing::start() {
+    originNs.store(steadyNs());
+    origin.store(now());
+    generation.fetch_add(1);
+    recording.store(true);
+}
+
+void Tracing::stop() {
+    recording.store(false);
+}
+
+void Tracing::record(const char *name, long long begin, long long end) {
+    TraceBuffer *buffer = threadBuffer();
+    unsigned current = generation.load(std::memory_order_relaxed);
+    if(buffer->generation.load(std::memory_order_relaxed) != current) {
+        buffer->used.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->generation.store(current, std::memory_order_release);
+    }
+    int index = buffer->used.load(std::memory_order_relaxed);
+    if(index >= maxChunks * chunkSpans) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TraceEvent *chunk = buffer->chunks[index / chunkSpans];
+    if(!chunk) {
+        chunk = new (std::nothrow) TraceEvent[chunkSpans];
+        if(!chunk) {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer->chunks[index / chunkSpans] = chunk;
+    }
+    TraceEvent &event = chunk[index % chunkSpans];
+    event.name = name;
+    event.begin = begin;
+    event.duration = end - begin;
+    buffer->used.store(index + 1, std::memory_order_release);
+}
+
+void Tracing::nameThread(const char *name) {
+    TraceBuffer *buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    strncpy(buffer->name, name, sizeof(buffer->name) - 1);
+    buffer->name[sizeof(buffer->name) - 1] = 0;
+}
+
+long long Tracing::spans() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    unsigned current = generation.load();
+    long long total = 0;
+    for(size_t i = 0; i < buffers.size(); i++) {
+        if(buffers[i]->generation.load(std::memory_order_acquire) == current) {
+            total += buffers[i]->used.load(std::memory_order_acquire);
+        }
+    }
+    return total;
+}
+
+long long Tracing::dropped() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    unsigned current = generation.load();
+    long long total = 0;
+    for(size_t i = 0; i < buffers.size(); i++) {
+        if(buffers[i]->generation.load(std::memory_order_acquire) == current) {
+            total += buffers[i]->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+//Complete ("X") events with microsecond timestamps relative to start, one track per thread named by a metadata event.
+//Span and thread names are literals and are written unescaped.
+bool Tracing::write(const QString &path) {
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    struct Track {
+        TraceBuffer *buffer;
+        int id;
+        std::string name;
+    };
+    std::vector<Track> tracks;
+    unsigned current = generation.load();
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for(size_t i = 0; i < buffers.size(); i++) {
+            if(buffers[i]->generation.load(std::memory_order_acquire) == current) {
+                Track track = { buffers[i], buffers[i]->track, buffers[i]->name };
+                tracks.push_back(track);
+            }
+        }
+    }
+    long long base = origin.load();
+    if(steadyNs() - originNs.load() < calibrationNs) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(calibrationNs));
+    }
+    double microsecondsPerTick = (steadyNs() - originNs.load()) / 1000.0 / std::max(1LL, now() - base);
+    std::string text = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    text.reserve(writeBlock + 256);
+    const char *separator = "";
+    char line[256];
+    bool ok = true;
+    for(size_t t = 0; t < tracks.size() && ok; t++) {
+        const Track &track = tracks[t];
+        if(track.name.empty()) {
+            snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                     separator, track.id, track.id);
+        }
+        else {
+            snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                     separator, track.id, track.name.c_str());
+        }
+        text += line;
+        separator = ",\n";
+        int count = track.buffer->used.load(std::memory_order_acquire);
+        for(int i = 0; i < count && ok; i++) {
+            const TraceEvent &event = track.buffer->chunks[i / chunkSpans][i % chunkSpans];
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                     event.name, track.id, (event.begin - base) * microsecondsPerTick, event.duration * microsecondsPerTick);
+            text += line;
+            if(text.size() >= writeBlock) {
+                ok = file.write(text.data(), (qint64)text.size()) == (qint64)text.size();
+                text.clear();
+            }
+        }
+    }
+    text += "\n]}\n";
+    return ok && file.write(text.data(), (qint64)text.size()) == (qint64)text.size();
+}
+
+bool Tracing::finish(const QString &path) {
+    stop();
+    if(!compiledIn()) {
+        qWarning() << "Built without MYGAZE_TRACE (qmake CONFIG+=trace), the trace has no spans";
+    }
+    if(!write(path)) {
+        qWarning() << "Could not write:" << path;
+        return false;
+    }
+    qDebug().noquote() << QString("Trace of %1 spans written to %2, %3 dropped").arg(spans()).arg(path).arg(dropped());
+    return true;
+}
+
+//average cost of one span on each of threads threads [nanoseconds]
+static double spanCost(long long spans, int threads) {
+    std::vector<double> costs(threads);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([spans, t, &costs] {
+            long long start = steadyNs();
+            for(long long i = 0; i < spans; i++) {
+                TraceSpan span("benchmark span");
+            }
+            costs[t] = (double)(steadyNs() - start) / spans;
+        }));
+    }
+    for(int t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    double total = 0;
+    for(int t = 0; t < threads; t++) {
+        total += costs[t];
+    }
+    return total / threads;
+}
+
+QStringList Tracing::benchmark(long long spans, int threads) {
+    QStringList rows;
+    rows << "recording,threads,ns_per_span,dropped";
+    bool wasRecording = isRecording();
+    stop();
+    rows << QString("off,1,%1,0").arg(spanCost(spans, 1), 0, 'f', 2);
+    rows << QString("off,%1,%2,0").arg(threads).arg(spanCost(spans, threads), 0, 'f', 2);
+    start();
+    double single = spanCost(spans, 1);
+    rows << QString("on,1,%1,%2").arg(single, 0, 'f', 2).arg(dropped());
+    start();
+    double contended = spanCost(spans, threads);
+    rows << QString("on,%1,%2,%3").arg(threads).arg(contended, 0, 'f', 2).arg(dropped());
+    if(!wasRecording) {
+        stop();
+    }
+    return rows;
+}
+
+//--trace-benchmark [--output file] [--spans n] [--threads n] [--trace file]
+int Tracing::runFromCommandLine(const QStringList &arguments) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Cost of a trace span with recording off and on");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("trace-benchmark", "Benchmark the tracing spans."));
+    parser.addOption(QCommandLineOption("output", "Result table.", "file", "trace_benchmark.csv"));
+    parser.addOption(QCommandLineOption("spans", "Spans per thread and run.", "n", "500000"));
+    parser.addOption(QCommandLineOption("threads", "Threads of the contended run, 0 uses one per core.", "n", "0"));
+    parser.addOption(QCommandLineOption("trace", "Also write the spans of the contended run as Chrome trace JSON.", "file"));
+    parser.process(arguments);
+
+    QFile file(parser.value("output"));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Could not write:" << parser.value("output");
+        return 1;
+    }
+    QTextStream out(&file);
+    int threads = parser.value("threads").toInt();
+    if(threads <= 0) {
+        threads = std::max(1, (int)std::thread::hardware_concurrency()); //more threads than cores would time their waiting too
+    }
+    QStringList rows = benchmark(std::max(1000LL, parser.value("spans").toLongLong()), threads);
+    for(int r = 0; r < rows.size(); r++) {
+        out << rows[r] << '\n';
+        qDebug().noquote() << rows[r];
+    }
+    if(parser.isSet("trace") && !write(parser.value("trace"))) {
+        qWarning() << "Could not write:" << parser.value("trace");
+        return 1;
+    }
+    return 0;
+}
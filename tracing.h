@@ -0,0 +1,86 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+//tracing.h
+//Timing spans of the callback, queue, rendering and disk paths written as Chrome trace JSON, which Perfetto
+//(ui.perfetto.dev) and chrome://tracing open. Built with MYGAZE_TRACE (qmake CONFIG+=trace) TRACE_SCOPE records the
+//begin and duration of the enclosing scope into a buffer owned by the calling thread, without locks or allocation;
+//without it the macros compile to nothing. Spans are only kept between Tracing::start() and write().
+
+#include <QString>
+#include <QStringList>
+#include <atomic>
+#include <chrono>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class Tracing {
+
+public:
+    static bool compiledIn(); //whether TRACE_SCOPE records anything in this build
+
+    static void start(); //discards earlier spans and starts recording
+    static void stop();
+    static bool isRecording() {
+        return recording.load(std::memory_order_relaxed);
+    }
+    //span clock: the x86 timestamp counter, a few ns to read where the system clock can take tens, converted to time
+    //against the steady clock when written; nanoseconds of the steady clock elsewhere
+    static long long now() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return (long long)__rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    //name must outlive the trace, spans take string literals
+    static void record(const char *name, long long begin, long long end);
+    static void nameThread(const char *name); //shown as the track name
+    static long long spans();   //kept since start
+    static long long dropped(); //spans that found the buffer of their thread full
+
+    static bool write(const QString &path); //every span kept since start, as Chrome trace JSON
+    static bool finish(const QString &path); //stops, writes and logs the span count
+
+    //ns per span with recording off and on, single threaded and contended
+    static QStringList benchmark(long long spans, int threads);
+    //entry point of the --trace-benchmark command line mode, returns the process exit code
+    static int runFromCommandLine(const QStringList &arguments);
+
+private:
+    static std::atomic<bool> recording;
+};
+
+//records the lifetime of the object as one span
+class TraceSpan {
+
+public:
+    explicit TraceSpan(const char *name) : name(Tracing::isRecording() ? name : 0), begin(this->name ? Tracing::now() : 0) {}
+    ~TraceSpan() {
+        if(name) {
+            Tracing::record(name, begin, Tracing::now());
+        }
+    }
+
+private:
+    TraceSpan(const TraceSpan &);
+    TraceSpan &operator=(const TraceSpan &);
+    const char *name;
+    long long begin;
+};
+
+#ifdef MYGAZE_TRACE
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TraceSpan TRACE_JOIN(traceSpan, __LINE__)(name)
+#define TRACE_THREAD(name) Tracing::nameThread(name)
+#else
+#define TRACE_SCOPE(name) (void)0
+#define TRACE_THREAD(name) (void)0
+#endif
+
+#endif // TRACING_H
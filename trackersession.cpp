@@ -0,0 +1,498 @@
+//trackersession.cpp
+//Implements the per tracker session, all state formerly kept in globals of the widget lives here
+
+#include "trackersession.h"
+#include "gazesource.h"
+#include "callbackregistry.h"
+#include "calibrationcache.h"
+#include "metrics.h"
+#include "tracing.h"
+#include <QDebug>
+#include <string.h>
+
+//metrics of all sessions together, the status gauges follow the session that changed last
+struct SessionMetrics {
+    SessionMetrics() {
+        MetricsRegistry &registry = MetricsRegistry::global();
+        lostSamples = registry.counter("mygaze_lost_samples_total", "Samples without a tracked eye.");
+        markers = registry.counter("mygaze_markers_total", "Experiment event markers recorded.");
+        connects = registry.counter("mygaze_connects_total", "Connection attempts to the myGaze server, more than one per run are reconnects.");
+        connectFailures = registry.counter("mygaze_connect_failures_total", "Connection attempts that failed.");
+        calibrations = registry.counter("mygaze_calibrations_total", "Calibrations run on the device.");
+        calibrationFailures = registry.counter("mygaze_calibration_failures_total", "Calibrations or validations that did not finish.");
+        calibrationsRestored = registry.counter("mygaze_calibrations_restored_total", "Calibrations taken from the cache.");
+        connectStatus = registry.gauge("mygaze_connect_status", "Last iV_Connect result, 1 is RET_SUCCESS.");
+        calibrateStatus = registry.gauge("mygaze_calibrate_status", "Last iV_Calibrate result, 1 is RET_SUCCESS.");
+        validateStatus = registry.gauge("mygaze_validate_status", "Last iV_Validate result, 1 is RET_SUCCESS.");
+        const char *deviationHelp = "Calibration deviation reported by the validation [degree].";
+        deviation[0] = registry.gauge("mygaze_calibration_deviation_degrees", deviationHelp, "eye=\"left\",axis=\"x\"");
+        deviation[1] = registry.gauge("mygaze_calibration_deviation_degrees", deviationHelp, "eye=\"left\",axis=\"y\"");
+        deviation[2] = registry.gauge("mygaze_calibration_deviation_degrees", deviationHelp, "eye=\"right\",axis=\"x\"");
+        deviation[3] = registry.gauge("mygaze_calibration_deviation_degrees", deviationHelp, "eye=\"right\",axis=\"y\"");
+        streaming = registry.gauge("mygaze_streaming_sessions", "Sessions currently receiving samples.");
+    }
+    MetricCounter *lostSamples;
+    MetricCounter *markers;
+    MetricCounter *connects;
+    MetricCounter *connectFailures;
+    MetricCounter *calibrations;
+    MetricCounter *calibrationFailures;
+    MetricCounter *calibrationsRestored;
+    MetricGauge *connectStatus;
+    MetricGauge *calibrateStatus;
+    MetricGauge *validateStatus;
+    MetricGauge *deviation[4];
+    MetricGauge *streaming;
+};
+static SessionMetrics metrics;
+
+//Tracker Session Constructor, default calibration setup, see the myGaze User Manual for the meaning of each field
+TrackerSession::TrackerSession(GazeSource *source) : gazeSource(source), slot(-1), ret_connect(0), ret_calibrate(0), ret_validate(0),
+    screenWidth(0), screenHeight(0), restored(false), logSamples(false), sLeftEyeX(0), sLeftEyeY(0), sRightEyeX(0), sRightEyeY(0),
+    samples(0), events(0), lastTimestamp(0),
+    gazeResampler(1000, GazeResampler::Linear) {
+    memset(&calibrationData, 0, sizeof(calibrationData));
+    memset(&accuracyData, 0, sizeof(accuracyData));
+    calibrationData.method = 5;
+    calibrationData.visualization = 1;
+    calibrationData.displayDevice = 0;
+    calibrationData.speed = 0;
+    calibrationData.autoAccept = 1;
+    calibrationData.foregroundBrightness = 250;
+    calibrationData.backgroundBrightness = 230;
+    calibrationData.targetShape = 2;
+    calibrationData.targetSize = 20;
+    strcpy(calibrationData.targetFilename, "");
+
+    sampleClassifier.setBlinkListener([this](const EventStruct &blink) {
+        sessionRecorder.addEvent(blink);
+        if(logSamples) {
+            qDebug() << "Blink event - duration: " << blink.duration / 1000.0 << " ms\n";
+        }
+    });
+    pursuitClassifier.setListener([this](const EventStruct &segment) {
+        if(segment.eventType == 'P') {
+            sessionRecorder.addEvent(segment);
+        }
+    });
+    qualityMonitor.setAlertListener([this](const QualityAlert &alert) {
+        if(alert.raised) {
+            qWarning() << "Data quality alert" << name() << qualityMetricName(alert.metric) << alert.value << "above" << alert.threshold;
+        }
+        else {
+            qDebug() << "Data quality recovered" << name() << qualityMetricName(alert.metric);
+        }
+    });
+}
+
+//Tracker Session Destructor
+TrackerSession::~TrackerSession() {
+    stopStreaming();
+    disconnect();
+}
+
+GazeSource *TrackerSession::source() const {
+    return gazeSource.get();
+}
+
+QString TrackerSession::name() const {
+    return gazeSource->name();
+}
+
+//Connects the eyetracker to the myGaze server, simulated sources are always connected
+int TrackerSession::connect() {
+    if(!gazeSource->isDevice()) {
+        ret_connect = RET_SUCCESS;
+        return ret_connect;
+    }
+    iV_Start();
+    ret_connect = iV_Connect();
+    metrics.connects->add();
+    if(ret_connect != RET_SUCCESS) {
+        metrics.connectFailures->add();
+    }
+    publishStatus();
+    if(ret_connect == RET_SUCCESS) {
+        qDebug() << "Eyetracker Connected"; //write connection status to debug log
+        clockSync.stop(); //a reconnect must not mix in measurements of the previous server clock
+        clockSync.clear();
+        clockSync.start(); //begin tracking server clock offset and drift
+        ScreenGeometry geometry = vergenceEstimator.geometry();
+        if(screenWidth > 0 && screenHeight > 0) {
+            geometry.screenWidth = screenWidth;
+            geometry.screenHeight = screenHeight;
+        }
+        if(!ScreenGeometry::current(&geometry)) { //fromProfile with the resolution set above
+            qWarning() << "No geometry profile on the server, keeping" << geometry.stimulusWidth << "x" << geometry.stimulusHeight << "mm";
+        }
+        vergenceEstimator.setGeometry(geometry);
+        VisualAngle::setCurrent(geometry); //the profile is read once per connection, analyses share the tables
+        qDebug() << "Screen" << geometry.screenWidth << "x" << geometry.screenHeight << "px";
+    }
+    else {
+        qDebug() << "Eyetracker Could Not Be Connected";
+    }
+    return ret_connect;
+}
+
+void TrackerSession::setScreenSize(int width, int height) {
+    screenWidth = width;
+    screenHeight = height;
+}
+
+void TrackerSession::disconnect() {
+    if(gazeSource->isDevice() && ret_connect == RET_SUCCESS) {
+        clockSync.stop(); //stop clock sampling before the connection goes away
+        iV_Disconnect(); //disconnect hardware from server
+    }
+    ret_connect = 0;
+}
+
+bool TrackerSession::isConnected() const {
+    return ret_connect == RET_SUCCESS;
+}
+
+CalibrationStruct &TrackerSession::calibrationSetup() {
+    return calibrationData;
+}
+
+//Sets up calibration of the eyetracking device and validates the calibration data
+int TrackerSession::calibrate() {
+    restored = false;
+    if(!gazeSource->isDevice()) {
+        ret_calibrate = ret_validate = RET_SUCCESS;
+        headCompensator.resetModel();
+        headCompensator.captureReference();
+        return RET_SUCCESS;
+    }
+    iV_SetupCalibration(&calibrationData);
+    metrics.calibrations->add();
+    ret_calibrate = iV_Calibrate(); //get calibration status
+    if(ret_calibrate != RET_SUCCESS) {
+        qDebug() << "Calibration could not be finished: " << ret_calibrate; //write status to debug log
+        metrics.calibrationFailures->add();
+        publishStatus();
+        return ret_calibrate;
+    }
+    qDebug() << "Calibration done successfully";
+    ret_validate = iV_Validate(); //validate calibration data
+    if(ret_validate != RET_SUCCESS) {
+        qDebug() << "Validation could not be finished: " << ret_validate;
+        metrics.calibrationFailures->add();
+        publishStatus();
+        return ret_validate;
+    }
+    //read out the accuracy values
+    if(iV_GetAccuracy(&accuracyData) == RET_SUCCESS) {
+        qDebug() << "AccuracyData - dev left X: " << accuracyData.deviationLX << " dev left Y: " << accuracyData.deviationLY
+                 << " dev right X: " << accuracyData.deviationRX << " dev right Y: " << accuracyData.deviationRY;
+    }
+    publishStatus();
+    //the head position the calibration was made at, taken from the stream if the server has no current sample
+    SampleStruct current;
+    double eyeX, eyeY, eyeZ;
+    headCompensator.resetModel();
+    if(iV_GetSample(&current) == RET_SUCCESS && HeadCompensation::eyePosition(current, eyeX, eyeY, eyeZ)) {
+        headCompensator.setReference(eyeX, eyeY, eyeZ);
+    }
+    else {
+        headCompensator.captureReference();
+    }
+    return RET_SUCCESS;
+}
+
+int TrackerSession::calibrateWithCache(CalibrationCache &cache, const QString &participant, bool allowCalibration) {
+    if(!gazeSource->isDevice()) {
+        return calibrate();
+    }
+    if(participant.trimmed().isEmpty()) {
+        //without an identifier the calibration cannot belong to anyone else, never share one between unnamed participants
+        return allowCalibration ? calibrate() : ERR_CALIBRATION_NOT_AVAILABLE;
+    }
+    QString profile = CalibrationCache::currentGeometryProfile();
+    CachedCalibration cached;
+    if(cache.restore(participant, profile, &cached) == RET_SUCCESS) {
+        ret_calibrate = RET_SUCCESS;
+        ret_validate = RET_SUCCESS;
+        accuracyData = cached.accuracy;
+        restored = true;
+        metrics.calibrationsRestored->add();
+        publishStatus();
+        headCompensator.resetModel();
+        headCompensator.captureReference(); //the head position of the cached calibration is not known
+        qDebug() << "Calibration restored: " << cached.name << " from " << cached.created.toString(Qt::ISODate);
+        return RET_SUCCESS;
+    }
+    if(!allowCalibration) {
+        return ERR_CALIBRATION_NOT_AVAILABLE;
+    }
+    int status = calibrate();
+    if(status == RET_SUCCESS) {
+        int ret_save = cache.store(participant, profile, accuracyData);
+        if(ret_save != RET_SUCCESS) {
+            qDebug() << "Calibration could not be saved: " << ret_save;
+        }
+    }
+    return status;
+}
+
+void TrackerSession::publishStatus() const {
+    metrics.connectStatus->set(ret_connect);
+    metrics.calibrateStatus->set(ret_calibrate);
+    metrics.validateStatus->set(ret_validate);
+    metrics.deviation[0]->set(accuracyData.deviationLX);
+    metrics.deviation[1]->set(accuracyData.deviationLY);
+    metrics.deviation[2]->set(accuracyData.deviationRX);
+    metrics.deviation[3]->set(accuracyData.deviationRY);
+}
+
+bool TrackerSession::calibrationRestored() const {
+    return restored;
+}
+
+int TrackerSession::connectStatus() const {
+    return ret_connect;
+}
+
+int TrackerSession::calibrateStatus() const {
+    return ret_calibrate;
+}
+
+int TrackerSession::validateStatus() const {
+    return ret_validate;
+}
+
+const AccuracyStruct &TrackerSession::accuracy() const {
+    return accuracyData;
+}
+
+bool TrackerSession::startStreaming(const QString &recordingPath, const QString &participant) {
+    if(slot >= 0) {
+        return false;
+    }
+    slot = CallbackRegistry::acquire(this);
+    if(slot < 0) {
+        qWarning() << "No free callback slot for" << name();
+        return false;
+    }
+    gazeResampler.reset(); //drop ticks left over from a previous session
+    samples.store(0);
+    events.store(0);
+    sampleClassifier.reset();
+    std::shared_ptr<const VisualAngle> angle = VisualAngle::current(); //thresholds in degrees follow the connected screen
+    qualityMonitor.setVisualAngle(angle);
+    qualityMonitor.reset(gazeSource->sampleRate());
+    pupilStream.reset(gazeSource->sampleRate());
+    vergenceEstimator.reset();
+    microsaccadeStream.setVisualAngle(*angle);
+    microsaccadeStream.reset(gazeSource->sampleRate());
+    pursuitClassifier.setVisualAngle(*angle);
+    pursuitClassifier.reset(gazeSource->sampleRate());
+    if(!recordingPath.isEmpty() && !sessionRecorder.open(recordingPath, participant, gazeSource->sampleRate())) {
+        qDebug() << "Session file could not be created: " << recordingPath;
+    }
+    if(!gazeSource->start(CallbackRegistry::sampleCallback(slot), CallbackRegistry::eventCallback(slot))) {
+        CallbackRegistry::release(slot);
+        sessionRecorder.close();
+        slot = -1;
+        return false;
+    }
+    metrics.streaming->add(1);
+    return true;
+}
+
+//stops the source before the slot is released so no trampoline can still reach this session
+void TrackerSession::stopStreaming() {
+    if(slot < 0) {
+        return;
+    }
+    gazeSource->stop();
+    CallbackRegistry::release(slot); //returns once no callback of this session is running, so nothing writes during close
+    slot = -1;
+    metrics.streaming->add(-1);
+    sampleClassifier.finish(); //a blink or pursuit still open at the end is recorded before the file closes
+    pursuitClassifier.finish();
+    sessionRecorder.close();
+}
+
+bool TrackerSession::isStreaming() const {
+    return slot >= 0;
+}
+
+void TrackerSession::setLogSamples(bool enabled) {
+    logSamples = enabled;
+}
+
+void TrackerSession::setRecordingSyncInterval(int milliseconds) {
+    sessionRecorder.setSyncInterval(milliseconds);
+}
+
+void TrackerSession::setRecordingBuffer(long long bytes, OverflowPolicy policy) {
+    sessionRecorder.setBufferLimit(bytes, policy);
+}
+
+void TrackerSession::setSampleListener(std::function<void(const SampleStruct &)> listener) {
+    sampleListener = listener;
+}
+
+//the live gaze of an eye keeps its last tracked value while that eye is lost; the live consumers get the head movement
+//compensated gaze, the recording, pupil, microsaccade and pursuit streams and the sample listener the sample as delivered
+void TrackerSession::handleSample(const SampleStruct &sample) {
+    int eyes = trackedEyes(sample);
+    SampleValidity validity = sampleClassifier.add(sample, eyes);
+    if(eyes == 0) {
+        metrics.lostSamples->add();
+    }
+    SampleStruct compensated = sample;
+    {
+        TRACE_SCOPE("live analysis");
+        headCompensator.correct(compensated, eyes);
+        qualityMonitor.add(compensated, eyes);
+        pupilStream.add(sample);
+        microsaccadeStream.add(sample, eyes);
+        pursuitClassifier.add(sample, eyes);
+        vergenceEstimator.add(compensated, eyes);
+    }
+    if(eyes & LeftEyeTracked) {
+        sLeftEyeX.store(compensated.leftEye.gazeX, std::memory_order_relaxed);
+        sLeftEyeY.store(compensated.leftEye.gazeY, std::memory_order_relaxed);
+    }
+    if(eyes & RightEyeTracked) {
+        sRightEyeX.store(compensated.rightEye.gazeX, std::memory_order_relaxed);
+        sRightEyeY.store(compensated.rightEye.gazeY, std::memory_order_relaxed);
+    }
+    gazeResampler.addSample(compensated, eyes); //feed the 1 kHz control loop stream
+    sessionRecorder.addSample(sample);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    lastTimestamp.store(sample.timestamp, std::memory_order_relaxed);
+    if(sampleListener) {
+        TRACE_SCOPE("sample listener");
+        sampleListener(sample);
+    }
+
+    //log left and right eye sample coordinates
+    TRACE_SCOPE("sample log");
+    if(logSamples && validity == SampleLost) {
+        qDebug() << "Tracking lost at " << sample.timestamp << "\n";
+    }
+    else if(logSamples) {
+        qDebug() << "Left eye X: " << sample.leftEye.gazeX << " Left eye Y: " << sample.leftEye.gazeY << "\n";
+        qDebug() << "Right eye X: " << sample.rightEye.gazeX << " Right eye Y: " << sample.rightEye.gazeY << "\n";
+    }
+}
+
+void TrackerSession::handleEvent(const EventStruct &event) {
+    if(event.eventType == 'M') {
+        addMarker(event.startTime, (int)event.positionX); //replayed marker, set again so epochs and trials follow it
+        return;
+    }
+    sessionRecorder.addEvent(event);
+    events.fetch_add(1, std::memory_order_relaxed);
+    if(logSamples) {
+        qDebug() << "Event" << QString(QChar(event.eventType)) << "- X: " << event.positionX << " Y: " << event.positionY << "\n"; //log event data
+    }
+}
+
+void TrackerSession::setValidationTarget(double x, double y) {
+    qualityMonitor.setTarget(x, y);
+    headCompensator.setTarget(x, y);
+}
+
+void TrackerSession::clearValidationTarget() {
+    qualityMonitor.clearTarget();
+    headCompensator.clearTarget();
+}
+
+void TrackerSession::addMarkerNow(int code) {
+    long long trackerTime = lastTimestamp.load(std::memory_order_relaxed);
+    if(clockSync.isSynchronized()) {
+        trackerTime = clockSync.hostToTracker(ClockSync::hostNow());
+    }
+    addMarker(trackerTime, code);
+}
+
+void TrackerSession::addMarker(long long trackerTime, int code) {
+    EventStruct marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.eventType = 'M';
+    marker.startTime = trackerTime;
+    marker.endTime = trackerTime;
+    marker.positionX = code;
+    sessionRecorder.addEvent(marker);
+    metrics.markers->add();
+    pupilStream.mark(trackerTime, QString::number(code));
+    if(logSamples) {
+        qDebug() << "Marker " << code << " at " << trackerTime << "\n";
+    }
+}
+
+double TrackerSession::leftGazeX() const {
+    return sLeftEyeX.load(std::memory_order_relaxed);
+}
+
+double TrackerSession::leftGazeY() const {
+    return sLeftEyeY.load(std::memory_order_relaxed);
+}
+
+double TrackerSession::rightGazeX() const {
+    return sRightEyeX.load(std::memory_order_relaxed);
+}
+
+double TrackerSession::rightGazeY() const {
+    return sRightEyeY.load(std::memory_order_relaxed);
+}
+
+long long TrackerSession::sampleCount() const {
+    return samples.load(std::memory_order_relaxed);
+}
+
+long long TrackerSession::eventCount() const {
+    return events.load(std::memory_order_relaxed);
+}
+
+const GazeResampler &TrackerSession::resampledGaze() const {
+    return gazeResampler;
+}
+
+long long TrackerSession::advanceResampledGaze() {
+    if(clockSync.isSynchronized()) {
+        gazeResampler.advanceTo(clockSync.hostToTracker(ClockSync::hostNow()));
+    }
+    return gazeResampler.latestTick();
+}
+
+const ClockSync &TrackerSession::clockSynchronization() const {
+    return clockSync;
+}
+
+const SessionRecorder &TrackerSession::recorder() const {
+    return sessionRecorder;
+}
+
+const SampleClassifier &TrackerSession::sampleClassification() const {
+    return sampleClassifier;
+}
+
+QualityMonitor &TrackerSession::quality() {
+    return qualityMonitor;
+}
+
+PupilStream &TrackerSession::pupil() {
+    return pupilStream;
+}
+
+VergenceEstimator &TrackerSession::vergence() {
+    return vergenceEstimator;
+}
+
+HeadCompensation &TrackerSession::headCompensation() {
+    return headCompensator;
+}
+
+MicrosaccadeStream &TrackerSession::microsaccades() {
+    return microsaccadeStream;
+}
+
+PursuitClassifier &TrackerSession::pursuit() {
+    return pursuitClassifier;
+}
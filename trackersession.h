@@ -0,0 +1,147 @@
+#ifndef TRACKERSESSION_H
+#define TRACKERSESSION_H
+
+//trackersession.h
+//State of one tracker (or simulated / replayed tracker): device status, calibration, live gaze,
+//resampled stream and recording. Several sessions can run side by side, each fed by its own source.
+
+#include <QString>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <myGazeAPI.h>
+#include "gazeresampler.h"
+#include "clocksync.h"
+#include "sessionrecorder.h"
+#include "sampleclassifier.h"
+#include "qualitymonitor.h"
+#include "pupillometry.h"
+#include "vergence.h"
+#include "headcompensation.h"
+#include "microsaccades.h"
+#include "pursuit.h"
+
+class GazeSource;
+class CalibrationCache;
+
+class TrackerSession {
+
+public:
+    //takes ownership of source
+    explicit TrackerSession(GazeSource *source);
+    ~TrackerSession();
+
+    GazeSource *source() const;
+    QString name() const;
+
+    //device control, only meaningful when the source is the physical tracker
+    int connect();
+    void disconnect();
+    //resolution of the stimulus screen the gaze refers to [pixel], combined with the server geometry profile on connect
+    void setScreenSize(int width, int height);
+    bool isConnected() const;
+    CalibrationStruct &calibrationSetup();
+    int calibrate(); //calibration followed by validation, returns the first failing status
+    //reuses the newest acceptable cached calibration of participant, otherwise calibrates if allowed and stores the result;
+    //an empty participant skips the cache and always calibrates
+    int calibrateWithCache(CalibrationCache &cache, const QString &participant, bool allowCalibration = true);
+    bool calibrationRestored() const;
+
+    //status of the last device operations, compared against the RET_ / ERR_ constants of the myGaze API
+    int connectStatus() const;
+    int calibrateStatus() const;
+    int validateStatus() const;
+    const AccuracyStruct &accuracy() const;
+
+    //starts delivering samples and events to this session, recording to recordingPath if given
+    bool startStreaming(const QString &recordingPath = QString(), const QString &participant = QString());
+    void stopStreaming();
+    bool isStreaming() const;
+    void setLogSamples(bool enabled); //writes every sample and event to the debug log
+    //how often the recording is synced to disk [milliseconds], bounds what a crash or power loss can cost
+    void setRecordingSyncInterval(int milliseconds);
+    //memory for recorded samples the disk has not taken yet and the overflow policy beyond it
+    void setRecordingBuffer(long long bytes, OverflowPolicy policy);
+    //extra consumer of every sample, called on the ingestion thread, set before streaming starts
+    void setSampleListener(std::function<void(const SampleStruct &)> listener);
+
+    //called through the callback registry on the ingestion thread of the source
+    void handleSample(const SampleStruct &sample);
+    void handleEvent(const EventStruct &event);
+
+    //validation target shown to the participant at [pixel], measured by the quality monitor and fitted by the head
+    //movement compensation when it is cleared or replaced, safe to call from any thread
+    void setValidationTarget(double x, double y);
+    void clearValidationTarget();
+
+    //records an experiment event marker ('M' event) at trackerTime [microseconds], safe to call from any thread,
+    //the live pupil stream cuts a baseline corrected epoch around it
+    void addMarker(long long trackerTime, int code);
+    void addMarkerNow(int code); //at the current tracker time, or the newest sample without clock synchronization
+
+    //live state, safe to read from any thread
+    double leftGazeX() const;
+    double leftGazeY() const;
+    double rightGazeX() const;
+    double rightGazeY() const;
+    long long sampleCount() const;
+    long long eventCount() const;
+    const GazeResampler &resampledGaze() const;
+    //consumer tick of the resampled stream, safe to call from any thread: closes ticks stalled input left open up to the
+    //current tracker time (once the clock is synchronized) so they are not held back until the next sample, returns latestTick()
+    long long advanceResampledGaze();
+    const ClockSync &clockSynchronization() const;
+    const SessionRecorder &recorder() const;
+    const SampleClassifier &sampleClassification() const; //validity, blink and data loss statistics of the stream
+    QualityMonitor &quality(); //sliding window precision, loss and target accuracy, targets may be set from any thread
+    PupilStream &pupil();      //filtered pupil diameter and marker epochs, delayed by PupilStream::latency()
+    //vergence, fixation depth and head distance of every sample, the device geometry profile is read on connect,
+    //the listener and other geometries are set before streaming
+    VergenceEstimator &vergence();
+    //corrects the live gaze for head movement since calibration, recordings keep the uncorrected samples
+    HeadCompensation &headCompensation();
+    MicrosaccadeStream &microsaccades(); //binocular microsaccades of the uncorrected stream, listener set before streaming
+    //fixation, saccade and pursuit labels of the uncorrected stream, delayed by PursuitClassifier::delay(), pursuits are
+    //recorded as 'P' events
+    PursuitClassifier &pursuit();
+
+private:
+    TrackerSession(const TrackerSession &);
+    TrackerSession &operator=(const TrackerSession &);
+    void publishStatus() const; //connect, calibrate and validate status and the accuracy as metrics
+
+    std::unique_ptr<GazeSource> gazeSource;
+    int slot; //callback registry slot while streaming, -1 otherwise
+
+    CalibrationStruct calibrationData;
+    AccuracyStruct accuracyData;
+    int ret_connect;
+    int ret_calibrate;
+    int ret_validate;
+    int screenWidth;  //0 keeps the resolution of the default geometry
+    int screenHeight;
+    bool restored;
+    bool logSamples;
+    std::function<void(const SampleStruct &)> sampleListener;
+
+    std::atomic<double> sLeftEyeX;
+    std::atomic<double> sLeftEyeY;
+    std::atomic<double> sRightEyeX;
+    std::atomic<double> sRightEyeY;
+    std::atomic<long long> samples;
+    std::atomic<long long> events;
+    std::atomic<long long> lastTimestamp; //of the newest sample [microseconds]
+
+    GazeResampler gazeResampler;     //fixed rate gaze stream pulled by the haptics control loop
+    ClockSync clockSync;             //maps tracker timestamps onto the host monotonic clock while connected
+    SessionRecorder sessionRecorder; //writes the sample and event streams to disk
+    SampleClassifier sampleClassifier; //flags lost samples and detects blinks, which are recorded as 'B' events
+    QualityMonitor qualityMonitor;     //data quality while streaming, alerts go to the debug log
+    PupilStream pupilStream;           //live pupillometry
+    VergenceEstimator vergenceEstimator; //3D gaze depth cues
+    HeadCompensation headCompensator;    //reference eye position from the last calibration
+    MicrosaccadeStream microsaccadeStream;
+    PursuitClassifier pursuitClassifier;
+};
+
+#endif // TRACKERSESSION_H
@@ -0,0 +1,78 @@
+//validationtargets.cpp
+//Implements the validation target sequence
+
+#include "validationtargets.h"
+#include "trackersession.h"
+#include <QCloseEvent>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QTimer>
+
+static const int targetCount = 5;
+static const double targetPoints[targetCount][2] = { { 0.5, 0.5 }, { 0.15, 0.15 }, { 0.85, 0.15 }, { 0.85, 0.85 }, { 0.15, 0.85 } };
+static const int targetMs = 1500;   //long enough for the settle time of the quality monitor and the compensation
+static const double targetRadius = 10; //[pixel]
+
+//Validation Targets Constructor
+ValidationTargets::ValidationTargets(TrackerSession *session, QWidget *parent)
+    : QWidget(parent, Qt::Window | Qt::FramelessWindowHint), session(session), index(-1) {
+    setAttribute(Qt::WA_DeleteOnClose);
+    setWindowTitle("Validation");
+    stepTimer = new QTimer(this);
+    connect(stepTimer, &QTimer::timeout, this, &ValidationTargets::next);
+}
+
+void ValidationTargets::start() {
+    showFullScreen();
+    raise();
+    activateWindow();
+    index = -1;
+    next();
+    stepTimer->start(targetMs);
+}
+
+//the session takes screen pixels, the full screen window starts at the screen origin
+void ValidationTargets::next() {
+    index++;
+    if(index >= targetCount) {
+        close();
+        return;
+    }
+    QPointF position = targetPosition() * devicePixelRatioF();
+    session->setValidationTarget(position.x(), position.y());
+    update();
+}
+
+QPointF ValidationTargets::targetPosition() const {
+    return QPointF(targetPoints[index][0] * width(), targetPoints[index][1] * height());
+}
+
+void ValidationTargets::paintEvent(QPaintEvent *) {
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::gray);
+    if(index < 0 || index >= targetCount) {
+        return;
+    }
+    QPointF position = targetPosition();
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(Qt::white);
+    painter.drawEllipse(position, targetRadius, targetRadius);
+    painter.setBrush(Qt::black);
+    painter.drawEllipse(position, targetRadius / 4, targetRadius / 4);
+}
+
+void ValidationTargets::keyPressEvent(QKeyEvent *event) {
+    if(event->key() == Qt::Key_Escape) {
+        close();
+        return;
+    }
+    QWidget::keyPressEvent(event);
+}
+
+//the last target is measured and fitted when it is cleared
+void ValidationTargets::closeEvent(QCloseEvent *event) {
+    stepTimer->stop();
+    session->clearValidationTarget();
+    QWidget::closeEvent(event);
+}
@@ -0,0 +1,36 @@
+#ifndef VALIDATIONTARGETS_H
+#define VALIDATIONTARGETS_H
+
+//validationtargets.h
+//Full screen sequence of validation targets shown to the participant. Each target is handed to the session while it is
+//shown, so the quality monitor measures the accuracy against it and the head movement compensation fits its model
+//once the next target replaces it. Escape ends the sequence early.
+
+#include <QWidget>
+
+class TrackerSession;
+class QTimer;
+
+class ValidationTargets : public QWidget {
+    Q_OBJECT
+
+public:
+    ValidationTargets(TrackerSession *session, QWidget *parent = 0);
+
+    void start(); //shows the targets full screen on the primary screen, the window deletes itself when done
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void keyPressEvent(QKeyEvent *event);
+    void closeEvent(QCloseEvent *event);
+
+private:
+    void next();
+    QPointF targetPosition() const; //of the current target in window coordinates
+
+    TrackerSession *session;
+    QTimer *stepTimer;
+    int index; //current target, -1 before the first
+};
+
+#endif // VALIDATIONTARGETS_H
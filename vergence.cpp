@@ -0,0 +1,313 @@
+//vergence.cpp
+//Implements the vergence estimator. Samples are moved into columns and the closest approach of the gaze rays is
+//solved without branches, two lanes at a time with SSE2 where available; the live stream runs the scalar form
+//of the same code on a single lane.
+//The ray intersection is written with cross products, which stay accurate for the nearly parallel rays of
+//distant fixations where the textbook dot product form cancels.
+
+#include "vergence.h"
+#include "sampleclassifier.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERGENCE_SSE2
+#include <emmintrin.h>
+#endif
+
+static const int batchLanes = 256;
+static const double radiansToDegrees = 57.29577951308232;
+
+//inputs and results of a block of samples, one array per value
+template<int N>
+struct RayColumns {
+    double leftGazeX[N], leftGazeY[N], rightGazeX[N], rightGazeY[N]; //[pixel]
+    double leftEyeX[N], leftEyeY[N], leftEyeZ[N];                     //device coordinates [mm]
+    double rightEyeX[N], rightEyeY[N], rightEyeZ[N];
+    double sine[N], cosine[N]; //of the vergence angle, scaled by the product of the ray lengths
+    double depth[N], fixationX[N], fixationY[N], fixationZ[N], headDistance[N], interocular[N];
+};
+
+template<int N>
+static inline void loadLane(RayColumns<N> &c, int i, const SampleStruct &sample) {
+    c.leftGazeX[i] = sample.leftEye.gazeX;
+    c.leftGazeY[i] = sample.leftEye.gazeY;
+    c.rightGazeX[i] = sample.rightEye.gazeX;
+    c.rightGazeY[i] = sample.rightEye.gazeY;
+    c.leftEyeX[i] = sample.leftEye.eyePositionX;
+    c.leftEyeY[i] = sample.leftEye.eyePositionY;
+    c.leftEyeZ[i] = sample.leftEye.eyePositionZ;
+    c.rightEyeX[i] = sample.rightEye.eyePositionX;
+    c.rightEyeY[i] = sample.rightEye.eyePositionY;
+    c.rightEyeZ[i] = sample.rightEye.eyePositionZ;
+}
+
+template<int N>
+static inline void storeLane(const RayColumns<N> &c, int i, long long timestamp, VergenceSample &out) {
+    out.timestamp = timestamp;
+    out.valid = true;
+    out.vergence = atan2(c.sine[i], c.cosine[i]) * radiansToDegrees;
+    out.depth = c.depth[i];
+    out.fixationX = c.fixationX[i];
+    out.fixationY = c.fixationY[i];
+    out.fixationZ = c.fixationZ[i];
+    out.headDistance = c.headDistance[i];
+    out.interocular = c.interocular[i];
+}
+
+static inline void invalidSample(long long timestamp, VergenceSample &out) {
+    memset(&out, 0, sizeof(out));
+    out.timestamp = timestamp;
+}
+
+//eye positions must be reported for both eyes on top of the tracked gaze
+static inline bool usable(const SampleStruct &sample, int eyes) {
+    return eyes == (LeftEyeTracked | RightEyeTracked) && sample.leftEye.eyePositionZ > 0 && sample.rightEye.eyePositionZ > 0;
+}
+
+//solves lanes [first, count), the model is VergenceEstimator::Model
+template<class Model, int N>
+static void solveRays(const Model &m, RayColumns<N> &c, int first, int count) {
+    for(int i = first; i < count; i++) {
+        //eyes in screen coordinates
+        double lx = c.leftEyeX[i];
+        double ly = c.leftEyeY[i] * m.inclinationCos + c.leftEyeZ[i] * m.inclinationSin + m.deviceY;
+        double lz = c.leftEyeZ[i] * m.inclinationCos - c.leftEyeY[i] * m.inclinationSin + m.deviceZ;
+        double rx = c.rightEyeX[i];
+        double ry = c.rightEyeY[i] * m.inclinationCos + c.rightEyeZ[i] * m.inclinationSin + m.deviceY;
+        double rz = c.rightEyeZ[i] * m.inclinationCos - c.rightEyeY[i] * m.inclinationSin + m.deviceZ;
+
+        //ray directions from the eyes to their gaze points on the screen plane (z = 0)
+        double ux = c.leftGazeX[i] * m.scaleX + m.offsetX - lx;
+        double uy = c.leftGazeY[i] * m.scaleY + m.offsetY - ly;
+        double uz = -lz;
+        double vx = c.rightGazeX[i] * m.scaleX + m.offsetX - rx;
+        double vy = c.rightGazeY[i] * m.scaleY + m.offsetY - ry;
+        double vz = -rz;
+        double wx = lx - rx, wy = ly - ry, wz = lz - rz;
+
+        //closest points left + t * u and right + s * v with n = u x v:
+        //t = n . (v x w) / |n|^2, s = n . (u x w) / |n|^2
+        double nx = uy * vz - uz * vy;
+        double ny = uz * vx - ux * vz;
+        double nz = ux * vy - uy * vx;
+        double nn = nx * nx + ny * ny + nz * nz;
+        double tn = nx * (vy * wz - vz * wy) + ny * (vz * wx - vx * wz) + nz * (vx * wy - vy * wx);
+        double sn = nx * (uy * wz - uz * wy) + ny * (uz * wx - ux * wz) + nz * (ux * wy - uy * wx);
+        double uu = ux * ux + uy * uy + uz * uz;
+        double vv = vx * vx + vy * vy + vz * vz;
+        double dot = ux * vx + uy * vy + uz * vz;
+
+        double cx = (lx + rx) * 0.5, cy = (ly + ry) * 0.5, cz = (lz + rz) * 0.5;
+        double inverse = nn > 0 ? 1.0 / nn : 0.0;
+        double t = tn * inverse, s = sn * inverse;
+        double mx = (lx + t * ux + rx + s * vx) * 0.5;
+        double my = (ly + t * uy + ry + s * vy) * 0.5;
+        double mz = (lz + t * uz + rz + s * vz) * 0.5;
+        double dx = mx - cx, dy = my - cy, dz = mz - cz;
+        double depth = sqrt(dx * dx + dy * dy + dz * dz);
+
+        //parallel, diverging or too distant rays: maxDepth along the mean direction
+        double lu = 1.0 / sqrt(uu), lv = 1.0 / sqrt(vv);
+        double ex = ux * lu + vx * lv, ey = uy * lu + vy * lv, ez = uz * lu + vz * lv;
+        double far = m.maxDepth / sqrt(ex * ex + ey * ey + ez * ez);
+        bool converging = nn > 1e-18 * uu * vv && t > 0 && s > 0 && depth < m.maxDepth;
+
+        c.sine[i] = sqrt(nn);
+        c.cosine[i] = dot;
+        c.depth[i] = converging ? depth : m.maxDepth;
+        c.fixationX[i] = converging ? mx : cx + ex * far;
+        c.fixationY[i] = converging ? my : cy + ey * far;
+        c.fixationZ[i] = converging ? mz : cz + ez * far;
+        c.headDistance[i] = cz;
+        c.interocular[i] = sqrt(wx * wx + wy * wy + wz * wz);
+    }
+}
+
+#ifdef VERGENCE_SSE2
+//two lanes per step with the same operations as solveRays, the odd lane left over goes through solveRays
+template<class Model, int N>
+static void solveRaysSse2(const Model &m, RayColumns<N> &c, int count) {
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d parallel = _mm_set1_pd(1e-18);
+    const __m128d maxDepth = _mm_set1_pd(m.maxDepth);
+    const __m128d inclinationSin = _mm_set1_pd(m.inclinationSin), inclinationCos = _mm_set1_pd(m.inclinationCos);
+    const __m128d deviceY = _mm_set1_pd(m.deviceY), deviceZ = _mm_set1_pd(m.deviceZ);
+    const __m128d scaleX = _mm_set1_pd(m.scaleX), offsetX = _mm_set1_pd(m.offsetX);
+    const __m128d scaleY = _mm_set1_pd(m.scaleY), offsetY = _mm_set1_pd(m.offsetY);
+    int i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m128d ley = _mm_loadu_pd(c.leftEyeY + i), lez = _mm_loadu_pd(c.leftEyeZ + i);
+        __m128d rey = _mm_loadu_pd(c.rightEyeY + i), rez = _mm_loadu_pd(c.rightEyeZ + i);
+        __m128d lx = _mm_loadu_pd(c.leftEyeX + i);
+        __m128d ly = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ley, inclinationCos), _mm_mul_pd(lez, inclinationSin)), deviceY);
+        __m128d lz = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(lez, inclinationCos), _mm_mul_pd(ley, inclinationSin)), deviceZ);
+        __m128d rx = _mm_loadu_pd(c.rightEyeX + i);
+        __m128d ry = _mm_add_pd(_mm_add_pd(_mm_mul_pd(rey, inclinationCos), _mm_mul_pd(rez, inclinationSin)), deviceY);
+        __m128d rz = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(rez, inclinationCos), _mm_mul_pd(rey, inclinationSin)), deviceZ);
+
+        __m128d ux = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(c.leftGazeX + i), scaleX), offsetX), lx);
+        __m128d uy = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(c.leftGazeY + i), scaleY), offsetY), ly);
+        __m128d uz = _mm_sub_pd(zero, lz);
+        __m128d vx = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(c.rightGazeX + i), scaleX), offsetX), rx);
+        __m128d vy = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(_mm_loadu_pd(c.rightGazeY + i), scaleY), offsetY), ry);
+        __m128d vz = _mm_sub_pd(zero, rz);
+        __m128d wx = _mm_sub_pd(lx, rx), wy = _mm_sub_pd(ly, ry), wz = _mm_sub_pd(lz, rz);
+
+        __m128d nx = _mm_sub_pd(_mm_mul_pd(uy, vz), _mm_mul_pd(uz, vy));
+        __m128d ny = _mm_sub_pd(_mm_mul_pd(uz, vx), _mm_mul_pd(ux, vz));
+        __m128d nz = _mm_sub_pd(_mm_mul_pd(ux, vy), _mm_mul_pd(uy, vx));
+        __m128d nn = _mm_add_pd(_mm_add_pd(_mm_mul_pd(nx, nx), _mm_mul_pd(ny, ny)), _mm_mul_pd(nz, nz));
+        __m128d tn = _mm_add_pd(_mm_add_pd(
+            _mm_mul_pd(nx, _mm_sub_pd(_mm_mul_pd(vy, wz), _mm_mul_pd(vz, wy))),
+            _mm_mul_pd(ny, _mm_sub_pd(_mm_mul_pd(vz, wx), _mm_mul_pd(vx, wz)))),
+            _mm_mul_pd(nz, _mm_sub_pd(_mm_mul_pd(vx, wy), _mm_mul_pd(vy, wx))));
+        __m128d sn = _mm_add_pd(_mm_add_pd(
+            _mm_mul_pd(nx, _mm_sub_pd(_mm_mul_pd(uy, wz), _mm_mul_pd(uz, wy))),
+            _mm_mul_pd(ny, _mm_sub_pd(_mm_mul_pd(uz, wx), _mm_mul_pd(ux, wz)))),
+            _mm_mul_pd(nz, _mm_sub_pd(_mm_mul_pd(ux, wy), _mm_mul_pd(uy, wx))));
+        __m128d uu = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ux, ux), _mm_mul_pd(uy, uy)), _mm_mul_pd(uz, uz));
+        __m128d vv = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)), _mm_mul_pd(vz, vz));
+        __m128d dot = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ux, vx), _mm_mul_pd(uy, vy)), _mm_mul_pd(uz, vz));
+
+        __m128d cx = _mm_mul_pd(_mm_add_pd(lx, rx), half);
+        __m128d cy = _mm_mul_pd(_mm_add_pd(ly, ry), half);
+        __m128d cz = _mm_mul_pd(_mm_add_pd(lz, rz), half);
+        __m128d inverse = _mm_and_pd(_mm_cmpgt_pd(nn, zero), _mm_div_pd(one, nn));
+        __m128d t = _mm_mul_pd(tn, inverse), s = _mm_mul_pd(sn, inverse);
+        __m128d mx = _mm_mul_pd(_mm_add_pd(_mm_add_pd(lx, _mm_mul_pd(t, ux)), _mm_add_pd(rx, _mm_mul_pd(s, vx))), half);
+        __m128d my = _mm_mul_pd(_mm_add_pd(_mm_add_pd(ly, _mm_mul_pd(t, uy)), _mm_add_pd(ry, _mm_mul_pd(s, vy))), half);
+        __m128d mz = _mm_mul_pd(_mm_add_pd(_mm_add_pd(lz, _mm_mul_pd(t, uz)), _mm_add_pd(rz, _mm_mul_pd(s, vz))), half);
+        __m128d dx = _mm_sub_pd(mx, cx), dy = _mm_sub_pd(my, cy), dz = _mm_sub_pd(mz, cz);
+        __m128d depth = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz)));
+
+        __m128d lu = _mm_div_pd(one, _mm_sqrt_pd(uu)), lv = _mm_div_pd(one, _mm_sqrt_pd(vv));
+        __m128d ex = _mm_add_pd(_mm_mul_pd(ux, lu), _mm_mul_pd(vx, lv));
+        __m128d ey = _mm_add_pd(_mm_mul_pd(uy, lu), _mm_mul_pd(vy, lv));
+        __m128d ez = _mm_add_pd(_mm_mul_pd(uz, lu), _mm_mul_pd(vz, lv));
+        __m128d far = _mm_div_pd(maxDepth, _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ex, ex), _mm_mul_pd(ey, ey)), _mm_mul_pd(ez, ez))));
+        __m128d converging = _mm_and_pd(_mm_and_pd(_mm_cmpgt_pd(nn, _mm_mul_pd(_mm_mul_pd(parallel, uu), vv)),
+                                                   _mm_cmpgt_pd(t, zero)),
+                                        _mm_and_pd(_mm_cmpgt_pd(s, zero), _mm_cmplt_pd(depth, maxDepth)));
+
+        _mm_storeu_pd(c.sine + i, _mm_sqrt_pd(nn));
+        _mm_storeu_pd(c.cosine + i, dot);
+        _mm_storeu_pd(c.depth + i, _mm_or_pd(_mm_and_pd(converging, depth), _mm_andnot_pd(converging, maxDepth)));
+        _mm_storeu_pd(c.fixationX + i, _mm_or_pd(_mm_and_pd(converging, mx), _mm_andnot_pd(converging, _mm_add_pd(cx, _mm_mul_pd(ex, far)))));
+        _mm_storeu_pd(c.fixationY + i, _mm_or_pd(_mm_and_pd(converging, my), _mm_andnot_pd(converging, _mm_add_pd(cy, _mm_mul_pd(ey, far)))));
+        _mm_storeu_pd(c.fixationZ + i, _mm_or_pd(_mm_and_pd(converging, mz), _mm_andnot_pd(converging, _mm_add_pd(cz, _mm_mul_pd(ez, far)))));
+        _mm_storeu_pd(c.headDistance + i, cz);
+        _mm_storeu_pd(c.interocular + i, _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(wx, wx), _mm_mul_pd(wy, wy)), _mm_mul_pd(wz, wz))));
+    }
+    solveRays(m, c, i, count);
+}
+#endif
+
+//Vergence Estimator Constructor
+VergenceEstimator::VergenceEstimator(const ScreenGeometry &geometry, double maxDepth)
+    : latestVergence(0), latestDepth(0), latestHeadDistance(0), latestTime(0) {
+    model.maxDepth = maxDepth;
+    setGeometry(geometry);
+}
+
+void VergenceEstimator::setGeometry(const ScreenGeometry &geometry) {
+    screen = geometry;
+    model.scaleX = geometry.stimulusWidth / geometry.screenWidth;
+    model.offsetX = -geometry.stimulusWidth / 2;
+    model.scaleY = -geometry.stimulusHeight / geometry.screenHeight; //pixel rows grow downwards
+    model.offsetY = geometry.stimulusHeight / 2;
+    double angle = geometry.inclination / radiansToDegrees;
+    model.inclinationSin = sin(angle);
+    model.inclinationCos = cos(angle);
+    model.deviceY = -geometry.stimulusHeight / 2 - geometry.deviceBelow;
+    model.deviceZ = geometry.deviceInFront;
+}
+
+const ScreenGeometry &VergenceEstimator::geometry() const {
+    return screen;
+}
+
+bool VergenceEstimator::estimate(const SampleStruct &sample, VergenceSample &out) const {
+    return estimate(sample, trackedEyes(sample), out);
+}
+
+bool VergenceEstimator::estimate(const SampleStruct &sample, int eyes, VergenceSample &out) const {
+    if(!usable(sample, eyes)) {
+        invalidSample(sample.timestamp, out);
+        return false;
+    }
+    RayColumns<1> lane;
+    loadLane(lane, 0, sample);
+    solveRays(model, lane, 0, 1);
+    storeLane(lane, 0, sample.timestamp, out);
+    return true;
+}
+
+//invalid samples are solved along with the rest and overwritten afterwards, which keeps the loop branch free
+void VergenceEstimator::estimate(const SampleStruct *samples, int count, VergenceSample *out) const {
+    RayColumns<batchLanes> columns;
+    unsigned char eyes[batchLanes];
+    for(int first = 0; first < count; first += batchLanes) {
+        int lanes = count - first < batchLanes ? count - first : batchLanes;
+        const SampleStruct *block = samples + first;
+        trackedEyes(block, lanes, eyes);
+        for(int i = 0; i < lanes; i++) {
+            loadLane(columns, i, block[i]);
+        }
+#ifdef VERGENCE_SSE2
+        solveRaysSse2(model, columns, lanes);
+#else
+        solveRays(model, columns, 0, lanes);
+#endif
+        for(int i = 0; i < lanes; i++) {
+            if(usable(block[i], eyes[i])) {
+                storeLane(columns, i, block[i].timestamp, out[first + i]);
+            }
+            else {
+                invalidSample(block[i].timestamp, out[first + i]);
+            }
+        }
+    }
+}
+
+void VergenceEstimator::reset() {
+    latestVergence.store(0, std::memory_order_relaxed);
+    latestDepth.store(0, std::memory_order_relaxed);
+    latestHeadDistance.store(0, std::memory_order_relaxed);
+    latestTime.store(0, std::memory_order_relaxed);
+}
+
+void VergenceEstimator::add(const SampleStruct &sample, int eyes) {
+    VergenceSample result;
+    if(estimate(sample, eyes, result)) {
+        latestVergence.store(result.vergence, std::memory_order_relaxed);
+        latestDepth.store(result.depth, std::memory_order_relaxed);
+        latestHeadDistance.store(result.headDistance, std::memory_order_relaxed);
+        latestTime.store(result.timestamp, std::memory_order_relaxed);
+    }
+    if(listener) {
+        listener(result);
+    }
+}
+
+void VergenceEstimator::setListener(std::function<void(const VergenceSample &)> listener) {
+    this->listener = listener;
+}
+
+double VergenceEstimator::vergence() const {
+    return latestVergence.load(std::memory_order_relaxed);
+}
+
+double VergenceEstimator::depth() const {
+    return latestDepth.load(std::memory_order_relaxed);
+}
+
+double VergenceEstimator::headDistance() const {
+    return latestHeadDistance.load(std::memory_order_relaxed);
+}
+
+long long VergenceEstimator::timestamp() const {
+    return latestTime.load(std::memory_order_relaxed);
+}
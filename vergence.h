@@ -0,0 +1,77 @@
+#ifndef VERGENCE_H
+#define VERGENCE_H
+
+//vergence.h
+//Binocular vergence and 3D gaze depth: each eye's gaze ray runs from its eye position to its gaze point on the
+//screen, the fixation point is the midpoint of the closest approach of the two rays. Positions are in screen
+//coordinates [mm] with the origin at the centre of the stimulus area, x right, y up and z towards the viewer.
+//Note that myGaze averages binocular gaze, in that case both rays end on the same screen point and the depth
+//is the distance to the screen.
+
+#include <atomic>
+#include <functional>
+#include <myGazeAPI.h>
+#include "screengeometry.h"
+
+struct VergenceSample {
+    long long timestamp;  //[microseconds]
+    bool valid;           //both eyes tracked with eye positions, all values are 0 otherwise
+    double vergence;      //angle between the gaze rays [degree]
+    double depth;         //distance from the cyclopean eye to the fixation point [mm], maxDepth for parallel rays
+    double fixationX;     //fixation point [mm]
+    double fixationY;
+    double fixationZ;
+    double headDistance;  //distance from the cyclopean eye to the screen plane [mm]
+    double interocular;   //distance between the eyes [mm]
+};
+
+class VergenceEstimator {
+
+public:
+    //depths beyond maxDepth [mm], including diverging rays, are reported as maxDepth along the mean gaze direction
+    explicit VergenceEstimator(const ScreenGeometry &geometry = ScreenGeometry(), double maxDepth = 5000.0);
+
+    //not while samples are added
+    void setGeometry(const ScreenGeometry &geometry);
+    const ScreenGeometry &geometry() const;
+
+    //allocation free and safe to call from any thread, false for invalid samples
+    bool estimate(const SampleStruct &sample, VergenceSample &out) const;
+    //batch form for recordings, runs a branch free kernel over columns of up to 256 samples
+    void estimate(const SampleStruct *samples, int count, VergenceSample *out) const;
+
+    //producer side, must be called from a single thread (the sample callback), reset before streaming
+    void reset();
+    void add(const SampleStruct &sample, int eyes); //eyes as returned by trackedEyes(sample)
+    //called with every estimate, valid or not, on the producer thread, set before adding samples
+    void setListener(std::function<void(const VergenceSample &)> listener);
+
+    //newest valid estimate, lock free and safe to read from any thread, 0 before the first one
+    double vergence() const;      //[degree]
+    double depth() const;         //[mm]
+    double headDistance() const;  //[mm]
+    long long timestamp() const;  //[microseconds]
+
+private:
+    bool estimate(const SampleStruct &sample, int eyes, VergenceSample &out) const;
+
+    //precomputed from the geometry: screen coordinates = scale * pixel + offset, eye positions are rotated by the
+    //device inclination and moved by the device position
+    struct Model {
+        double scaleX, offsetX, scaleY, offsetY;
+        double inclinationSin, inclinationCos;
+        double deviceY, deviceZ;
+        double maxDepth;
+    };
+
+    ScreenGeometry screen;
+    Model model;
+    std::function<void(const VergenceSample &)> listener;
+
+    std::atomic<double> latestVergence;
+    std::atomic<double> latestDepth;
+    std::atomic<double> latestHeadDistance;
+    std::atomic<long long> latestTime;
+};
+
+#endif // VERGENCE_H